@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * C API of libntag
+ *
+ * All functions report errors through their return value and never print.
+ * A keys handle is immutable after opening and may be shared between threads.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ntag_keys ntag_keys;
+
+typedef enum ntag_status {
+    NTAG_OK                     = 0,
+    NTAG_ERROR_INVALID_ARGUMENT = -1,
+    NTAG_ERROR_INVALID_KEYSET   = -2,
+    NTAG_ERROR_BUFFER_TOO_SMALL = -3,
+    NTAG_ERROR_PARSE            = -4,
+    NTAG_ERROR_KEYS             = -5,
+    NTAG_ERROR_CRYPT            = -6,
+    NTAG_ERROR_HMAC_INVALID     = -7,
+    NTAG_ERROR_INTERNAL         = -8,
+    NTAG_ERROR_MISMATCH         = -9,
+} ntag_status;
+
+typedef enum ntag_operation {
+    NTAG_OPERATION_DECRYPT  = 0,
+    NTAG_OPERATION_ENCRYPT  = 1,
+    NTAG_OPERATION_VERIFY   = 2,
+    NTAG_OPERATION_AUDIT    = 3,
+} ntag_operation;
+
+typedef struct ntag_item {
+    const void* in;
+    size_t in_size;
+    /* Ignored for NTAG_OPERATION_VERIFY and NTAG_OPERATION_AUDIT, may be the same as in */
+    void* out;
+    size_t out_size;
+    /* Set by ntag_batch */
+    ntag_status status;
+} ntag_item;
+
+/* Pass as tag_version to detect the version and whether the tag is encrypted for every tag */
+#define NTAG_TAG_VERSION_AUTO UINT32_MAX
+
+/* Returns a static description of the status */
+const char* ntag_status_string(ntag_status status);
+
+/* Opens a 160-byte keyset (the concatenation of unfixed-info.bin and locked-secret.bin) */
+ntag_status ntag_keys_open(const void* keyset, size_t keyset_size, ntag_keys** out_keys);
+void ntag_keys_close(ntag_keys* keys);
+
+/*
+ * Single buffer operations
+ * The output has the same size as the input, out_size needs to be at least in_size.
+ * in and out may point to the same buffer.
+ */
+
+/* Decrypts the tag, returns NTAG_ERROR_HMAC_INVALID if the decrypted data doesn't match its HMACs (the output is still written) */
+ntag_status ntag_decrypt(const ntag_keys* keys, uint32_t tag_version, const void* in, size_t in_size, void* out, size_t out_size);
+/* Updates the HMACs of the decrypted tag and encrypts it */
+ntag_status ntag_encrypt(const ntag_keys* keys, uint32_t tag_version, const void* in, size_t in_size, void* out, size_t out_size);
+/* Checks the HMACs of the encrypted tag */
+ntag_status ntag_verify(const ntag_keys* keys, uint32_t tag_version, const void* in, size_t in_size);
+/* Decrypts and encrypts the tag again, returns NTAG_ERROR_MISMATCH if the result is not identical to the input */
+ntag_status ntag_audit(const ntag_keys* keys, uint32_t tag_version, const void* in, size_t in_size);
+/* Decrypts the tag with keys, then signs and encrypts it with target_keys, nothing is written if the HMACs are not valid with keys */
+ntag_status ntag_rekey(const ntag_keys* keys, const ntag_keys* target_keys, uint32_t tag_version, const void* in, size_t in_size, void* out, size_t out_size);
+
+/*
+ * Batch operation
+ * Processes all items with up to jobs threads (0 uses all available cores) and stores the result of each item in its status.
+ * Only returns an error if the arguments are invalid, failed items are reported through their status.
+ */
+ntag_status ntag_batch(const ntag_keys* keys, ntag_operation operation, uint32_t tag_version, ntag_item* items, size_t count, uint32_t jobs);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,696 @@
+#include "Archive.hpp"
+#include "Batch.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <zlib.h>
+
+namespace {
+
+// Larger entries can't be tags, so they are skipped instead of being read into memory
+constexpr std::uint64_t kMaxEntrySize = 0x1000;
+
+constexpr std::uint32_t kZipLocalHeaderSignature = 0x04034b50;
+constexpr std::uint32_t kZipCentralHeaderSignature = 0x02014b50;
+constexpr std::uint32_t kZipEndSignature = 0x06054b50;
+constexpr std::size_t kZipLocalHeaderSize = 30;
+constexpr std::size_t kZipCentralHeaderSize = 46;
+constexpr std::size_t kZipEndSize = 22;
+// The end of central directory record is followed by a comment of at most 64 KiB
+constexpr std::size_t kZipMaxEndSearch = kZipEndSize + 0xffff;
+constexpr std::uint16_t kZipMethodStored = 0;
+constexpr std::uint16_t kZipMethodDeflate = 8;
+constexpr std::uint16_t kZipFlagEncrypted = 0x1;
+
+constexpr std::size_t kTarBlockSize = 512;
+constexpr std::size_t kTarNameSize = 100;
+constexpr std::size_t kTarPrefixSize = 155;
+constexpr std::size_t kTarSizeOffset = 124;
+constexpr std::size_t kTarMtimeOffset = 136;
+constexpr std::size_t kTarChecksumOffset = 148;
+constexpr std::size_t kTarTypeOffset = 156;
+constexpr std::size_t kTarMagicOffset = 257;
+constexpr std::size_t kTarPrefixOffset = 345;
+// Data of skipped tar entries is read in chunks of this size
+constexpr std::size_t kSkipChunkSize = 0x4000;
+
+using File = std::unique_ptr<std::FILE, int(*)(std::FILE*)>;
+
+std::uint16_t ReadU16(const std::byte* data)
+{
+    return std::to_integer<std::uint16_t>(data[0]) | (std::to_integer<std::uint16_t>(data[1]) << 8);
+}
+
+std::uint32_t ReadU32(const std::byte* data)
+{
+    return ReadU16(data) | (std::uint32_t(ReadU16(data + 2)) << 16);
+}
+
+bool EndsWith(const std::string& str, const std::string& suffix)
+{
+    return str.size() >= suffix.size() && std::equal(suffix.rbegin(), suffix.rend(), str.rbegin(), [](char a, char b) {
+        return std::tolower(static_cast<unsigned char>(a)) == b;
+    });
+}
+
+// Entries are written below the output directory, so they can't be absolute or go up
+bool IsSafePath(const std::string& path)
+{
+    if (path.empty() || path.front() == '/' || path.find('\\') != std::string::npos || path.find(':') != std::string::npos) {
+        return false;
+    }
+
+    std::size_t start = 0;
+    while (start <= path.size()) {
+        const std::size_t end = std::min(path.find('/', start), path.size());
+        if (path.compare(start, end - start, "..") == 0) {
+            return false;
+        }
+        start = end + 1;
+    }
+
+    return true;
+}
+
+std::uint32_t GetCrc(const std::span<const std::byte>& data)
+{
+    return crc32(crc32(0, nullptr, 0), reinterpret_cast<const Bytef*>(data.data()), data.size());
+}
+
+class DirectoryReader : public archive::Reader {
+public:
+    DirectoryReader(const std::filesystem::path& dir)
+     : mDir(dir), mNext(0)
+    {
+        std::uintmax_t bytes;
+        mFiles = batch::CollectFiles(dir, bytes);
+    }
+
+    Result<bool> Next(archive::Entry& entry) override
+    {
+        if (mNext >= mFiles.size()) {
+            return false;
+        }
+
+        const std::filesystem::path& file = mFiles[mNext++];
+        entry.path = file.generic_string();
+        entry.error.reset();
+        entry.data.clear();
+        if (batch::ReadTagFile(mDir / file, entry.data) != batch::STATUS_OK) {
+            entry.error = Error(Error::ARCHIVE_READ_FAILED);
+        }
+
+        return true;
+    }
+
+private:
+    std::filesystem::path mDir;
+    std::vector<std::filesystem::path> mFiles;
+    std::size_t mNext;
+};
+
+// Reads the central directory once and the entries in its order, so zips written with data descriptors work as well
+class ZipReader : public archive::Reader {
+public:
+    ZipReader(File&& file, std::vector<std::byte>&& directory, std::size_t count)
+     : mFile(std::move(file)), mDirectory(std::move(directory)), mOffset(0), mRemaining(count)
+    {
+    }
+
+    Result<bool> Next(archive::Entry& entry) override
+    {
+        while (mRemaining > 0) {
+            if (mOffset + kZipCentralHeaderSize > mDirectory.size() || ReadU32(&mDirectory[mOffset]) != kZipCentralHeaderSignature) {
+                return std::unexpected(Error(Error::ARCHIVE_INVALID, mOffset));
+            }
+
+            const std::byte* header = &mDirectory[mOffset];
+            const std::uint16_t flags = ReadU16(header + 8);
+            const std::uint16_t method = ReadU16(header + 10);
+            const std::uint32_t crc = ReadU32(header + 16);
+            const std::uint32_t compressedSize = ReadU32(header + 20);
+            const std::uint32_t size = ReadU32(header + 24);
+            const std::uint16_t nameSize = ReadU16(header + 28);
+            const std::uint16_t extraSize = ReadU16(header + 30);
+            const std::uint16_t commentSize = ReadU16(header + 32);
+            const std::uint32_t localOffset = ReadU32(header + 42);
+
+            const std::size_t nameOffset = mOffset + kZipCentralHeaderSize;
+            if (nameOffset + nameSize > mDirectory.size()) {
+                return std::unexpected(Error(Error::ARCHIVE_INVALID, mOffset));
+            }
+
+            mOffset = nameOffset + nameSize + extraSize + commentSize;
+            mRemaining--;
+
+            entry.path.assign(reinterpret_cast<const char*>(&mDirectory[nameOffset]), nameSize);
+            entry.error.reset();
+            entry.data.clear();
+
+            // Directories only hold other entries
+            if (entry.path.ends_with('/')) {
+                continue;
+            }
+
+            if (!IsSafePath(entry.path)) {
+                entry.error = Error(Error::ARCHIVE_UNSAFE_PATH);
+            } else if ((flags & kZipFlagEncrypted) || (method != kZipMethodStored && method != kZipMethodDeflate)) {
+                entry.error = Error(Error::ARCHIVE_UNSUPPORTED);
+            } else if (size > kMaxEntrySize || compressedSize > kMaxEntrySize * 2) {
+                entry.error = Error(Error::ARCHIVE_ENTRY_TOO_LARGE);
+            } else {
+                Result<void> res = ReadEntry(localOffset, method, compressedSize, size, entry.data);
+                if (!res) {
+                    entry.error = res.error();
+                } else if (GetCrc(entry.data) != crc) {
+                    entry.error = Error(Error::ARCHIVE_CRC_MISMATCH);
+                }
+            }
+
+            return true;
+        }
+
+        return false;
+    }
+
+private:
+    Result<void> ReadEntry(std::uint32_t localOffset, std::uint16_t method, std::uint32_t compressedSize, std::uint32_t size, std::vector<std::byte>& data)
+    {
+        // The name and extra field can differ from the central directory, so only their sizes are taken from here
+        std::array<std::byte, kZipLocalHeaderSize> header;
+        if (std::fseek(mFile.get(), localOffset, SEEK_SET) != 0 || std::fread(header.data(), 1, header.size(), mFile.get()) != header.size()
+            || ReadU32(header.data()) != kZipLocalHeaderSignature) {
+            return std::unexpected(Error(Error::ARCHIVE_INVALID, localOffset));
+        }
+
+        std::vector<std::byte> compressed(compressedSize);
+        const long dataOffset = ReadU16(header.data() + 26) + ReadU16(header.data() + 28);
+        if (std::fseek(mFile.get(), dataOffset, SEEK_CUR) != 0 || std::fread(compressed.data(), 1, compressed.size(), mFile.get()) != compressed.size()) {
+            return std::unexpected(Error(Error::ARCHIVE_INVALID, localOffset));
+        }
+
+        metrics::Increment(metrics::BYTES_READ, compressed.size());
+
+        if (method == kZipMethodStored) {
+            if (compressedSize != size) {
+                return std::unexpected(Error(Error::ARCHIVE_INVALID, localOffset));
+            }
+
+            data = std::move(compressed);
+            return {};
+        }
+
+        // Raw deflate without a zlib header
+        z_stream stream{};
+        if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+            return std::unexpected(Error(Error::ARCHIVE_INVALID, localOffset));
+        }
+
+        data.resize(size);
+        stream.next_in = reinterpret_cast<Bytef*>(compressed.data());
+        stream.avail_in = compressed.size();
+        stream.next_out = reinterpret_cast<Bytef*>(data.data());
+        stream.avail_out = data.size();
+        const int res = inflate(&stream, Z_FINISH);
+        inflateEnd(&stream);
+        if (res != Z_STREAM_END || stream.total_out != size) {
+            return std::unexpected(Error(Error::ARCHIVE_INVALID, localOffset));
+        }
+
+        return {};
+    }
+
+    File mFile;
+    std::vector<std::byte> mDirectory;
+    std::size_t mOffset;
+    std::size_t mRemaining;
+};
+
+Result<std::unique_ptr<archive::Reader>> OpenZip(const std::filesystem::path& path)
+{
+    File file(std::fopen(path.string().c_str(), "rb"), &std::fclose);
+    if (!file || std::fseek(file.get(), 0, SEEK_END) != 0) {
+        return std::unexpected(Error(Error::ARCHIVE_READ_FAILED));
+    }
+
+    const long size = std::ftell(file.get());
+    if (size < static_cast<long>(kZipEndSize)) {
+        return std::unexpected(Error(Error::ARCHIVE_INVALID));
+    }
+
+    // Find the end of central directory record, searching backwards over the comment
+    const std::size_t searchSize = std::min<std::size_t>(size, kZipMaxEndSearch);
+    std::vector<std::byte> tail(searchSize);
+    if (std::fseek(file.get(), size - searchSize, SEEK_SET) != 0 || std::fread(tail.data(), 1, tail.size(), file.get()) != tail.size()) {
+        return std::unexpected(Error(Error::ARCHIVE_READ_FAILED));
+    }
+
+    std::optional<std::size_t> end;
+    for (std::size_t i = searchSize - kZipEndSize + 1; i-- > 0;) {
+        if (ReadU32(&tail[i]) == kZipEndSignature) {
+            end = i;
+            break;
+        }
+    }
+
+    if (!end) {
+        return std::unexpected(Error(Error::ARCHIVE_INVALID));
+    }
+
+    const std::uint16_t count = ReadU16(&tail[*end + 10]);
+    const std::uint32_t directorySize = ReadU32(&tail[*end + 12]);
+    const std::uint32_t directoryOffset = ReadU32(&tail[*end + 16]);
+
+    // Zip64 marks the fields it moved to its own record with all bits set
+    if (count == 0xffff || directorySize == 0xffffffff || directoryOffset == 0xffffffff) {
+        return std::unexpected(Error(Error::ARCHIVE_UNSUPPORTED));
+    }
+
+    if (std::uint64_t(directoryOffset) + directorySize > std::uint64_t(size)) {
+        return std::unexpected(Error(Error::ARCHIVE_INVALID, directoryOffset));
+    }
+
+    std::vector<std::byte> directory(directorySize);
+    if (std::fseek(file.get(), directoryOffset, SEEK_SET) != 0 || std::fread(directory.data(), 1, directory.size(), file.get()) != directory.size()) {
+        return std::unexpected(Error(Error::ARCHIVE_READ_FAILED));
+    }
+
+    return std::make_unique<ZipReader>(std::move(file), std::move(directory), count);
+}
+
+// Reads plain and gzip compressed tars the same way, zlib passes uncompressed files through
+class TarReader : public archive::Reader {
+public:
+    TarReader(gzFile file)
+     : mFile(file), mOffset(0)
+    {
+    }
+
+    ~TarReader() override
+    {
+        gzclose(mFile);
+    }
+
+    Result<bool> Next(archive::Entry& entry) override
+    {
+        // Set by GNU long name and pax headers for the following entry
+        std::optional<std::string> longPath;
+
+        while (true) {
+            const std::uint64_t headerOffset = mOffset;
+            std::array<std::byte, kTarBlockSize> header;
+            const int read = gzread(mFile, header.data(), header.size());
+            if (read == 0) {
+                // Archives written without the two zero blocks at the end
+                return false;
+            }
+
+            if (read != static_cast<int>(header.size())) {
+                return std::unexpected(Error(Error::ARCHIVE_INVALID, headerOffset));
+            }
+
+            mOffset += header.size();
+
+            if (std::all_of(header.begin(), header.end(), [](std::byte b) { return b == std::byte(0); })) {
+                return false;
+            }
+
+            if (!IsChecksumValid(header)) {
+                return std::unexpected(Error(Error::ARCHIVE_INVALID, headerOffset));
+            }
+
+            const std::optional<std::uint64_t> size = ParseNumber(std::span(header).subspan(kTarSizeOffset, 12));
+            if (!size) {
+                return std::unexpected(Error(Error::ARCHIVE_INVALID, headerOffset));
+            }
+
+            const char type = static_cast<char>(header[kTarTypeOffset]);
+            const std::uint64_t padded = (*size + kTarBlockSize - 1) / kTarBlockSize * kTarBlockSize;
+
+            if ((type == 'L' || type == 'x') && *size > kMaxEntrySize) {
+                // Larger headers don't hold anything but the path which fits, so they are skipped like other types
+                Result<void> res = Skip(padded);
+                if (!res) {
+                    return std::unexpected(res.error());
+                }
+
+                longPath.reset();
+                continue;
+            }
+
+            if (type == 'L' || type == 'x') {
+                // The path of the next entry is stored as the data of this one
+                std::vector<std::byte> data;
+                Result<void> res = ReadData(*size, padded, data);
+                if (!res) {
+                    return std::unexpected(res.error());
+                }
+
+                const std::string_view text(reinterpret_cast<const char*>(data.data()), data.size());
+                if (type == 'L') {
+                    longPath = std::string(text.substr(0, text.find('\0')));
+                } else if (std::optional<std::string> path = ParsePaxPath(text)) {
+                    longPath = std::move(path);
+                }
+
+                continue;
+            }
+
+            // Everything but regular files is skipped, including directories, links and global pax headers
+            if (type != '0' && type != '\0' && type != '7') {
+                Result<void> res = Skip(padded);
+                if (!res) {
+                    return std::unexpected(res.error());
+                }
+
+                longPath.reset();
+                continue;
+            }
+
+            entry.path = longPath ? *longPath : GetPath(header);
+            entry.error.reset();
+            entry.data.clear();
+
+            if (!IsSafePath(entry.path)) {
+                entry.error = Error(Error::ARCHIVE_UNSAFE_PATH);
+            } else if (*size > kMaxEntrySize) {
+                entry.error = Error(Error::ARCHIVE_ENTRY_TOO_LARGE);
+            }
+
+            Result<void> res = entry.error ? Skip(padded) : ReadData(*size, padded, entry.data);
+            if (!res) {
+                return std::unexpected(res.error());
+            }
+
+            return true;
+        }
+    }
+
+private:
+    static bool IsChecksumValid(const std::array<std::byte, kTarBlockSize>& header)
+    {
+        // The checksum is calculated with its own field filled with spaces
+        std::uint32_t sum = 0;
+        for (std::size_t i = 0; i < header.size(); i++) {
+            const bool isChecksum = i >= kTarChecksumOffset && i < kTarChecksumOffset + 8;
+            sum += isChecksum ? ' ' : std::to_integer<std::uint32_t>(header[i]);
+        }
+
+        const std::optional<std::uint64_t> checksum = ParseNumber(std::span(header).subspan(kTarChecksumOffset, 8));
+        return checksum && *checksum == sum;
+    }
+
+    // Octal, or big endian binary with the high bit set for large values as written by GNU tar
+    static std::optional<std::uint64_t> ParseNumber(const std::span<const std::byte>& field)
+    {
+        std::uint64_t value = 0;
+        if (std::to_integer<std::uint8_t>(field[0]) & 0x80) {
+            for (std::size_t i = 1; i < field.size(); i++) {
+                value = (value << 8) | std::to_integer<std::uint64_t>(field[i]);
+            }
+            return value;
+        }
+
+        bool digits = false;
+        for (std::byte b : field) {
+            const char c = static_cast<char>(b);
+            if (c >= '0' && c <= '7') {
+                value = value * 8 + (c - '0');
+                digits = true;
+            } else if (c == ' ' && !digits) {
+                continue;
+            } else if (c == '\0' || c == ' ') {
+                break;
+            } else {
+                return {};
+            }
+        }
+
+        return value;
+    }
+
+    static std::string GetField(const std::array<std::byte, kTarBlockSize>& header, std::size_t offset, std::size_t size)
+    {
+        const char* field = reinterpret_cast<const char*>(&header[offset]);
+        return std::string(field, strnlen(field, size));
+    }
+
+    static std::string GetPath(const std::array<std::byte, kTarBlockSize>& header)
+    {
+        std::string path = GetField(header, 0, kTarNameSize);
+
+        // ustar splits long paths into a prefix and the name
+        if (GetField(header, kTarMagicOffset, 5) == "ustar") {
+            const std::string prefix = GetField(header, kTarPrefixOffset, kTarPrefixSize);
+            if (!prefix.empty()) {
+                path = prefix + "/" + path;
+            }
+        }
+
+        return path;
+    }
+
+    // Pax headers are records of "<length> <key>=<value>\n"
+    static std::optional<std::string> ParsePaxPath(std::string_view text)
+    {
+        while (!text.empty()) {
+            const std::size_t space = text.find(' ');
+            if (space == std::string_view::npos) {
+                break;
+            }
+
+            const std::size_t length = std::strtoull(std::string(text.substr(0, space)).c_str(), nullptr, 10);
+            if (length <= space + 1 || length > text.size()) {
+                break;
+            }
+
+            const std::string_view record = text.substr(space + 1, length - space - 2);
+            if (record.starts_with("path=")) {
+                return std::string(record.substr(5));
+            }
+
+            text.remove_prefix(length);
+        }
+
+        return {};
+    }
+
+    Result<void> ReadData(std::uint64_t size, std::uint64_t padded, std::vector<std::byte>& data)
+    {
+        data.resize(size);
+        if (gzread(mFile, data.data(), size) != static_cast<int>(size)) {
+            return std::unexpected(Error(Error::ARCHIVE_INVALID, mOffset));
+        }
+
+        metrics::Increment(metrics::BYTES_READ, size);
+        mOffset += size;
+        return Skip(padded - size);
+    }
+
+    Result<void> Skip(std::uint64_t size)
+    {
+        // Read instead of seeking, gzseek succeeds past the end of plain tars, so truncated ones would look complete.
+        // Seeking forward decompresses the skipped data of gzip compressed tars anyway.
+        std::array<std::byte, kSkipChunkSize> chunk;
+        while (size != 0) {
+            const std::size_t chunkSize = std::min<std::uint64_t>(size, chunk.size());
+            if (gzread(mFile, chunk.data(), chunkSize) != static_cast<int>(chunkSize)) {
+                return std::unexpected(Error(Error::ARCHIVE_INVALID, mOffset));
+            }
+
+            mOffset += chunkSize;
+            size -= chunkSize;
+        }
+
+        return {};
+    }
+
+    gzFile mFile;
+    // Offset into the uncompressed archive, for reporting errors
+    std::uint64_t mOffset;
+};
+
+} // namespace
+
+archive::Reader::~Reader()
+{
+}
+
+bool archive::IsArchive(const std::filesystem::path& path)
+{
+    return EndsWith(path.string(), ".zip") || IsTar(path);
+}
+
+bool archive::IsTar(const std::filesystem::path& path)
+{
+    const std::string str = path.string();
+    return EndsWith(str, ".tar") || EndsWith(str, ".tar.gz") || EndsWith(str, ".tgz");
+}
+
+Result<std::unique_ptr<archive::Reader>> archive::OpenReader(const std::filesystem::path& path)
+{
+    if (std::filesystem::is_directory(path)) {
+        return std::make_unique<DirectoryReader>(path);
+    }
+
+    if (EndsWith(path.string(), ".zip")) {
+        return OpenZip(path);
+    }
+
+    gzFile file = gzopen(path.string().c_str(), "rb");
+    if (!file) {
+        return std::unexpected(Error(Error::ARCHIVE_READ_FAILED));
+    }
+
+    return std::make_unique<TarReader>(file);
+}
+
+struct archive::TarWriter::Context {
+    gzFile file = nullptr;
+    bool failed = false;
+};
+
+archive::TarWriter::TarWriter()
+ : mContext(std::make_unique<Context>())
+{
+}
+
+archive::TarWriter::~TarWriter()
+{
+    if (mContext->file) {
+        gzclose(mContext->file);
+    }
+}
+
+Result<std::unique_ptr<archive::TarWriter>> archive::TarWriter::Open(const std::filesystem::path& path)
+{
+    // T writes without compression
+    const std::string str = path.string();
+    const bool compress = EndsWith(str, ".gz") || EndsWith(str, ".tgz");
+
+    std::error_code ec;
+    if (path.has_parent_path()) {
+        std::filesystem::create_directories(path.parent_path(), ec);
+    }
+
+    std::unique_ptr<TarWriter> writer = std::make_unique<TarWriter>();
+    writer->mContext->file = gzopen(str.c_str(), compress ? "wb6" : "wbT");
+    if (!writer->mContext->file) {
+        return std::unexpected(Error(Error::ARCHIVE_WRITE_FAILED));
+    }
+
+    // Tags are small, so a larger buffer saves most of the calls into zlib
+    gzbuffer(writer->mContext->file, 0x40000);
+    return writer;
+}
+
+Result<void> archive::TarWriter::Write(const std::span<const std::byte>& data)
+{
+    if (mContext->failed || gzwrite(mContext->file, data.data(), data.size()) != static_cast<int>(data.size())) {
+        mContext->failed = true;
+        return std::unexpected(Error(Error::ARCHIVE_WRITE_FAILED));
+    }
+
+    return {};
+}
+
+Result<void> archive::TarWriter::Add(const std::string& path, const std::span<const std::byte>& data)
+{
+    const auto writeHeader = [this](const std::string& name, const std::string& prefix, char type, std::uint64_t size) {
+        std::array<std::byte, kTarBlockSize> header{};
+        const auto setField = [&header](std::size_t offset, const std::string& value) {
+            std::memcpy(&header[offset], value.data(), value.size());
+        };
+        const auto setNumber = [&header](std::size_t offset, std::size_t fieldSize, std::uint64_t value) {
+            char buffer[24];
+            std::snprintf(buffer, sizeof(buffer), "%0*llo", static_cast<int>(fieldSize - 1), static_cast<unsigned long long>(value));
+            std::memcpy(&header[offset], buffer, fieldSize - 1);
+        };
+
+        setField(0, name);
+        setNumber(100, 8, 0644);
+        setNumber(108, 8, 0);
+        setNumber(116, 8, 0);
+        setNumber(kTarSizeOffset, 12, size);
+        setNumber(kTarMtimeOffset, 12, static_cast<std::uint64_t>(std::time(nullptr)));
+        header[kTarTypeOffset] = std::byte(type);
+        setField(kTarMagicOffset, std::string("ustar\0" "00", 8));
+        setField(kTarPrefixOffset, prefix);
+
+        std::uint32_t sum = 0;
+        std::fill(&header[kTarChecksumOffset], &header[kTarChecksumOffset + 8], std::byte(' '));
+        for (std::byte b : header) {
+            sum += std::to_integer<std::uint32_t>(b);
+        }
+        setNumber(kTarChecksumOffset, 7, sum);
+        header[kTarChecksumOffset + 6] = std::byte(0);
+
+        return Write(header);
+    };
+
+    const auto writePadded = [this](const std::span<const std::byte>& data) -> Result<void> {
+        static constexpr std::array<std::byte, kTarBlockSize> kZeros{};
+        Result<void> res = Write(data);
+        if (res && data.size() % kTarBlockSize != 0) {
+            res = Write(std::span(kZeros).first(kTarBlockSize - data.size() % kTarBlockSize));
+        }
+        return res;
+    };
+
+    // Paths which fit neither the name nor the ustar prefix are stored in a GNU long name entry first
+    std::string name = path;
+    std::string prefix;
+    if (name.size() > kTarNameSize) {
+        const std::size_t split = path.rfind('/', kTarPrefixSize);
+        if (split != std::string::npos && path.size() - split - 1 <= kTarNameSize && split != 0) {
+            prefix = path.substr(0, split);
+            name = path.substr(split + 1);
+        } else {
+            const std::string longName = path + '\0';
+            Result<void> res = writeHeader("././@LongLink", {}, 'L', longName.size());
+            if (res) {
+                res = writePadded(std::as_bytes(std::span(longName)));
+            }
+            if (!res) {
+                return res;
+            }
+
+            name = path.substr(0, kTarNameSize);
+        }
+    }
+
+    Result<void> res = writeHeader(name, prefix, '0', data.size());
+    if (res) {
+        res = writePadded(data);
+    }
+
+    if (res) {
+        metrics::Increment(metrics::BYTES_WRITTEN, data.size());
+    }
+
+    return res;
+}
+
+Result<void> archive::TarWriter::Finish()
+{
+    NTAG_TRACE_SCOPE("FinishTar");
+
+    // Two zero blocks end the archive
+    static constexpr std::array<std::byte, kTarBlockSize * 2> kEnd{};
+    Result<void> res = Write(kEnd);
+
+    const int closeRes = gzclose(mContext->file);
+    mContext->file = nullptr;
+    if (res && closeRes != Z_OK) {
+        return std::unexpected(Error(Error::ARCHIVE_WRITE_FAILED));
+    }
+
+    return res;
+}
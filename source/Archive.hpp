@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "Error.hpp"
+
+// Reading tags from zip and tar archives and writing results to a tar archive, without extracting anything to disk
+// Entries are read one at a time and only their contents are held in memory.
+namespace archive {
+
+struct Entry {
+    // Relative path with / separators, never absolute and never leaving the archive
+    std::string path;
+    std::vector<std::byte> data;
+    // Set if only this entry couldn't be read, for example because it is too large, the following entries can still be read
+    std::optional<Error> error;
+};
+
+class Reader {
+public:
+    virtual ~Reader();
+
+    // Reads the next file, returns false at the end of the archive and an error if the archive itself is broken
+    virtual Result<bool> Next(Entry& entry) = 0;
+};
+
+// Returns whether the path names an archive by its extension: .zip, .tar, .tar.gz or .tgz
+bool IsArchive(const std::filesystem::path& path);
+// Returns whether the path names a tar archive, which is the only kind of archive which can be written
+bool IsTar(const std::filesystem::path& path);
+
+// Opens a zip (stored or deflate) or tar (plain or gzip) archive, or a directory whose files are read in order
+Result<std::unique_ptr<Reader>> OpenReader(const std::filesystem::path& path);
+
+// Writes a tar archive, compressed with gzip if the path ends with .gz or .tgz
+class TarWriter {
+public:
+    TarWriter();
+    virtual ~TarWriter();
+
+    static Result<std::unique_ptr<TarWriter>> Open(const std::filesystem::path& path);
+
+    Result<void> Add(const std::string& path, const std::span<const std::byte>& data);
+    // Writes the end of the archive, nothing can be added afterwards
+    Result<void> Finish();
+
+private:
+    Result<void> Write(const std::span<const std::byte>& data);
+
+    struct Context;
+    std::unique_ptr<Context> mContext;
+};
+
+} // namespace archive
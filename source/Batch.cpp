@@ -0,0 +1,565 @@
+#include "Batch.hpp"
+#include "Cache.hpp"
+#include "Detect.hpp"
+#include "Dump.hpp"
+#include "Edit.hpp"
+#include "Keyring.hpp"
+#include "Keys.hpp"
+#include "Manifest.hpp"
+#include "Pipeline.hpp"
+#include "Scheduler.hpp"
+#include "Tag.hpp"
+#include "TagEncryption.hpp"
+#include "crypto.hpp"
+#include "io.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+void batch::CountFailure(Status status)
+{
+    switch (status) {
+        case STATUS_READ_FAILED:  metrics::Increment(metrics::FAILED_READ);  break;
+        case STATUS_PARSE_FAILED: metrics::Increment(metrics::FAILED_PARSE); break;
+        case STATUS_KEYS_FAILED:  metrics::Increment(metrics::FAILED_KEYS);  break;
+        case STATUS_CRYPT_FAILED: metrics::Increment(metrics::FAILED_CRYPT); break;
+        case STATUS_HMAC_INVALID: metrics::Increment(metrics::FAILED_HMAC);  break;
+        case STATUS_WRITE_FAILED: metrics::Increment(metrics::FAILED_WRITE); break;
+        case STATUS_MISMATCH:     metrics::Increment(metrics::FAILED_MISMATCH); break;
+        case STATUS_EDIT_FAILED:  metrics::Increment(metrics::FAILED_EDIT);  break;
+        default: break;
+    }
+}
+
+batch::MetricsReporter::MetricsReporter(const Options& options)
+ : mPath(options.metricsPath), mDone(false)
+{
+    if (mPath.empty()) {
+        return;
+    }
+
+    mThread = std::thread([this, interval = options.metricsInterval]() {
+        NTAG_TRACE_THREAD_NAME("metrics");
+
+        std::unique_lock lock(mMutex);
+        while (!mCondition.wait_for(lock, interval, [this]() { return mDone; })) {
+            metrics::WritePrometheus(mPath);
+        }
+    });
+}
+
+batch::MetricsReporter::~MetricsReporter()
+{
+    if (!mThread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard lock(mMutex);
+        mDone = true;
+    }
+    mCondition.notify_one();
+    mThread.join();
+
+    // Final dump with the complete results
+    metrics::WritePrometheus(mPath);
+}
+
+batch::Context::Context(const Keys& keys, const Keys* targetKeys)
+ : encryptions{ TagEncryption(keys) }, keyring(nullptr), script(nullptr), cache(nullptr), fingerprint(),
+   inputFormat(dump::FORMAT_BINARY), outputFormat(dump::FORMAT_BINARY), inputLayout(dump::LAYOUT_TAG), outputLayout(dump::LAYOUT_TAG)
+{
+    if (targetKeys) {
+        targetEncryption.emplace(*targetKeys);
+    }
+}
+
+batch::Context::Context(Keyring& keyring, const Keys* targetKeys)
+ : keyring(&keyring), script(nullptr), cache(nullptr), fingerprint(),
+   inputFormat(dump::FORMAT_BINARY), outputFormat(dump::FORMAT_BINARY), inputLayout(dump::LAYOUT_TAG), outputLayout(dump::LAYOUT_TAG)
+{
+    encryptions.reserve(keyring.GetSize());
+    for (std::size_t i = 0; i < keyring.GetSize(); i++) {
+        encryptions.emplace_back(*keyring.GetKeys(i));
+    }
+
+    if (targetKeys) {
+        targetEncryption.emplace(*targetKeys);
+    }
+}
+
+batch::Context::Context(const Options& options)
+ : Context(options.keyring ? Context(*options.keyring, options.targetKeys.get()) : Context(*options.keys, options.targetKeys.get()))
+{
+    script = options.script.get();
+    inputFormat = options.inputFormat;
+    outputFormat = options.outputFormat;
+    inputLayout = options.inputLayout;
+    outputLayout = options.outputLayout;
+    if (options.cache) {
+        SetCache(options.cache.get());
+    }
+}
+
+void batch::Context::SetCache(Cache* cache)
+{
+    this->cache = cache;
+
+    std::vector<std::byte> data;
+    for (const TagEncryption& encryption : encryptions) {
+        data.insert(data.end(), encryption.GetKeys().GetFingerprint().begin(), encryption.GetKeys().GetFingerprint().end());
+    }
+
+    // Separates the keysets from the target keys
+    data.push_back(std::byte(targetEncryption ? 1 : 0));
+    if (targetEncryption) {
+        data.insert(data.end(), targetEncryption->GetKeys().GetFingerprint().begin(), targetEncryption->GetKeys().GetFingerprint().end());
+    }
+
+    data.push_back(std::byte(script ? 1 : 0));
+    if (script) {
+        const std::array<std::byte, 0x20> scriptFingerprint = script->GetFingerprint();
+        data.insert(data.end(), scriptFingerprint.begin(), scriptFingerprint.end());
+    }
+
+    crypto::GenerateSHA256(data, fingerprint);
+}
+
+std::vector<std::filesystem::path> batch::CollectFiles(const std::filesystem::path& inDir, std::uintmax_t& bytes)
+{
+    std::vector<std::filesystem::path> files;
+    bytes = 0;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(inDir)) {
+        if (entry.is_regular_file()) {
+            files.push_back(std::filesystem::relative(entry.path(), inDir));
+            bytes += entry.file_size();
+        }
+    }
+
+    // Process in a deterministic order
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+const char* batch::GetStatusString(Status status)
+{
+    switch (status) {
+        case STATUS_OK:           return "OK";
+        case STATUS_READ_FAILED:  return "Failed to read file";
+        case STATUS_PARSE_FAILED: return "Failed to parse tag";
+        case STATUS_KEYS_FAILED:  return "Failed to init internal keys";
+        case STATUS_CRYPT_FAILED: return "Failed to crypt tag";
+        case STATUS_HMAC_INVALID: return "HMAC not valid";
+        case STATUS_WRITE_FAILED: return "Failed to write file";
+        case STATUS_MISMATCH:     return "Round trip mismatch";
+        case STATUS_EDIT_FAILED:  return "Edit script doesn't fit the tag version";
+        case STATUS_UNCHANGED:    return "Unchanged";
+    }
+
+    return "Unknown";
+}
+
+batch::Status batch::ParseTag(Operation operation, const std::optional<std::uint32_t>& tagVersion, const std::span<const std::byte>& in, std::shared_ptr<Tag>& tag, std::optional<Error>* error)
+{
+    metrics::Timer timer(metrics::STAGE_PARSE);
+
+    const std::optional<std::uint32_t> version = tagVersion ? tagVersion : detect::DetectVersion(in);
+    if (!version) {
+        if (error) {
+            *error = Error(Error::TAG_UNKNOWN_VERSION);
+        }
+
+        return STATUS_PARSE_FAILED;
+    }
+
+    Result<std::shared_ptr<Tag>> res = Tag::FromBytes(*version, in);
+    if (!res) {
+        if (error) {
+            *error = res.error();
+        }
+
+        return STATUS_PARSE_FAILED;
+    }
+
+    tag = std::move(*res);
+    tag->SetEncrypted(operation != OPERATION_ENCRYPT);
+    return STATUS_OK;
+}
+
+batch::Status batch::CryptTag(Operation operation, Context& context, Tag& tag, bool detectState)
+{
+    metrics::Timer timer(metrics::STAGE_CRYPT);
+
+    const bool expectEncrypted = operation != OPERATION_ENCRYPT;
+    detect::State state;
+    const std::optional<std::size_t> index = SelectKeys(context, tag, expectEncrypted ? detect::STATE_ENCRYPTED : detect::STATE_DECRYPTED, detectState, state);
+    if (!index) {
+        return STATUS_KEYS_FAILED;
+    }
+
+    TagEncryption& encryption = context.encryptions[*index];
+
+    if (operation != OPERATION_ENCRYPT) {
+        // Tags which are already decrypted are passed through, detecting an encrypted tag already decrypted it
+        const bool wasEncrypted = state == detect::STATE_ENCRYPTED || tag.IsEncrypted();
+        if (tag.IsEncrypted() && !encryption.DecryptTag()) {
+            return STATUS_CRYPT_FAILED;
+        }
+
+        if (!encryption.ValidateLockedSecretHMAC() || !encryption.ValidateUnfixedInfosHMAC()) {
+            return STATUS_HMAC_INVALID;
+        }
+
+        if (operation == OPERATION_REKEY) {
+            // Only tags which were valid with the old keys are signed with the new ones
+            TagEncryption& targetEncryption = *context.targetEncryption;
+            targetEncryption.Bind(tag);
+            if (!targetEncryption.InitializeInternalKeys()) {
+                return STATUS_KEYS_FAILED;
+            }
+
+            if (!targetEncryption.UpdateHMACs()) {
+                return STATUS_CRYPT_FAILED;
+            }
+
+            if (!targetEncryption.EncryptTag()) {
+                return STATUS_CRYPT_FAILED;
+            }
+        } else if (operation == OPERATION_APPLY) {
+            // Only tags which were valid before are signed again, same as for rekeying
+            const edit::Plan* plan = context.script ? context.script->GetPlan(tag.GetVersion()) : nullptr;
+            if (!plan) {
+                return STATUS_EDIT_FAILED;
+            }
+
+            edit::Apply(*plan, tag);
+
+            // Changing the write counter, UID or salt changes the keys, binding again drops the old ones
+            if (plan->deriveKeys) {
+                encryption.Bind(tag);
+                if (!encryption.InitializeInternalKeys()) {
+                    return STATUS_KEYS_FAILED;
+                }
+            }
+
+            if (!encryption.UpdateHMACs(plan->updateLockedSecretHmac, plan->updateUnfixedInfosHmac)) {
+                return STATUS_CRYPT_FAILED;
+            }
+
+            if (!encryption.EncryptTag()) {
+                return STATUS_CRYPT_FAILED;
+            }
+        } else if (operation == OPERATION_AUDIT) {
+            // Bring the tag back into the state it was read in, decrypted tags are encrypted and decrypted again
+            // The HMACs are not updated, so the result only matches if crypting and serializing is lossless
+            if (!encryption.EncryptTag()) {
+                return STATUS_CRYPT_FAILED;
+            }
+
+            if (!wasEncrypted && !encryption.DecryptTag()) {
+                return STATUS_CRYPT_FAILED;
+            }
+        }
+    } else {
+        // Tags which are already encrypted are passed through
+        if (tag.IsEncrypted()) {
+            return STATUS_OK;
+        }
+
+        // Sign the tag before encrypting
+        if (!encryption.ValidateLockedSecretHMAC()) {
+            encryption.UpdateLockedSecretHMAC();
+        }
+
+        if (!encryption.ValidateUnfixedInfosHMAC()) {
+            encryption.UpdateUnfixedInfosHMAC();
+        }
+
+        if (!encryption.EncryptTag()) {
+            return STATUS_CRYPT_FAILED;
+        }
+    }
+
+    return STATUS_OK;
+}
+
+std::optional<std::size_t> batch::SelectKeys(Context& context, Tag& tag, detect::State expected, bool detectState, detect::State& state)
+{
+    const std::size_t count = context.encryptions.size();
+    const std::size_t first = context.keyring ? context.keyring->GetHint(tag) : 0;
+
+    state = detect::STATE_UNKNOWN;
+    for (std::size_t i = 0; i < count; i++) {
+        const std::size_t index = (first + i) % count;
+        TagEncryption& encryption = context.encryptions[index];
+        encryption.Bind(tag);
+        if (!encryption.InitializeInternalKeys()) {
+            return {};
+        }
+
+        if (count == 1 && !detectState) {
+            state = expected;
+            return index;
+        }
+
+        if (detectState) {
+            state = detect::DetectState(encryption, tag, expected);
+        } else if (detect::IsStateValid(encryption, tag, expected)) {
+            state = expected;
+        }
+
+        if (state != detect::STATE_UNKNOWN) {
+            // The check leaves encrypted tags decrypted, which only saves work if they were supposed to be decrypted
+            if (state == detect::STATE_ENCRYPTED && expected != detect::STATE_ENCRYPTED && !tag.IsEncrypted() && !encryption.EncryptTag()) {
+                return {};
+            }
+
+            // Only write the hint if it changed, so threads processing similar tags don't keep invalidating each other's caches
+            if (context.keyring && index != first) {
+                context.keyring->SetHint(tag, index);
+            }
+
+            return index;
+        }
+    }
+
+    // Process the tag like it would have been without detection, so the result still reports the invalid HMAC
+    // All contexts were bound and have their keys derived at this point
+    tag.SetEncrypted(expected == detect::STATE_ENCRYPTED);
+    return first;
+}
+
+batch::Status batch::ReadTagFile(const std::filesystem::path& path, std::vector<std::byte>& data)
+{
+    metrics::Timer timer(metrics::STAGE_READ);
+
+    std::optional<std::vector<std::byte>> in = io::ReadBinaryFile(path.string());
+    if (!in) {
+        return STATUS_READ_FAILED;
+    }
+
+    data = std::move(*in);
+    return STATUS_OK;
+}
+
+batch::Status batch::WriteTagFile(const std::filesystem::path& path, const std::span<const std::byte>& data)
+{
+    metrics::Timer timer(metrics::STAGE_WRITE);
+
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    if (!io::WriteBinaryFile(path.string(), data)) {
+        return STATUS_WRITE_FAILED;
+    }
+
+    return STATUS_OK;
+}
+
+batch::Status batch::CompareTag(const std::span<const std::byte>& in, const std::span<const std::byte>& out, std::optional<Error>* error)
+{
+    const auto [inIt, outIt] = std::mismatch(in.begin(), in.end(), out.begin(), out.end());
+    if (inIt == in.end() && outIt == out.end()) {
+        return STATUS_OK;
+    }
+
+    if (error) {
+        *error = Error(Error::TAG_ROUND_TRIP_MISMATCH, std::distance(in.begin(), inIt));
+    }
+
+    return STATUS_MISMATCH;
+}
+
+bool batch::ShouldWrite(Operation operation, Status status)
+{
+    if (operation == OPERATION_VERIFY || operation == OPERATION_AUDIT) {
+        return false;
+    }
+
+    // Signing a tag which was not valid with the old keys would make it look valid with the new ones
+    if (operation == OPERATION_REKEY || operation == OPERATION_APPLY) {
+        return status == STATUS_OK;
+    }
+
+    // Tags with an invalid HMAC are still written, same as in single file mode
+    return status == STATUS_OK || status == STATUS_HMAC_INVALID;
+}
+
+batch::Status batch::ProcessTag(Operation operation, const std::optional<std::uint32_t>& tagVersion, Context& context, const std::span<const std::byte>& in, std::vector<std::byte>& out, std::optional<Error>* error)
+{
+    std::vector<std::byte> converted;
+    Result<std::span<const std::byte>> res = dump::Import(context.inputFormat, context.inputLayout, in, converted);
+    if (!res) {
+        if (error) {
+            *error = res.error();
+        }
+
+        return STATUS_PARSE_FAILED;
+    }
+
+    const std::span<const std::byte> data = *res;
+
+    Status status;
+    if (!context.cache) {
+        status = ProcessTagUncached(operation, tagVersion, context, data, out, error);
+    } else {
+        // The same input is always processed to the same result, so nothing needs to be parsed or derived for a hit
+        const std::array<std::byte, 0x20> key = Cache::GetKey(operation, tagVersion, context.fingerprint, data);
+        if (context.cache->Load(key, out)) {
+            status = STATUS_OK;
+        } else {
+            // Failed tags are processed again, so they are still reported
+            status = ProcessTagUncached(operation, tagVersion, context, data, out, error);
+            if (status == STATUS_OK) {
+                context.cache->Store(key, out);
+            }
+        }
+    }
+
+    if (ShouldWrite(operation, status)) {
+        dump::Export(context.outputFormat, context.outputLayout, out);
+    }
+
+    return status;
+}
+
+batch::Status batch::ProcessTagUncached(Operation operation, const std::optional<std::uint32_t>& tagVersion, Context& context, const std::span<const std::byte>& in, std::vector<std::byte>& out, std::optional<Error>* error)
+{
+    std::shared_ptr<Tag> tag{};
+    Status status = ParseTag(operation, tagVersion, in, tag, error);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    status = CryptTag(operation, context, *tag, !tagVersion);
+    if (operation == OPERATION_AUDIT && status == STATUS_OK) {
+        metrics::Timer timer(metrics::STAGE_SERIALIZE);
+        out = tag->ToBytes();
+        return CompareTag(in, out, error);
+    }
+
+    if (ShouldWrite(operation, status)) {
+        metrics::Timer timer(metrics::STAGE_SERIALIZE);
+        out = tag->ToBytes();
+    }
+
+    return status;
+}
+
+void batch::ProcessFiles(const Options& options, std::vector<Context>& contexts, const std::vector<std::filesystem::path>& files, const std::filesystem::path& inDir, const std::filesystem::path& outDir, const ReportFunction& report)
+{
+    scheduler::ParallelFor(files.size(), std::min<std::size_t>(options.jobs, contexts.size()), options.pin, [&](std::size_t i, unsigned int worker) {
+        std::vector<std::byte> in;
+        std::vector<std::byte> out;
+        std::optional<Error> error;
+
+        // Stat before reading, so a file which changes in between is processed again by the next run
+        std::optional<Manifest::FileState> state;
+        if (options.manifest) {
+            state = Manifest::Stat(inDir / files[i]);
+        }
+
+        Status status = ReadTagFile(inDir / files[i], in);
+        if (status == STATUS_OK && state && options.manifest->IsUnchanged(files[i], in, outDir / files[i])) {
+            // Only the modification time changed, like for a copy
+            options.manifest->Refresh(files[i], *state);
+            report(i, STATUS_UNCHANGED, error);
+            return;
+        }
+
+        if (status == STATUS_OK) {
+            status = ProcessTag(options.operation, options.tagVersion, contexts[worker], in, out, &error);
+        }
+
+        const bool write = ShouldWrite(options.operation, status);
+        if (write) {
+            const Status writeStatus = WriteTagFile(outDir / files[i], out);
+            if (writeStatus != STATUS_OK) {
+                status = writeStatus;
+            }
+        }
+
+        // Failed files are always processed again
+        if (status == STATUS_OK && state) {
+            options.manifest->Record(files[i], *state, in, write ? std::optional<std::span<const std::byte>>(out) : std::nullopt);
+        }
+
+        report(i, status, error);
+    });
+}
+
+batch::Summary batch::Run(const Options& options, const std::filesystem::path& inDir, const std::filesystem::path& outDir)
+{
+    const auto startTime = std::chrono::steady_clock::now();
+    std::uintmax_t bytes;
+    const std::vector<std::filesystem::path> files = CollectFiles(inDir, bytes);
+
+    // With a manifest, files which didn't change since the last run are only stat'ed
+    std::vector<std::filesystem::path> pending;
+    std::atomic<std::size_t> skipped = 0;
+    if (options.manifest) {
+        for (const std::filesystem::path& file : files) {
+            const std::optional<Manifest::FileState> state = Manifest::Stat(inDir / file);
+            if (state && options.manifest->IsUnchanged(file, *state, outDir / file)) {
+                skipped++;
+            } else {
+                pending.push_back(file);
+            }
+        }
+    } else {
+        pending = files;
+    }
+
+    std::atomic<std::size_t> failed = 0;
+    std::mutex outputMutex;
+
+    // Periodically dump the metrics while the workers are running
+    std::optional<MetricsReporter> reporter(std::in_place, options);
+
+    const ReportFunction report = [&](std::size_t i, Status status, const std::optional<Error>& error) {
+        if (status == STATUS_OK) {
+            return;
+        }
+
+        if (status == STATUS_UNCHANGED) {
+            skipped++;
+            return;
+        }
+
+        CountFailure(status);
+        failed++;
+
+        std::lock_guard lock(outputMutex);
+        std::cerr << pending[i].string() << ": " << GetStatusString(status);
+        if (error) {
+            std::cerr << " (" << error->GetDescription() << " at offset 0x" << std::hex << error->GetOffset() << std::dec << ")";
+        }
+        std::cerr << "\n";
+    };
+
+    // The pipeline doesn't keep the input and output of a file together, which recording in the manifest and caching need
+    if (options.executor == EXECUTOR_PIPELINE && !options.manifest && !options.cache) {
+        RunPipeline(options, pending, inDir, outDir, report);
+    } else {
+        // One context per worker, they all share the same keys
+        std::vector<Context> contexts(std::max(1u, options.jobs), Context(options));
+        ProcessFiles(options, contexts, pending, inDir, outDir, report);
+    }
+
+    if (options.manifest) {
+        Result<void> res = options.manifest->Commit(files);
+        if (!res) {
+            std::cerr << "Failed to update the manifest: " << res.error().GetDescription() << "\n";
+            failed++;
+        }
+    }
+
+    reporter.reset();
+    return Summary{ files.size(), bytes, failed.load(), std::chrono::steady_clock::now() - startTime, skipped.load() };
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+#include <optional>
+
+#include "Detect.hpp"
+#include "Dump.hpp"
+#include "Error.hpp"
+#include "TagEncryption.hpp"
+
+class Cache;
+class Keyring;
+class Keys;
+class Manifest;
+class Tag;
+
+namespace edit {
+class Script;
+}
+
+namespace batch {
+
+enum Operation {
+    OPERATION_DECRYPT,
+    OPERATION_ENCRYPT,
+    // Decrypt and validate the HMACs without producing any output
+    OPERATION_VERIFY,
+    // Decrypt with the keys and sign and encrypt again with the target keys
+    OPERATION_REKEY,
+    // Decrypt and encrypt again in memory and check that the result is identical to the input, without producing any output
+    OPERATION_AUDIT,
+    // Decrypt, apply an edit script, sign and encrypt again
+    OPERATION_APPLY,
+};
+
+enum Status {
+    STATUS_OK,
+    STATUS_READ_FAILED,
+    STATUS_PARSE_FAILED,
+    STATUS_KEYS_FAILED,
+    STATUS_CRYPT_FAILED,
+    STATUS_HMAC_INVALID,
+    STATUS_WRITE_FAILED,
+    STATUS_MISMATCH,
+    STATUS_EDIT_FAILED,
+    // The file didn't change since it was recorded in the manifest, so it was skipped
+    STATUS_UNCHANGED,
+};
+
+enum Executor {
+    // Every worker processes whole files
+    EXECUTOR_PARALLEL,
+    // Every stage has its own workers, connected by bounded queues
+    EXECUTOR_PIPELINE,
+};
+
+struct Options {
+    Operation operation;
+    // If empty, the version and whether a tag is encrypted are detected for every tag
+    std::optional<std::uint32_t> tagVersion;
+    // Format of the input files, detected for every file if empty
+    std::optional<dump::Format> inputFormat;
+    // Format the results are written in
+    dump::Format outputFormat;
+    // Layout of version 2 input tags and results
+    dump::Layout inputLayout;
+    dump::Layout outputLayout;
+    std::shared_ptr<const Keys> keys;
+    // If set, every tag is processed with the keyset of the keyring it was signed with and keys is ignored
+    std::shared_ptr<Keyring> keyring;
+    // Only used for OPERATION_REKEY
+    std::shared_ptr<const Keys> targetKeys;
+    // Only used for OPERATION_APPLY
+    std::shared_ptr<const edit::Script> script;
+    // If set, files which didn't change since they were recorded are skipped and processed files are recorded
+    // Only used when processing directories, which then always uses the parallel executor.
+    std::shared_ptr<Manifest> manifest;
+    // If set, results are loaded from and stored in the cache, directories then always use the parallel executor
+    std::shared_ptr<Cache> cache;
+    Executor executor;
+    // Number of worker threads
+    unsigned int jobs;
+    // Number of threads for each of the read and write stages of the pipeline executor
+    unsigned int ioJobs;
+    // Pin the workers of the parallel executor to CPUs
+    bool pin;
+    // Path to periodically write Prometheus metrics to, empty to disable
+    std::string metricsPath;
+    std::chrono::seconds metricsInterval;
+};
+
+struct Summary {
+    std::size_t total;
+    // Size of all input files
+    std::uintmax_t bytes;
+    std::size_t failed;
+    std::chrono::duration<double> elapsed;
+    // Files which were skipped since they didn't change, they are included in total
+    std::size_t skipped = 0;
+};
+
+// Crypto state of a single worker, the keys need to outlive it
+struct Context {
+    Context(const Keys& keys, const Keys* targetKeys = nullptr);
+    Context(Keyring& keyring, const Keys* targetKeys = nullptr);
+    Context(const Options& options);
+
+    // One for every keyset of the keyring, or a single one for the keys
+    std::vector<TagEncryption> encryptions;
+    // Remembers which keysets matched, null if there is no keyring
+    Keyring* keyring;
+    // Only used for OPERATION_REKEY
+    std::optional<TagEncryption> targetEncryption;
+    // Only used for OPERATION_APPLY, set by the constructor taking the options
+    const edit::Script* script;
+    // Checked by ProcessTag before any keys are derived, set by the constructor taking the options
+    Cache* cache;
+    // Hash of the keysets, target keys and script, part of every cache key
+    std::array<std::byte, 0x20> fingerprint;
+    // Format of the input, detected for every tag if empty, and of the results, with the layouts of version 2 tags
+    // Binary in the tag layout unless set by the constructor taking the options.
+    std::optional<dump::Format> inputFormat;
+    dump::Format outputFormat;
+    dump::Layout inputLayout;
+    dump::Layout outputLayout;
+
+    // Sets the cache and fingerprints the context, needs to be called after the script was set
+    void SetCache(Cache* cache);
+};
+
+const char* GetStatusString(Status status);
+
+// Processes a single tag in memory using the specified context, out contains the processed tag unless parsing or crypting failed
+// If the context has a cache, results are loaded from it and successful results are stored in it
+// Dumps are converted to raw tags first and results which are written are converted to the output format and layout of the
+// context, so the cache and everything else only ever see raw tags in the tag layout
+// For OPERATION_AUDIT out contains the round tripped tag and a mismatch is reported through error
+// If parsing failed and error is set, it receives the reason
+// Without a tag version, the version and state are detected, tags which are already in the target state are passed through unchanged
+Status ProcessTag(Operation operation, const std::optional<std::uint32_t>& tagVersion, Context& context, const std::span<const std::byte>& in, std::vector<std::byte>& out, std::optional<Error>* error = nullptr);
+// Same as ProcessTag, but without checking the cache and converting dumps
+Status ProcessTagUncached(Operation operation, const std::optional<std::uint32_t>& tagVersion, Context& context, const std::span<const std::byte>& in, std::vector<std::byte>& out, std::optional<Error>* error = nullptr);
+
+// The individual steps of ProcessTag, for executors which run them on different threads
+Status ParseTag(Operation operation, const std::optional<std::uint32_t>& tagVersion, const std::span<const std::byte>& in, std::shared_ptr<Tag>& tag, std::optional<Error>* error = nullptr);
+Status CryptTag(Operation operation, Context& context, Tag& tag, bool detectState);
+
+// Binds the context to the tag and finds the keyset the tag was signed with, starting with the keyset which matched similar tags
+// With detectState the encrypted flag of the tag is set to the detected state, otherwise the tag is expected to be in the expected state
+// and only that state is checked. A single keyset isn't checked at all if the state is known.
+// state receives STATE_UNKNOWN if no keyset matched, the tag then keeps the expected state and the first keyset tried is returned.
+// A tag which is expected and found to be encrypted is left decrypted by the check, IsEncrypted reports its current data.
+// Returns the index of the keyset to process the tag with, empty if deriving the keys failed.
+std::optional<std::size_t> SelectKeys(Context& context, Tag& tag, detect::State expected, bool detectState, detect::State& state);
+
+// Compares the round tripped tag of OPERATION_AUDIT with the input, error receives the first differing offset
+Status CompareTag(const std::span<const std::byte>& in, const std::span<const std::byte>& out, std::optional<Error>* error = nullptr);
+
+// Returns the paths of all files in inDir relative to it in a deterministic order, bytes receives their total size
+std::vector<std::filesystem::path> CollectFiles(const std::filesystem::path& inDir, std::uintmax_t& bytes);
+
+// Reads or writes a tag file, creating the parent directories of the output if needed
+Status ReadTagFile(const std::filesystem::path& path, std::vector<std::byte>& data);
+Status WriteTagFile(const std::filesystem::path& path, const std::span<const std::byte>& data);
+
+// Returns whether the result of a tag with this status should still be written
+bool ShouldWrite(Operation operation, Status status);
+
+// Called with the final status of every file, may be called from multiple threads at once
+using ReportFunction = std::function<void(std::size_t index, Status status, const std::optional<Error>& error)>;
+
+// Counts a failed tag in the metrics, does nothing for STATUS_OK
+void CountFailure(Status status);
+
+// Periodically writes the metrics to the metrics path of the options while it is alive, and once more with the final results when destroyed
+// Does nothing if the options have no metrics path.
+class MetricsReporter {
+public:
+    MetricsReporter(const Options& options);
+    ~MetricsReporter();
+
+private:
+    std::string mPath;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mDone;
+    std::thread mThread;
+};
+
+// Processes the files in parallel, every worker uses its context from contexts, which stay warm for later calls
+// The paths are relative to inDir and the results are stored with the same relative paths in outDir.
+void ProcessFiles(const Options& options, std::vector<Context>& contexts, const std::vector<std::filesystem::path>& files, const std::filesystem::path& inDir, const std::filesystem::path& outDir, const ReportFunction& report);
+
+// Processes all files in inDir and stores the results with the same relative paths in outDir
+Summary Run(const Options& options, const std::filesystem::path& inDir, const std::filesystem::path& outDir);
+
+} // namespace batch
@@ -0,0 +1,429 @@
+#include "BatchIO.hpp"
+#include "io.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define NTAG_HAS_IO_URING
+#include <linux/io_uring.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Every file in a batch gets a slot of this size in the buffer, larger files use the portable path
+constexpr std::size_t kSlotSize = 0x1000;
+// Result of operations which never completed, no system call returns it
+constexpr int kNoResult = std::numeric_limits<int>::min();
+
+} // namespace
+
+#ifdef NTAG_HAS_IO_URING
+
+// Minimal io_uring wrapper using the raw system calls, so there is no dependency on liburing
+struct BatchIO::Ring {
+    static std::unique_ptr<Ring> Create(std::size_t entries);
+    ~Ring();
+
+    std::byte* GetSlot(std::size_t index);
+
+    // Submits one entry for every index, prepared by prepare, and waits for all of them to complete
+    // results[index] receives the result of the operation for that index. If entering the ring fails, everything which was
+    // submitted is still waited for and its result stored, results of the other indices are left as they are.
+    template<typename Function>
+    bool Run(const std::vector<std::size_t>& indices, std::vector<int>& results, const Function& prepare);
+
+    int fd = -1;
+    // Operations which were submitted but never completed because waiting for them failed as well
+    std::size_t inFlight = 0;
+
+    void* sqRing = MAP_FAILED;
+    std::size_t sqRingSize = 0;
+    void* cqRing = MAP_FAILED;
+    std::size_t cqRingSize = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    std::size_t sqesSize = 0;
+
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    // Registered with the kernel if possible, which saves mapping the pages for every operation
+    std::vector<std::byte> buffer;
+    bool fixedBuffer = false;
+};
+
+std::unique_ptr<BatchIO::Ring> BatchIO::Ring::Create(std::size_t entries)
+{
+    std::unique_ptr<Ring> ring = std::make_unique<Ring>();
+
+    io_uring_params params{};
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        // Not supported by the kernel or blocked, e.g. by a seccomp filter
+        return {};
+    }
+
+    // All required operations need to be supported
+    constexpr std::size_t kProbeOps = 256;
+    std::vector<std::byte> probeBuffer(sizeof(io_uring_probe) + kProbeOps * sizeof(io_uring_probe_op));
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(probeBuffer.data());
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, kProbeOps) < 0) {
+        return {};
+    }
+
+    for (std::uint8_t op : { IORING_OP_OPENAT, IORING_OP_CLOSE, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED }) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            return {};
+        }
+    }
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sqRingSize = ring->cqRingSize = std::max(ring->sqRingSize, ring->cqRingSize);
+    }
+
+    ring->sqRing = mmap(nullptr, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED) {
+        return {};
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cqRing = ring->sqRing;
+    } else {
+        ring->cqRing = mmap(nullptr, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cqRing == MAP_FAILED) {
+            return {};
+        }
+    }
+
+    ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes = static_cast<io_uring_sqe*>(mmap(nullptr, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES));
+    if (ring->sqes == MAP_FAILED) {
+        return {};
+    }
+
+    std::byte* sq = static_cast<std::byte*>(ring->sqRing);
+    ring->sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    ring->sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    ring->sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+    std::byte* cq = static_cast<std::byte*>(ring->cqRing);
+    ring->cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    ring->cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    ring->cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    ring->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // Registering can fail if the locked memory limit is too low, plain reads and writes still work in that case
+    ring->buffer.resize(entries * kSlotSize);
+    iovec iov{ ring->buffer.data(), ring->buffer.size() };
+    ring->fixedBuffer = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+
+    return ring;
+}
+
+BatchIO::Ring::~Ring()
+{
+    if (sqes != MAP_FAILED) {
+        munmap(sqes, sqesSize);
+    }
+
+    if (cqRing != MAP_FAILED && cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+
+    if (sqRing != MAP_FAILED) {
+        munmap(sqRing, sqRingSize);
+    }
+
+    // Closing the ring also unregisters the buffer
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+std::byte* BatchIO::Ring::GetSlot(std::size_t index)
+{
+    return buffer.data() + index * kSlotSize;
+}
+
+template<typename Function>
+bool BatchIO::Ring::Run(const std::vector<std::size_t>& indices, std::vector<int>& results, const Function& prepare)
+{
+    if (indices.empty()) {
+        return true;
+    }
+
+    // Only this thread writes the tail, the kernel reads it
+    std::atomic_ref<unsigned> tail(*sqTail);
+    unsigned currentTail = tail.load(std::memory_order_relaxed);
+    for (std::size_t index : indices) {
+        const unsigned slot = currentTail & *sqMask;
+
+        io_uring_sqe& sqe = sqes[slot];
+        std::memset(&sqe, 0, sizeof(sqe));
+        prepare(index, sqe);
+        sqe.user_data = index;
+
+        sqArray[slot] = slot;
+        currentTail++;
+    }
+    tail.store(currentTail, std::memory_order_release);
+
+    std::size_t submitted = 0;
+    std::size_t completed = 0;
+    std::atomic_ref<unsigned> head(*cqHead);
+    std::atomic_ref<unsigned> completionTail(*cqTail);
+
+    // Reap everything which completed so far
+    const auto reap = [&]() {
+        unsigned currentHead = head.load(std::memory_order_relaxed);
+        const unsigned available = completionTail.load(std::memory_order_acquire);
+        while (currentHead != available) {
+            const io_uring_cqe& cqe = cqes[currentHead & *cqMask];
+            results[cqe.user_data] = cqe.res;
+            currentHead++;
+            completed++;
+        }
+        head.store(currentHead, std::memory_order_release);
+    };
+
+    while (completed < indices.size()) {
+        const int res = syscall(__NR_io_uring_enter, fd, indices.size() - submitted, indices.size() - completed, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // Wait for what was submitted, so no completion is left over and every opened file is reported
+            while (completed < submitted) {
+                if (syscall(__NR_io_uring_enter, fd, 0, submitted - completed, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR) {
+                    break;
+                }
+
+                reap();
+            }
+
+            inFlight = submitted - completed;
+            return false;
+        }
+        submitted += res;
+
+        reap();
+    }
+
+    return true;
+}
+
+void BatchIO::DropRing(const std::vector<std::size_t>& indices, const std::vector<int>& fds, const std::vector<int>& closed)
+{
+    // Files which were opened but not closed by the ring
+    for (std::size_t i : indices) {
+        if (fds[i] >= 0 && closed[i] == kNoResult) {
+            close(fds[i]);
+        }
+    }
+
+    // The kernel may still write to the buffer of operations which never completed, so the ring is leaked instead of freed
+    if (mRing->inFlight != 0) {
+        static_cast<void>(mRing.release());
+    }
+
+    mRing.reset();
+}
+
+#else
+
+struct BatchIO::Ring {
+};
+
+#endif
+
+BatchIO::BatchIO(std::size_t maxBatchSize)
+ : mMaxBatchSize(std::max<std::size_t>(maxBatchSize, 1))
+{
+#ifdef NTAG_HAS_IO_URING
+    mRing = Ring::Create(mMaxBatchSize);
+#endif
+}
+
+BatchIO::~BatchIO()
+{
+}
+
+bool BatchIO::IsAsync() const
+{
+    return mRing != nullptr;
+}
+
+std::size_t BatchIO::GetMaxBatchSize() const
+{
+    return mMaxBatchSize;
+}
+
+void BatchIO::ReadFiles(const std::span<const std::string>& paths, std::vector<std::optional<std::vector<std::byte>>>& results)
+{
+    NTAG_TRACE_SCOPE("ReadFiles");
+
+    const std::size_t count = std::min(paths.size(), mMaxBatchSize);
+    results.assign(count, std::nullopt);
+
+#ifdef NTAG_HAS_IO_URING
+    if (mRing) {
+        std::vector<std::size_t> indices(count);
+        for (std::size_t i = 0; i < count; i++) {
+            indices[i] = i;
+        }
+
+        // Open all files
+        std::vector<int> fds(count, -1);
+        bool ok = mRing->Run(indices, fds, [&](std::size_t i, io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_OPENAT;
+            sqe.fd = AT_FDCWD;
+            sqe.addr = reinterpret_cast<std::uintptr_t>(paths[i].c_str());
+            sqe.open_flags = O_RDONLY | O_CLOEXEC;
+        });
+
+        std::erase_if(indices, [&](std::size_t i) { return fds[i] < 0; });
+
+        // Read all opened files into their slots
+        std::vector<int> sizes(count, -1);
+        ok = ok && mRing->Run(indices, sizes, [&](std::size_t i, io_uring_sqe& sqe) {
+            sqe.opcode = mRing->fixedBuffer ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            sqe.fd = fds[i];
+            sqe.addr = reinterpret_cast<std::uintptr_t>(mRing->GetSlot(i));
+            sqe.len = kSlotSize;
+            sqe.off = 0;
+            sqe.buf_index = 0;
+        });
+
+        // And close them again
+        std::vector<int> closed(count, kNoResult);
+        ok = ok && mRing->Run(indices, closed, [&](std::size_t i, io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_CLOSE;
+            sqe.fd = fds[i];
+        });
+
+        if (ok) {
+            for (std::size_t i : indices) {
+                if (sizes[i] < 0) {
+                    continue;
+                }
+
+                // The file might be larger than the slot
+                if (std::size_t(sizes[i]) == kSlotSize) {
+                    results[i] = io::ReadBinaryFile(paths[i]);
+                    continue;
+                }
+
+                const std::byte* slot = mRing->GetSlot(i);
+                results[i] = std::vector<std::byte>(slot, slot + sizes[i]);
+                metrics::Increment(metrics::BYTES_READ, sizes[i]);
+            }
+
+            return;
+        }
+
+        // The whole batch is read again without the ring
+        DropRing(indices, fds, closed);
+    }
+#endif
+
+    for (std::size_t i = 0; i < count; i++) {
+        results[i] = io::ReadBinaryFile(paths[i]);
+    }
+}
+
+void BatchIO::WriteFiles(const std::span<const std::string>& paths, const std::span<const std::span<const std::byte>>& data, std::vector<bool>& results)
+{
+    NTAG_TRACE_SCOPE("WriteFiles");
+
+    const std::size_t count = std::min({ paths.size(), data.size(), mMaxBatchSize });
+    results.assign(count, false);
+
+#ifdef NTAG_HAS_IO_URING
+    if (mRing) {
+        std::vector<std::size_t> indices;
+        for (std::size_t i = 0; i < count; i++) {
+            if (data[i].size() > kSlotSize) {
+                // Too large for a slot
+                results[i] = io::WriteBinaryFile(paths[i], data[i]);
+                continue;
+            }
+
+            std::copy(data[i].begin(), data[i].end(), mRing->GetSlot(i));
+            indices.push_back(i);
+        }
+
+        // Create all files
+        std::vector<int> fds(count, -1);
+        bool ok = mRing->Run(indices, fds, [&](std::size_t i, io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_OPENAT;
+            sqe.fd = AT_FDCWD;
+            sqe.addr = reinterpret_cast<std::uintptr_t>(paths[i].c_str());
+            sqe.len = 0644;
+            sqe.open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        });
+
+        std::erase_if(indices, [&](std::size_t i) { return fds[i] < 0; });
+
+        // Write the slots to the files
+        std::vector<int> sizes(count, -1);
+        ok = ok && mRing->Run(indices, sizes, [&](std::size_t i, io_uring_sqe& sqe) {
+            sqe.opcode = mRing->fixedBuffer ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            sqe.fd = fds[i];
+            sqe.addr = reinterpret_cast<std::uintptr_t>(mRing->GetSlot(i));
+            sqe.len = data[i].size();
+            sqe.off = 0;
+            sqe.buf_index = 0;
+        });
+
+        // Closing can report delayed write errors as well
+        std::vector<int> closed(count, kNoResult);
+        ok = ok && mRing->Run(indices, closed, [&](std::size_t i, io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_CLOSE;
+            sqe.fd = fds[i];
+        });
+
+        if (ok) {
+            for (std::size_t i : indices) {
+                results[i] = sizes[i] >= 0 && std::size_t(sizes[i]) == data[i].size() && closed[i] == 0;
+                if (results[i]) {
+                    metrics::Increment(metrics::BYTES_WRITTEN, data[i].size());
+                }
+            }
+
+            return;
+        }
+
+        // The files written through the ring are written again without it, the larger ones are already done
+        DropRing(indices, fds, closed);
+        for (std::size_t i = 0; i < count; i++) {
+            if (data[i].size() <= kSlotSize) {
+                results[i] = io::WriteBinaryFile(paths[i], data[i]);
+            }
+        }
+
+        return;
+    }
+#endif
+
+    for (std::size_t i = 0; i < count; i++) {
+        results[i] = io::WriteBinaryFile(paths[i], data[i]);
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+// Reads and writes many small files with as few system calls as possible
+// On Linux the opens, reads, writes and closes of a whole batch are submitted through io_uring at once,
+// everywhere else (or if io_uring is not permitted) every file is processed with io::ReadBinaryFile / io::WriteBinaryFile.
+// An instance is not thread safe, every thread should use its own.
+class BatchIO {
+public:
+    BatchIO(std::size_t maxBatchSize);
+    virtual ~BatchIO();
+
+    // Returns whether io_uring is used
+    bool IsAsync() const;
+
+    std::size_t GetMaxBatchSize() const;
+
+    // Reads at most GetMaxBatchSize() files, results[i] is empty if reading paths[i] failed
+    void ReadFiles(const std::span<const std::string>& paths, std::vector<std::optional<std::vector<std::byte>>>& results);
+
+    // Writes at most GetMaxBatchSize() files, results[i] is false if writing paths[i] failed
+    void WriteFiles(const std::span<const std::string>& paths, const std::span<const std::span<const std::byte>>& data, std::vector<bool>& results);
+
+private:
+    struct Ring;
+
+    // Closes the files the failed batch opened and left open and falls back to the portable path for good
+    void DropRing(const std::vector<std::size_t>& indices, const std::vector<int>& fds, const std::vector<int>& closed);
+
+    std::size_t mMaxBatchSize;
+    std::unique_ptr<Ring> mRing;
+};
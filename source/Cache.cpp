@@ -0,0 +1,207 @@
+#include "Cache.hpp"
+#include "crypto.hpp"
+#include "io.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <random>
+
+namespace {
+
+// Eviction removes entries until the cache is this fraction of its size, so it doesn't run again for every new entry
+constexpr std::uintmax_t kEvictNumerator = 9;
+constexpr std::uintmax_t kEvictDenominator = 10;
+// Temporary files this old were left behind by a process which was killed while storing an entry
+constexpr std::chrono::hours kStaleTempAge(1);
+
+constexpr const char* kTempDir = "tmp";
+
+std::string ToHex(const std::span<const std::byte>& data)
+{
+    constexpr char kHexDigits[] = "0123456789abcdef";
+
+    std::string str;
+    str.reserve(data.size() * 2);
+    for (std::byte b : data) {
+        str += kHexDigits[std::to_integer<int>(b) >> 4];
+        str += kHexDigits[std::to_integer<int>(b) & 0xf];
+    }
+    return str;
+}
+
+} // namespace
+
+Cache::Cache()
+ : mMaxSize(0), mTempCounter(0), mSize(0), mScanned(false)
+{
+}
+
+Cache::~Cache()
+{
+}
+
+Result<std::shared_ptr<Cache>> Cache::Open(const std::filesystem::path& dir, std::uintmax_t maxSize)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(dir / kTempDir, ec);
+    if (ec) {
+        return std::unexpected(Error(Error::CACHE_OPEN_FAILED));
+    }
+
+    std::shared_ptr<Cache> cache = std::make_shared<Cache>();
+    cache->mDir = dir;
+    cache->mMaxSize = maxSize;
+    cache->mTempPrefix = std::to_string(std::random_device()());
+    return cache;
+}
+
+std::array<std::byte, 0x20> Cache::GetKey(batch::Operation operation, const std::optional<std::uint32_t>& tagVersion, const std::array<std::byte, 0x20>& fingerprint, const std::span<const std::byte>& in)
+{
+    std::vector<std::byte> data;
+    data.reserve(fingerprint.size() + 8 + in.size());
+    data.insert(data.end(), fingerprint.begin(), fingerprint.end());
+
+    // Without a tag version the version and state are detected, which can give a different result for the same input
+    const std::uint32_t version = tagVersion ? *tagVersion : ~0u;
+    for (int i = 0; i < 4; i++) {
+        data.push_back(std::byte(static_cast<std::uint32_t>(operation) >> (i * 8)));
+    }
+    for (int i = 0; i < 4; i++) {
+        data.push_back(std::byte(version >> (i * 8)));
+    }
+
+    data.insert(data.end(), in.begin(), in.end());
+
+    std::array<std::byte, 0x20> key;
+    crypto::GenerateSHA256(data, key);
+    return key;
+}
+
+std::filesystem::path Cache::GetPath(const std::array<std::byte, 0x20>& key) const
+{
+    // Split by the first byte, so no directory holds too many entries
+    const std::string name = ToHex(key);
+    return mDir / name.substr(0, 2) / name.substr(2);
+}
+
+bool Cache::Load(const std::array<std::byte, 0x20>& key, std::vector<std::byte>& out)
+{
+    NTAG_TRACE_SCOPE("CacheLoad");
+
+    const std::filesystem::path path = GetPath(key);
+    std::optional<std::vector<std::byte>> data = io::ReadBinaryFile(path.string());
+    if (!data) {
+        metrics::Increment(metrics::CACHE_MISSES);
+        return false;
+    }
+
+    // Eviction goes by modification time, so entries which are used are kept
+    std::error_code ec;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+
+    metrics::Increment(metrics::CACHE_HITS);
+    out = std::move(*data);
+    return true;
+}
+
+void Cache::Store(const std::array<std::byte, 0x20>& key, const std::span<const std::byte>& data)
+{
+    NTAG_TRACE_SCOPE("CacheStore");
+
+    const std::filesystem::path path = GetPath(key);
+    const std::filesystem::path tempPath = mDir / kTempDir / (mTempPrefix + "-" + std::to_string(mTempCounter++));
+
+    // Readers either see the complete entry or none at all
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    if (ec || !io::WriteBinaryFile(tempPath.string(), data)) {
+        std::filesystem::remove(tempPath, ec);
+        return;
+    }
+
+    std::filesystem::rename(tempPath, path, ec);
+    if (ec) {
+        std::filesystem::remove(tempPath, ec);
+        return;
+    }
+
+    // The size is only known once the cache was scanned, which is done on the first store so read only runs never scan
+    if (mSize += data.size(); !mScanned || mSize > mMaxSize) {
+        Evict();
+    }
+}
+
+void Cache::Evict()
+{
+    // Another thread is already evicting, which frees enough space for this one as well
+    std::unique_lock lock(mEvictMutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return;
+    }
+
+    NTAG_TRACE_SCOPE("CacheEvict");
+
+    struct Entry {
+        std::filesystem::file_time_type modified;
+        std::uintmax_t size;
+        std::filesystem::path path;
+    };
+
+    const auto now = std::filesystem::file_time_type::clock::now();
+
+    // Other threads keep adding their stores to mSize during the scan, only what it was before is replaced by the scan
+    // Stores the scan already saw are counted twice until the next scan, which only makes eviction run early.
+    const std::uintmax_t previousSize = mSize;
+
+    std::vector<Entry> entries;
+    std::uintmax_t size = 0;
+    std::error_code ec;
+    for (auto it = std::filesystem::recursive_directory_iterator(mDir, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        // Entries removed by another process in the meantime are skipped, only failing to iterate ends the scan
+        std::error_code entryEc;
+        if (!it->is_regular_file(entryEc)) {
+            continue;
+        }
+
+        Entry entry{ it->last_write_time(entryEc), it->file_size(entryEc), it->path() };
+        if (entryEc) {
+            continue;
+        }
+
+        if (it.depth() == 1 && entry.path.parent_path().filename() == kTempDir) {
+            if (now - entry.modified > kStaleTempAge) {
+                std::filesystem::remove(entry.path, entryEc);
+            }
+
+            continue;
+        }
+
+        size += entry.size;
+        entries.push_back(std::move(entry));
+    }
+
+    if (size > mMaxSize) {
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+            return a.modified < b.modified;
+        });
+
+        // Entries another process removed first still count as removed
+        const std::uintmax_t target = mMaxSize / kEvictDenominator * kEvictNumerator;
+        for (const Entry& entry : entries) {
+            if (size <= target) {
+                break;
+            }
+
+            std::filesystem::remove(entry.path, ec);
+            size -= entry.size;
+        }
+    }
+
+    if (size >= previousSize) {
+        mSize += size - previousSize;
+    } else {
+        mSize -= previousSize - size;
+    }
+    mScanned = true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "Batch.hpp"
+#include "Error.hpp"
+
+// Content addressed store of processed tags on disk, so the same tag is only crypted once no matter its name or path
+// Entries are named by a hash of the input, the operation, tag version and the fingerprints of the keys and edit script,
+// and hold the processed tag. They are written to a temporary file and renamed into place, so any number of threads and
+// processes can share a cache directory. Once the cache grows beyond its size, the least recently used entries are removed.
+class Cache {
+public:
+    Cache();
+    virtual ~Cache();
+
+    // Creates the directory if needed, maxSize is the total size of the entries in bytes
+    static Result<std::shared_ptr<Cache>> Open(const std::filesystem::path& dir, std::uintmax_t maxSize);
+
+    // fingerprint identifies the keys and edit script, see batch::Context::SetCache
+    static std::array<std::byte, 0x20> GetKey(batch::Operation operation, const std::optional<std::uint32_t>& tagVersion, const std::array<std::byte, 0x20>& fingerprint, const std::span<const std::byte>& in);
+
+    // Returns false if there is no entry for the key, may be called from multiple threads at once
+    bool Load(const std::array<std::byte, 0x20>& key, std::vector<std::byte>& out);
+    // Failing to store an entry only means the tag is processed again, may be called from multiple threads at once
+    void Store(const std::array<std::byte, 0x20>& key, const std::span<const std::byte>& data);
+
+private:
+    std::filesystem::path GetPath(const std::array<std::byte, 0x20>& key) const;
+    // Removes the oldest entries of all processes until the cache is well below its size again
+    void Evict();
+
+    std::filesystem::path mDir;
+    std::uintmax_t mMaxSize;
+    // Temporary files are named by this prefix and a counter, so processes never write the same one
+    std::string mTempPrefix;
+    std::atomic<std::uint64_t> mTempCounter;
+
+    // Size of the cache when it was last scanned plus the entries this process stored since
+    // Other processes are only accounted for once it is scanned again.
+    std::atomic<std::uintmax_t> mSize;
+    std::atomic<bool> mScanned;
+    std::mutex mEvictMutex;
+};
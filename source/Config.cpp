@@ -0,0 +1,82 @@
+#include "Config.hpp"
+#include "io.hpp"
+
+namespace {
+
+std::string_view Trim(const std::string_view& str)
+{
+    const std::size_t begin = str.find_first_not_of(" \t\r");
+    if (begin == std::string_view::npos) {
+        return {};
+    }
+
+    const std::size_t end = str.find_last_not_of(" \t\r");
+    return str.substr(begin, end - begin + 1);
+}
+
+} // namespace
+
+std::optional<std::string> config::Section::Get(const std::string& key) const
+{
+    auto it = values.find(key);
+    if (it == values.end()) {
+        return {};
+    }
+
+    return it->second;
+}
+
+Result<std::vector<config::Section>> config::Parse(const std::string_view& text)
+{
+    std::vector<Section> sections;
+
+    std::size_t offset = 0;
+    while (offset < text.size()) {
+        std::size_t end = text.find('\n', offset);
+        if (end == std::string_view::npos) {
+            end = text.size();
+        }
+
+        const std::size_t lineOffset = offset;
+        const std::string_view line = Trim(text.substr(offset, end - offset));
+        offset = end + 1;
+
+        if (line.empty() || line[0] == '#' || line[0] == ';') {
+            continue;
+        }
+
+        if (line.front() == '[') {
+            if (line.back() != ']' || line.size() < 3) {
+                return std::unexpected(Error(Error::CONFIG_INVALID_LINE, lineOffset));
+            }
+
+            sections.push_back(Section{ std::string(Trim(line.substr(1, line.size() - 2))), lineOffset, {} });
+            continue;
+        }
+
+        // Every value belongs to a keyset
+        const std::size_t separator = line.find('=');
+        if (separator == std::string_view::npos || sections.empty()) {
+            return std::unexpected(Error(Error::CONFIG_INVALID_LINE, lineOffset));
+        }
+
+        const std::string_view key = Trim(line.substr(0, separator));
+        if (key.empty()) {
+            return std::unexpected(Error(Error::CONFIG_INVALID_LINE, lineOffset));
+        }
+
+        sections.back().values[std::string(key)] = std::string(Trim(line.substr(separator + 1)));
+    }
+
+    return sections;
+}
+
+Result<std::vector<config::Section>> config::Load(const std::filesystem::path& path)
+{
+    std::optional<std::vector<std::byte>> data = io::ReadBinaryFile(path.string());
+    if (!data) {
+        return std::unexpected(Error(Error::CONFIG_READ_FAILED));
+    }
+
+    return Parse(std::string_view(reinterpret_cast<const char*>(data->data()), data->size()));
+}
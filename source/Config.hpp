@@ -0,0 +1,36 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Error.hpp"
+
+// Parser for ntagtool.conf
+// The file consists of [name] sections with key = value pairs, lines starting with # or ; are comments:
+//
+//   [retail]
+//   key_file = key-retail.bin
+//
+//   [dev]
+//   unfixed_info = unfixed-info.bin
+//   locked_secret = locked-secret.bin
+namespace config {
+
+struct Section {
+    std::string name;
+    // Byte offset of the section header, used for reporting errors in the section
+    std::size_t offset;
+    std::map<std::string, std::string> values;
+
+    std::optional<std::string> Get(const std::string& key) const;
+};
+
+Result<std::vector<Section>> Parse(const std::string_view& text);
+
+Result<std::vector<Section>> Load(const std::filesystem::path& path);
+
+} // namespace config
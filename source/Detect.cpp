@@ -0,0 +1,148 @@
+#include "Detect.hpp"
+#include "Tag.hpp"
+#include "TagEncryption.hpp"
+#include "trace.hpp"
+
+namespace {
+
+// Version 0
+constexpr std::size_t kTagV0Size = 512u;
+// The capability container starts at block 1, the TLVs follow it in the same block
+constexpr std::size_t kTagV0CCOffset = 8u;
+constexpr std::size_t kTagV0TLVOffset = 12u;
+constexpr std::size_t kTagV0TLVEnd = 16u;
+constexpr std::uint8_t kNDEFMagicNumber = 0xe1;
+
+// TLV tags which can come before the NDEF TLV
+constexpr std::uint8_t kTLVNull = 0x00;
+constexpr std::uint8_t kTLVLockControl = 0x01;
+constexpr std::uint8_t kTLVMemoryControl = 0x02;
+constexpr std::uint8_t kTLVNDEF = 0x03;
+
+// Version 2, with and without pwd and reserved data
+constexpr std::size_t kTagV2Size0 = 0x214u;
+constexpr std::size_t kTagV2Size1 = 0x21cu;
+constexpr std::size_t kTagV2CCOffset = 0xcu;
+constexpr std::uint8_t kTagV2CCMagic = 0xf1;
+constexpr std::size_t kTagV2MagicOffset = 0x10u;
+constexpr std::uint8_t kTagV2Magic = 0xa5;
+
+// Checks the capability container and the first TLV the same way TagV0::FromBytes does, without parsing the tag
+bool IsTagV0(const std::span<const std::byte>& data)
+{
+    const std::uint8_t magic = std::to_integer<std::uint8_t>(data[kTagV0CCOffset]);
+    const std::uint8_t version = std::to_integer<std::uint8_t>(data[kTagV0CCOffset + 1]);
+    const std::uint8_t size = std::to_integer<std::uint8_t>(data[kTagV0CCOffset + 2]);
+    if (magic != kNDEFMagicNumber || version >> 4 != 1 || 8u * (size + 1) < kTagV0Size) {
+        return false;
+    }
+
+    for (std::size_t offset = kTagV0TLVOffset; offset < kTagV0TLVEnd; offset++) {
+        const std::uint8_t tlv = std::to_integer<std::uint8_t>(data[offset]);
+        if (tlv != kTLVNull) {
+            return tlv == kTLVLockControl || tlv == kTLVMemoryControl || tlv == kTLVNDEF;
+        }
+    }
+
+    // Only null TLVs in the first block, the next one could be locked
+    return true;
+}
+
+bool IsTagV2(const std::span<const std::byte>& data)
+{
+    const std::uint8_t magic = std::to_integer<std::uint8_t>(data[kTagV2CCOffset]);
+    const std::uint8_t version = std::to_integer<std::uint8_t>(data[kTagV2CCOffset + 1]);
+    return magic == kTagV2CCMagic && version >> 4 == 1 && data[kTagV2MagicOffset] == std::byte(kTagV2Magic);
+}
+
+bool IsEncryptedStateValid(TagEncryption& context, Tag& tag)
+{
+    // Decrypt in place to check the HMAC, the tag is only encrypted again if it doesn't match
+    // A matching tag stays decrypted, so it doesn't need to be decrypted a second time for processing.
+    tag.SetEncrypted(true);
+    if (!context.DecryptTag()) {
+        return false;
+    }
+
+    if (!detect::ValidateCheapestHMAC(context, tag)) {
+        context.EncryptTag();
+        return false;
+    }
+
+    return true;
+}
+
+bool IsDecryptedStateValid(TagEncryption& context, Tag& tag)
+{
+    tag.SetEncrypted(false);
+    return detect::ValidateCheapestHMAC(context, tag);
+}
+
+} // namespace
+
+std::optional<std::uint32_t> detect::DetectVersion(const std::span<const std::byte>& data)
+{
+    if (data.size() == kTagV0Size && IsTagV0(data)) {
+        return 0;
+    }
+
+    if ((data.size() == kTagV2Size0 || data.size() == kTagV2Size1) && IsTagV2(data)) {
+        return 2;
+    }
+
+    return {};
+}
+
+bool detect::ValidateCheapestHMAC(TagEncryption& context, const Tag& tag)
+{
+    // The version 0 locked secret is encrypted and its HMAC covers less data than the unfixed infos HMAC
+    // The version 2 locked secret HMAC only covers data which is never encrypted, so it can't tell the states apart
+    if (tag.GetVersion() == 0) {
+        return context.ValidateLockedSecretHMAC();
+    }
+
+    return context.ValidateUnfixedInfosHMAC();
+}
+
+bool detect::IsStateValid(TagEncryption& context, Tag& tag, State state)
+{
+    if (state == STATE_ENCRYPTED) {
+        return IsEncryptedStateValid(context, tag);
+    }
+
+    if (state == STATE_DECRYPTED) {
+        return IsDecryptedStateValid(context, tag);
+    }
+
+    return false;
+}
+
+detect::State detect::DetectState(TagEncryption& context, Tag& tag, State expected)
+{
+    NTAG_TRACE_SCOPE("DetectState");
+
+    // Deriving the keys doesn't depend on the state, so this only needs to happen once for both checks
+    if (!context.InitializeInternalKeys()) {
+        return STATE_UNKNOWN;
+    }
+
+    if (expected == STATE_ENCRYPTED) {
+        if (IsEncryptedStateValid(context, tag)) {
+            return STATE_ENCRYPTED;
+        }
+
+        if (IsDecryptedStateValid(context, tag)) {
+            return STATE_DECRYPTED;
+        }
+    } else {
+        if (IsDecryptedStateValid(context, tag)) {
+            return STATE_DECRYPTED;
+        }
+
+        if (IsEncryptedStateValid(context, tag)) {
+            return STATE_ENCRYPTED;
+        }
+    }
+
+    return STATE_UNKNOWN;
+}
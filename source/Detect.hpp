@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+
+class Tag;
+class TagEncryption;
+
+namespace detect {
+
+enum State {
+    // Neither the encrypted nor the decrypted data matches the HMAC, e.g. because the tag uses different keys
+    STATE_UNKNOWN,
+    STATE_ENCRYPTED,
+    STATE_DECRYPTED,
+};
+
+// Guesses the tag version from the size, the capability container and the magic values of raw tag data, without parsing it
+// Version 0 tags also need an NDEF or control TLV after the capability container.
+std::optional<std::uint32_t> DetectVersion(const std::span<const std::byte>& data);
+
+// Checks the HMAC which tells keysets and states apart at the lowest cost, the tag needs to be decrypted
+bool ValidateCheapestHMAC(TagEncryption& context, const Tag& tag);
+
+// Checks whether the cheapest HMAC of the tag matches if it is in the specified state, which is enough to tell keysets apart
+// The context needs to be bound to the tag and have its keys derived. A tag which is valid in the encrypted state is left
+// decrypted, so it isn't decrypted twice. Otherwise the tag data is left unchanged and the encrypted flag of the tag is set
+// to the checked state.
+bool IsStateValid(TagEncryption& context, Tag& tag, State state);
+
+// Determines whether the tag is encrypted by checking an HMAC, the expected state is tried first
+// The context needs to be bound to the tag, the derived keys are kept in the context for processing the tag afterwards.
+// Like IsStateValid, a tag detected as encrypted is left decrypted, otherwise the tag data is left unchanged.
+State DetectState(TagEncryption& context, Tag& tag, State expected);
+
+} // namespace detect
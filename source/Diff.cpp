@@ -0,0 +1,424 @@
+#include "Diff.hpp"
+#include "Cache.hpp"
+#include "Detect.hpp"
+#include "Dump.hpp"
+#include "Keyring.hpp"
+#include "Scheduler.hpp"
+#include "Tag.hpp"
+#include "TagEncryption.hpp"
+#include "TagV0.hpp"
+#include "TagV2.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+
+// Number of bytes compared at once, the word compares below are vectorized by the compiler
+constexpr std::size_t kBlockSize = 32u;
+// Changes up to this size are printed with their bytes
+constexpr std::size_t kMaxPrintedBytes = 16u;
+
+bool IsBlockEqual(const std::byte* left, const std::byte* right)
+{
+    std::uint64_t difference = 0;
+    for (std::size_t i = 0; i < kBlockSize; i += sizeof(std::uint64_t)) {
+        std::uint64_t l;
+        std::uint64_t r;
+        std::memcpy(&l, left + i, sizeof(l));
+        std::memcpy(&r, right + i, sizeof(r));
+        difference |= l ^ r;
+    }
+
+    return difference == 0;
+}
+
+std::vector<diff::Field> BuildFields(const Tag& tag)
+{
+    // The version 2 locked secret isn't encrypted, so it has no size, it spans the model info up to the key gen salt
+    const std::uint32_t lockedSecretSize = tag.GetLockedSecretSize() != 0 ? tag.GetLockedSecretSize() : tag.GetKeyGenSaltOffset() - tag.GetLockedSecretOffset();
+    // Version 0 stores the UID as part of the format info
+    const bool hasFormatInfo = tag.GetVersion() == 0;
+
+    std::vector<diff::Field> fields = {
+        { "Unfixed infos HMAC", tag.GetUnfixedInfosHmacOffset(), 0x20 },
+        { "Unfixed infos", tag.GetUnfixedInfosOffset(), tag.GetUnfixedInfosSize() },
+        { "Locked secret HMAC", tag.GetLockedSecretHmacOffset(), 0x20 },
+        { "Locked secret", tag.GetLockedSecretOffset(), lockedSecretSize },
+        { hasFormatInfo ? "Format info" : "UID", tag.GetUidOffset(), hasFormatInfo ? 0x10u : 0x8u },
+        { "Key gen salt", tag.GetKeyGenSaltOffset(), 0x20 },
+    };
+
+    std::sort(fields.begin(), fields.end(), [](const diff::Field& a, const diff::Field& b) { return a.offset < b.offset; });
+    return fields;
+}
+
+// Parts of the version 2 unfixed infos, relative to its start
+constexpr diff::Field kUnfixedInfosFieldsV2[] = {
+    { "Flags", 0x00, 0x1 },
+    { "Country code", 0x01, 0x1 },
+    { "Setup date", 0x04, 0x2 },
+    { "Last write date", 0x06, 0x2 },
+    { "Nickname", 0x0c, 0x14 },
+    { "Owner Mii", 0x20, 0x60 },
+    { "Title ID", 0x80, 0x8 },
+    { "Application write counter", 0x88, 0x2 },
+    { "Application ID", 0x8a, 0x4 },
+    { "Application data", 0xb0, 0xd8 },
+};
+
+std::vector<diff::Field> BuildSubFields(const Tag& tag)
+{
+    // Both versions keep the write counter in front of the unfixed infos, where the seed for their keys starts
+    std::vector<diff::Field> fields = {
+        { "Write counter", tag.GetSeedOffset(), 0x2 },
+    };
+
+    if (tag.GetVersion() == 2) {
+        for (const diff::Field& field : kUnfixedInfosFieldsV2) {
+            fields.push_back(diff::Field{ field.name, tag.GetUnfixedInfosOffset() + field.offset, field.size });
+        }
+    }
+
+    std::sort(fields.begin(), fields.end(), [](const diff::Field& a, const diff::Field& b) { return a.offset < b.offset; });
+    return fields;
+}
+
+// Reports the parts of a change which are inside of sub-fields by the name of the sub-field
+void AddChange(const std::vector<diff::Field>& subFields, const diff::Change& change, std::vector<diff::Change>& changes)
+{
+    std::uint32_t begin = change.offset;
+    const std::uint32_t end = change.offset + change.size;
+    for (const diff::Field& subField : subFields) {
+        if (subField.offset >= end) {
+            break;
+        }
+
+        if (subField.offset + subField.size <= begin) {
+            continue;
+        }
+
+        if (subField.offset > begin) {
+            changes.push_back(diff::Change{ change.field, begin, change.fieldOffset + (begin - change.offset), subField.offset - begin });
+            begin = subField.offset;
+        }
+
+        const std::uint32_t subFieldEnd = std::min(end, subField.offset + subField.size);
+        changes.push_back(diff::Change{ subField.name, begin, begin - subField.offset, subFieldEnd - begin });
+        begin = subFieldEnd;
+    }
+
+    if (begin < end) {
+        changes.push_back(diff::Change{ change.field, begin, change.fieldOffset + (begin - change.offset), end - begin });
+    }
+}
+
+// Splits the differing range [begin, end) at the field and sub-field boundaries
+void AddRange(const std::vector<diff::Field>& fields, const std::vector<diff::Field>& subFields, std::uint32_t begin, std::uint32_t end, std::vector<diff::Change>& changes)
+{
+    while (begin < end) {
+        const diff::Field* field = nullptr;
+        std::uint32_t next = end;
+        for (const diff::Field& f : fields) {
+            if (begin >= f.offset && begin < f.offset + f.size) {
+                field = &f;
+                next = std::min(end, f.offset + f.size);
+                break;
+            }
+
+            if (f.offset > begin) {
+                next = std::min(end, f.offset);
+                break;
+            }
+        }
+
+        if (field) {
+            AddChange(subFields, diff::Change{ field->name, begin, begin - field->offset, next - begin }, changes);
+        } else {
+            AddChange(subFields, diff::Change{ "Other", begin, begin, next - begin }, changes);
+        }
+
+        begin = next;
+    }
+}
+
+void PrintBytes(std::ostream& out, const std::span<const std::byte>& bytes)
+{
+    out << std::hex << std::setfill('0');
+    for (std::byte b : bytes) {
+        out << std::setw(2) << std::to_integer<int>(b);
+    }
+    out << std::dec << std::setfill(' ');
+}
+
+std::uint64_t GetUidKey(const diff::Snapshot& snapshot)
+{
+    // Tags of different versions never match, even with the same UID
+    std::uint64_t key = snapshot.version;
+    for (std::byte b : snapshot.uid) {
+        key = (key << 8) | std::to_integer<std::uint64_t>(b);
+    }
+
+    return key;
+}
+
+} // namespace
+
+const std::vector<diff::Field>& diff::GetFields(std::uint32_t version)
+{
+    // The offsets are the same for every tag of a version
+    static const std::vector<Field> fieldsV0 = BuildFields(TagV0());
+    static const std::vector<Field> fieldsV2 = BuildFields(TagV2());
+    static const std::vector<Field> none;
+
+    switch (version) {
+        case 0: return fieldsV0;
+        case 2: return fieldsV2;
+    }
+
+    return none;
+}
+
+const std::vector<diff::Field>& diff::GetSubFields(std::uint32_t version)
+{
+    static const std::vector<Field> subFieldsV0 = BuildSubFields(TagV0());
+    static const std::vector<Field> subFieldsV2 = BuildSubFields(TagV2());
+    static const std::vector<Field> none;
+
+    switch (version) {
+        case 0: return subFieldsV0;
+        case 2: return subFieldsV2;
+    }
+
+    return none;
+}
+
+batch::Status diff::LoadTag(batch::Context& context, const std::optional<std::uint32_t>& tagVersion, const std::span<const std::byte>& in, std::shared_ptr<Tag>& tag, std::optional<Error>* error)
+{
+    std::vector<std::byte> converted;
+    Result<std::span<const std::byte>> data = dump::Import(context.inputFormat, context.inputLayout, in, converted);
+    if (!data) {
+        if (error) {
+            *error = data.error();
+        }
+
+        return batch::STATUS_PARSE_FAILED;
+    }
+
+    // Decrypting a tag gives the same data diff compares, so entries are shared with decrypt runs
+    std::array<std::byte, 0x20> key;
+    if (context.cache) {
+        key = Cache::GetKey(batch::OPERATION_DECRYPT, tagVersion, context.fingerprint, *data);
+
+        std::vector<std::byte> decrypted;
+        if (context.cache->Load(key, decrypted)) {
+            return batch::ParseTag(batch::OPERATION_ENCRYPT, tagVersion, decrypted, tag, error);
+        }
+    }
+
+    batch::Status status = batch::ParseTag(batch::OPERATION_DECRYPT, tagVersion, *data, tag, error);
+    if (status != batch::STATUS_OK) {
+        return status;
+    }
+
+    detect::State state;
+    const std::optional<std::size_t> index = batch::SelectKeys(context, *tag, detect::STATE_ENCRYPTED, !tagVersion, state);
+    if (!index) {
+        return batch::STATUS_KEYS_FAILED;
+    }
+
+    // Without a matching keyset the decrypted data would only be noise
+    if (state == detect::STATE_UNKNOWN) {
+        return batch::STATUS_CRYPT_FAILED;
+    }
+
+    TagEncryption& encryption = context.encryptions[*index];
+    if (tag->IsEncrypted() && !encryption.DecryptTag()) {
+        return batch::STATUS_CRYPT_FAILED;
+    }
+
+    // A single keyset isn't checked when the version is known, so a wrong key file is only noticed here
+    if (context.encryptions.size() == 1 && tagVersion && !detect::ValidateCheapestHMAC(encryption, *tag)) {
+        return batch::STATUS_CRYPT_FAILED;
+    }
+
+    // Decrypt only caches tags with valid HMACs, so the same goes for entries stored here
+    if (context.cache && encryption.ValidateLockedSecretHMAC() && encryption.ValidateUnfixedInfosHMAC()) {
+        context.cache->Store(key, tag->ToBytes());
+    }
+
+    return batch::STATUS_OK;
+}
+
+batch::Status diff::LoadSnapshot(batch::Context& context, const std::optional<std::uint32_t>& tagVersion, const std::span<const std::byte>& in, Snapshot& snapshot, std::optional<Error>* error)
+{
+    std::shared_ptr<Tag> tag;
+    const batch::Status status = LoadTag(context, tagVersion, in, tag, error);
+    if (status != batch::STATUS_OK) {
+        return status;
+    }
+
+    snapshot.version = tag->GetVersion();
+    std::copy_n(tag->GetData().begin() + tag->GetUidOffset(), snapshot.uid.size(), snapshot.uid.begin());
+    snapshot.data = tag->GetData();
+    return batch::STATUS_OK;
+}
+
+void diff::Compare(const Snapshot& left, const Snapshot& right, std::vector<Change>& changes)
+{
+    const std::vector<Field>& fields = GetFields(left.version);
+    const std::vector<Field>& subFields = GetSubFields(left.version);
+    const std::size_t size = left.data.size();
+
+    // Start of the current range of differing bytes, size if there is none
+    std::size_t rangeBegin = size;
+    for (std::size_t block = 0; block < size; block += kBlockSize) {
+        const std::size_t blockEnd = std::min(block + kBlockSize, size);
+        if (blockEnd - block == kBlockSize && IsBlockEqual(left.data.data() + block, right.data.data() + block)) {
+            if (rangeBegin != size) {
+                AddRange(fields, subFields, rangeBegin, block, changes);
+                rangeBegin = size;
+            }
+
+            continue;
+        }
+
+        for (std::size_t i = block; i < blockEnd; i++) {
+            if (left.data[i] != right.data[i]) {
+                if (rangeBegin == size) {
+                    rangeBegin = i;
+                }
+            } else if (rangeBegin != size) {
+                AddRange(fields, subFields, rangeBegin, i, changes);
+                rangeBegin = size;
+            }
+        }
+    }
+
+    if (rangeBegin != size) {
+        AddRange(fields, subFields, rangeBegin, size, changes);
+    }
+}
+
+void diff::PrintChanges(std::ostream& out, const Snapshot& left, const Snapshot& right, const std::vector<Change>& changes)
+{
+    for (const Change& change : changes) {
+        out << "  " << change.field << " +0x" << std::hex << change.fieldOffset << " (0x" << change.offset << std::dec << "), "
+            << change.size << (change.size == 1 ? " byte" : " bytes");
+
+        if (change.size <= kMaxPrintedBytes) {
+            out << ": ";
+            PrintBytes(out, std::span(left.data).subspan(change.offset, change.size));
+            out << " -> ";
+            PrintBytes(out, std::span(right.data).subspan(change.offset, change.size));
+        }
+
+        out << "\n";
+    }
+}
+
+diff::Summary diff::CompareDirectories(const Options& options, const std::filesystem::path& leftDir, const std::filesystem::path& rightDir, std::ostream& out)
+{
+    const auto startTime = std::chrono::steady_clock::now();
+
+    std::uintmax_t bytes;
+    const std::vector<std::filesystem::path> leftFiles = batch::CollectFiles(leftDir, bytes);
+    const std::vector<std::filesystem::path> rightFiles = batch::CollectFiles(rightDir, bytes);
+
+    // Both directories are loaded in a single run, so the workers are busy until the very end
+    const std::size_t total = leftFiles.size() + rightFiles.size();
+    std::vector<Snapshot> snapshots(total);
+    std::vector<batch::Status> statuses(total);
+    std::vector<std::optional<Error>> errors(total);
+
+    batch::Context context(*options.keyring);
+    context.inputFormat = options.inputFormat;
+    context.inputLayout = options.inputLayout;
+    context.SetCache(options.cache.get());
+    std::vector<batch::Context> contexts(std::max(1u, options.jobs), context);
+    scheduler::ParallelFor(total, options.jobs, options.pin, [&](std::size_t i, unsigned int worker) {
+        const std::filesystem::path path = i < leftFiles.size() ? leftDir / leftFiles[i] : rightDir / rightFiles[i - leftFiles.size()];
+
+        std::vector<std::byte> in;
+        statuses[i] = batch::ReadTagFile(path, in);
+        if (statuses[i] == batch::STATUS_OK) {
+            statuses[i] = LoadSnapshot(contexts[worker], options.tagVersion, in, snapshots[i], &errors[i]);
+        }
+    });
+
+    Summary summary{};
+
+    for (std::size_t i = 0; i < total; i++) {
+        if (statuses[i] != batch::STATUS_OK) {
+            const std::filesystem::path path = i < leftFiles.size() ? leftDir / leftFiles[i] : rightDir / rightFiles[i - leftFiles.size()];
+            std::cerr << path.string() << ": " << batch::GetStatusString(statuses[i]);
+            if (errors[i]) {
+                std::cerr << " (" << errors[i]->GetDescription() << " at offset 0x" << std::hex << errors[i]->GetOffset() << std::dec << ")";
+            }
+            std::cerr << "\n";
+            summary.failed++;
+        }
+    }
+
+    // Tags with the same UID are paired in path order
+    std::unordered_map<std::uint64_t, std::vector<std::size_t>> rightByUid;
+    for (std::size_t i = leftFiles.size(); i < total; i++) {
+        if (statuses[i] == batch::STATUS_OK) {
+            rightByUid[GetUidKey(snapshots[i])].push_back(i);
+        }
+    }
+
+    std::vector<std::pair<std::size_t, std::size_t>> pairs;
+    std::vector<bool> rightMatched(rightFiles.size());
+    std::vector<std::size_t> onlyLeft;
+    for (std::size_t i = 0; i < leftFiles.size(); i++) {
+        if (statuses[i] != batch::STATUS_OK) {
+            continue;
+        }
+
+        auto it = rightByUid.find(GetUidKey(snapshots[i]));
+        if (it == rightByUid.end() || it->second.empty()) {
+            onlyLeft.push_back(i);
+            continue;
+        }
+
+        const std::size_t right = it->second.front();
+        it->second.erase(it->second.begin());
+        rightMatched[right - leftFiles.size()] = true;
+        pairs.emplace_back(i, right);
+    }
+
+    std::vector<std::vector<Change>> changes(pairs.size());
+    scheduler::ParallelFor(pairs.size(), options.jobs, options.pin, [&](std::size_t i, unsigned int) {
+        Compare(snapshots[pairs[i].first], snapshots[pairs[i].second], changes[i]);
+    });
+
+    for (std::size_t i = 0; i < pairs.size(); i++) {
+        if (changes[i].empty()) {
+            continue;
+        }
+
+        out << leftFiles[pairs[i].first].string() << " <-> " << rightFiles[pairs[i].second - leftFiles.size()].string() << "\n";
+        PrintChanges(out, snapshots[pairs[i].first], snapshots[pairs[i].second], changes[i]);
+        summary.changed++;
+    }
+
+    for (std::size_t i : onlyLeft) {
+        out << "Only in " << leftDir.string() << ": " << leftFiles[i].string() << "\n";
+    }
+
+    for (std::size_t i = 0; i < rightFiles.size(); i++) {
+        if (!rightMatched[i] && statuses[leftFiles.size() + i] == batch::STATUS_OK) {
+            out << "Only in " << rightDir.string() << ": " << rightFiles[i].string() << "\n";
+            summary.onlyRight++;
+        }
+    }
+
+    summary.matched = pairs.size();
+    summary.onlyLeft = onlyLeft.size();
+    summary.elapsed = std::chrono::steady_clock::now() - startTime;
+    return summary;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <vector>
+
+#include "Batch.hpp"
+
+class Cache;
+class Keyring;
+class Tag;
+
+namespace diff {
+
+// A named region of the decrypted tag data
+struct Field {
+    const char* name;
+    std::uint32_t offset;
+    std::uint32_t size;
+};
+
+// A range of differing bytes, ranges never cross field boundaries
+struct Change {
+    // "Other" for bytes which are not part of any field
+    const char* field;
+    // Offset into the tag data
+    std::uint32_t offset;
+    // Offset relative to the start of the field
+    std::uint32_t fieldOffset;
+    std::uint32_t size;
+};
+
+// Decrypted data of a tag, without the parsed representation
+struct Snapshot {
+    std::uint32_t version;
+    // The UID without the check byte, used to pair tags
+    std::array<std::byte, 7> uid;
+    std::array<std::byte, 540> data;
+};
+
+struct Options {
+    // If empty, the version and whether a tag is encrypted are detected for every tag
+    std::optional<std::uint32_t> tagVersion;
+    // Format of the tags, detected for every tag if empty, and the layout of version 2 tags
+    std::optional<dump::Format> inputFormat;
+    dump::Layout inputLayout;
+    std::shared_ptr<Keyring> keyring;
+    // If set, decrypted tags are loaded from and stored in the cache, shared with decrypt
+    std::shared_ptr<Cache> cache;
+    // Number of worker threads
+    unsigned int jobs;
+    // Pin the workers to CPUs
+    bool pin;
+};
+
+struct Summary {
+    // Number of tags matched by UID
+    std::size_t matched;
+    std::size_t changed;
+    std::size_t onlyLeft;
+    std::size_t onlyRight;
+    std::size_t failed;
+    std::chrono::duration<double> elapsed;
+};
+
+// Returns the fields of a tag version, sorted by offset
+const std::vector<Field>& GetFields(std::uint32_t version);
+// Returns the named parts of the fields of a tag version, like the write counter and nickname, sorted by offset
+// Changes inside of them are reported by their name instead of the name of the field.
+const std::vector<Field>& GetSubFields(std::uint32_t version);
+
+// Parses and decrypts a tag, tags which are already decrypted are only parsed
+// Dumps are converted with the input format and layout of the context first.
+// Only the cheapest HMAC is checked, tags it doesn't match with any keyset fail with STATUS_CRYPT_FAILED.
+batch::Status LoadTag(batch::Context& context, const std::optional<std::uint32_t>& tagVersion, const std::span<const std::byte>& in, std::shared_ptr<Tag>& tag, std::optional<Error>* error = nullptr);
+// Loads a tag like LoadTag and copies its decrypted data
+batch::Status LoadSnapshot(batch::Context& context, const std::optional<std::uint32_t>& tagVersion, const std::span<const std::byte>& in, Snapshot& snapshot, std::optional<Error>* error = nullptr);
+
+// Compares the data of two snapshots of the same version, changes receives the differing ranges split by field
+// Whole blocks are compared at once and only blocks which differ are looked at byte by byte.
+void Compare(const Snapshot& left, const Snapshot& right, std::vector<Change>& changes);
+
+// Prints every change with the bytes of both sides
+void PrintChanges(std::ostream& out, const Snapshot& left, const Snapshot& right, const std::vector<Change>& changes);
+
+// Decrypts all tags of both directories, pairs them by version and UID and prints the changes of every pair in path order
+Summary CompareDirectories(const Options& options, const std::filesystem::path& leftDir, const std::filesystem::path& rightDir, std::ostream& out);
+
+} // namespace diff
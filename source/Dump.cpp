@@ -0,0 +1,684 @@
+#include "Dump.hpp"
+#include "TagV2.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <charconv>
+#include <cstdint>
+#include <string_view>
+
+namespace {
+
+// Raw tags of all versions, see Detect.cpp
+constexpr std::array<std::size_t, 3> kTagSizes = { 512u, 0x214u, 0x21cu };
+
+constexpr std::size_t kPageSize = 4u;
+// NTAG216 has the most pages of all tags a dump could be of, anything beyond is rejected before it is stored
+constexpr std::size_t kMaxPages = 231u;
+constexpr std::size_t kNTAG215Pages = 135u;
+constexpr std::size_t kUIDSize = 7u;
+constexpr std::size_t kSignatureSize = 0x20u;
+
+constexpr std::array<std::uint8_t, 8> kNTAG215Version = { 0x00, 0x04, 0x04, 0x02, 0x01, 0x00, 0x11, 0x03 };
+constexpr std::array<std::uint8_t, 8> kNTAG216Version = { 0x00, 0x04, 0x04, 0x02, 0x01, 0x00, 0x13, 0x03 };
+
+constexpr std::string_view kWhitespace = " \t\r\n";
+constexpr std::string_view kFlipperHeader = "Filetype: Flipper NFC device";
+constexpr std::string_view kFlipperPage = "Page ";
+constexpr std::string_view kProxmarkBlocks = "blocks";
+// Characters which end a JSON number or literal
+constexpr std::string_view kValueEnd = ",}] \t\r\n";
+
+// Number of bytes DetectFormat checks for hex digits, binary data never gets this far
+constexpr std::size_t kDetectSize = 64u;
+// Objects and arrays in Proxmark dumps this deep are not skipped but rejected
+constexpr int kMaxJSONDepth = 16;
+
+// Value of every character as a hex digit, 0xff if it isn't one
+constexpr std::array<std::uint8_t, 256> kHexValues = []() {
+    std::array<std::uint8_t, 256> values{};
+    values.fill(0xff);
+    for (int i = 0; i < 10; i++) {
+        values['0' + i] = i;
+    }
+    for (int i = 0; i < 6; i++) {
+        values['a' + i] = 10 + i;
+        values['A' + i] = 10 + i;
+    }
+    return values;
+}();
+
+// Both digits of every byte, so encoding is a single lookup per byte
+constexpr std::array<std::array<char, 2>, 256> kHexDigits = []() {
+    constexpr char kDigits[] = "0123456789ABCDEF";
+
+    std::array<std::array<char, 2>, 256> digits{};
+    for (int i = 0; i < 256; i++) {
+        digits[i] = { kDigits[i >> 4], kDigits[i & 0xf] };
+    }
+    return digits;
+}();
+
+bool IsSpace(char c)
+{
+    return kWhitespace.find(c) != std::string_view::npos;
+}
+
+bool IsText(char c)
+{
+    return (c >= ' ' && c <= '~') || IsSpace(c);
+}
+
+std::string_view ToText(const std::span<const std::byte>& data)
+{
+    return std::string_view(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+// Decodes pairs of hex digits with any whitespace between the pairs into out, which holds at most size bytes
+// offset is the offset of text in the dump, errors carry the offset of the offending character.
+// Dumps without separators are decoded a page of digits at a time, with a single check for invalid digits.
+Result<std::size_t> DecodeHex(std::string_view text, std::size_t offset, std::byte* out, std::size_t size)
+{
+    const unsigned char* digits = reinterpret_cast<const unsigned char*>(text.data());
+
+    std::size_t count = 0;
+    std::size_t i = 0;
+    while (i < text.size()) {
+        if (text.size() - i >= kPageSize * 2 && size - count >= kPageSize) {
+            std::array<std::uint8_t, kPageSize * 2> values;
+            std::uint8_t invalid = 0;
+            for (std::size_t j = 0; j < values.size(); j++) {
+                values[j] = kHexValues[digits[i + j]];
+                invalid |= values[j];
+            }
+
+            if ((invalid & 0xf0) == 0) {
+                for (std::size_t j = 0; j < kPageSize; j++) {
+                    out[count + j] = std::byte((values[j * 2] << 4) | values[j * 2 + 1]);
+                }
+
+                count += kPageSize;
+                i += kPageSize * 2;
+                continue;
+            }
+        }
+
+        if (IsSpace(text[i])) {
+            i++;
+            continue;
+        }
+
+        const std::uint8_t high = kHexValues[digits[i]];
+        if (high == 0xff) {
+            return std::unexpected(Error(Error::DUMP_INVALID_HEX, offset + i));
+        }
+
+        if (i + 1 == text.size() || kHexValues[digits[i + 1]] == 0xff) {
+            return std::unexpected(Error(Error::DUMP_INVALID_HEX, offset + i + 1));
+        }
+
+        if (count == size) {
+            return std::unexpected(Error(Error::DUMP_INVALID_PAGE_SIZE, offset + i));
+        }
+
+        out[count++] = std::byte((high << 4) | kHexValues[digits[i + 1]]);
+        i += 2;
+    }
+
+    return count;
+}
+
+void AppendHex(std::string& str, const std::span<const std::byte>& data, bool separate)
+{
+    for (std::size_t i = 0; i < data.size(); i++) {
+        if (separate && i != 0) {
+            str += ' ';
+        }
+
+        const std::array<char, 2>& digits = kHexDigits[std::to_integer<std::uint8_t>(data[i])];
+        str.append(digits.data(), digits.size());
+    }
+}
+
+// Stores pages listed by number in any order, straight at their offset in the raw layout
+class PageMap {
+public:
+    PageMap(std::vector<std::byte>& out)
+     : mOut(out), mPages(0)
+    {
+        mOut.assign(kMaxPages * kPageSize, std::byte(0));
+    }
+
+    // number and digits are views into the dump at the specified offsets
+    Result<void> Set(std::string_view number, std::size_t numberOffset, std::string_view digits, std::size_t digitsOffset)
+    {
+        std::size_t page;
+        const std::from_chars_result res = std::from_chars(number.data(), number.data() + number.size(), page);
+        if (res.ec != std::errc() || res.ptr != number.data() + number.size() || page >= kMaxPages || mSeen[page]) {
+            return std::unexpected(Error(Error::DUMP_INVALID_PAGE, numberOffset));
+        }
+
+        Result<std::size_t> count = DecodeHex(digits, digitsOffset, mOut.data() + page * kPageSize, kPageSize);
+        if (!count) {
+            return std::unexpected(count.error());
+        }
+
+        if (*count != kPageSize) {
+            return std::unexpected(Error(Error::DUMP_INVALID_PAGE_SIZE, digitsOffset));
+        }
+
+        mSeen[page] = true;
+        mPages = std::max(mPages, page + 1);
+        return {};
+    }
+
+    // Cuts the output to the listed pages, offset is where the dump ended
+    Result<void> Finish(std::size_t offset)
+    {
+        if (mPages == 0) {
+            return std::unexpected(Error(Error::DUMP_NO_PAGES, offset));
+        }
+
+        if (mSeen.count() != mPages) {
+            return std::unexpected(Error(Error::DUMP_MISSING_PAGE, offset));
+        }
+
+        mOut.resize(mPages * kPageSize);
+        return {};
+    }
+
+private:
+    std::vector<std::byte>& mOut;
+    std::bitset<kMaxPages> mSeen;
+    std::size_t mPages;
+};
+
+// Reads just enough JSON to find the blocks of a Proxmark dump, everything else is skipped without being stored
+class JSONCursor {
+public:
+    JSONCursor(std::string_view text)
+     : mText(text), mPosition(0)
+    {
+    }
+
+    std::size_t GetPosition() const
+    {
+        return mPosition;
+    }
+
+    bool Consume(char c)
+    {
+        SkipWhitespace();
+        if (mPosition < mText.size() && mText[mPosition] == c) {
+            mPosition++;
+            return true;
+        }
+
+        return false;
+    }
+
+    // The string keeps its escapes, which never occur in the keys and values which are used
+    bool ReadString(std::string_view& str, std::size_t& offset)
+    {
+        if (!Consume('"')) {
+            return false;
+        }
+
+        offset = mPosition;
+        for (; mPosition < mText.size(); mPosition++) {
+            if (mText[mPosition] == '\\') {
+                mPosition++;
+            } else if (mText[mPosition] == '"') {
+                str = mText.substr(offset, mPosition - offset);
+                mPosition++;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool SkipValue(int depth = 0)
+    {
+        if (depth > kMaxJSONDepth) {
+            return false;
+        }
+
+        SkipWhitespace();
+        if (mPosition == mText.size()) {
+            return false;
+        }
+
+        std::string_view str;
+        std::size_t offset;
+        switch (mText[mPosition]) {
+            case '"':
+                return ReadString(str, offset);
+            case '{':
+                mPosition++;
+                if (Consume('}')) {
+                    return true;
+                }
+
+                do {
+                    if (!ReadString(str, offset) || !Consume(':') || !SkipValue(depth + 1)) {
+                        return false;
+                    }
+                } while (Consume(','));
+
+                return Consume('}');
+            case '[':
+                mPosition++;
+                if (Consume(']')) {
+                    return true;
+                }
+
+                do {
+                    if (!SkipValue(depth + 1)) {
+                        return false;
+                    }
+                } while (Consume(','));
+
+                return Consume(']');
+            default: {
+                // Numbers, true, false and null
+                const std::size_t start = mPosition;
+                while (mPosition < mText.size() && kValueEnd.find(mText[mPosition]) == std::string_view::npos) {
+                    mPosition++;
+                }
+
+                return mPosition != start;
+            }
+        }
+    }
+
+private:
+    void SkipWhitespace()
+    {
+        while (mPosition < mText.size() && IsSpace(mText[mPosition])) {
+            mPosition++;
+        }
+    }
+
+    std::string_view mText;
+    std::size_t mPosition;
+};
+
+Result<void> ParseFlipper(std::string_view text, std::vector<std::byte>& out)
+{
+    PageMap pages(out);
+    for (std::size_t position = 0; position < text.size();) {
+        const std::size_t end = std::min(text.find('\n', position), text.size());
+        const std::string_view line = text.substr(position, end - position);
+
+        // Page 0: 04 A1 B2 C3
+        if (line.starts_with(kFlipperPage)) {
+            const std::size_t colon = line.find(':');
+            if (colon == std::string_view::npos) {
+                return std::unexpected(Error(Error::DUMP_INVALID_PAGE, position));
+            }
+
+            const std::size_t numberStart = kFlipperPage.size();
+            Result<void> res = pages.Set(line.substr(numberStart, colon - numberStart), position + numberStart, line.substr(colon + 1), position + colon + 1);
+            if (!res) {
+                return res;
+            }
+        }
+
+        position = end + 1;
+    }
+
+    return pages.Finish(text.size());
+}
+
+Result<void> ParseProxmark(std::string_view text, std::vector<std::byte>& out)
+{
+    PageMap pages(out);
+    JSONCursor json(text);
+
+    const auto invalid = [&json]() {
+        return std::unexpected(Error(Error::DUMP_INVALID_JSON, json.GetPosition()));
+    };
+
+    if (!json.Consume('{')) {
+        return invalid();
+    }
+
+    if (!json.Consume('}')) {
+        do {
+            std::string_view key;
+            std::size_t keyOffset;
+            if (!json.ReadString(key, keyOffset) || !json.Consume(':')) {
+                return invalid();
+            }
+
+            if (key != kProxmarkBlocks) {
+                if (!json.SkipValue()) {
+                    return invalid();
+                }
+
+                continue;
+            }
+
+            // "blocks": { "0": "04A1B2C3", ... }
+            if (!json.Consume('{')) {
+                return invalid();
+            }
+
+            if (json.Consume('}')) {
+                continue;
+            }
+
+            do {
+                std::string_view number;
+                std::string_view digits;
+                std::size_t numberOffset;
+                std::size_t digitsOffset;
+                if (!json.ReadString(number, numberOffset) || !json.Consume(':') || !json.ReadString(digits, digitsOffset)) {
+                    return invalid();
+                }
+
+                Result<void> res = pages.Set(number, numberOffset, digits, digitsOffset);
+                if (!res) {
+                    return res;
+                }
+            } while (json.Consume(','));
+
+            if (!json.Consume('}')) {
+                return invalid();
+            }
+        } while (json.Consume(','));
+
+        if (!json.Consume('}')) {
+            return invalid();
+        }
+    }
+
+    return pages.Finish(text.size());
+}
+
+Result<void> ParseHex(std::string_view text, std::vector<std::byte>& out)
+{
+    // Every byte takes at least two characters
+    out.resize(text.size() / 2);
+
+    std::size_t size = 0;
+    for (std::size_t position = 0; position < text.size();) {
+        const std::size_t end = std::min(text.find('\n', position), text.size());
+        const std::string_view line = text.substr(position, end - position);
+
+        const std::size_t first = line.find_first_not_of(kWhitespace);
+        if (first != std::string_view::npos && line[first] != '#') {
+            Result<std::size_t> count = DecodeHex(line, position, out.data() + size, out.size() - size);
+            if (!count) {
+                return std::unexpected(count.error());
+            }
+
+            size += *count;
+        }
+
+        position = end + 1;
+    }
+
+    if (size == 0) {
+        return std::unexpected(Error(Error::DUMP_NO_PAGES, text.size()));
+    }
+
+    out.resize(size);
+    return {};
+}
+
+// Everything which isn't part of the pages, taken from them or written with its default
+struct CardInfo {
+    std::array<std::byte, kUIDSize> uid{};
+    const std::array<std::uint8_t, 8>* version;
+    // Pages of the tag type, the dump may hold fewer
+    std::size_t pages;
+};
+
+CardInfo GetCardInfo(const std::span<const std::byte>& data)
+{
+    CardInfo info{};
+
+    // The UID is stored in the first two pages, the last byte of the first page is a check byte
+    const std::size_t uidSize = std::min(data.size(), kUIDSize + 1);
+    for (std::size_t i = 0, j = 0; i < uidSize; i++) {
+        if (i != 3) {
+            info.uid[j++] = data[i];
+        }
+    }
+
+    const std::size_t pages = data.size() / kPageSize;
+    info.version = pages <= kNTAG215Pages ? &kNTAG215Version : &kNTAG216Version;
+    info.pages = pages <= kNTAG215Pages ? kNTAG215Pages : kMaxPages;
+    return info;
+}
+
+std::string WriteFlipper(const std::span<const std::byte>& data)
+{
+    const CardInfo info = GetCardInfo(data);
+    const std::size_t pages = data.size() / kPageSize;
+
+    std::string str;
+    str.reserve(0x400 + pages * 24);
+    str += kFlipperHeader;
+    str += "\nVersion: 4\n";
+    str += "Device type: NTAG/Ultralight\n";
+    str += "UID: ";
+    AppendHex(str, info.uid, true);
+    str += "\nATQA: 00 44\n";
+    str += "SAK: 00\n";
+    str += "Data format version: 2\n";
+    str += info.version == &kNTAG215Version ? "NTAG/Ultralight type: NTAG215\n" : "NTAG/Ultralight type: NTAG216\n";
+    str += "Signature: ";
+    AppendHex(str, std::array<std::byte, kSignatureSize>{}, true);
+    str += "\nMifare version: ";
+    AppendHex(str, std::as_bytes(std::span(*info.version)), true);
+    str += '\n';
+    for (int i = 0; i < 3; i++) {
+        str += "Counter " + std::to_string(i) + ": 0\n";
+        str += "Tearing " + std::to_string(i) + ": 00\n";
+    }
+    str += "Pages total: " + std::to_string(info.pages) + "\n";
+    str += "Pages read: " + std::to_string(pages) + "\n";
+    for (std::size_t i = 0; i < pages; i++) {
+        str += kFlipperPage;
+        str += std::to_string(i) + ": ";
+        AppendHex(str, data.subspan(i * kPageSize, kPageSize), true);
+        str += '\n';
+    }
+    str += "Failed authentication attempts: 0\n";
+    return str;
+}
+
+std::string WriteProxmark(const std::span<const std::byte>& data)
+{
+    const CardInfo info = GetCardInfo(data);
+    const std::size_t pages = data.size() / kPageSize;
+
+    std::string str;
+    str.reserve(0x200 + pages * 20);
+    str += "{\n";
+    str += "  \"Created\": \"ntagtool\",\n";
+    str += "  \"FileType\": \"mfu\",\n";
+    str += "  \"Card\": {\n";
+    str += "    \"UID\": \"";
+    AppendHex(str, info.uid, false);
+    str += "\",\n    \"Version\": \"";
+    AppendHex(str, std::as_bytes(std::span(*info.version)), false);
+    str += "\",\n";
+    str += "    \"TBO_0\": \"0000\",\n";
+    str += "    \"TBO_1\": \"00\",\n";
+    str += "    \"Signature\": \"";
+    AppendHex(str, std::array<std::byte, kSignatureSize>{}, false);
+    str += "\",\n";
+    for (int i = 0; i < 3; i++) {
+        str += "    \"Counter" + std::to_string(i) + "\": \"000000\",\n";
+        str += "    \"Tearing" + std::to_string(i) + "\": \"00\"" + (i != 2 ? ",\n" : "\n");
+    }
+    str += "  },\n";
+    str += "  \"blocks\": {\n";
+    for (std::size_t i = 0; i < pages; i++) {
+        str += "    \"" + std::to_string(i) + "\": \"";
+        AppendHex(str, data.subspan(i * kPageSize, kPageSize), false);
+        str += i + 1 != pages ? "\",\n" : "\"\n";
+    }
+    str += "  }\n";
+    str += "}\n";
+    return str;
+}
+
+std::string WriteHex(const std::span<const std::byte>& data)
+{
+    std::string str;
+    str.reserve(data.size() * 3);
+    for (std::size_t i = 0; i < data.size(); i += kPageSize) {
+        AppendHex(str, data.subspan(i, kPageSize), true);
+        str += '\n';
+    }
+    return str;
+}
+
+} // namespace
+
+std::optional<dump::Format> dump::GetFormat(const std::string& name)
+{
+    if (name == "binary") {
+        return FORMAT_BINARY;
+    } else if (name == "flipper") {
+        return FORMAT_FLIPPER;
+    } else if (name == "proxmark") {
+        return FORMAT_PROXMARK;
+    } else if (name == "hex") {
+        return FORMAT_HEX;
+    }
+
+    return {};
+}
+
+std::optional<dump::Layout> dump::GetLayout(const std::string& name)
+{
+    if (name == "tag") {
+        return LAYOUT_TAG;
+    } else if (name == "amiitool") {
+        return LAYOUT_AMIITOOL;
+    }
+
+    return {};
+}
+
+dump::Format dump::DetectFormat(const std::span<const std::byte>& data)
+{
+    const std::string_view text = ToText(data);
+    const std::size_t start = text.find_first_not_of(kWhitespace);
+    if (start == std::string_view::npos) {
+        return FORMAT_BINARY;
+    }
+
+    if (text.substr(start).starts_with(kFlipperHeader)) {
+        return FORMAT_FLIPPER;
+    }
+
+    // A text dump can be as long as a raw tag, but a raw tag starts with its UID, which can be any bytes.
+    // At those sizes the data is only taken as text if it starts with printable characters.
+    const std::string_view head = text.substr(start, kDetectSize);
+    const bool isTagSize = std::find(kTagSizes.begin(), kTagSizes.end(), data.size()) != kTagSizes.end();
+    if (isTagSize && !std::all_of(head.begin(), head.end(), IsText)) {
+        return FORMAT_BINARY;
+    }
+
+    if (text[start] == '{') {
+        return FORMAT_PROXMARK;
+    }
+
+    if (text[start] == '#') {
+        return FORMAT_HEX;
+    }
+
+    const bool isHex = std::all_of(head.begin(), head.end(), [](char c) {
+        return kHexValues[static_cast<unsigned char>(c)] != 0xff || IsSpace(c);
+    });
+    return isHex ? FORMAT_HEX : FORMAT_BINARY;
+}
+
+Result<void> dump::Parse(Format format, const std::span<const std::byte>& data, std::vector<std::byte>& out)
+{
+    NTAG_TRACE_SCOPE("dump::Parse");
+
+    switch (format) {
+        case FORMAT_BINARY:
+            out.assign(data.begin(), data.end());
+            return {};
+        case FORMAT_FLIPPER:
+            return ParseFlipper(ToText(data), out);
+        case FORMAT_PROXMARK:
+            return ParseProxmark(ToText(data), out);
+        case FORMAT_HEX:
+            return ParseHex(ToText(data), out);
+    }
+
+    return {};
+}
+
+std::vector<std::byte> dump::Write(Format format, const std::span<const std::byte>& data)
+{
+    NTAG_TRACE_SCOPE("dump::Write");
+
+    if (format == FORMAT_BINARY) {
+        return std::vector<std::byte>(data.begin(), data.end());
+    }
+
+    // Every format lists whole pages
+    std::vector<std::byte> padded(data.begin(), data.end());
+    padded.resize((data.size() + kPageSize - 1) / kPageSize * kPageSize);
+
+    std::string str;
+    switch (format) {
+        case FORMAT_FLIPPER:  str = WriteFlipper(padded);  break;
+        case FORMAT_PROXMARK: str = WriteProxmark(padded); break;
+        default:              str = WriteHex(padded);      break;
+    }
+
+    const std::span<const std::byte> bytes = std::as_bytes(std::span(str));
+    return std::vector<std::byte>(bytes.begin(), bytes.end());
+}
+
+Result<std::span<const std::byte>> dump::Import(const std::optional<Format>& format, Layout layout, const std::span<const std::byte>& in, std::vector<std::byte>& out)
+{
+    std::span<const std::byte> data = in;
+
+    const Format inputFormat = format ? *format : DetectFormat(in);
+    if (inputFormat != FORMAT_BINARY) {
+        Result<void> res = Parse(inputFormat, in, out);
+        if (!res) {
+            return std::unexpected(res.error());
+        }
+
+        data = out;
+    }
+
+    // Version 0 tags are left as they are
+    if (layout == LAYOUT_AMIITOOL) {
+        if (Result<std::vector<std::byte>> res = TagV2::FromInternalLayout(data)) {
+            out = std::move(*res);
+            data = out;
+        }
+    }
+
+    return data;
+}
+
+void dump::Export(Format format, Layout layout, std::vector<std::byte>& data)
+{
+    if (layout == LAYOUT_AMIITOOL) {
+        if (Result<std::vector<std::byte>> res = TagV2::ToInternalLayout(data)) {
+            data = std::move(*res);
+        }
+    }
+
+    if (format != FORMAT_BINARY) {
+        data = Write(format, data);
+    }
+}
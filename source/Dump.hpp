@@ -0,0 +1,59 @@
+#pragma once
+
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "Error.hpp"
+
+// Dump formats and layouts of other NFC tools, converted straight from and to the raw page layout Tag::FromBytes expects
+// Every format lists the 4 byte pages of the tag, page n ends up at offset n * 4, so an NTAG215 dump of 135 pages gives
+// the 540 byte layout and a dump without the two configuration pages the 532 byte one.
+namespace dump {
+
+enum Format {
+    // Raw pages, nothing to convert
+    FORMAT_BINARY,
+    // Flipper Zero .nfc files
+    FORMAT_FLIPPER,
+    // Proxmark3 JSON dumps of hf mfu dump
+    FORMAT_PROXMARK,
+    // Hex digits, any whitespace between them is ignored and lines starting with # are comments
+    FORMAT_HEX,
+};
+
+// Order of the bytes of version 2 tags, version 0 tags only have the tag layout
+enum Layout {
+    // The layout of the tag memory
+    LAYOUT_TAG,
+    // The internal layout amiitool and 3DS tools store decrypted tags in, see TagV2::ToInternalLayout
+    LAYOUT_AMIITOOL,
+};
+
+// Returns the format for its name on the command line: binary, flipper, proxmark or hex
+std::optional<Format> GetFormat(const std::string& name);
+// Returns the layout for its name on the command line: tag or amiitool
+std::optional<Layout> GetLayout(const std::string& name);
+
+// Guesses the format from the size and the first bytes of the data, without parsing it
+// Data of the size of a raw tag is binary unless it starts with printable text.
+Format DetectFormat(const std::span<const std::byte>& data);
+
+// Converts a dump to raw pages in a single pass, out receives the pages
+// Errors have the offset into the dump at which parsing failed.
+Result<void> Parse(Format format, const std::span<const std::byte>& data, std::vector<std::byte>& out);
+
+// Converts raw pages to a dump, an incomplete last page is padded with zeros
+// Flipper and Proxmark dumps are written as NTAG215, or NTAG216 if there are more pages, with the UID taken from the pages.
+// The signature, version and counters aren't part of the pages and are written with their defaults.
+std::vector<std::byte> Write(Format format, const std::span<const std::byte>& data);
+
+// Converts a tag in the format, detected if empty, and layout to raw tag data in the tag layout
+// Returns in itself if there is nothing to convert, otherwise the converted tag, which is stored in out.
+// Only data of the size of a version 2 tag is converted from the amiitool layout.
+Result<std::span<const std::byte>> Import(const std::optional<Format>& format, Layout layout, const std::span<const std::byte>& in, std::vector<std::byte>& out);
+// Converts raw tag data in the tag layout to the layout and format in place
+void Export(Format format, Layout layout, std::vector<std::byte>& data);
+
+} // namespace dump
@@ -0,0 +1,369 @@
+#include "Edit.hpp"
+#include "Diff.hpp"
+#include "Tag.hpp"
+#include "TagV0.hpp"
+#include "TagV2.hpp"
+#include "crypto.hpp"
+#include "io.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+
+namespace {
+
+// Integers larger than this don't fit the value the increment is applied to
+constexpr std::uint32_t kMaxIncrementSize = 8u;
+constexpr std::uint32_t kWriteCounterSize = 2u;
+
+// An edit as written in the script, before it is resolved to the offsets of a tag version
+struct Edit {
+    edit::Patch::Type type;
+    std::string field;
+    std::uint32_t offset;
+    std::optional<std::uint32_t> size;
+    std::vector<std::byte> bytes;
+    std::uint64_t amount;
+    // Byte offset of the line in the script, used for reporting errors
+    std::size_t lineOffset;
+};
+
+struct Region {
+    std::uint32_t offset;
+    std::uint32_t size;
+};
+
+bool Overlaps(const edit::Patch& patch, const Region& region)
+{
+    return patch.offset < region.offset + region.size && region.offset < patch.offset + patch.size;
+}
+
+std::optional<std::uint64_t> ParseNumber(const std::string& str)
+{
+    try {
+        std::size_t end;
+        const std::uint64_t value = std::stoull(str, &end, 0);
+        if (end != str.size()) {
+            return {};
+        }
+
+        return value;
+    } catch (...) {
+        return {};
+    }
+}
+
+std::optional<std::vector<std::byte>> ParseBytes(const std::string& str)
+{
+    if (str.empty() || str.size() % 2 != 0) {
+        return {};
+    }
+
+    std::vector<std::byte> bytes;
+    for (std::size_t i = 0; i < str.size(); i += 2) {
+        if (!std::isxdigit(static_cast<unsigned char>(str[i])) || !std::isxdigit(static_cast<unsigned char>(str[i + 1]))) {
+            return {};
+        }
+
+        bytes.push_back(std::byte(std::stoul(str.substr(i, 2), nullptr, 16)));
+    }
+
+    return bytes;
+}
+
+// Field names in scripts are the names reported by diff in lower case with underscores
+std::string ToIdentifier(const std::string& name)
+{
+    std::string identifier = name;
+    std::transform(identifier.begin(), identifier.end(), identifier.begin(), [](unsigned char c) {
+        return c == ' ' ? '_' : std::tolower(c);
+    });
+
+    return identifier;
+}
+
+std::optional<Region> FindField(const Tag& tag, const std::string& name)
+{
+    if (name == "data") {
+        return Region{ 0, tag.GetDataSize() };
+    }
+
+    for (const std::vector<diff::Field>* fields : { &diff::GetFields(tag.GetVersion()), &diff::GetSubFields(tag.GetVersion()) }) {
+        for (const diff::Field& field : *fields) {
+            if (ToIdentifier(field.name) == name) {
+                return Region{ field.offset, field.size };
+            }
+        }
+    }
+
+    return {};
+}
+
+Result<Edit> ParseLine(const std::string_view& line, std::size_t lineOffset)
+{
+    std::istringstream stream{ std::string(line) };
+    std::vector<std::string> tokens;
+    for (std::string token; stream >> token;) {
+        if (token[0] == '#') {
+            break;
+        }
+
+        tokens.push_back(token);
+    }
+
+    const Error invalid(Error::EDIT_INVALID_LINE, lineOffset);
+    if (tokens.size() < 3) {
+        return std::unexpected(invalid);
+    }
+
+    Edit edit{};
+    edit.lineOffset = lineOffset;
+
+    // The target is the field name, optionally followed by +offset
+    const std::size_t plus = tokens[1].find('+');
+    edit.field = tokens[1].substr(0, plus);
+    if (plus != std::string::npos) {
+        std::optional<std::uint64_t> offset = ParseNumber(tokens[1].substr(plus + 1));
+        if (!offset || *offset > UINT32_MAX) {
+            return std::unexpected(invalid);
+        }
+
+        edit.offset = *offset;
+    }
+
+    std::optional<std::uint64_t> size;
+    if (tokens.size() > 4) {
+        return std::unexpected(invalid);
+    } else if (tokens.size() == 4) {
+        size = ParseNumber(tokens[3]);
+        if (!size || *size > UINT32_MAX) {
+            return std::unexpected(invalid);
+        }
+
+        edit.size = *size;
+    }
+
+    if (tokens[0] == "set" && tokens.size() == 3) {
+        std::optional<std::vector<std::byte>> bytes = ParseBytes(tokens[2]);
+        if (!bytes) {
+            return std::unexpected(invalid);
+        }
+
+        edit.type = edit::Patch::PATCH_SET;
+        edit.bytes = std::move(*bytes);
+        edit.size = edit.bytes.size();
+    } else if (tokens[0] == "fill") {
+        std::optional<std::vector<std::byte>> bytes = ParseBytes(tokens[2]);
+        if (!bytes || bytes->size() != 1) {
+            return std::unexpected(invalid);
+        }
+
+        edit.type = edit::Patch::PATCH_FILL;
+        edit.bytes = std::move(*bytes);
+    } else if (tokens[0] == "increment") {
+        std::optional<std::uint64_t> amount = ParseNumber(tokens[2]);
+        if (!amount) {
+            return std::unexpected(invalid);
+        }
+
+        edit.type = edit::Patch::PATCH_INCREMENT;
+        edit.amount = *amount;
+    } else {
+        return std::unexpected(invalid);
+    }
+
+    return edit;
+}
+
+// Resolves the edits to the offsets of the template tag's version and works out which keys and HMACs are affected
+Result<edit::Plan> Compile(const std::vector<Edit>& edits, const Tag& tag)
+{
+    edit::Plan plan{};
+    for (const Edit& edit : edits) {
+        std::optional<Region> field = FindField(tag, edit.field);
+        if (!field) {
+            return std::unexpected(Error(Error::EDIT_UNKNOWN_FIELD, edit.lineOffset));
+        }
+
+        // Without an explicit size fill and increment use the rest of the field
+        const std::uint32_t size = edit.size.value_or(field->size > edit.offset ? field->size - edit.offset : 0);
+        if (size == 0 || edit.offset >= field->size || size > field->size - edit.offset) {
+            return std::unexpected(Error(Error::EDIT_OUT_OF_RANGE, edit.lineOffset));
+        }
+
+        if (edit.type == edit::Patch::PATCH_INCREMENT && size > kMaxIncrementSize) {
+            return std::unexpected(Error(Error::EDIT_OUT_OF_RANGE, edit.lineOffset));
+        }
+
+        plan.patches.push_back(edit::Patch{ edit.type, field->offset + edit.offset, size, edit.bytes, edit.amount });
+    }
+
+    // All keys are derived from the UID (or format info) and the key gen salt, only the unfixed infos keys from the write counter
+    const Region writeCounter{ tag.GetSeedOffset(), kWriteCounterSize };
+    const Region keyInputs[] = {
+        *FindField(tag, tag.GetVersion() == 0 ? "format_info" : "uid"),
+        { tag.GetKeyGenSaltOffset(), 0x20 },
+    };
+
+    // Both HMACs cover all data following them, the unfixed infos HMAC also covers the locked secret HMAC
+    const std::uint32_t unfixedInfosHmacEnd = tag.GetUnfixedInfosHmacOffset() + (tag.GetVersion() == 0 ? 0x20 : 0x21);
+    const std::uint32_t lockedSecretHmacEnd = tag.GetLockedSecretHmacOffset() + 0x20;
+    const Region unfixedInfosHmacData{ unfixedInfosHmacEnd, tag.GetDataSize() - unfixedInfosHmacEnd };
+    const Region lockedSecretHmacData{ lockedSecretHmacEnd, tag.GetDataSize() - lockedSecretHmacEnd };
+
+    bool changesAllKeys = false;
+    for (const edit::Patch& patch : plan.patches) {
+        changesAllKeys |= std::any_of(std::begin(keyInputs), std::end(keyInputs), [&patch](const Region& region) { return Overlaps(patch, region); });
+        plan.deriveKeys |= Overlaps(patch, writeCounter);
+        plan.updateLockedSecretHmac |= Overlaps(patch, lockedSecretHmacData);
+        plan.updateUnfixedInfosHmac |= Overlaps(patch, unfixedInfosHmacData);
+    }
+
+    // New keys mean new HMAC keys as well
+    plan.deriveKeys |= changesAllKeys;
+    plan.updateLockedSecretHmac |= changesAllKeys;
+    plan.updateUnfixedInfosHmac |= plan.deriveKeys || plan.updateLockedSecretHmac;
+    return plan;
+}
+
+} // namespace
+
+edit::Script::Script()
+{
+}
+
+edit::Script::~Script()
+{
+}
+
+Result<std::shared_ptr<const edit::Script>> edit::Script::FromText(const std::string_view& text)
+{
+    std::vector<Edit> edits;
+
+    std::size_t offset = 0;
+    while (offset < text.size()) {
+        std::size_t end = text.find('\n', offset);
+        if (end == std::string_view::npos) {
+            end = text.size();
+        }
+
+        const std::size_t lineOffset = offset;
+        const std::string_view line = text.substr(offset, end - offset);
+        offset = end + 1;
+
+        const std::size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string_view::npos || line[first] == '#') {
+            continue;
+        }
+
+        Result<Edit> edit = ParseLine(line, lineOffset);
+        if (!edit) {
+            return std::unexpected(edit.error());
+        }
+
+        edits.push_back(std::move(*edit));
+    }
+
+    if (edits.empty()) {
+        return std::unexpected(Error(Error::EDIT_NO_EDITS));
+    }
+
+    // The fields have different offsets and sizes in every version, so the script is compiled for each of them
+    std::shared_ptr<Script> script = std::make_shared<Script>();
+    const TagV0 tagV0;
+    const TagV2 tagV2;
+    std::optional<Error> error;
+    for (const Tag* tag : { static_cast<const Tag*>(&tagV0), static_cast<const Tag*>(&tagV2) }) {
+        Result<Plan> plan = Compile(edits, *tag);
+        if (plan) {
+            script->mPlans[tag->GetVersion()] = std::move(*plan);
+        } else if (!error) {
+            error = plan.error();
+        }
+    }
+
+    // Scripts which only fit some versions are fine, tags of the other versions fail when applying
+    if (!script->mPlans[0] && !script->mPlans[2]) {
+        return std::unexpected(*error);
+    }
+
+    return script;
+}
+
+Result<std::shared_ptr<const edit::Script>> edit::Script::FromFile(const std::filesystem::path& path)
+{
+    std::optional<std::vector<std::byte>> data = io::ReadBinaryFile(path.string());
+    if (!data) {
+        return std::unexpected(Error(Error::EDIT_READ_FAILED));
+    }
+
+    return FromText(std::string_view(reinterpret_cast<const char*>(data->data()), data->size()));
+}
+
+const edit::Plan* edit::Script::GetPlan(std::uint32_t version) const
+{
+    if (version >= mPlans.size() || !mPlans[version]) {
+        return nullptr;
+    }
+
+    return &*mPlans[version];
+}
+
+std::array<std::byte, 0x20> edit::Script::GetFingerprint() const
+{
+    std::vector<std::byte> data;
+    const auto appendNumber = [&data](std::uint64_t value) {
+        for (int i = 0; i < 8; i++) {
+            data.push_back(std::byte(value >> (i * 8)));
+        }
+    };
+
+    for (std::uint32_t version = 0; version < mPlans.size(); version++) {
+        if (!mPlans[version]) {
+            continue;
+        }
+
+        appendNumber(version);
+        for (const Patch& patch : mPlans[version]->patches) {
+            appendNumber(patch.type);
+            appendNumber(patch.offset);
+            appendNumber(patch.size);
+            appendNumber(patch.amount);
+            appendNumber(patch.bytes.size());
+            data.insert(data.end(), patch.bytes.begin(), patch.bytes.end());
+        }
+    }
+
+    std::array<std::byte, 0x20> fingerprint;
+    crypto::GenerateSHA256(data, fingerprint);
+    return fingerprint;
+}
+
+void edit::Apply(const Plan& plan, Tag& tag)
+{
+    for (const Patch& patch : plan.patches) {
+        std::span<std::byte> data = tag.GetData(patch.offset, patch.size);
+        switch (patch.type) {
+            case Patch::PATCH_SET:
+                std::copy(patch.bytes.begin(), patch.bytes.end(), data.begin());
+                break;
+            case Patch::PATCH_FILL:
+                std::fill(data.begin(), data.end(), patch.bytes[0]);
+                break;
+            case Patch::PATCH_INCREMENT: {
+                // Big endian, overflows wrap around within the size of the field
+                std::uint64_t value = 0;
+                for (std::byte b : data) {
+                    value = (value << 8) | std::to_integer<std::uint64_t>(b);
+                }
+
+                value += patch.amount;
+                for (std::size_t i = data.size(); i > 0; i--) {
+                    data[i - 1] = std::byte(value & 0xff);
+                    value >>= 8;
+                }
+                break;
+            }
+        }
+    }
+}
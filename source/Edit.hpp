@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Error.hpp"
+
+class Tag;
+
+// Edit scripts describe changes which are applied to many decrypted tags at once
+// Every line holds one edit of a field, optionally at an offset into the field, lines starting with # are comments:
+//
+//   set unfixed_infos+0x4 00          # Write the bytes (hex) to the field
+//   fill unfixed_infos+0xdc 00        # Fill the rest of the field with the byte, an explicit size can follow
+//   increment write_counter 1         # Add to the big endian number in the rest of the field, an explicit size can follow
+//
+// The fields are the ones reported by diff, in lower case with underscores, plus write_counter and data (the whole tag).
+namespace edit {
+
+struct Patch {
+    enum Type {
+        PATCH_SET,
+        PATCH_FILL,
+        PATCH_INCREMENT,
+    };
+
+    Type type;
+    // Range of the tag data which is changed
+    std::uint32_t offset;
+    std::uint32_t size;
+    // Bytes for PATCH_SET, the fill byte for PATCH_FILL
+    std::vector<std::byte> bytes;
+    // Only used for PATCH_INCREMENT
+    std::uint64_t amount;
+};
+
+// A script resolved to the offsets of one tag version, together with the work needed to sign the tag again
+struct Plan {
+    std::vector<Patch> patches;
+    // The patches change data the keys are derived from (write counter, UID or key gen salt)
+    bool deriveKeys;
+    // Only the HMACs covering changed data are recomputed
+    bool updateLockedSecretHmac;
+    bool updateUnfixedInfosHmac;
+};
+
+// A parsed edit script with a plan for every tag version the script can be applied to
+// Scripts are immutable once created, so a single instance can be shared between threads.
+class Script {
+public:
+    Script();
+    virtual ~Script();
+
+    static Result<std::shared_ptr<const Script>> FromText(const std::string_view& text);
+    static Result<std::shared_ptr<const Script>> FromFile(const std::filesystem::path& path);
+
+    // Returns the plan for the tag version, null if the script doesn't fit tags of this version
+    const Plan* GetPlan(std::uint32_t version) const;
+
+    // Hash of the plans, scripts which only differ in comments or formatting have the same fingerprint
+    std::array<std::byte, 0x20> GetFingerprint() const;
+
+private:
+    // Indexed by tag version
+    std::array<std::optional<Plan>, 3> mPlans;
+};
+
+// Applies the patches of the plan to a decrypted tag, signing and encrypting is left to the caller
+void Apply(const Plan& plan, Tag& tag);
+
+} // namespace edit
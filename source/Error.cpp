@@ -0,0 +1,90 @@
+#include "Error.hpp"
+
+Error::Error(Code code, std::size_t offset)
+ : mCode(code), mOffset(offset)
+{
+}
+
+Error::Code Error::GetCode() const
+{
+    return mCode;
+}
+
+std::size_t Error::GetOffset() const
+{
+    return mOffset;
+}
+
+const char* Error::GetDescription() const
+{
+    switch (mCode) {
+        case TAG_UNSUPPORTED_VERSION:       return "Unsupported tag version";
+        case TAG_UNKNOWN_VERSION:           return "Could not detect the tag version";
+        case TAG_ROUND_TRIP_MISMATCH:       return "Round trip output differs from the input";
+        case TAG_V0_INVALID_SIZE:           return "Version 0 tags should be 512 bytes in size";
+        case TAG_V0_INVALID_LOCKED_AREA:    return "Failed to parse locked area";
+        case TAG_V0_INVALID_DATA_AREA:      return "Failed to parse data area";
+        case TAG_V0_CC_INVALID_MAGIC:       return "CC: Invalid NDEF Magic Number";
+        case TAG_V0_CC_INVALID_VERSION:     return "CC: Invalid Version Number";
+        case TAG_V0_CC_INCOMPLETE_SIZE:     return "CC: Incomplete tag memory size";
+        case TAG_V0_NO_TLVS:                return "Tag contains no TLVs";
+        case TAG_V0_NO_NDEF_TLV:            return "Tag contains no NDEF TLV";
+        case TAG_V0_NO_NDEF_PAYLOAD:        return "Tag doesn't contain NDEF payload";
+        case TAG_V0_NO_NOFT_MAGIC:          return "Tag doesn't contain NOFT magic";
+        case TAG_V2_INVALID_SIZE:           return "Version 2 tags should be at either 532 or 540 bytes in size";
+        case TAG_V2_NO_MAGIC:               return "Version 2 tag doesn't contain tag magic. Not a valid tag?";
+        case TLV_READ_PAST_END:             return "TLV parsing read past end of stream";
+        case NDEF_RECORD_READ_PAST_END:     return "NDEF record parsing read past end of stream";
+        case NDEF_RECORD_PAYLOAD_TOO_LARGE: return "NDEF record payload too large";
+        case NDEF_NO_RECORDS:               return "NDEF message contains no records";
+        case NDEF_MISSING_END_RECORD:       return "NDEF message missing end record";
+        case KEYS_XOR_PAD_MISMATCH:         return "Locked Secret XOR padding does not match Unfixed Info XOR padding";
+        case KEYS_READ_FAILED:              return "Failed to read key file";
+        case KEYS_INVALID_SIZE:             return "Key file has an invalid size";
+        case KEYS_DUPLICATE:                return "Keyset was already loaded";
+        case KEYS_INVALID_NFC_KEY:          return "nfc_key and nfc_nonce need to be 32 hex digits each";
+        case KEYS_NFC_KEY_MISMATCH:         return "NFC key and nonce don't produce the XOR padding of the keyset";
+        case KEYS_HMAC_SETUP_FAILED:        return "Failed to precompute the HMAC key states";
+        case CONFIG_READ_FAILED:            return "Failed to read configuration";
+        case CONFIG_INVALID_LINE:           return "Expected a [keyset] section or a key = value pair";
+        case CONFIG_MISSING_KEYS:           return "Keyset needs either key_file or unfixed_info and locked_secret";
+        case CONFIG_NO_KEYSETS:             return "Configuration contains no keysets";
+        case EDIT_READ_FAILED:              return "Failed to read edit script";
+        case EDIT_INVALID_LINE:             return "Expected set, fill or increment followed by a field and its arguments";
+        case EDIT_UNKNOWN_FIELD:            return "Unknown field";
+        case EDIT_OUT_OF_RANGE:             return "Edit exceeds the field";
+        case EDIT_NO_EDITS:                 return "Edit script contains no edits";
+        case SERVER_NOT_SUPPORTED:          return "Unix domain sockets are not supported on this platform";
+        case SERVER_SOCKET_FAILED:          return "Failed to create, bind or listen on the socket";
+        case SERVER_SOCKET_IN_USE:          return "Another server is already listening on the socket";
+        case RECORD_TRUNCATED:              return "Stream ends in the middle of a record";
+        case RECORD_TOO_LARGE:              return "Record is larger than any tag";
+        case WATCH_NOT_SUPPORTED:           return "Watching directories is not supported on this platform";
+        case WATCH_FAILED:                  return "Failed to watch the directory";
+        case WATCH_OUTPUT_INSIDE_INPUT:     return "Output directory is inside of the watched directory";
+        case MANIFEST_OPEN_FAILED:          return "Failed to open the manifest";
+        case MANIFEST_WRITE_FAILED:         return "Failed to write the manifest";
+        case CACHE_OPEN_FAILED:             return "Failed to create the cache directory";
+        case ARCHIVE_READ_FAILED:           return "Failed to read the archive";
+        case ARCHIVE_INVALID:               return "Archive is corrupted";
+        case ARCHIVE_UNSUPPORTED:           return "Archive uses an unsupported compression method, encryption or zip64";
+        case ARCHIVE_UNSAFE_PATH:           return "Archive entry path is absolute or leaves the archive";
+        case ARCHIVE_ENTRY_TOO_LARGE:       return "Archive entry is larger than any tag";
+        case ARCHIVE_CRC_MISMATCH:          return "Archive entry CRC mismatch";
+        case ARCHIVE_WRITE_FAILED:          return "Failed to write the archive";
+        case DUMP_INVALID_HEX:              return "Dump contains an invalid hex digit";
+        case DUMP_INVALID_JSON:             return "Dump is not valid JSON";
+        case DUMP_INVALID_PAGE:             return "Dump page number is invalid, out of range or listed twice";
+        case DUMP_INVALID_PAGE_SIZE:        return "Dump page is not 4 bytes in size";
+        case DUMP_MISSING_PAGE:             return "Dump is missing pages";
+        case DUMP_NO_PAGES:                 return "Dump contains no pages";
+        case STORE_DECOMPRESS_FAILED:       return "Failed to decompress a block of the tag store";
+    }
+
+    return "Unknown error";
+}
+
+Error Error::WithOffset(std::size_t offset) const
+{
+    return Error(mCode, offset);
+}
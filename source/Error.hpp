@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <expected>
+
+// Describes why parsing or loading failed, rendering is left to the caller
+class Error {
+public:
+    enum Code {
+        TAG_UNSUPPORTED_VERSION,
+        TAG_UNKNOWN_VERSION,
+        TAG_ROUND_TRIP_MISMATCH,
+
+        // Version 0 tags
+        TAG_V0_INVALID_SIZE,
+        TAG_V0_INVALID_LOCKED_AREA,
+        TAG_V0_INVALID_DATA_AREA,
+        TAG_V0_CC_INVALID_MAGIC,
+        TAG_V0_CC_INVALID_VERSION,
+        TAG_V0_CC_INCOMPLETE_SIZE,
+        TAG_V0_NO_TLVS,
+        TAG_V0_NO_NDEF_TLV,
+        TAG_V0_NO_NDEF_PAYLOAD,
+        TAG_V0_NO_NOFT_MAGIC,
+
+        // Version 2 tags
+        TAG_V2_INVALID_SIZE,
+        TAG_V2_NO_MAGIC,
+
+        // TLVs
+        TLV_READ_PAST_END,
+
+        // NDEF
+        NDEF_RECORD_READ_PAST_END,
+        NDEF_RECORD_PAYLOAD_TOO_LARGE,
+        NDEF_NO_RECORDS,
+        NDEF_MISSING_END_RECORD,
+
+        // Keys
+        KEYS_XOR_PAD_MISMATCH,
+        KEYS_READ_FAILED,
+        KEYS_INVALID_SIZE,
+        KEYS_DUPLICATE,
+        KEYS_INVALID_NFC_KEY,
+        KEYS_NFC_KEY_MISMATCH,
+        KEYS_HMAC_SETUP_FAILED,
+
+        // Configuration
+        CONFIG_READ_FAILED,
+        CONFIG_INVALID_LINE,
+        CONFIG_MISSING_KEYS,
+        CONFIG_NO_KEYSETS,
+
+        // Edit scripts
+        EDIT_READ_FAILED,
+        EDIT_INVALID_LINE,
+        EDIT_UNKNOWN_FIELD,
+        EDIT_OUT_OF_RANGE,
+        EDIT_NO_EDITS,
+
+        // Server
+        SERVER_NOT_SUPPORTED,
+        SERVER_SOCKET_FAILED,
+        SERVER_SOCKET_IN_USE,
+
+        // Record streams
+        RECORD_TRUNCATED,
+        RECORD_TOO_LARGE,
+
+        // Watch
+        WATCH_NOT_SUPPORTED,
+        WATCH_FAILED,
+        WATCH_OUTPUT_INSIDE_INPUT,
+
+        // Manifest
+        MANIFEST_OPEN_FAILED,
+        MANIFEST_WRITE_FAILED,
+
+        // Cache
+        CACHE_OPEN_FAILED,
+
+        // Archives
+        ARCHIVE_READ_FAILED,
+        ARCHIVE_INVALID,
+        ARCHIVE_UNSUPPORTED,
+        ARCHIVE_UNSAFE_PATH,
+        ARCHIVE_ENTRY_TOO_LARGE,
+        ARCHIVE_CRC_MISMATCH,
+        ARCHIVE_WRITE_FAILED,
+
+        // Dumps
+        DUMP_INVALID_HEX,
+        DUMP_INVALID_JSON,
+        DUMP_INVALID_PAGE,
+        DUMP_INVALID_PAGE_SIZE,
+        DUMP_MISSING_PAGE,
+        DUMP_NO_PAGES,
+
+        // Tag stores
+        STORE_DECOMPRESS_FAILED,
+    };
+
+public:
+    Error(Code code, std::size_t offset = 0);
+
+    Code GetCode() const;
+    // Byte offset into the parsed data where the error was detected
+    std::size_t GetOffset() const;
+    const char* GetDescription() const;
+
+    Error WithOffset(std::size_t offset) const;
+
+private:
+    Code mCode;
+    std::size_t mOffset;
+};
+
+template<typename T>
+using Result = std::expected<T, Error>;
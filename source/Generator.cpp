@@ -0,0 +1,175 @@
+#include "Generator.hpp"
+#include "Tag.hpp"
+#include "TLV.hpp"
+#include "ndef.hpp"
+#include "Keys.hpp"
+#include "TagEncryption.hpp"
+#include "stream.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr std::size_t kBlockSize = 8u;
+
+// Version 0 layout
+constexpr std::size_t kTagV0Size = 512u;
+constexpr std::size_t kTagV0PayloadSize = 0x148u;
+constexpr std::size_t kTagV0LockedSize = 0x80u;
+// The locked area is stored in the last 16 blocks of the tag
+constexpr std::uint8_t kTagV0FirstLockedBlock = 0x30;
+
+// Version 2 layout
+constexpr std::size_t kTagV2Size = 0x21cu;
+
+constexpr char kUnfixedInfosString[0xe] = "unfixed infos";
+constexpr char kLockedSecretString[0xe] = "locked secret";
+
+} // namespace
+
+Generator::Generator(std::uint64_t seed)
+ : mRng(seed)
+{
+}
+
+Generator::~Generator()
+{
+}
+
+std::array<std::byte, 160> Generator::GenerateKeyset()
+{
+    std::array<std::byte, 160> keyset{};
+    const std::span<std::byte, 80> unfixedInfo = std::span(keyset).subspan<0, 80>();
+    const std::span<std::byte, 80> lockedSecret = std::span(keyset).subspan<80, 80>();
+
+    // HMAC keys (only the first 0x10 bytes are used)
+    Fill(unfixedInfo.subspan(0, 0x10));
+    Fill(lockedSecret.subspan(0, 0x10));
+
+    // Strings
+    std::copy_n(std::as_bytes(std::span(kUnfixedInfosString)).begin(), 0xe, unfixedInfo.begin() + 0x10);
+    std::copy_n(std::as_bytes(std::span(kLockedSecretString)).begin(), 0xe, lockedSecret.begin() + 0x10);
+
+    // Magic bytes
+    Fill(unfixedInfo.subspan(0x20, 0xe));
+    Fill(lockedSecret.subspan(0x20, 0x10));
+
+    // XOR pad (needs to be the same for both halves)
+    Fill(unfixedInfo.subspan(0x30, 0x20));
+    std::copy_n(unfixedInfo.begin() + 0x30, 0x20, lockedSecret.begin() + 0x30);
+
+    return keyset;
+}
+
+std::optional<std::vector<std::byte>> Generator::GenerateTag(std::uint32_t version, const Keys& keys)
+{
+    // Create a decrypted tag with random contents
+    Result<std::shared_ptr<Tag>> res = Tag::FromBytes(version, version == 0 ? GenerateRawTagV0() : GenerateRawTagV2());
+    if (!res) {
+        return {};
+    }
+
+    std::shared_ptr<Tag> tag = *res;
+
+    tag->SetEncrypted(false);
+
+    // Sign and encrypt the tag with the specified keys
+    TagEncryption te(*tag, keys);
+    if (!te.InitializeInternalKeys()) {
+        return {};
+    }
+
+    if (!te.UpdateHMACs()) {
+        return {};
+    }
+
+    if (!te.EncryptTag()) {
+        return {};
+    }
+
+    return tag->ToBytes();
+}
+
+std::vector<std::byte> Generator::GenerateRawTagV0()
+{
+    // See <https://wiiubrew.org/wiki/Rumble_U_NFC_Figures> for the layout
+    std::vector<std::byte> bytes(kTagV0Size);
+
+    // 7-byte UID
+    std::array<std::byte, 7> uid;
+    Fill(uid);
+    std::copy(uid.begin(), uid.end(), bytes.begin());
+
+    // Lock bytes: block 0 and the reserved blocks 0xd - 0xf, as well as the locked area
+    bytes[0xe * kBlockSize + 0] = std::byte(0x01);
+    bytes[0xe * kBlockSize + 1] = std::byte(0xe0);
+    bytes[0xf * kBlockSize + 6] = std::byte(0xff);
+    bytes[0xf * kBlockSize + 7] = std::byte(0xff);
+
+    // NDEF payload
+    std::array<std::byte, kTagV0PayloadSize> payload;
+    Fill(payload);
+    std::copy_n("NOFT", 4, reinterpret_cast<char*>(payload.data()) + 0x20);
+
+    // Locked area
+    std::array<std::byte, kTagV0LockedSize> locked;
+    Fill(locked);
+    // Format Info starts with the UID followed by the format version
+    std::copy(uid.begin(), uid.end(), locked.begin() + 0x50);
+    locked[0x57] = std::byte(0);
+
+    ndef::Record record;
+    record.SetTNF(ndef::Record::NDEF_TNF_UNKNOWN);
+    record.SetPayload(payload);
+
+    // Capability container followed by the NDEF and terminator TLVs
+    std::vector<std::byte> dataArea;
+    VectorStream stream(dataArea, std::endian::big);
+    stream << std::uint8_t(0xe1) << std::uint8_t(0x10) << std::uint8_t(0x3f) << std::uint8_t(0x00);
+    stream.Write(TLV(TLV::TAG_NDEF, record.ToBytes(ndef::Record::NDEF_MB | ndef::Record::NDEF_ME)).ToBytes());
+    stream.Write(TLV(TLV::TAG_TERMINATOR, {}).ToBytes());
+
+    // Scatter the data area and locked area into the blocks
+    auto dataIterator = dataArea.begin();
+    for (std::uint8_t currentBlock = 1; currentBlock < kTagV0Size / kBlockSize && dataIterator < dataArea.end(); currentBlock++) {
+        if ((currentBlock >= 0xd && currentBlock <= 0xf) || currentBlock >= kTagV0FirstLockedBlock) {
+            continue;
+        }
+
+        const std::size_t count = std::min<std::size_t>(kBlockSize, dataArea.end() - dataIterator);
+        std::copy_n(dataIterator, count, bytes.begin() + currentBlock * kBlockSize);
+        dataIterator += count;
+    }
+    std::copy(locked.begin(), locked.end(), bytes.begin() + kTagV0FirstLockedBlock * kBlockSize);
+
+    return bytes;
+}
+
+std::vector<std::byte> Generator::GenerateRawTagV2()
+{
+    // See <https://www.3dbrew.org/wiki/Amiibo> for the layout
+    std::vector<std::byte> bytes(kTagV2Size);
+    Fill(bytes);
+
+    // 7-byte UID with BCC0 / BCC1
+    bytes[0] = std::byte(0x04);
+    bytes[3] = std::byte(0x88) ^ bytes[0] ^ bytes[1] ^ bytes[2];
+    bytes[8] = bytes[4] ^ bytes[5] ^ bytes[6] ^ bytes[7];
+    // Internal byte, static lock bytes and capability container
+    static constexpr std::uint8_t kHeader[] = { 0x48, 0x0f, 0xe0, 0xf1, 0x10, 0xff, 0xee, 0xa5 };
+    std::copy_n(std::as_bytes(std::span(kHeader)).begin(), sizeof(kHeader), bytes.begin() + 9);
+
+    // Dynamic lock bytes, CFG0, CFG1
+    static constexpr std::uint8_t kConfig[] = { 0x01, 0x00, 0x0f, 0xbd, 0x00, 0x00, 0x00, 0x04, 0x5f, 0x00, 0x00, 0x00 };
+    std::copy_n(std::as_bytes(std::span(kConfig)).begin(), sizeof(kConfig), bytes.begin() + 0x208);
+
+    return bytes;
+}
+
+void Generator::Fill(const std::span<std::byte>& data)
+{
+    for (std::byte& b : data) {
+        b = std::byte(mRng() & 0xff);
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <memory>
+#include <optional>
+#include <random>
+#include <span>
+#include <vector>
+
+class Keys;
+
+// Produces synthetic keysets and tags for testing without real retail keys
+class Generator {
+public:
+    Generator(std::uint64_t seed);
+    virtual ~Generator();
+
+    // Generates a self-consistent keyset in the format expected by Keys::FromKeyset
+    std::array<std::byte, 160> GenerateKeyset();
+
+    // Generates a valid tag of the specified version, encrypted with the specified keys
+    std::optional<std::vector<std::byte>> GenerateTag(std::uint32_t version, const Keys& keys);
+
+private:
+    std::vector<std::byte> GenerateRawTagV0();
+    std::vector<std::byte> GenerateRawTagV2();
+
+    void Fill(const std::span<std::byte>& data);
+
+    std::mt19937_64 mRng;
+};
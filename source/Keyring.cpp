@@ -0,0 +1,108 @@
+#include "Keyring.hpp"
+#include "Config.hpp"
+#include "Keys.hpp"
+#include "Tag.hpp"
+
+#include <algorithm>
+
+namespace {
+
+// The version 0 format info and the version 2 model info are never encrypted and are the same for every tag of a figure
+constexpr std::size_t kTagV0FormatInfoOffset = 8u;
+constexpr std::size_t kFigureInfoSize = 8u;
+
+} // namespace
+
+Keyring::Keyring()
+ : mHints()
+{
+}
+
+Keyring::~Keyring()
+{
+}
+
+Result<std::shared_ptr<Keyring>> Keyring::FromConfiguration(const std::filesystem::path& path)
+{
+    Result<std::vector<config::Section>> sections = config::Load(path);
+    if (!sections) {
+        return std::unexpected(sections.error());
+    }
+
+    if (sections->empty()) {
+        return std::unexpected(Error(Error::CONFIG_NO_KEYSETS));
+    }
+
+    std::shared_ptr<Keyring> keyring = std::make_shared<Keyring>();
+    for (const config::Section& section : *sections) {
+        Result<std::shared_ptr<const Keys>> keys = Keys::FromConfiguration(section, path.parent_path());
+        if (!keys) {
+            return std::unexpected(keys.error());
+        }
+
+        // The same keyset twice would only cost an additional HMAC check for every tag it doesn't match
+        if (!keyring->Add(section.name, *keys)) {
+            return std::unexpected(Error(Error::KEYS_DUPLICATE, section.offset));
+        }
+    }
+
+    return keyring;
+}
+
+bool Keyring::Add(const std::string& name, const std::shared_ptr<const Keys>& keys)
+{
+    const bool duplicate = std::any_of(mEntries.begin(), mEntries.end(), [&keys](const Entry& entry) {
+        return entry.keys->GetFingerprint() == keys->GetFingerprint();
+    });
+    if (duplicate) {
+        return false;
+    }
+
+    mEntries.push_back(Entry{ name, keys });
+    return true;
+}
+
+std::size_t Keyring::GetSize() const
+{
+    return mEntries.size();
+}
+
+const std::string& Keyring::GetName(std::size_t index) const
+{
+    return mEntries[index].name;
+}
+
+const std::shared_ptr<const Keys>& Keyring::GetKeys(std::size_t index) const
+{
+    return mEntries[index].keys;
+}
+
+std::size_t Keyring::GetHint(const Tag& tag) const
+{
+    // Slots store the index plus one, so zero means no keyset matched yet
+    const std::uint32_t hint = mHints[GetHintSlot(tag)].load(std::memory_order_relaxed);
+    if (hint == 0 || hint > mEntries.size()) {
+        return 0;
+    }
+
+    return hint - 1;
+}
+
+void Keyring::SetHint(const Tag& tag, std::size_t index)
+{
+    mHints[GetHintSlot(tag)].store(static_cast<std::uint32_t>(index + 1), std::memory_order_relaxed);
+}
+
+std::size_t Keyring::GetHintSlot(const Tag& tag)
+{
+    const std::size_t offset = tag.GetVersion() == 0 ? tag.GetUidOffset() + kTagV0FormatInfoOffset : tag.GetLockedSecretOffset();
+
+    // FNV-1a over the version and the figure info
+    std::uint32_t hash = 2166136261u;
+    hash = (hash ^ tag.GetVersion()) * 16777619u;
+    for (std::byte b : tag.GetData(offset, kFigureInfoSize)) {
+        hash = (hash ^ std::to_integer<std::uint32_t>(b)) * 16777619u;
+    }
+
+    return hash % kHintSlots;
+}
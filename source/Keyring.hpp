@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Error.hpp"
+
+class Keys;
+class Tag;
+
+// A set of keysets, tags are matched against all of them to find the one they were signed with
+// Keysets are only added before processing, afterwards a keyring can be shared between threads.
+// It remembers which keyset matched for similar tags, so mixed collections mostly only need a single HMAC check per tag.
+class Keyring {
+public:
+    Keyring();
+    virtual ~Keyring();
+
+    // Loads every keyset section of ntagtool.conf, key files are relative to the directory of the configuration
+    static Result<std::shared_ptr<Keyring>> FromConfiguration(const std::filesystem::path& path);
+
+    // Returns false if a keyset with the same fingerprint was already added
+    bool Add(const std::string& name, const std::shared_ptr<const Keys>& keys);
+
+    std::size_t GetSize() const;
+    const std::string& GetName(std::size_t index) const;
+    const std::shared_ptr<const Keys>& GetKeys(std::size_t index) const;
+
+    // Returns the keyset which last matched a tag similar to this one, 0 if there is none yet
+    std::size_t GetHint(const Tag& tag) const;
+    // Remembers that the keyset matched the tag, may be called from multiple threads at once
+    void SetHint(const Tag& tag, std::size_t index);
+
+private:
+    static std::size_t GetHintSlot(const Tag& tag);
+
+    struct Entry {
+        std::string name;
+        std::shared_ptr<const Keys> keys;
+    };
+
+    std::vector<Entry> mEntries;
+
+    // Lossy table of the last matching keyset, indexed by a hash of the plaintext data which identifies the figure
+    // Collisions only cost an additional HMAC check, so the slots are neither locked nor verified.
+    static constexpr std::size_t kHintSlots = 256;
+    std::array<std::atomic<std::uint32_t>, kHintSlots> mHints;
+};
@@ -1,10 +1,63 @@
 #include "Keys.hpp"
+#include "Config.hpp"
+#include "crypto.hpp"
+#include "io.hpp"
 
 #include <algorithm>
-#include <iostream>
+
+namespace {
+
+constexpr std::size_t kKeysetSize = 160u;
+constexpr std::size_t kBinSize = 80u;
+constexpr std::size_t kNfcKeySize = 0x10;
+
+// Reads a key file from the configuration, which needs to be exactly size bytes
+Result<std::vector<std::byte>> ReadKeyFile(const std::filesystem::path& path, std::size_t size, std::size_t offset)
+{
+    std::optional<std::vector<std::byte>> data = io::ReadBinaryFile(path.string());
+    if (!data) {
+        return std::unexpected(Error(Error::KEYS_READ_FAILED, offset));
+    }
+
+    if (data->size() != size) {
+        return std::unexpected(Error(Error::KEYS_INVALID_SIZE, offset));
+    }
+
+    return std::move(*data);
+}
+
+// Parses a value of exactly out.size() bytes written as hex digits
+bool ParseHex(const std::string& str, const std::span<std::byte>& out)
+{
+    if (str.size() != out.size() * 2) {
+        return false;
+    }
+
+    for (std::size_t i = 0; i < out.size(); i++) {
+        unsigned int value = 0;
+        for (char c : { str[i * 2], str[i * 2 + 1] }) {
+            value <<= 4;
+            if (c >= '0' && c <= '9') {
+                value |= c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                value |= c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                value |= c - 'A' + 10;
+            } else {
+                return false;
+            }
+        }
+
+        out[i] = std::byte(value);
+    }
+
+    return true;
+}
+
+} // namespace
 
 Keys::Keys()
- : mNfcKey()
+ : mFingerprint(), mNfcKey(), mNfcNonce()
 {
 }
 
@@ -12,18 +65,73 @@ Keys::~Keys()
 {
 }
 
-std::shared_ptr<Keys> Keys::FromConfiguration()
+Result<std::shared_ptr<const Keys>> Keys::FromConfiguration(const config::Section& section, const std::filesystem::path& baseDir)
 {
-    // TODO
-    return {};
+    // Errors are reported at the section, since the configuration doesn't keep the offsets of the values
+    std::vector<std::byte> keyset;
+    if (std::optional<std::string> keyFile = section.Get("key_file")) {
+        Result<std::vector<std::byte>> res = ReadKeyFile(baseDir / *keyFile, kKeysetSize, section.offset);
+        if (!res) {
+            return std::unexpected(res.error());
+        }
+
+        keyset = std::move(*res);
+    } else {
+        std::optional<std::string> unfixedInfoFile = section.Get("unfixed_info");
+        std::optional<std::string> lockedSecretFile = section.Get("locked_secret");
+        if (!unfixedInfoFile || !lockedSecretFile) {
+            return std::unexpected(Error(Error::CONFIG_MISSING_KEYS, section.offset));
+        }
+
+        Result<std::vector<std::byte>> unfixedInfo = ReadKeyFile(baseDir / *unfixedInfoFile, kBinSize, section.offset);
+        if (!unfixedInfo) {
+            return std::unexpected(unfixedInfo.error());
+        }
+
+        Result<std::vector<std::byte>> lockedSecret = ReadKeyFile(baseDir / *lockedSecretFile, kBinSize, section.offset);
+        if (!lockedSecret) {
+            return std::unexpected(lockedSecret.error());
+        }
+
+        keyset = std::move(*unfixedInfo);
+        keyset.insert(keyset.end(), lockedSecret->begin(), lockedSecret->end());
+    }
+
+    Result<std::shared_ptr<Keys>> keys = Create(std::span(keyset).subspan<0, kBinSize>(), std::span(keyset).subspan<kBinSize, kBinSize>());
+    if (!keys) {
+        return std::unexpected(keys.error().WithOffset(section.offset));
+    }
+
+    // The NFC key is optional, without it the key gen salt is derived with the XOR pad
+    std::optional<std::string> nfcKey = section.Get("nfc_key");
+    std::optional<std::string> nfcNonce = section.Get("nfc_nonce");
+    if (nfcKey || nfcNonce) {
+        std::array<std::byte, kNfcKeySize> key;
+        std::array<std::byte, kNfcKeySize> nonce;
+        if (!nfcKey || !nfcNonce || !ParseHex(*nfcKey, key) || !ParseHex(*nfcNonce, nonce)) {
+            return std::unexpected(Error(Error::KEYS_INVALID_NFC_KEY, section.offset));
+        }
+
+        Result<void> res = (*keys)->SetNfcKey(key, nonce);
+        if (!res) {
+            return std::unexpected(res.error().WithOffset(section.offset));
+        }
+    }
+
+    return std::move(*keys);
 }
 
-std::shared_ptr<Keys> Keys::FromKeyset(const std::span<const std::byte, 160>& keyset)
+Result<std::shared_ptr<const Keys>> Keys::FromKeyset(const std::span<const std::byte, 160>& keyset)
 {
     return FromBins(keyset.subspan<0, 80>(), keyset.subspan<80, 80>());
 }
 
-std::shared_ptr<Keys> Keys::FromBins(const std::span<const std::byte, 80>& unfixedInfo, const std::span<const std::byte, 80>& lockedSecret)
+Result<std::shared_ptr<const Keys>> Keys::FromBins(const std::span<const std::byte, 80>& unfixedInfo, const std::span<const std::byte, 80>& lockedSecret)
+{
+    return Create(unfixedInfo, lockedSecret);
+}
+
+Result<std::shared_ptr<Keys>> Keys::Create(const std::span<const std::byte, 80>& unfixedInfo, const std::span<const std::byte, 80>& lockedSecret)
 {
     std::shared_ptr<Keys> keys = std::make_shared<Keys>();
 
@@ -46,16 +154,50 @@ std::shared_ptr<Keys> Keys::FromBins(const std::span<const std::byte, 80>& unfix
     std::copy_n(lockedSecret.begin() + 0x20, 0x10, keys->mLockedSecretMagicBytes.begin());
     // XOR pad (this should be the same as the unfixedInfo one)
     if (!std::equal(keys->mNfcXorPad.begin(), keys->mNfcXorPad.end(), lockedSecret.begin() + 0x30)) {
-        std::cerr << "Error: Locked Secret XOR padding does not match Unfixed Info XOR padding" << std::endl;
-        return {};
+        return std::unexpected(Error(Error::KEYS_XOR_PAD_MISMATCH, 0x30));
+    }
+
+    // Hash the padded HMAC keys once, key derivation only continues from the precomputed states
+    if (!keys->mUnfixedInfosHmac.SetKey(keys->mUnfixedInfosHmacKey) || !keys->mLockedSecretHmac.SetKey(keys->mLockedSecretHmacKey)) {
+        return std::unexpected(Error(Error::KEYS_HMAC_SETUP_FAILED));
     }
 
+    // Fingerprint the keyset in the key-retail.bin layout, so it is the same no matter how the keys were loaded
+    std::array<std::byte, kKeysetSize> keyset;
+    std::copy(unfixedInfo.begin(), unfixedInfo.end(), keyset.begin());
+    std::copy(lockedSecret.begin(), lockedSecret.end(), keyset.begin() + kBinSize);
+    crypto::GenerateSHA256(keyset, keys->mFingerprint);
+
     return keys;
 }
 
+const std::array<std::byte, 0x20>& Keys::GetFingerprint() const
+{
+    return mFingerprint;
+}
+
+Result<void> Keys::SetNfcKey(const std::span<const std::byte, 0x10>& key, const std::span<const std::byte, 0x10>& nonce)
+{
+    // The XOR pad is the key stream of the NFC key, so crypting zeros has to produce it
+    std::array<std::byte, 0x20> zeros{};
+    std::array<std::byte, 0x20> keyStream;
+    if (!crypto::CryptAesCTR(key, nonce, zeros, keyStream) || keyStream != mNfcXorPad) {
+        return std::unexpected(Error(Error::KEYS_NFC_KEY_MISMATCH));
+    }
+
+    // Expand the key schedule once, every tag uses it to derive its key gen salt
+    if (!mNfcAesKey.SetKey(key)) {
+        return std::unexpected(Error(Error::KEYS_INVALID_NFC_KEY));
+    }
+
+    std::copy(key.begin(), key.end(), mNfcKey.begin());
+    std::copy(nonce.begin(), nonce.end(), mNfcNonce.begin());
+    return {};
+}
+
 bool Keys::HasNfcKey() const
 {
-    return mNfcKey[0] != std::byte(0);
+    return mNfcAesKey.IsSet();
 }
 
 const std::array<std::byte, 0x10>& Keys::GetNfcKey() const
@@ -63,6 +205,11 @@ const std::array<std::byte, 0x10>& Keys::GetNfcKey() const
     return mNfcKey;
 }
 
+const crypto::AesKey& Keys::GetNfcAesKey() const
+{
+    return mNfcAesKey;
+}
+
 const std::array<std::byte, 0x10>& Keys::GetNfcNonce() const
 {
     return mNfcNonce;
@@ -88,6 +235,11 @@ const std::array<std::byte, 0x40>& Keys::GetUnfixedInfosHmacKey() const
     return mUnfixedInfosHmacKey;
 }
 
+const crypto::HmacKey& Keys::GetUnfixedInfosHmac() const
+{
+    return mUnfixedInfosHmac;
+}
+
 const std::array<std::byte, 0xe>& Keys::GetLockedSecretString() const
 {
     return mLockedSecretString;
@@ -102,3 +254,8 @@ const std::array<std::byte, 0x40>& Keys::GetLockedSecretHmacKey() const
 {
     return mLockedSecretHmacKey;
 }
+
+const crypto::HmacKey& Keys::GetLockedSecretHmac() const
+{
+    return mLockedSecretHmac;
+}
@@ -1,44 +1,71 @@
 #pragma once
 
 #include <array>
+#include <filesystem>
 #include <memory>
 #include <span>
 
+#include "Error.hpp"
+#include "crypto.hpp"
+
+namespace config {
+struct Section;
+}
+
+// Keys are immutable once created, so a single instance can be shared between threads without synchronization
 class Keys {
 public:
     Keys();
     virtual ~Keys();
 
-    // ntagtool.conf
-    static std::shared_ptr<Keys> FromConfiguration();
+    // A keyset section of ntagtool.conf, relative key file paths are resolved against baseDir
+    static Result<std::shared_ptr<const Keys>> FromConfiguration(const config::Section& section, const std::filesystem::path& baseDir);
     // key-retail.bin
-    static std::shared_ptr<Keys> FromKeyset(const std::span<const std::byte, 160>& keyset);
+    static Result<std::shared_ptr<const Keys>> FromKeyset(const std::span<const std::byte, 160>& keyset);
     // locked-secret.bin, unfixed-info.bin
-    static std::shared_ptr<Keys> FromBins(const std::span<const std::byte, 80>& unfixedInfo, const std::span<const std::byte, 80>& lockedSecret);
+    static Result<std::shared_ptr<const Keys>> FromBins(const std::span<const std::byte, 80>& unfixedInfo, const std::span<const std::byte, 80>& lockedSecret);
+
+    // SHA-256 of the keyset, identifies the keys without exposing them
+    const std::array<std::byte, 0x20>& GetFingerprint() const;
 
     bool HasNfcKey() const;
     const std::array<std::byte, 0x10>& GetNfcKey() const;
+    // The NFC key with its expanded key schedule, only valid if HasNfcKey()
+    const crypto::AesKey& GetNfcAesKey() const;
     const std::array<std::byte, 0x10>& GetNfcNonce() const;
     const std::array<std::byte, 0x20>& GetNfcXorPad() const;
 
     const std::array<std::byte, 0xe>& GetUnfixedInfosString() const;
     const std::array<std::byte, 0xe>& GetUnfixedInfosMagicBytes() const;
     const std::array<std::byte, 0x40>& GetUnfixedInfosHmacKey() const; 
+    // The unfixed infos HMAC key with its hash states precomputed, used to derive the keys of every tag
+    const crypto::HmacKey& GetUnfixedInfosHmac() const;
 
     const std::array<std::byte, 0xe>& GetLockedSecretString() const;
     const std::array<std::byte, 0x10>& GetLockedSecretMagicBytes() const;
     const std::array<std::byte, 0x40>& GetLockedSecretHmacKey() const; 
+    const crypto::HmacKey& GetLockedSecretHmac() const;
 
 private:
+    static Result<std::shared_ptr<Keys>> Create(const std::span<const std::byte, 80>& unfixedInfo, const std::span<const std::byte, 80>& lockedSecret);
+
+    // Checks the NFC key against the XOR pad before setting it, since a wrong key would silently derive wrong keys for every tag
+    Result<void> SetNfcKey(const std::span<const std::byte, 0x10>& key, const std::span<const std::byte, 0x10>& nonce);
+
+    std::array<std::byte, 0x20> mFingerprint;
+
     std::array<std::byte, 0x10> mNfcKey;
     std::array<std::byte, 0x10> mNfcNonce;
+    crypto::AesKey mNfcAesKey;
     std::array<std::byte, 0x20> mNfcXorPad;
 
     std::array<std::byte, 0xe> mUnfixedInfosString;
     std::array<std::byte, 0xe> mUnfixedInfosMagicBytes;
     std::array<std::byte, 0x40> mUnfixedInfosHmacKey;
+    crypto::HmacKey mUnfixedInfosHmac;
 
     std::array<std::byte, 0xe> mLockedSecretString;
     std::array<std::byte, 0x10> mLockedSecretMagicBytes;
     std::array<std::byte, 0x40> mLockedSecretHmacKey;
+    crypto::HmacKey mLockedSecretHmac;
 };
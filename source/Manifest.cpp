@@ -0,0 +1,356 @@
+#include "Manifest.hpp"
+#include "Edit.hpp"
+#include "Keyring.hpp"
+#include "Keys.hpp"
+#include "crypto.hpp"
+
+#include <charconv>
+#include <fstream>
+#include <string_view>
+
+namespace {
+
+// Bumped whenever the format of the lines changes, manifests of other versions are dropped like ones of different runs
+constexpr std::string_view kHeader = "ntagtool-manifest 1 ";
+// Entries are flushed to disk every this many files, which bounds the work an interrupted run repeats
+constexpr std::size_t kCheckpointInterval = 1024;
+
+constexpr char kHexDigits[] = "0123456789abcdef";
+
+void AppendHex(std::string& str, const std::span<const std::byte>& data)
+{
+    for (std::byte b : data) {
+        str += kHexDigits[std::to_integer<int>(b) >> 4];
+        str += kHexDigits[std::to_integer<int>(b) & 0xf];
+    }
+}
+
+bool ParseHex(const std::string_view& str, const std::span<std::byte>& out)
+{
+    if (str.size() != out.size() * 2) {
+        return false;
+    }
+
+    for (std::size_t i = 0; i < out.size(); i++) {
+        std::uint8_t value;
+        const auto res = std::from_chars(str.data() + i * 2, str.data() + i * 2 + 2, value, 16);
+        if (res.ec != std::errc() || res.ptr != str.data() + i * 2 + 2) {
+            return false;
+        }
+        out[i] = std::byte(value);
+    }
+
+    return true;
+}
+
+// Splits off the next field of a line, fields are separated by a single space
+std::string_view NextField(std::string_view& line)
+{
+    const std::size_t end = line.find(' ');
+    const std::string_view field = line.substr(0, end);
+    line = end == std::string_view::npos ? std::string_view() : line.substr(end + 1);
+    return field;
+}
+
+template <typename T>
+bool ParseNumber(const std::string_view& str, T& value)
+{
+    const auto res = std::from_chars(str.data(), str.data() + str.size(), value);
+    return res.ec == std::errc() && res.ptr == str.data() + str.size();
+}
+
+// Returns the key of the entry, empty if the line is malformed, like the last line of a journal which was cut off
+std::string ParseEntry(std::string_view line, Manifest::Entry& entry)
+{
+    const std::string_view size = NextField(line);
+    const std::string_view modified = NextField(line);
+    const std::string_view inputHash = NextField(line);
+    const std::string_view outputSize = NextField(line);
+    const std::string_view outputHash = NextField(line);
+    if (!ParseNumber(size, entry.state.size) || !ParseNumber(modified, entry.state.modified) || !ParseHex(inputHash, entry.inputHash)) {
+        return {};
+    }
+
+    entry.outputSize.reset();
+    entry.outputHash = {};
+    if (outputSize != "-") {
+        std::uintmax_t value;
+        if (!ParseNumber(outputSize, value) || !ParseHex(outputHash, entry.outputHash)) {
+            return {};
+        }
+        entry.outputSize = value;
+    }
+
+    // The path is last, so it can contain spaces
+    return std::string(line);
+}
+
+std::string FormatEntry(const std::string& key, const Manifest::Entry& entry)
+{
+    std::string line = std::to_string(entry.state.size) + " " + std::to_string(entry.state.modified) + " ";
+    AppendHex(line, entry.inputHash);
+    if (entry.outputSize) {
+        line += " " + std::to_string(*entry.outputSize) + " ";
+        AppendHex(line, entry.outputHash);
+    } else {
+        line += " - -";
+    }
+    line += " " + key + "\n";
+    return line;
+}
+
+std::string FormatHeader(const std::array<std::byte, 0x20>& fingerprint)
+{
+    std::string header(kHeader);
+    AppendHex(header, fingerprint);
+    header += "\n";
+    return header;
+}
+
+std::string GetKey(const std::filesystem::path& file)
+{
+    return file.generic_string();
+}
+
+void AppendFingerprint(std::vector<std::byte>& data, const Keys& keys)
+{
+    data.insert(data.end(), keys.GetFingerprint().begin(), keys.GetFingerprint().end());
+}
+
+void AppendNumber(std::vector<std::byte>& data, std::uint64_t value)
+{
+    for (int i = 0; i < 8; i++) {
+        data.push_back(std::byte(value >> (i * 8)));
+    }
+}
+
+} // namespace
+
+Manifest::Manifest()
+ : mFingerprint(), mJournal(nullptr), mUnflushed(0)
+{
+}
+
+Manifest::~Manifest()
+{
+    if (mJournal) {
+        std::fclose(mJournal);
+    }
+}
+
+Result<std::shared_ptr<Manifest>> Manifest::Open(const std::filesystem::path& path, const std::array<std::byte, 0x20>& fingerprint)
+{
+    std::shared_ptr<Manifest> manifest = std::make_shared<Manifest>();
+    manifest->mPath = path;
+    manifest->mFingerprint = fingerprint;
+
+    const std::string header = FormatHeader(fingerprint);
+    bool matches = false;
+    std::ifstream file(path, std::ios::binary);
+    if (file) {
+        std::string line;
+        matches = std::getline(file, line) && line + "\n" == header;
+        while (matches && std::getline(file, line)) {
+            Entry entry;
+            std::string key = ParseEntry(line, entry);
+            if (!key.empty()) {
+                // Later lines were appended by a later run and replace earlier ones
+                manifest->mEntries.insert_or_assign(std::move(key), entry);
+            }
+        }
+    }
+    file.close();
+
+    // A manifest of a different run is started over
+    manifest->mJournal = std::fopen(path.string().c_str(), matches ? "ab" : "wb");
+    if (!manifest->mJournal) {
+        return std::unexpected(Error(Error::MANIFEST_OPEN_FAILED));
+    }
+
+    if (!matches && std::fputs(header.c_str(), manifest->mJournal) < 0) {
+        return std::unexpected(Error(Error::MANIFEST_WRITE_FAILED));
+    }
+
+    return manifest;
+}
+
+std::array<std::byte, 0x20> Manifest::GetFingerprint(const batch::Options& options)
+{
+    std::vector<std::byte> data;
+    AppendNumber(data, options.operation);
+    AppendNumber(data, options.tagVersion ? *options.tagVersion : ~0ull);
+    AppendNumber(data, options.inputFormat ? *options.inputFormat : ~0ull);
+    AppendNumber(data, options.outputFormat);
+    AppendNumber(data, options.inputLayout);
+    AppendNumber(data, options.outputLayout);
+
+    if (options.keyring) {
+        for (std::size_t i = 0; i < options.keyring->GetSize(); i++) {
+            AppendFingerprint(data, *options.keyring->GetKeys(i));
+        }
+    } else if (options.keys) {
+        AppendFingerprint(data, *options.keys);
+    }
+
+    if (options.targetKeys) {
+        AppendFingerprint(data, *options.targetKeys);
+    }
+
+    if (options.script) {
+        const std::array<std::byte, 0x20> scriptFingerprint = options.script->GetFingerprint();
+        data.insert(data.end(), scriptFingerprint.begin(), scriptFingerprint.end());
+    }
+
+    std::array<std::byte, 0x20> fingerprint;
+    crypto::GenerateSHA256(data, fingerprint);
+    return fingerprint;
+}
+
+std::optional<Manifest::FileState> Manifest::Stat(const std::filesystem::path& path)
+{
+    std::error_code ec;
+    const std::uintmax_t size = std::filesystem::file_size(path, ec);
+    if (ec) {
+        return {};
+    }
+
+    const std::filesystem::file_time_type modified = std::filesystem::last_write_time(path, ec);
+    if (ec) {
+        return {};
+    }
+
+    return FileState{ size, static_cast<std::int64_t>(modified.time_since_epoch().count()) };
+}
+
+const Manifest::Entry* Manifest::Find(const std::filesystem::path& file) const
+{
+    auto it = mEntries.find(GetKey(file));
+    return it != mEntries.end() ? &it->second : nullptr;
+}
+
+bool Manifest::HasOutput(const Entry& entry, const std::filesystem::path& output) const
+{
+    if (!entry.outputSize) {
+        return true;
+    }
+
+    // The output is only stat'ed, rewriting it with other contents of the same size goes unnoticed
+    std::error_code ec;
+    return std::filesystem::file_size(output, ec) == *entry.outputSize && !ec;
+}
+
+bool Manifest::IsUnchanged(const std::filesystem::path& file, const FileState& state, const std::filesystem::path& output) const
+{
+    const Entry* entry = Find(file);
+    return entry && entry->state.size == state.size && entry->state.modified == state.modified && HasOutput(*entry, output);
+}
+
+bool Manifest::IsUnchanged(const std::filesystem::path& file, const std::span<const std::byte>& data, const std::filesystem::path& output) const
+{
+    const Entry* entry = Find(file);
+    if (!entry || entry->state.size != data.size()) {
+        return false;
+    }
+
+    std::array<std::byte, 0x20> hash;
+    crypto::GenerateSHA256(data, hash);
+    return hash == entry->inputHash && HasOutput(*entry, output);
+}
+
+void Manifest::Record(const std::filesystem::path& file, const FileState& state, const std::span<const std::byte>& in, const std::optional<std::span<const std::byte>>& out)
+{
+    Entry entry{};
+    entry.state = state;
+    crypto::GenerateSHA256(in, entry.inputHash);
+    if (out) {
+        entry.outputSize = out->size();
+        crypto::GenerateSHA256(*out, entry.outputHash);
+    }
+
+    Append(GetKey(file), entry);
+}
+
+void Manifest::Refresh(const std::filesystem::path& file, const FileState& state)
+{
+    const Entry* loaded = Find(file);
+    if (!loaded) {
+        return;
+    }
+
+    Entry entry = *loaded;
+    entry.state = state;
+    Append(GetKey(file), entry);
+}
+
+void Manifest::Append(std::string&& key, const Entry& entry)
+{
+    const std::string line = FormatEntry(key, entry);
+
+    std::lock_guard lock(mMutex);
+    mRecorded.insert_or_assign(std::move(key), entry);
+
+    // A failed write only means the file is processed again by the next run
+    if (!mJournal) {
+        return;
+    }
+
+    std::fputs(line.c_str(), mJournal);
+    if (++mUnflushed >= kCheckpointInterval) {
+        std::fflush(mJournal);
+        mUnflushed = 0;
+    }
+}
+
+Result<void> Manifest::Commit(const std::vector<std::filesystem::path>& files)
+{
+    std::lock_guard lock(mMutex);
+
+    // The journal is kept until the compacted manifest replaced it, so it is never lost
+    if (!mJournal || std::fflush(mJournal) != 0) {
+        return std::unexpected(Error(Error::MANIFEST_WRITE_FAILED));
+    }
+
+    const std::filesystem::path tempPath = mPath.string() + ".tmp";
+    std::FILE* out = std::fopen(tempPath.string().c_str(), "wb");
+    if (!out) {
+        return std::unexpected(Error(Error::MANIFEST_WRITE_FAILED));
+    }
+
+    bool failed = std::fputs(FormatHeader(mFingerprint).c_str(), out) < 0;
+    for (const std::filesystem::path& file : files) {
+        const std::string key = GetKey(file);
+        auto it = mRecorded.find(key);
+        if (it == mRecorded.end()) {
+            it = mEntries.find(key);
+            if (it == mEntries.end()) {
+                continue;
+            }
+        }
+
+        failed = failed || std::fputs(FormatEntry(key, it->second).c_str(), out) < 0;
+    }
+
+    failed = std::fclose(out) != 0 || failed;
+    if (failed) {
+        std::filesystem::remove(tempPath);
+        return std::unexpected(Error(Error::MANIFEST_WRITE_FAILED));
+    }
+
+    // Windows can't replace a file which is still open
+    std::fclose(mJournal);
+    mJournal = nullptr;
+
+    std::error_code ec;
+    std::filesystem::rename(tempPath, mPath, ec);
+    if (ec) {
+        return std::unexpected(Error(Error::MANIFEST_WRITE_FAILED));
+    }
+
+    // Further files are appended to the compacted manifest
+    mJournal = std::fopen(mPath.string().c_str(), "ab");
+    if (!mJournal) {
+        return std::unexpected(Error(Error::MANIFEST_OPEN_FAILED));
+    }
+
+    return {};
+}
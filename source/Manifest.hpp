@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Batch.hpp"
+#include "Error.hpp"
+
+// Remembers the files a batch run processed, so later runs with the same operation and keys only need to stat unchanged files
+// The manifest is a journal: every processed file is appended while the run is going and flushed regularly, so an interrupted run
+// resumes where it stopped. Once a run completes, the manifest is rewritten with only the files of that run.
+// Lookups only read the entries loaded from disk and recording is locked, so a manifest can be shared between the workers.
+class Manifest {
+public:
+    // Size and modification time of an input file, which is all that is checked for files whose entry matches
+    struct FileState {
+        std::uintmax_t size;
+        std::int64_t modified;
+    };
+
+    struct Entry {
+        FileState state;
+        std::array<std::byte, 0x20> inputHash;
+        // Only set if the operation writes a result
+        std::optional<std::uintmax_t> outputSize;
+        std::array<std::byte, 0x20> outputHash;
+    };
+
+    Manifest();
+    virtual ~Manifest();
+
+    // Loads the manifest at path if it exists, entries are dropped if it was written by a run with a different fingerprint
+    static Result<std::shared_ptr<Manifest>> Open(const std::filesystem::path& path, const std::array<std::byte, 0x20>& fingerprint);
+
+    // Hashes everything which changes the results of a run: the operation, tag version, dump formats and layouts, keysets and edit script
+    static std::array<std::byte, 0x20> GetFingerprint(const batch::Options& options);
+
+    static std::optional<FileState> Stat(const std::filesystem::path& path);
+
+    // Returns whether the file has the size and modification time of its entry and its result still exists with the recorded size
+    bool IsUnchanged(const std::filesystem::path& file, const FileState& state, const std::filesystem::path& output) const;
+    // Same for files whose modification time changed, but which still have the same contents
+    bool IsUnchanged(const std::filesystem::path& file, const std::span<const std::byte>& data, const std::filesystem::path& output) const;
+
+    // Appends the file to the journal, without output if nothing was written, may be called from multiple threads at once
+    void Record(const std::filesystem::path& file, const FileState& state, const std::span<const std::byte>& in, const std::optional<std::span<const std::byte>>& out);
+
+    // Records the file again with its loaded entry and the new size and modification time
+    void Refresh(const std::filesystem::path& file, const FileState& state);
+
+    // Rewrites the manifest with the entries of the files, the files which weren't recorded by this run keep their loaded entry
+    Result<void> Commit(const std::vector<std::filesystem::path>& files);
+
+private:
+    const Entry* Find(const std::filesystem::path& file) const;
+    bool HasOutput(const Entry& entry, const std::filesystem::path& output) const;
+    void Append(std::string&& key, const Entry& entry);
+
+    std::filesystem::path mPath;
+    std::array<std::byte, 0x20> mFingerprint;
+
+    // Loaded from disk, never changed during a run
+    std::unordered_map<std::string, Entry> mEntries;
+
+    std::mutex mMutex;
+    std::FILE* mJournal;
+    std::size_t mUnflushed;
+    std::unordered_map<std::string, Entry> mRecorded;
+};
@@ -0,0 +1,299 @@
+#include "Pipeline.hpp"
+#include "BatchIO.hpp"
+#include "Dump.hpp"
+#include "Queue.hpp"
+#include "Tag.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace {
+
+// Number of tags which can wait between two stages
+constexpr std::size_t kQueueCapacity = 64;
+// Number of files the read and write stages submit at once
+constexpr std::size_t kIOBatchSize = 32;
+
+struct Job {
+    std::size_t index;
+    batch::Status status;
+    std::vector<std::byte> in;
+    std::shared_ptr<Tag> tag;
+    std::vector<std::byte> out;
+    std::optional<Error> error;
+};
+
+// Connects two stages, consumers stop once all producers are done and the queue is drained
+struct Channel {
+    Channel(unsigned int producers)
+     : queue(kQueueCapacity), producers(producers)
+    {
+    }
+
+    BoundedQueue<std::unique_ptr<Job>> queue;
+    std::atomic<unsigned int> producers;
+};
+
+// Spins for a short while before yielding and finally sleeping, so idle stages don't keep a core busy
+class Backoff {
+public:
+    void Wait()
+    {
+        if (mCount < 64) {
+            mCount++;
+        } else if (mCount < 128) {
+            mCount++;
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+private:
+    unsigned int mCount = 0;
+};
+
+void Push(Channel& channel, std::unique_ptr<Job>&& job)
+{
+    // Wait while the next stage is behind, this bounds the number of tags in flight
+    Backoff backoff;
+    while (!channel.queue.TryPush(std::move(job))) {
+        backoff.Wait();
+    }
+}
+
+bool Pop(Channel& channel, std::unique_ptr<Job>& job)
+{
+    Backoff backoff;
+    while (!channel.queue.TryPop(job)) {
+        if (channel.producers.load(std::memory_order_acquire) == 0) {
+            // Everything the producers pushed is visible once they are done, so check one last time
+            return channel.queue.TryPop(job);
+        }
+
+        backoff.Wait();
+    }
+
+    return true;
+}
+
+// Gets the next job for a stage, returns false once there are no more jobs
+using SourceFunction = std::function<bool(std::unique_ptr<Job>& job)>;
+// Runs the stage on a job, returns whether the job should be passed on to the next stage
+using StageFunction = std::function<bool(Job& job, unsigned int worker)>;
+
+void StartStage(std::vector<std::thread>& threads, const std::string& name, unsigned int workers, const SourceFunction& source, Channel* out, const batch::ReportFunction& report, const StageFunction& func)
+{
+    for (unsigned int i = 0; i < workers; i++) {
+        threads.emplace_back([&source, out, &report, &func, name, i]() {
+            NTAG_TRACE_THREAD_NAME(name + " " + std::to_string(i));
+
+            std::unique_ptr<Job> job;
+            while (source(job)) {
+                if (func(*job, i) && out) {
+                    Push(*out, std::move(job));
+                } else {
+                    // The job either failed or reached the end of the pipeline
+                    report(job->index, job->status, job->error);
+                }
+
+                job.reset();
+            }
+
+            if (out) {
+                out->producers.fetch_sub(1, std::memory_order_release);
+            }
+        });
+    }
+}
+
+void ObserveBatch(metrics::Stage stage, std::chrono::steady_clock::time_point start, std::size_t count)
+{
+    // Spread the time of the whole batch over its files
+    const auto duration = (std::chrono::steady_clock::now() - start) / std::max<std::size_t>(count, 1);
+    for (std::size_t i = 0; i < count; i++) {
+        metrics::Observe(stage, duration);
+    }
+}
+
+// Reads files in batches and passes them on to the parse stage
+void StartReadStage(std::vector<std::thread>& threads, unsigned int workers, const std::vector<std::filesystem::path>& files, const std::filesystem::path& inDir, std::atomic<std::size_t>& nextIndex, Channel& out, const batch::ReportFunction& report)
+{
+    for (unsigned int i = 0; i < workers; i++) {
+        threads.emplace_back([&files, &inDir, &nextIndex, &out, &report, i]() {
+            NTAG_TRACE_THREAD_NAME("read " + std::to_string(i));
+
+            BatchIO batchIO(kIOBatchSize);
+            std::vector<std::string> paths;
+            std::vector<std::optional<std::vector<std::byte>>> results;
+            while (true) {
+                const std::size_t first = nextIndex.fetch_add(kIOBatchSize, std::memory_order_relaxed);
+                if (first >= files.size()) {
+                    break;
+                }
+
+                const std::size_t last = std::min(first + kIOBatchSize, files.size());
+                paths.clear();
+                for (std::size_t j = first; j < last; j++) {
+                    paths.push_back((inDir / files[j]).string());
+                }
+
+                const auto start = std::chrono::steady_clock::now();
+                batchIO.ReadFiles(paths, results);
+                ObserveBatch(metrics::STAGE_READ, start, paths.size());
+
+                for (std::size_t j = 0; j < results.size(); j++) {
+                    std::unique_ptr<Job> job = std::make_unique<Job>();
+                    job->index = first + j;
+                    if (!results[j]) {
+                        report(job->index, batch::STATUS_READ_FAILED, job->error);
+                        continue;
+                    }
+
+                    job->status = batch::STATUS_OK;
+                    job->in = std::move(*results[j]);
+                    Push(out, std::move(job));
+                }
+            }
+
+            out.producers.fetch_sub(1, std::memory_order_release);
+        });
+    }
+}
+
+// Collects serialized tags into batches and writes them
+void StartWriteStage(std::vector<std::thread>& threads, unsigned int workers, const std::vector<std::filesystem::path>& files, const std::filesystem::path& outDir, Channel& in, const batch::ReportFunction& report)
+{
+    for (unsigned int i = 0; i < workers; i++) {
+        threads.emplace_back([&files, &outDir, &in, &report, i]() {
+            NTAG_TRACE_THREAD_NAME("write " + std::to_string(i));
+
+            BatchIO batchIO(kIOBatchSize);
+            std::vector<std::unique_ptr<Job>> jobs;
+            std::vector<std::string> paths;
+            std::vector<std::span<const std::byte>> data;
+            std::vector<bool> results;
+            std::filesystem::path lastDirectory;
+
+            std::unique_ptr<Job> job;
+            while (Pop(in, job)) {
+                // Take whatever else is ready without waiting for a full batch
+                jobs.clear();
+                jobs.push_back(std::move(job));
+                while (jobs.size() < kIOBatchSize && in.queue.TryPop(job)) {
+                    jobs.push_back(std::move(job));
+                }
+
+                paths.clear();
+                data.clear();
+                for (const std::unique_ptr<Job>& j : jobs) {
+                    const std::filesystem::path path = outDir / files[j->index];
+
+                    // Files are mostly sorted, so this avoids checking the same directory over and over
+                    if (path.parent_path() != lastDirectory) {
+                        std::error_code ec;
+                        std::filesystem::create_directories(path.parent_path(), ec);
+                        lastDirectory = path.parent_path();
+                    }
+
+                    paths.push_back(path.string());
+                    data.push_back(j->out);
+                }
+
+                const auto start = std::chrono::steady_clock::now();
+                batchIO.WriteFiles(paths, data, results);
+                ObserveBatch(metrics::STAGE_WRITE, start, paths.size());
+
+                for (std::size_t j = 0; j < jobs.size(); j++) {
+                    report(jobs[j]->index, results[j] ? jobs[j]->status : batch::STATUS_WRITE_FAILED, jobs[j]->error);
+                }
+            }
+        });
+    }
+}
+
+} // namespace
+
+void batch::RunPipeline(const Options& options, const std::vector<std::filesystem::path>& files, const std::filesystem::path& inDir, const std::filesystem::path& outDir, const ReportFunction& report)
+{
+    // Most of the time is spent crypting, so that stage gets the largest share of the workers
+    const unsigned int ioWorkers = std::max(1u, options.ioJobs);
+    const unsigned int parseWorkers = std::max(1u, options.jobs / 4);
+    const unsigned int cryptWorkers = std::max(1u, options.jobs / 2);
+    const unsigned int serializeWorkers = std::max(1u, options.jobs / 4);
+
+    Channel parseChannel(ioWorkers);
+    Channel cryptChannel(parseWorkers);
+    Channel serializeChannel(cryptWorkers);
+    Channel writeChannel(serializeWorkers);
+
+    // One context per crypt worker, they all share the same keys
+    std::vector<Context> contexts(cryptWorkers, Context(options));
+
+    std::atomic<std::size_t> nextIndex = 0;
+    const SourceFunction parseSource = [&](std::unique_ptr<Job>& job) { return Pop(parseChannel, job); };
+    const SourceFunction cryptSource = [&](std::unique_ptr<Job>& job) { return Pop(cryptChannel, job); };
+    const SourceFunction serializeSource = [&](std::unique_ptr<Job>& job) { return Pop(serializeChannel, job); };
+
+    const StageFunction parse = [&](Job& job, unsigned int) {
+        // Dumps are replaced by the raw tag, which audits compare the result with
+        std::vector<std::byte> converted;
+        Result<std::span<const std::byte>> res = dump::Import(options.inputFormat, options.inputLayout, job.in, converted);
+        if (!res) {
+            job.status = STATUS_PARSE_FAILED;
+            job.error = res.error();
+            return false;
+        }
+
+        if (res->data() != job.in.data()) {
+            job.in = std::move(converted);
+        }
+
+        job.status = ParseTag(options.operation, options.tagVersion, job.in, job.tag, &job.error);
+        // Audits compare the input with the result after serializing
+        if (options.operation != OPERATION_AUDIT) {
+            job.in = {};
+        }
+
+        return job.status == STATUS_OK;
+    };
+
+    const StageFunction crypt = [&](Job& job, unsigned int worker) {
+        job.status = CryptTag(options.operation, contexts[worker], *job.tag, !options.tagVersion);
+        if (options.operation == OPERATION_AUDIT) {
+            return job.status == STATUS_OK;
+        }
+
+        return ShouldWrite(options.operation, job.status);
+    };
+
+    const StageFunction serialize = [&](Job& job, unsigned int) {
+        metrics::Timer timer(metrics::STAGE_SERIALIZE);
+        job.out = job.tag->ToBytes();
+        job.tag.reset();
+
+        // Audited tags end here, nothing is written
+        if (options.operation == OPERATION_AUDIT) {
+            job.status = CompareTag(job.in, job.out, &job.error);
+            return false;
+        }
+
+        dump::Export(options.outputFormat, options.outputLayout, job.out);
+
+        return true;
+    };
+
+    std::vector<std::thread> threads;
+    StartReadStage(threads, ioWorkers, files, inDir, nextIndex, parseChannel, report);
+    StartStage(threads, "parse", parseWorkers, parseSource, &cryptChannel, report, parse);
+    StartStage(threads, "crypt", cryptWorkers, cryptSource, &serializeChannel, report, crypt);
+    StartStage(threads, "serialize", serializeWorkers, serializeSource, &writeChannel, report, serialize);
+    StartWriteStage(threads, ioWorkers, files, outDir, writeChannel, report);
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
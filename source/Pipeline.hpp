@@ -0,0 +1,11 @@
+#pragma once
+
+#include "Batch.hpp"
+
+namespace batch {
+
+// Runs read, parse, crypt, serialize and write on separate workers connected by bounded lock-free queues,
+// so disk I/O overlaps with the crypto and the queues keep the number of tags in flight bounded
+void RunPipeline(const Options& options, const std::vector<std::filesystem::path>& files, const std::filesystem::path& inDir, const std::filesystem::path& outDir, const ReportFunction& report);
+
+} // namespace batch
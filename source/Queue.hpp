@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free multi producer multi consumer queue
+// Based on Dmitry Vyukov's bounded MPMC queue, every cell carries a sequence number which tells
+// producers and consumers whether the cell is ready for them, so only the positions are contended.
+template<typename T>
+class BoundedQueue {
+public:
+    // The capacity is rounded up to the next power of two
+    BoundedQueue(std::size_t capacity)
+     : mMask(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1),
+       mCells(std::make_unique<Cell[]>(mMask + 1)),
+       mEnqueuePos(0),
+       mDequeuePos(0)
+    {
+        for (std::size_t i = 0; i <= mMask; i++) {
+            mCells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // Returns false if the queue is full, value is only moved from on success
+    bool TryPush(T&& value)
+    {
+        Cell* cell;
+        std::size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &mCells[pos & mMask];
+            const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t diff = std::ptrdiff_t(sequence) - std::ptrdiff_t(pos);
+            if (diff == 0) {
+                // The cell is free, try to claim it
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // The cell still holds a value from the previous lap
+                return false;
+            } else {
+                // Another producer claimed the cell
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue is empty
+    bool TryPop(T& value)
+    {
+        Cell* cell;
+        std::size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &mCells[pos & mMask];
+            const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t diff = std::ptrdiff_t(sequence) - std::ptrdiff_t(pos + 1);
+            if (diff == 0) {
+                // The cell holds a value, try to claim it
+                if (mDequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // The cell has not been written yet
+                return false;
+            } else {
+                // Another consumer claimed the cell
+                pos = mDequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        value = std::move(cell->value);
+        // Mark the cell as free for the next lap
+        cell->sequence.store(pos + mMask + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::size_t GetCapacity() const
+    {
+        return mMask + 1;
+    }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    // Keep the positions on separate cache lines, so producers and consumers don't invalidate each other
+    static constexpr std::size_t kCacheLineSize = 64;
+
+    const std::size_t mMask;
+    const std::unique_ptr<Cell[]> mCells;
+    alignas(kCacheLineSize) std::atomic<std::size_t> mEnqueuePos;
+    alignas(kCacheLineSize) std::atomic<std::size_t> mDequeuePos;
+};
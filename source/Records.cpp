@@ -0,0 +1,407 @@
+#include "Records.hpp"
+#include "Archive.hpp"
+#include "Scheduler.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+#include <array>
+#include <future>
+#include <iostream>
+
+namespace {
+
+// Number of records read, processed and written at once
+constexpr std::size_t kWindowSize = 1024;
+// Size of the stdio buffers of both streams, so records are read and written with few system calls
+constexpr std::size_t kBufferSize = 0x100000;
+
+struct Window {
+    // Index of the first record in the stream
+    std::size_t first = 0;
+    std::size_t count = 0;
+    std::uintmax_t bytes = 0;
+
+    // Only the first count entries are used, the vectors are kept to reuse their allocations
+    std::vector<std::vector<std::byte>> in;
+    std::vector<std::vector<std::byte>> out;
+    std::vector<batch::Status> statuses;
+    std::vector<std::optional<Error>> errors;
+
+    // Set if the stream ended in the middle of the record following the window
+    bool truncated = false;
+    std::optional<Error> readError;
+};
+
+// Returns false at the end of the stream, readError is set if it ended in the middle of a record
+bool ReadRecord(std::FILE* in, const batch::StreamOptions& options, std::vector<std::byte>& data, std::uintmax_t& offset, std::optional<Error>& readError)
+{
+    std::size_t size = options.recordSize;
+    if (options.framing == batch::FRAMING_LENGTH) {
+        std::array<std::uint8_t, 4> header;
+        const std::size_t read = std::fread(header.data(), 1, header.size(), in);
+        if (read == 0) {
+            return false;
+        }
+
+        if (read != header.size()) {
+            readError = Error(Error::RECORD_TRUNCATED, offset);
+            return false;
+        }
+
+        size = header[0] | (header[1] << 8) | (header[2] << 16) | (std::uint32_t(header[3]) << 24);
+        if (size > batch::kMaxRecordSize) {
+            readError = Error(Error::RECORD_TOO_LARGE, offset);
+            return false;
+        }
+
+        offset += header.size();
+    }
+
+    data.resize(size);
+    const std::size_t read = std::fread(data.data(), 1, size, in);
+    if (read != size) {
+        // A fixed size record can't be empty, so nothing read means the stream ended before it
+        if (read != 0 || options.framing == batch::FRAMING_LENGTH) {
+            readError = Error(Error::RECORD_TRUNCATED, offset);
+        }
+
+        return false;
+    }
+
+    offset += size;
+    return true;
+}
+
+void ReadWindow(std::FILE* in, const batch::StreamOptions& options, Window& window, std::size_t first, std::uintmax_t& offset)
+{
+    NTAG_TRACE_SCOPE("ReadWindow");
+    metrics::Timer timer(metrics::STAGE_READ);
+
+    window.first = first;
+    window.count = 0;
+    window.bytes = 0;
+    window.readError.reset();
+    window.truncated = false;
+
+    const std::uintmax_t start = offset;
+    while (window.count < kWindowSize) {
+        if (!ReadRecord(in, options, window.in[window.count], offset, window.readError)) {
+            window.truncated = window.readError.has_value() || std::ferror(in);
+            break;
+        }
+
+        window.count++;
+    }
+
+    window.bytes = offset - start;
+    metrics::Increment(metrics::BYTES_READ, window.bytes);
+}
+
+// Returns false if writing failed, the statuses of the records which could not be written are updated
+bool WriteWindow(std::FILE* out, const batch::Options& options, const batch::StreamOptions& streamOptions, Window& window)
+{
+    NTAG_TRACE_SCOPE("WriteWindow");
+    metrics::Timer timer(metrics::STAGE_WRITE);
+
+    // Operations like verify write nothing, not even placeholders
+    if (!batch::ShouldWrite(options.operation, batch::STATUS_OK)) {
+        return true;
+    }
+
+    // Records which aren't written are replaced by a placeholder so the output stays aligned with the input,
+    // an empty record with length framing and a record of zeros with fixed framing
+    const std::vector<std::byte> placeholder(streamOptions.framing == batch::FRAMING_FIXED ? streamOptions.recordSize : 0);
+
+    bool failed = false;
+    for (std::size_t i = 0; i < window.count; i++) {
+        const bool isResult = batch::ShouldWrite(options.operation, window.statuses[i]);
+        const std::vector<std::byte>& data = isResult ? window.out[i] : placeholder;
+        if (!failed && streamOptions.framing == batch::FRAMING_LENGTH) {
+            const std::uint32_t size = data.size();
+            const std::array<std::uint8_t, 4> header = { std::uint8_t(size), std::uint8_t(size >> 8), std::uint8_t(size >> 16), std::uint8_t(size >> 24) };
+            failed = std::fwrite(header.data(), 1, header.size(), out) != header.size();
+        }
+
+        if (!failed) {
+            failed = std::fwrite(data.data(), 1, data.size(), out) != data.size();
+        }
+
+        // Once the output is broken, none of the following records make it either
+        if (failed) {
+            if (isResult) {
+                window.statuses[i] = batch::STATUS_WRITE_FAILED;
+            }
+            continue;
+        }
+
+        metrics::Increment(metrics::BYTES_WRITTEN, data.size());
+    }
+
+    return !failed;
+}
+
+struct ArchiveWindow {
+    std::size_t count = 0;
+    std::uintmax_t bytes = 0;
+
+    // Like Window, only the first count entries are used
+    std::vector<archive::Entry> entries;
+    std::vector<std::vector<std::byte>> out;
+    std::vector<batch::Status> statuses;
+    std::vector<std::optional<Error>> errors;
+
+    // Set if the archive is broken, nothing follows this window
+    std::optional<Error> readError;
+};
+
+// Returns false once the archive ended
+bool ReadArchiveWindow(archive::Reader& reader, ArchiveWindow& window)
+{
+    NTAG_TRACE_SCOPE("ReadArchiveWindow");
+    metrics::Timer timer(metrics::STAGE_READ);
+
+    window.count = 0;
+    window.bytes = 0;
+    window.readError.reset();
+
+    while (window.count < kWindowSize) {
+        Result<bool> res = reader.Next(window.entries[window.count]);
+        if (!res) {
+            window.readError = res.error();
+            return false;
+        }
+
+        if (!*res) {
+            return false;
+        }
+
+        window.bytes += window.entries[window.count].data.size();
+        window.count++;
+    }
+
+    return true;
+}
+
+} // namespace
+
+batch::Summary batch::RunArchive(const Options& options, const std::filesystem::path& in, const std::filesystem::path& out)
+{
+    const auto startTime = std::chrono::steady_clock::now();
+
+    std::size_t total = 0;
+    std::size_t failed = 0;
+    std::uintmax_t bytes = 0;
+
+    std::optional<MetricsReporter> reporter(std::in_place, options);
+
+    const auto report = [&](const std::string& path, Status status, const std::optional<Error>& error) {
+        if (status == STATUS_OK) {
+            return;
+        }
+
+        CountFailure(status);
+        failed++;
+
+        std::cerr << path << ": " << GetStatusString(status);
+        if (error) {
+            std::cerr << " (" << error->GetDescription() << " at offset 0x" << std::hex << error->GetOffset() << std::dec << ")";
+        }
+        std::cerr << "\n";
+    };
+
+    Result<std::unique_ptr<archive::Reader>> reader = archive::OpenReader(in);
+    if (!reader) {
+        report(in.string(), STATUS_READ_FAILED, reader.error());
+        return Summary{ 0, 0, failed, std::chrono::steady_clock::now() - startTime };
+    }
+
+    // Operations which don't write anything don't need an output
+    std::unique_ptr<archive::TarWriter> tar;
+    if (ShouldWrite(options.operation, STATUS_OK) && archive::IsTar(out)) {
+        Result<std::unique_ptr<archive::TarWriter>> writer = archive::TarWriter::Open(out);
+        if (!writer) {
+            report(out.string(), STATUS_WRITE_FAILED, writer.error());
+            return Summary{ 0, 0, failed, std::chrono::steady_clock::now() - startTime };
+        }
+
+        tar = std::move(*writer);
+    }
+
+    // While one window is processed and written, the next one is read
+    std::array<ArchiveWindow, 2> windows;
+    for (ArchiveWindow& window : windows) {
+        window.entries.resize(kWindowSize);
+        window.out.resize(kWindowSize);
+        window.statuses.resize(kWindowSize);
+        window.errors.resize(kWindowSize);
+    }
+
+    std::vector<Context> contexts(std::max(1u, options.jobs), Context(options));
+
+    bool writeFailed = false;
+    std::future<bool> reading = std::async(std::launch::async, ReadArchiveWindow, std::ref(**reader), std::ref(windows[0]));
+    for (std::size_t current = 0;; current = (current + 1) % windows.size()) {
+        const bool more = reading.get();
+        ArchiveWindow& window = windows[current];
+        total += window.count;
+        bytes += window.bytes;
+
+        if (more) {
+            reading = std::async(std::launch::async, ReadArchiveWindow, std::ref(**reader), std::ref(windows[(current + 1) % windows.size()]));
+        }
+
+        scheduler::ParallelFor(window.count, options.jobs, options.pin, [&](std::size_t i, unsigned int worker) {
+            const archive::Entry& entry = window.entries[i];
+            window.errors[i] = entry.error;
+            window.statuses[i] = entry.error ? STATUS_READ_FAILED : ProcessTag(options.operation, options.tagVersion, contexts[worker], entry.data, window.out[i], &window.errors[i]);
+        });
+
+        {
+            NTAG_TRACE_SCOPE("WriteArchiveWindow");
+            metrics::Timer timer(metrics::STAGE_WRITE);
+
+            for (std::size_t i = 0; i < window.count; i++) {
+                const archive::Entry& entry = window.entries[i];
+                if (ShouldWrite(options.operation, window.statuses[i])) {
+                    // Once the archive is broken, none of the following entries make it either
+                    if (tar) {
+                        writeFailed = writeFailed || !tar->Add(entry.path, window.out[i]);
+                    }
+
+                    const Status writeStatus = writeFailed ? STATUS_WRITE_FAILED : (tar ? STATUS_OK : WriteTagFile(out / entry.path, window.out[i]));
+                    if (writeStatus != STATUS_OK) {
+                        window.statuses[i] = writeStatus;
+                    }
+                }
+
+                report(entry.path, window.statuses[i], window.errors[i]);
+            }
+        }
+
+        if (window.readError) {
+            total++;
+            report(in.string(), STATUS_READ_FAILED, window.readError);
+        }
+
+        if (!more) {
+            break;
+        }
+    }
+
+    if (tar && !writeFailed) {
+        Result<void> res = tar->Finish();
+        if (!res) {
+            report(out.string(), STATUS_WRITE_FAILED, res.error());
+        }
+    }
+
+    reporter.reset();
+    return Summary{ total, bytes, failed, std::chrono::steady_clock::now() - startTime };
+}
+
+batch::Summary batch::RunStream(const Options& options, const StreamOptions& streamOptions, std::FILE* in, std::FILE* out)
+{
+    const auto startTime = std::chrono::steady_clock::now();
+
+    std::setvbuf(in, nullptr, _IOFBF, kBufferSize);
+    std::setvbuf(out, nullptr, _IOFBF, kBufferSize);
+
+    std::size_t total = 0;
+    std::size_t failed = 0;
+    std::uintmax_t bytes = 0;
+
+    std::optional<MetricsReporter> reporter(std::in_place, options);
+
+    // Only the writer reports, so the failures are printed in stream order
+    const auto report = [&](std::size_t index, Status status, const std::optional<Error>& error) {
+        if (status == STATUS_OK) {
+            return;
+        }
+
+        CountFailure(status);
+        failed++;
+
+        std::cerr << "record " << index << ": " << GetStatusString(status);
+        if (error) {
+            std::cerr << " (" << error->GetDescription() << " at offset 0x" << std::hex << error->GetOffset() << std::dec << ")";
+        }
+        std::cerr << "\n";
+    };
+
+    // While one window is processed, the next one is read and the previous one is written
+    std::array<Window, 3> windows;
+    for (Window& window : windows) {
+        window.in.resize(kWindowSize);
+        window.out.resize(kWindowSize);
+        window.statuses.resize(kWindowSize);
+        window.errors.resize(kWindowSize);
+    }
+
+    std::vector<Context> contexts(std::max(1u, options.jobs), Context(options));
+
+    std::uintmax_t offset = 0;
+    const Window* last = nullptr;
+    bool writeFailed = false;
+    std::future<void> reading = std::async(std::launch::async, ReadWindow, in, std::cref(streamOptions), std::ref(windows[0]), 0, std::ref(offset));
+    std::future<bool> writing;
+    for (std::size_t current = 0;; current = (current + 1) % windows.size()) {
+        reading.get();
+        Window& window = windows[current];
+        total += window.count;
+        bytes += window.bytes;
+
+        if (window.truncated || window.count < kWindowSize) {
+            last = &window;
+        } else {
+            Window& next = windows[(current + 1) % windows.size()];
+            reading = std::async(std::launch::async, ReadWindow, in, std::cref(streamOptions), std::ref(next), window.first + window.count, std::ref(offset));
+        }
+
+        scheduler::ParallelFor(window.count, options.jobs, options.pin, [&](std::size_t i, unsigned int worker) {
+            window.errors[i].reset();
+            window.statuses[i] = ProcessTag(options.operation, options.tagVersion, contexts[worker], window.in[i], window.out[i], &window.errors[i]);
+        });
+
+        // Windows are written in order, the previous one has to be done before this one starts
+        writeFailed = writing.valid() && !writing.get();
+        if (writeFailed) {
+            // Nothing of this window makes it to the output either
+            for (std::size_t i = 0; i < window.count; i++) {
+                report(window.first + i, STATUS_WRITE_FAILED, {});
+            }
+
+            break;
+        }
+
+        writing = std::async(std::launch::async, [&, &window = window]() {
+            const bool res = WriteWindow(out, options, streamOptions, window);
+            for (std::size_t i = 0; i < window.count; i++) {
+                report(window.first + i, window.statuses[i], window.errors[i]);
+            }
+
+            return res;
+        });
+
+        if (last) {
+            break;
+        }
+    }
+
+    writeFailed = writeFailed || (writing.valid() && !writing.get());
+    if (!writeFailed && std::fflush(out) != 0) {
+        report(total, STATUS_WRITE_FAILED, {});
+    }
+
+    // A window which was still being read when writing failed
+    if (reading.valid()) {
+        reading.get();
+    }
+
+    if (last && last->truncated) {
+        total++;
+        report(last->first + last->count, STATUS_READ_FAILED, last->readError);
+    }
+
+    reporter.reset();
+    return Summary{ total, bytes, failed, std::chrono::steady_clock::now() - startTime };
+}
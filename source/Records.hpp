@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdio>
+
+#include "Batch.hpp"
+
+namespace batch {
+
+// Larger records can't be tags, a larger length prefix is most likely garbage and a larger record_size is rejected
+constexpr std::uint32_t kMaxRecordSize = 0x1000u;
+
+enum Framing {
+    // Every record is a 32 bit little endian size followed by the tag
+    FRAMING_LENGTH,
+    // Every record is a tag of the same size, without any header
+    FRAMING_FIXED,
+};
+
+struct StreamOptions {
+    Framing framing;
+    // Only used for FRAMING_FIXED
+    std::size_t recordSize;
+};
+
+// Reads tag records from in until the end of the stream and writes the processed records to out, in the same framing and order
+// Records are read, processed and written in windows of a fixed number of records, while one window is processed the next one
+// is read and the previous one is written, so memory use doesn't depend on the length of the stream.
+// Records which shouldn't be written are replaced by an empty record, or one of zeros with fixed framing, so the output stays
+// positional. Their status is reported with the index of the record.
+// A truncated record ends the stream and is reported as STATUS_READ_FAILED.
+Summary RunStream(const Options& options, const StreamOptions& streamOptions, std::FILE* in, std::FILE* out);
+
+// Processes every file of a zip or tar archive, or of a directory, in windows like RunStream without extracting anything
+// The results are stored with the paths of the entries in the out directory, or in a single tar archive if out names one.
+// Entries which can't be read are reported with their path, a broken archive ends processing and is reported as well.
+Summary RunArchive(const Options& options, const std::filesystem::path& in, const std::filesystem::path& out);
+
+} // namespace batch
@@ -0,0 +1,164 @@
+#include "Scheduler.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+namespace {
+
+// Aim for this many chunks per worker, so there is something left to steal
+constexpr std::size_t kChunksPerWorker = 16;
+// Upper bound for the chunk size, so stealing stays fine grained for large inputs
+constexpr std::size_t kMaxChunkSize = 64;
+
+// The chunks a worker still needs to process, the owner takes from the front and thieves from the back
+struct alignas(64) WorkerQueue {
+    std::mutex mutex;
+    std::size_t begin = 0;
+    std::size_t end = 0;
+
+    bool PopFront(std::size_t& chunk)
+    {
+        std::lock_guard lock(mutex);
+        if (begin == end) {
+            return false;
+        }
+
+        chunk = begin++;
+        return true;
+    }
+
+    // Takes the back half of the remaining chunks
+    bool StealHalf(std::size_t& stolenBegin, std::size_t& stolenEnd)
+    {
+        std::lock_guard lock(mutex);
+        const std::size_t remaining = end - begin;
+        if (remaining == 0) {
+            return false;
+        }
+
+        const std::size_t count = (remaining + 1) / 2;
+        stolenBegin = end - count;
+        stolenEnd = end;
+        end = stolenBegin;
+        return true;
+    }
+};
+
+bool Steal(std::vector<std::unique_ptr<WorkerQueue>>& queues, unsigned int self)
+{
+    // Try the other workers in order, starting with the next one
+    for (std::size_t i = 1; i < queues.size(); i++) {
+        WorkerQueue& victim = *queues[(self + i) % queues.size()];
+
+        std::size_t stolenBegin;
+        std::size_t stolenEnd;
+        if (victim.StealHalf(stolenBegin, stolenEnd)) {
+            WorkerQueue& own = *queues[self];
+            std::lock_guard lock(own.mutex);
+            own.begin = stolenBegin;
+            own.end = stolenEnd;
+            return true;
+        }
+    }
+
+    // Nothing is ever added, so once every queue is empty all work has been handed out
+    return false;
+}
+
+bool NextChunk(std::vector<std::unique_ptr<WorkerQueue>>& queues, unsigned int self, std::size_t& chunk)
+{
+    if (queues[self]->PopFront(chunk)) {
+        return true;
+    }
+
+    // Another thief can take the stolen chunks before they are popped, so keep stealing until nothing is left anywhere
+    while (Steal(queues, self)) {
+        if (queues[self]->PopFront(chunk)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+} // namespace
+
+void scheduler::ParallelFor(std::size_t count, unsigned int jobs, bool pin, const std::function<void(std::size_t, unsigned int)>& func)
+{
+    jobs = std::clamp<std::size_t>(jobs, 1, std::max<std::size_t>(count, 1));
+    if (jobs == 1) {
+        // The calling thread isn't pinned, threads it creates later would inherit its affinity
+        for (std::size_t i = 0; i < count; i++) {
+            func(i, 0);
+        }
+        return;
+    }
+
+    const std::size_t chunkSize = std::clamp<std::size_t>(count / (jobs * kChunksPerWorker), 1, kMaxChunkSize);
+    const std::size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+
+    // Start with one contiguous range of chunks per worker
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    for (unsigned int i = 0; i < jobs; i++) {
+        queues.push_back(std::make_unique<WorkerQueue>());
+        queues[i]->begin = chunkCount * i / jobs;
+        queues[i]->end = chunkCount * (i + 1) / jobs;
+    }
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < jobs; i++) {
+        workers.emplace_back([&queues, &func, count, chunkSize, pin, i]() {
+            NTAG_TRACE_THREAD_NAME("worker " + std::to_string(i));
+
+            if (pin) {
+                PinThread(i);
+            }
+
+            std::size_t chunk;
+            while (NextChunk(queues, i, chunk)) {
+                const std::size_t first = chunk * chunkSize;
+                const std::size_t last = std::min(first + chunkSize, count);
+                for (std::size_t j = first; j < last; j++) {
+                    func(j, i);
+                }
+            }
+        });
+    }
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+bool scheduler::PinThread(unsigned int cpu)
+{
+    const unsigned int cpuCount = std::max(1u, std::thread::hardware_concurrency());
+    cpu %= cpuCount;
+
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+    if (cpu >= sizeof(DWORD_PTR) * 8) {
+        return false;
+    }
+
+    return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace scheduler {
+
+// Calls func for every index in [0, count) using up to jobs threads
+// func also receives the index of the calling worker in [0, jobs), which can be used to access per thread state.
+// The indices are split into small chunks which are distributed over per worker queues, workers which run out
+// of work steal half of the remaining chunks of another worker, so uneven costs per index don't leave workers idle.
+// If pin is set, every worker is pinned to its own CPU. With a single job func runs on the calling thread, which isn't pinned.
+void ParallelFor(std::size_t count, unsigned int jobs, bool pin, const std::function<void(std::size_t, unsigned int)>& func);
+
+// Pins the calling thread to the specified CPU, returns false if this is not supported
+bool PinThread(unsigned int cpu);
+
+} // namespace scheduler
@@ -0,0 +1,452 @@
+#include "Server.hpp"
+#include "Batch.hpp"
+#include "Detect.hpp"
+#include "Keyring.hpp"
+#include "Tag.hpp"
+#include "TagEncryption.hpp"
+#include "signals.hpp"
+#include "stream.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define NTAG_HAS_UNIX_SOCKETS
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef NTAG_HAS_UNIX_SOCKETS
+
+namespace {
+
+// Receive buffer of every connection, many small pipelined requests are read with a single call
+constexpr std::size_t kReadBufferSize = 0x10000;
+// Interval in milliseconds in which the readers of closed connections are joined if no new clients connect
+constexpr int kCleanupInterval = 1000;
+
+struct Header {
+    std::uint32_t size;
+    std::uint32_t id;
+    std::uint8_t type;
+    std::uint8_t version;
+    std::uint16_t reserved;
+};
+
+Header ReadHeader(const std::span<const std::byte>& data)
+{
+    SpanStream stream(data, std::endian::little);
+    Header header;
+    stream >> header.size >> header.id >> header.type >> header.version >> header.reserved;
+    return header;
+}
+
+void WriteHeader(std::vector<std::byte>& data, const Header& header)
+{
+    VectorStream stream(data, std::endian::little);
+    stream << header.size << header.id << header.type << header.version << header.reserved;
+}
+
+struct Connection {
+    Connection(int fd)
+     : fd(fd), inFlight(0), done(false)
+    {
+    }
+
+    ~Connection()
+    {
+        close(fd);
+    }
+
+    // Sends the whole buffer, responses finished by different workers at the same time are never interleaved
+    void Send(const std::span<const std::byte>& data)
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+
+        std::size_t offset = 0;
+        while (offset < data.size()) {
+            const ssize_t res = send(fd, data.data() + offset, data.size() - offset, 0);
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+
+            // The client is gone, the reader notices as well
+            if (res <= 0) {
+                return;
+            }
+
+            offset += res;
+        }
+    }
+
+    int fd;
+    std::mutex writeMutex;
+
+    // Number of requests which were read but not answered yet
+    std::mutex mutex;
+    std::condition_variable answered;
+    unsigned int inFlight;
+
+    // Set once the client closed the connection and all its requests were answered
+    std::atomic<bool> done;
+};
+
+struct Job {
+    std::shared_ptr<Connection> connection;
+    Header header;
+    std::vector<std::byte> payload;
+};
+
+// Workers shared by all connections, every worker has its own crypto context
+class WorkerPool {
+public:
+    WorkerPool(Keyring& keyring, Cache* cache, unsigned int jobs)
+     : mStopping(false)
+    {
+        for (unsigned int i = 0; i < std::max(1u, jobs); i++) {
+            mWorkers.emplace_back([this, &keyring, cache, i]() {
+                NTAG_TRACE_THREAD_NAME("worker " + std::to_string(i));
+                batch::Context context(keyring);
+                if (cache) {
+                    context.SetCache(cache);
+                }
+                Work(context);
+            });
+        }
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+        }
+
+        mAvailable.notify_all();
+        for (std::thread& worker : mWorkers) {
+            worker.join();
+        }
+    }
+
+    void Push(Job&& job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mJobs.push_back(std::move(job));
+        }
+
+        mAvailable.notify_one();
+    }
+
+private:
+    void Work(batch::Context& context);
+
+    std::mutex mMutex;
+    std::condition_variable mAvailable;
+    std::deque<Job> mJobs;
+    bool mStopping;
+    std::vector<std::thread> mWorkers;
+};
+
+batch::Status GetInfo(batch::Context& context, const std::optional<std::uint32_t>& tagVersion, const std::span<const std::byte>& in, server::InfoPayload& info)
+{
+    std::shared_ptr<Tag> tag;
+    batch::Status status = batch::ParseTag(batch::OPERATION_DECRYPT, tagVersion, in, tag);
+    if (status != batch::STATUS_OK) {
+        return status;
+    }
+
+    // Info is requested for tags in any state, so the state is always detected
+    detect::State state;
+    const std::optional<std::size_t> index = batch::SelectKeys(context, *tag, detect::STATE_ENCRYPTED, true, state);
+    if (!index) {
+        return batch::STATUS_KEYS_FAILED;
+    }
+
+    info.version = tag->GetVersion();
+    info.state = state;
+    info.keyset = state != detect::STATE_UNKNOWN ? *index : server::kUnknownKeyset;
+    std::memcpy(info.uid, tag->GetData().data() + tag->GetUidOffset(), sizeof(info.uid));
+    if (state == detect::STATE_UNKNOWN) {
+        return batch::STATUS_HMAC_INVALID;
+    }
+
+    TagEncryption& encryption = context.encryptions[*index];
+    if (tag->IsEncrypted() && !encryption.DecryptTag()) {
+        return batch::STATUS_CRYPT_FAILED;
+    }
+
+    info.hmacs = (encryption.ValidateLockedSecretHMAC() ? 1 : 0) | (encryption.ValidateUnfixedInfosHMAC() ? 2 : 0);
+    return info.hmacs == 3 ? batch::STATUS_OK : batch::STATUS_HMAC_INVALID;
+}
+
+// Returns the response to a request, header included
+std::vector<std::byte> Process(batch::Context& context, const Header& request, const std::span<const std::byte>& payload)
+{
+    NTAG_TRACE_SCOPE("Request");
+
+    Header response{ 0, request.id, server::kInvalidRequest, 0, 0 };
+    std::vector<std::byte> out;
+
+    std::optional<std::uint32_t> tagVersion;
+    if (request.version != server::kDetectVersion) {
+        tagVersion = request.version;
+    }
+
+    if (!tagVersion || *tagVersion == 0 || *tagVersion == 2) {
+        switch (request.type) {
+            case server::REQUEST_DECRYPT:
+            case server::REQUEST_ENCRYPT:
+            case server::REQUEST_VERIFY: {
+                const batch::Operation operation = request.type == server::REQUEST_DECRYPT ? batch::OPERATION_DECRYPT :
+                    request.type == server::REQUEST_ENCRYPT ? batch::OPERATION_ENCRYPT : batch::OPERATION_VERIFY;
+                const batch::Status status = batch::ProcessTag(operation, tagVersion, context, payload, out);
+                if (!batch::ShouldWrite(operation, status)) {
+                    out.clear();
+                }
+
+                response.type = status;
+                break;
+            }
+            case server::REQUEST_INFO: {
+                server::InfoPayload info{};
+                response.type = GetInfo(context, tagVersion, payload, info);
+                out.resize(sizeof(info));
+                std::memcpy(out.data(), &info, sizeof(info));
+                break;
+            }
+        }
+    }
+
+    std::vector<std::byte> data;
+    data.reserve(server::kHeaderSize + out.size());
+    response.size = out.size();
+    WriteHeader(data, response);
+    data.insert(data.end(), out.begin(), out.end());
+    return data;
+}
+
+void WorkerPool::Work(batch::Context& context)
+{
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mAvailable.wait(lock, [this]() { return mStopping || !mJobs.empty(); });
+            if (mJobs.empty()) {
+                return;
+            }
+
+            job = std::move(mJobs.front());
+            mJobs.pop_front();
+        }
+
+        job.connection->Send(Process(context, job.header, job.payload));
+
+        {
+            std::lock_guard<std::mutex> lock(job.connection->mutex);
+            job.connection->inFlight--;
+        }
+
+        job.connection->answered.notify_all();
+    }
+}
+
+// Reads the requests of a connection until the client closes it and hands them to the workers
+void ReadRequests(const std::shared_ptr<Connection>& connection, WorkerPool& pool, unsigned int maxInFlight)
+{
+    std::vector<std::byte> buffer(kReadBufferSize);
+    std::size_t begin = 0;
+    std::size_t end = 0;
+    bool valid = true;
+    while (valid) {
+        // Queue every complete request in the buffer
+        while (end - begin >= server::kHeaderSize) {
+            const Header header = ReadHeader(std::span(buffer).subspan(begin, server::kHeaderSize));
+            if (header.size > server::kMaxPayloadSize) {
+                valid = false;
+                break;
+            }
+
+            if (end - begin < server::kHeaderSize + header.size) {
+                break;
+            }
+
+            {
+                std::unique_lock<std::mutex> lock(connection->mutex);
+                connection->answered.wait(lock, [&]() { return connection->inFlight < maxInFlight; });
+                connection->inFlight++;
+            }
+
+            const auto payload = buffer.begin() + begin + server::kHeaderSize;
+            pool.Push(Job{ connection, header, std::vector<std::byte>(payload, payload + header.size) });
+            begin += server::kHeaderSize + header.size;
+        }
+
+        if (!valid) {
+            break;
+        }
+
+        // Move the start of a partial request to the front, the buffer always fits a whole request
+        std::copy(buffer.begin() + begin, buffer.begin() + end, buffer.begin());
+        end -= begin;
+        begin = 0;
+
+        const ssize_t res = recv(connection->fd, buffer.data() + end, buffer.size() - end, 0);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (res <= 0) {
+            break;
+        }
+
+        end += res;
+    }
+
+    // Answer everything which was read before giving up the connection
+    std::unique_lock<std::mutex> lock(connection->mutex);
+    connection->answered.wait(lock, [&]() { return connection->inFlight == 0; });
+    shutdown(connection->fd, SHUT_RDWR);
+    connection->done = true;
+}
+
+struct Client {
+    std::shared_ptr<Connection> connection;
+    std::thread reader;
+};
+
+} // namespace
+
+bool server::IsAvailable()
+{
+    return true;
+}
+
+Result<void> server::Run(const Options& options)
+{
+    const std::string path = options.socketPath.string();
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        return std::unexpected(Error(Error::SERVER_SOCKET_FAILED));
+    }
+
+    std::copy(path.begin(), path.end(), address.sun_path);
+
+    // Replace a stale socket of a server which didn't shut down cleanly, but never the socket of one which is still running
+    if (std::filesystem::exists(options.socketPath)) {
+        const int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        const bool inUse = probe >= 0 && connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+        if (probe >= 0) {
+            close(probe);
+        }
+
+        if (inUse) {
+            return std::unexpected(Error(Error::SERVER_SOCKET_IN_USE));
+        }
+
+        unlink(path.c_str());
+    }
+
+    const int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        return std::unexpected(Error(Error::SERVER_SOCKET_FAILED));
+    }
+
+    if (bind(listenFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listenFd, SOMAXCONN) != 0) {
+        close(listenFd);
+        unlink(path.c_str());
+        return std::unexpected(Error(Error::SERVER_SOCKET_FAILED));
+    }
+
+    const signals::StopPipe stop;
+    if (stop.GetFd() < 0) {
+        close(listenFd);
+        unlink(path.c_str());
+        return std::unexpected(Error(Error::SERVER_SOCKET_FAILED));
+    }
+
+    // Write errors to clients which are gone are handled where they happen
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::vector<Client> clients;
+    {
+        WorkerPool pool(*options.keyring, options.cache.get(), options.jobs);
+
+        while (true) {
+            pollfd fds[2] = {
+                { listenFd, POLLIN, 0 },
+                { stop.GetFd(), POLLIN, 0 },
+            };
+
+            if (poll(fds, 2, kCleanupInterval) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                break;
+            }
+
+            if (fds[1].revents != 0) {
+                break;
+            }
+
+            if (fds[0].revents & POLLIN) {
+                const int fd = accept(listenFd, nullptr, nullptr);
+                if (fd >= 0) {
+                    std::shared_ptr<Connection> connection = std::make_shared<Connection>(fd);
+                    clients.push_back(Client{ connection, std::thread(ReadRequests, connection, std::ref(pool), std::max(1u, options.maxInFlight)) });
+                }
+            }
+
+            // Clean up after clients which disconnected
+            for (auto it = clients.begin(); it != clients.end();) {
+                if (it->connection->done) {
+                    it->reader.join();
+                    it = clients.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        // Stop reading new requests, the readers still wait for the answers to the ones they already read
+        for (Client& client : clients) {
+            shutdown(client.connection->fd, SHUT_RD);
+        }
+
+        for (Client& client : clients) {
+            client.reader.join();
+        }
+    }
+
+    close(listenFd);
+    unlink(path.c_str());
+    return {};
+}
+
+#else
+
+bool server::IsAvailable()
+{
+    return false;
+}
+
+Result<void> server::Run(const Options&)
+{
+    return std::unexpected(Error(Error::SERVER_NOT_SUPPORTED));
+}
+
+#endif
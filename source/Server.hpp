@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+
+#include "Error.hpp"
+
+class Cache;
+class Keyring;
+
+// Answers requests from other processes over a Unix domain socket, so the keys are loaded and prepared only once
+//
+// Every request and response is a 12 byte little endian header followed by size bytes of payload:
+//
+//   u32 size       Size of the payload
+//   u32 id         Chosen by the client, the response carries the id of its request
+//   u8  type       Request type for requests, batch::Status or kInvalidRequest for responses
+//   u8  version    Tag version of the request, kDetectVersion to detect the version and state, 0 in responses
+//   u16 reserved   0
+//
+// Clients can send any number of requests without waiting for the responses. Requests are processed in parallel,
+// so responses can arrive in a different order than the requests were sent in.
+namespace server {
+
+enum Request {
+    // Payload is the encrypted tag, responds with the decrypted tag
+    REQUEST_DECRYPT = 1,
+    // Payload is the decrypted tag, responds with the signed and encrypted tag
+    REQUEST_ENCRYPT = 2,
+    // Payload is the encrypted tag, responds with the status only
+    REQUEST_VERIFY = 3,
+    // Payload is the tag in any state, responds with an InfoPayload
+    REQUEST_INFO = 4,
+};
+
+constexpr std::size_t kHeaderSize = 12u;
+constexpr std::uint8_t kDetectVersion = 0xff;
+// Response type for unknown request types and versions
+constexpr std::uint8_t kInvalidRequest = 0xff;
+// Connections sending larger payloads are closed, since the stream can't be resynchronized
+constexpr std::uint32_t kMaxPayloadSize = 0x1000u;
+
+// Payload of the response to REQUEST_INFO
+struct InfoPayload {
+    std::uint8_t version;
+    // detect::State
+    std::uint8_t state;
+    // Index of the keyset in the order it was loaded, kUnknownKeyset if no keyset matched
+    std::uint8_t keyset;
+    // Bit 0 is set if the locked secret HMAC is valid, bit 1 if the unfixed infos HMAC is valid
+    std::uint8_t hmacs;
+    // The UID without the check byte
+    std::uint8_t uid[7];
+    std::uint8_t reserved;
+};
+
+static_assert(sizeof(InfoPayload) == 12);
+
+constexpr std::uint8_t kUnknownKeyset = 0xff;
+
+struct Options {
+    std::filesystem::path socketPath;
+    std::shared_ptr<Keyring> keyring;
+    // Shared by all workers, null to process every request
+    std::shared_ptr<Cache> cache;
+    // Number of worker threads shared by all connections
+    unsigned int jobs;
+    // Number of requests of a single connection which can be queued or processed at once, further requests are read
+    // only after earlier ones were answered, so a single client can't use up all memory
+    unsigned int maxInFlight;
+};
+
+// Returns whether the platform supports Unix domain sockets
+bool IsAvailable();
+
+// Serves requests until SIGINT or SIGTERM is received, all requests which were read are answered before returning
+// A stale socket file from a previous run is replaced, but a socket with a server still listening on it is not.
+Result<void> Run(const Options& options);
+
+} // namespace server
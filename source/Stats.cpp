@@ -0,0 +1,212 @@
+#include "Stats.hpp"
+#include "Archive.hpp"
+#include "Diff.hpp"
+#include "Keyring.hpp"
+#include "Scheduler.hpp"
+#include "Tag.hpp"
+#include "TagStore.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+namespace {
+
+// Number of tags which are read and decrypted before they are added to the store
+constexpr std::size_t kWindowSize = 1024;
+// Number of IDs printed
+constexpr std::size_t kTopIds = 10;
+
+void PrintBytes(std::ostream& out, const std::span<const std::byte>& data)
+{
+    out << std::hex << std::setfill('0');
+    for (std::byte b : data) {
+        out << std::setw(2) << std::to_integer<int>(b);
+    }
+    out << std::dec << std::setfill(' ');
+}
+
+} // namespace
+
+stats::Summary stats::Load(const Options& options, const std::filesystem::path& in, TagStore& store)
+{
+    const auto startTime = std::chrono::steady_clock::now();
+
+    Summary summary{};
+
+    const auto report = [&](const std::string& path, batch::Status status, const std::optional<Error>& error) {
+        summary.failed++;
+
+        std::cerr << path << ": " << batch::GetStatusString(status);
+        if (error) {
+            std::cerr << " (" << error->GetDescription() << " at offset 0x" << std::hex << error->GetOffset() << std::dec << ")";
+        }
+        std::cerr << "\n";
+    };
+
+    Result<std::unique_ptr<archive::Reader>> reader = archive::OpenReader(in);
+    if (!reader) {
+        report(in.string(), batch::STATUS_READ_FAILED, reader.error());
+        summary.elapsed = std::chrono::steady_clock::now() - startTime;
+        return summary;
+    }
+
+    batch::Context context(*options.keyring);
+    context.inputFormat = options.inputFormat;
+    context.inputLayout = options.inputLayout;
+    context.SetCache(options.cache.get());
+    std::vector<batch::Context> contexts(std::max(1u, options.jobs), context);
+
+    std::vector<archive::Entry> entries(kWindowSize);
+    std::vector<std::shared_ptr<Tag>> tags(kWindowSize);
+    std::vector<batch::Status> statuses(kWindowSize);
+    std::vector<std::optional<Error>> errors(kWindowSize);
+
+    for (bool more = true; more;) {
+        std::size_t count = 0;
+        while (count < kWindowSize) {
+            Result<bool> res = (*reader)->Next(entries[count]);
+            if (!res) {
+                summary.total++;
+                report(in.string(), batch::STATUS_READ_FAILED, res.error());
+            }
+
+            if (!res || !*res) {
+                more = false;
+                break;
+            }
+
+            count++;
+        }
+
+        scheduler::ParallelFor(count, options.jobs, options.pin, [&](std::size_t i, unsigned int worker) {
+            errors[i] = entries[i].error;
+            statuses[i] = entries[i].error ? batch::STATUS_READ_FAILED : diff::LoadTag(contexts[worker], options.tagVersion, entries[i].data, tags[i], &errors[i]);
+        });
+
+        // Adding keeps the order of the entries, so the store is the same for any number of workers
+        for (std::size_t i = 0; i < count; i++) {
+            summary.total++;
+            if (statuses[i] == batch::STATUS_OK) {
+                Result<void> res = store.Add(*tags[i]);
+                if (!res) {
+                    statuses[i] = batch::STATUS_PARSE_FAILED;
+                    errors[i] = res.error();
+                }
+            }
+
+            if (statuses[i] != batch::STATUS_OK) {
+                report(entries[i].path, statuses[i], errors[i]);
+            }
+
+            tags[i].reset();
+        }
+    }
+
+    summary.elapsed = std::chrono::steady_clock::now() - startTime;
+    return summary;
+}
+
+std::size_t stats::Verify(const TagStore& store, unsigned int jobs, bool pin)
+{
+    std::vector<std::optional<Error>> errors(store.GetSize());
+    std::vector<std::uint8_t> mismatches(store.GetSize());
+    scheduler::ParallelFor(store.GetSize(), jobs, pin, [&](std::size_t i, unsigned int) {
+        Result<std::vector<std::byte>> data = store.GetBytes(i);
+        if (!data) {
+            errors[i] = data.error();
+            return;
+        }
+
+        Result<std::shared_ptr<Tag>> tag = store.Materialize(i);
+        if (!tag) {
+            errors[i] = tag.error();
+            return;
+        }
+
+        mismatches[i] = (*tag)->ToBytes() != *data || (*tag)->IsEncrypted() != store.IsEncrypted(i);
+    });
+
+    std::size_t failed = 0;
+    for (std::size_t i = 0; i < store.GetSize(); i++) {
+        if (errors[i]) {
+            std::cerr << "Tag " << i << ": " << errors[i]->GetDescription() << " at offset 0x" << std::hex << errors[i]->GetOffset() << std::dec << "\n";
+            failed++;
+        } else if (mismatches[i]) {
+            std::cerr << "Tag " << i << ": Materialized tag differs from the stored data\n";
+            failed++;
+        }
+    }
+
+    return failed;
+}
+
+void stats::Print(const TagStore& store, std::ostream& out)
+{
+    const std::size_t size = store.GetSize();
+
+    std::map<std::uint32_t, std::size_t> versions;
+    for (std::uint8_t version : store.GetVersions()) {
+        versions[version]++;
+    }
+
+    out << "Tags: " << size;
+    for (const auto& [version, count] : versions) {
+        out << ", " << count << " version " << version;
+    }
+    out << "\n";
+
+    // Sorting a copy of the column groups equal UIDs, which is cheaper than hashing every one of them
+    std::vector<std::array<std::byte, 8>> uids = store.GetUids();
+    std::sort(uids.begin(), uids.end());
+    const std::size_t distinct = std::unique(uids.begin(), uids.end()) - uids.begin();
+    out << "Distinct UIDs: " << distinct << ", " << size - distinct << " duplicates\n";
+
+    const std::vector<std::uint16_t>& counters = store.GetWriteCounters();
+    if (!counters.empty()) {
+        std::uint64_t sum = 0;
+        for (std::uint16_t counter : counters) {
+            sum += counter;
+        }
+
+        const auto [min, max] = std::minmax_element(counters.begin(), counters.end());
+        out << "Write counter: min " << *min << ", mean " << static_cast<double>(sum) / counters.size() << ", max " << *max << "\n";
+    }
+
+    std::array<std::size_t, 8> bits{};
+    for (std::uint8_t flags : store.GetFlags()) {
+        for (std::size_t bit = 0; bit < bits.size(); bit++) {
+            bits[bit] += (flags >> bit) & 1;
+        }
+    }
+
+    out << "Flags:";
+    const char* separator = " ";
+    for (std::size_t bit = 0; bit < bits.size(); bit++) {
+        if (bits[bit] != 0) {
+            out << separator << "0x" << std::hex << (1u << bit) << std::dec << " set on " << bits[bit];
+            separator = ", ";
+        }
+    }
+    out << "\n";
+
+    std::map<std::array<std::byte, 8>, std::size_t> idCounts;
+    for (const std::array<std::byte, 8>& ids : store.GetIds()) {
+        idCounts[ids]++;
+    }
+
+    std::vector<std::pair<std::array<std::byte, 8>, std::size_t>> topIds(idCounts.begin(), idCounts.end());
+    const std::size_t top = std::min(kTopIds, topIds.size());
+    std::partial_sort(topIds.begin(), topIds.begin() + top, topIds.end(), [](const auto& a, const auto& b) { return a.second != b.second ? a.second > b.second : a.first < b.first; });
+
+    out << "Most common IDs:\n";
+    for (std::size_t i = 0; i < top; i++) {
+        out << "  ";
+        PrintBytes(out, topIds[i].first);
+        out << ": " << topIds[i].second << "\n";
+    }
+
+    const std::size_t memory = store.GetMemoryUsage();
+    out << "Store: " << memory << " bytes, " << (size != 0 ? static_cast<double>(memory) / size : 0.0) << " bytes per tag\n";
+}
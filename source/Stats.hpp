@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <ostream>
+
+#include "Dump.hpp"
+
+class Cache;
+class Keyring;
+class TagStore;
+
+namespace stats {
+
+struct Options {
+    // If empty, the version and whether a tag is encrypted are detected for every tag
+    std::optional<std::uint32_t> tagVersion;
+    // Format of the tags, detected for every tag if empty, and the layout of version 2 tags
+    std::optional<dump::Format> inputFormat;
+    dump::Layout inputLayout;
+    std::shared_ptr<Keyring> keyring;
+    // If set, decrypted tags are loaded from and stored in the cache, shared with decrypt
+    std::shared_ptr<Cache> cache;
+    // Number of worker threads
+    unsigned int jobs;
+    // Pin the workers to CPUs
+    bool pin;
+};
+
+struct Summary {
+    std::size_t total;
+    std::size_t failed;
+    std::chrono::duration<double> elapsed;
+};
+
+// Decrypts all tags of a directory or zip or tar archive into the store, a window of tags at a time
+// Only the tags of the current window are held as Tag objects, tags which fail to load are reported and left out.
+Summary Load(const Options& options, const std::filesystem::path& in, TagStore& store);
+
+// Materializes every tag of the store and checks that serializing it again gives the data it was stored with
+// Catches tags which don't survive being split into regions and compressed, returns the number of tags which failed.
+std::size_t Verify(const TagStore& store, unsigned int jobs, bool pin);
+
+// Prints the tag versions, duplicate UIDs, write counters, flags and most common IDs of the tags in the store
+void Print(const TagStore& store, std::ostream& out);
+
+} // namespace stats
@@ -0,0 +1,68 @@
+#include "Stress.hpp"
+#include "Batch.hpp"
+#include "Generator.hpp"
+#include "Keys.hpp"
+#include "Scheduler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace {
+
+struct SyntheticTag {
+    std::uint32_t version;
+    std::vector<std::byte> bytes;
+};
+
+} // namespace
+
+stress::Summary stress::Run(const Options& options)
+{
+    Generator generator(options.seed);
+
+    Result<std::shared_ptr<const Keys>> keys = Keys::FromKeyset(generator.GenerateKeyset());
+    if (!keys) {
+        return Summary{ 0, 0, {} };
+    }
+
+    std::vector<SyntheticTag> tags;
+    for (std::uint32_t i = 0; i < options.count; i++) {
+        const std::uint32_t version = (i & 1) ? 2 : 0;
+
+        std::optional<std::vector<std::byte>> bytes = generator.GenerateTag(version, **keys);
+        if (!bytes) {
+            return Summary{ 0, 0, {} };
+        }
+
+        tags.push_back(SyntheticTag{ version, std::move(*bytes) });
+    }
+
+    std::atomic<std::size_t> failed = 0;
+    std::vector<batch::Context> contexts(std::max(1u, options.jobs), batch::Context(**keys));
+
+    const auto startTime = std::chrono::steady_clock::now();
+
+    // Every iteration processes all tags again, so the contexts are rebound many times on every worker
+    scheduler::ParallelFor(tags.size() * options.iterations, options.jobs, options.pin, [&](std::size_t i, unsigned int worker) {
+        const SyntheticTag& tag = tags[i % tags.size()];
+
+        std::vector<std::byte> decrypted;
+        if (batch::ProcessTag(batch::OPERATION_DECRYPT, tag.version, contexts[worker], tag.bytes, decrypted) != batch::STATUS_OK) {
+            failed++;
+            return;
+        }
+
+        std::vector<std::byte> encrypted;
+        if (batch::ProcessTag(batch::OPERATION_ENCRYPT, tag.version, contexts[worker], decrypted, encrypted) != batch::STATUS_OK) {
+            failed++;
+            return;
+        }
+
+        if (encrypted != tag.bytes) {
+            failed++;
+        }
+    });
+
+    return Summary{ tags.size() * options.iterations, failed.load(), std::chrono::steady_clock::now() - startTime };
+}
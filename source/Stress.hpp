@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+
+namespace stress {
+
+struct Options {
+    // Number of worker threads
+    unsigned int jobs;
+    // Pin the workers to CPUs
+    bool pin;
+    // Number of synthetic tags
+    std::uint32_t count;
+    // Number of times every tag is processed
+    std::uint32_t iterations;
+    std::uint64_t seed;
+};
+
+struct Summary {
+    std::size_t total;
+    std::size_t failed;
+    std::chrono::duration<double> elapsed;
+};
+
+// Decrypts and re-encrypts synthetic tags on all workers at once, with every worker sharing the same keys
+// A round trip fails if the HMACs are not valid or the re-encrypted tag differs from the original one
+// Build with make SANITIZE=thread to check the concurrent paths for data races
+Summary Run(const Options& options);
+
+} // namespace stress
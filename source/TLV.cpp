@@ -1,15 +1,15 @@
 #include "TLV.hpp"
 #include "stream.hpp"
 
-#include <iostream>
 #include <cassert>
 
 TLV::TLV()
+ : mTag(TAG_NULL), mValueOffset(0)
 {
 }
 
 TLV::TLV(Tag tag, std::vector<std::byte> value)
- : mTag(tag), mValue(std::move(value))
+ : mTag(tag), mValue(std::move(value)), mValueOffset(0)
 {
 }
 
@@ -17,13 +17,15 @@ TLV::~TLV()
 {
 }
 
-std::vector<TLV> TLV::FromBytes(const std::span<std::byte>& data)
+Result<std::vector<TLV>> TLV::FromBytes(const std::span<std::byte>& data)
 {
     bool hasTerminator = false;
     std::vector<TLV> tlvs;
     SpanStream stream(data, std::endian::big);
 
     while (stream.GetRemaining() > 0 && !hasTerminator) {
+        const std::size_t tlvOffset = stream.GetPosition();
+
         // Read the tag
         uint8_t byte;
         stream >> byte;
@@ -51,20 +53,18 @@ std::vector<TLV> TLV::FromBytes(const std::span<std::byte>& data)
                     stream >> length;
                 }
 
+                const std::size_t valueOffset = stream.GetPosition();
                 std::vector<std::byte> value;
                 value.resize(length);
                 stream.Read(value);
 
-                tlvs.emplace_back(tag, value);
+                tlvs.emplace_back(tag, value).mValueOffset = valueOffset;
                 break;
             }
         }
 
         if (stream.GetError() != Stream::ERROR_OK) {
-            std::cerr << "Error: TLV parsing read past end of stream" << std::endl;
-            // Clear tlvs to prevent further havoc while parsing ndef data
-            tlvs.clear();
-            break;
+            return std::unexpected(Error(Error::TLV_READ_PAST_END, tlvOffset));
         }
     }
 
@@ -118,6 +118,11 @@ const std::vector<std::byte>& TLV::GetValue() const
     return mValue;
 }
 
+std::size_t TLV::GetValueOffset() const
+{
+    return mValueOffset;
+}
+
 void TLV::SetTag(Tag tag)
 {
     mTag = tag;
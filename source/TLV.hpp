@@ -4,6 +4,8 @@
 #include <span>
 #include <vector>
 
+#include "Error.hpp"
+
 class TLV {
 public:
     enum Tag {
@@ -20,11 +22,13 @@ public:
     TLV(Tag tag, std::vector<std::byte> value);
     virtual ~TLV();
 
-    static std::vector<TLV> FromBytes(const std::span<std::byte>& data);
+    static Result<std::vector<TLV>> FromBytes(const std::span<std::byte>& data);
     std::vector<std::byte> ToBytes() const;
 
     Tag GetTag() const;
     const std::vector<std::byte>& GetValue() const;
+    // Offset of the value in the data this TLV was parsed from
+    std::size_t GetValueOffset() const;
 
     void SetTag(Tag tag);
     void SetValue(const std::span<const std::byte>& value);
@@ -32,4 +36,5 @@ public:
 private:
     Tag mTag;
     std::vector<std::byte> mValue;
+    std::size_t mValueOffset;
 };
@@ -1,4 +1,6 @@
 #include "Tag.hpp"
+#include "TagV0.hpp"
+#include "TagV2.hpp"
 
 Tag::Tag()
  : mData()
@@ -9,6 +11,17 @@ Tag::~Tag()
 {
 }
 
+Result<std::shared_ptr<Tag>> Tag::FromBytes(std::uint32_t version, const std::span<const std::byte>& data)
+{
+    if (version == 0) {
+        return TagV0::FromBytes(data);
+    } else if (version == 2) {
+        return TagV2::FromBytes(data);
+    }
+
+    return std::unexpected(Error(Error::TAG_UNSUPPORTED_VERSION, 0));
+}
+
 bool Tag::IsEncrypted() const
 {
     return mIsEncrypted;
@@ -4,12 +4,18 @@
 #include <array>
 #include <span>
 #include <vector>
+#include <memory>
+
+#include "Error.hpp"
 
 class Tag {
 public:
     Tag();
     virtual ~Tag();
 
+    // Parses a tag of the specified version
+    static Result<std::shared_ptr<Tag>> FromBytes(std::uint32_t version, const std::span<const std::byte>& data);
+
     bool IsEncrypted() const;
     void SetEncrypted(bool encrypted);
 
@@ -3,14 +3,15 @@
 #include "Tag.hpp"
 #include "Keys.hpp"
 #include "crypto.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 
-#include <vector>
 #include <algorithm>
 
 namespace {
 
 // ccr_nfc way of generating internal keys
-bool GenerateKey(const std::span<const std::byte>& key, const std::span<const std::byte, 0xe>& name, const std::span<const std::byte, 0x40>& inData, const std::span<std::byte, 0x40>& outData)
+bool GenerateKey(const crypto::HmacKey& key, const std::span<const std::byte, 0xe>& name, const std::span<const std::byte, 0x40>& inData, const std::span<std::byte, 0x40>& outData)
 {
     // Create a buffer containing 2 counter bytes, the key name, and the key data
     std::uint16_t counter = 0;
@@ -39,8 +40,13 @@ bool GenerateKey(const std::span<const std::byte>& key, const std::span<const st
 
 } // namespace
 
-TagEncryption::TagEncryption(std::shared_ptr<Tag> tag, std::shared_ptr<Keys> keys)
- : mTag(std::move(tag)), mKeys(std::move(keys))
+TagEncryption::TagEncryption(const Keys& keys)
+ : mKeys(keys), mTag(nullptr), mHasInternalKeys(false)
+{
+}
+
+TagEncryption::TagEncryption(Tag& tag, const Keys& keys)
+ : mKeys(keys), mTag(&tag), mHasInternalKeys(false)
 {
 }
 
@@ -48,8 +54,30 @@ TagEncryption::~TagEncryption()
 {
 }
 
+void TagEncryption::Bind(Tag& tag)
+{
+    mTag = &tag;
+    mHasInternalKeys = false;
+}
+
+const Keys& TagEncryption::GetKeys() const
+{
+    return mKeys;
+}
+
 bool TagEncryption::InitializeInternalKeys()
 {
+    NTAG_TRACE_SCOPE("InitializeInternalKeys");
+
+    if (!mTag) {
+        return false;
+    }
+
+    // The derived keys only depend on plaintext parts of the tag, so they stay valid across encrypting and decrypting
+    if (mHasInternalKeys) {
+        return true;
+    }
+
     // Check for the supported tag versions
     if (mTag->GetVersion() != 0 && mTag->GetVersion() != 2) {
         return false;
@@ -63,11 +91,15 @@ bool TagEncryption::InitializeInternalKeys()
         return false;
     }
 
+    metrics::Increment(metrics::KEY_DERIVATIONS);
+    mHasInternalKeys = true;
     return true;
 }
 
 bool TagEncryption::ValidateLockedSecretHMAC()
 {
+    NTAG_TRACE_SCOPE("ValidateLockedSecretHMAC");
+
     if (mTag->IsEncrypted()) {
         return false;
     }
@@ -84,6 +116,8 @@ bool TagEncryption::ValidateLockedSecretHMAC()
 
 bool TagEncryption::ValidateUnfixedInfosHMAC()
 {
+    NTAG_TRACE_SCOPE("ValidateUnfixedInfosHMAC");
+
     if (mTag->IsEncrypted()) {
         return false;
     }
@@ -100,6 +134,8 @@ bool TagEncryption::ValidateUnfixedInfosHMAC()
 
 bool TagEncryption::UpdateLockedSecretHMAC()
 {
+    NTAG_TRACE_SCOPE("UpdateLockedSecretHMAC");
+
     if (mTag->IsEncrypted()) {
         return false;
     }
@@ -117,6 +153,8 @@ bool TagEncryption::UpdateLockedSecretHMAC()
 
 bool TagEncryption::UpdateUnfixedInfosHMAC()
 {
+    NTAG_TRACE_SCOPE("UpdateUnfixedInfosHMAC");
+
     if (mTag->IsEncrypted()) {
         return false;
     }
@@ -132,6 +170,16 @@ bool TagEncryption::UpdateUnfixedInfosHMAC()
     return true;
 }
 
+bool TagEncryption::UpdateHMACs(bool lockedSecret, bool unfixedInfos)
+{
+    // The locked secret HMAC is part of the unfixed infos HMAC data, so it needs to be updated first
+    if (lockedSecret && !UpdateLockedSecretHMAC()) {
+        return false;
+    }
+
+    return !unfixedInfos || UpdateUnfixedInfosHMAC();
+}
+
 bool TagEncryption::EncryptTag()
 {
     if (mTag->IsEncrypted()) {
@@ -164,13 +212,13 @@ bool TagEncryption::DecryptTag()
 
 bool TagEncryption::GenerateKeyGenSalt()
 {
-    // If we have the Nfc Key we can just decrypt using AES-CTR
-    if (mKeys->HasNfcKey()) {
-        return crypto::CryptAesCTR(mKeys->GetNfcKey(), mKeys->GetNfcNonce(), mTag->GetData(mTag->GetKeyGenSaltOffset(), 0x20), mKeyGenSalt);
+    // If we have the Nfc Key we can just decrypt using AES-CTR, its key schedule was already expanded when loading the keys
+    if (mKeys.HasNfcKey()) {
+        return crypto::CryptAesCTR(mKeys.GetNfcAesKey(), mKeys.GetNfcNonce(), mTag->GetData(mTag->GetKeyGenSaltOffset(), 0x20), mKeyGenSalt);
     }
 
     // Perform XOR with Xor pad
-    std::transform(mKeys->GetNfcXorPad().begin(), mKeys->GetNfcXorPad().end(), mTag->GetData(mTag->GetKeyGenSaltOffset(), 0x20).begin(), mKeyGenSalt.begin(), std::bit_xor<std::byte>());
+    std::transform(mKeys.GetNfcXorPad().begin(), mKeys.GetNfcXorPad().end(), mTag->GetData(mTag->GetKeyGenSaltOffset(), 0x20).begin(), mKeyGenSalt.begin(), std::bit_xor<std::byte>());
     return true;
 }
 
@@ -181,7 +229,7 @@ bool TagEncryption::GenerateInternalKeys()
     std::array<std::byte, 0x40> outBuffer{};
 
     // Fill the locked secret buffer
-    std::copy(mKeys->GetLockedSecretMagicBytes().begin(), mKeys->GetLockedSecretMagicBytes().end(), lockedSecretBuffer.begin());
+    std::copy(mKeys.GetLockedSecretMagicBytes().begin(), mKeys.GetLockedSecretMagicBytes().end(), lockedSecretBuffer.begin());
     if (mTag->GetVersion() == 0) {
         // For Version 0 this is the 16-byte Format Info: <https://wiiubrew.org/wiki/Rumble_U_NFC_Figures#Format_Info>
         std::copy_n(mTag->GetData().begin() + mTag->GetUidOffset(), 0x10, lockedSecretBuffer.begin() + 0x10);
@@ -195,7 +243,7 @@ bool TagEncryption::GenerateInternalKeys()
     std::copy(mKeyGenSalt.begin(), mKeyGenSalt.end(), lockedSecretBuffer.begin() + 0x20);
 
     // Generate the key output
-    if (!GenerateKey(mKeys->GetLockedSecretHmacKey(), mKeys->GetLockedSecretString(), lockedSecretBuffer, outBuffer)) {
+    if (!GenerateKey(mKeys.GetLockedSecretHmac(), mKeys.GetLockedSecretString(), lockedSecretBuffer, outBuffer)) {
         return false;
     }
 
@@ -210,7 +258,7 @@ bool TagEncryption::GenerateInternalKeys()
 
     // Fill the unfixed infos buffer
     std::copy_n(mTag->GetData().begin() + mTag->GetSeedOffset(), 2, unfixedInfosBuffer.begin());
-    std::copy_n(mKeys->GetUnfixedInfosMagicBytes().begin(), 0xe, unfixedInfosBuffer.begin() + 2);
+    std::copy_n(mKeys.GetUnfixedInfosMagicBytes().begin(), 0xe, unfixedInfosBuffer.begin() + 2);
     if (mTag->GetVersion() == 0) {
         // For Version 0 this is the 16-byte Format Info: <https://wiiubrew.org/wiki/Rumble_U_NFC_Figures#Format_Info>
         std::copy_n(mTag->GetData().begin() + mTag->GetUidOffset(), 0x10, unfixedInfosBuffer.begin() + 0x10);
@@ -224,7 +272,7 @@ bool TagEncryption::GenerateInternalKeys()
     std::copy(mKeyGenSalt.begin(), mKeyGenSalt.end(), unfixedInfosBuffer.begin() + 0x20);
 
     // Generate the key output
-    if (!GenerateKey(mKeys->GetUnfixedInfosHmacKey(), mKeys->GetUnfixedInfosString(), unfixedInfosBuffer, outBuffer)) {
+    if (!GenerateKey(mKeys.GetUnfixedInfosHmac(), mKeys.GetUnfixedInfosString(), unfixedInfosBuffer, outBuffer)) {
         return false;
     }
 
@@ -242,29 +290,23 @@ bool TagEncryption::GenerateInternalKeys()
 
 bool TagEncryption::CryptTag()
 {
-    std::vector<std::byte> cryptedLockedSecret;
-    std::vector<std::byte> cryptedUnfixedInfos;
+    NTAG_TRACE_SCOPE("CryptTag");
 
+    // AES-CTR can be done in place, which avoids allocating temporary buffers for every tag
     // Version 0 tags have an encrypted locked secret area
     if (mTag->GetVersion() == 0) {
-        cryptedLockedSecret.resize(mTag->GetLockedSecretSize());
-        if (!crypto::CryptAesCTR(mLockedSecretKey, mLockedSecretNonce, mTag->GetData(mTag->GetLockedSecretOffset(), mTag->GetLockedSecretSize()), cryptedLockedSecret)) {
+        const std::span<std::byte> lockedSecret = mTag->GetData(mTag->GetLockedSecretOffset(), mTag->GetLockedSecretSize());
+        if (!crypto::CryptAesCTR(mLockedSecretKey, mLockedSecretNonce, lockedSecret, lockedSecret)) {
             return false;
         }
     }
 
     // Crypt unfixed infos
-    cryptedUnfixedInfos.resize(mTag->GetUnfixedInfosSize());
-    if (!crypto::CryptAesCTR(mUnfixedInfosKey, mUnfixedInfosNonce, mTag->GetData(mTag->GetUnfixedInfosOffset(), mTag->GetUnfixedInfosSize()), cryptedUnfixedInfos)) {
+    const std::span<std::byte> unfixedInfos = mTag->GetData(mTag->GetUnfixedInfosOffset(), mTag->GetUnfixedInfosSize());
+    if (!crypto::CryptAesCTR(mUnfixedInfosKey, mUnfixedInfosNonce, unfixedInfos, unfixedInfos)) {
         return false;
     }
 
-    // Update tag data
-    if (mTag->GetVersion() == 0) {
-        std::copy(cryptedLockedSecret.begin(), cryptedLockedSecret.end(), mTag->GetData().begin() + mTag->GetLockedSecretOffset());
-    }
-    std::copy(cryptedUnfixedInfos.begin(), cryptedUnfixedInfos.end(), mTag->GetData().begin() + mTag->GetUnfixedInfosOffset());
-
     return true;
 }
 
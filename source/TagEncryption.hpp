@@ -1,25 +1,37 @@
 #pragma once
 
 #include <array>
-#include <memory>
 #include <span>
 
 
 class Tag;
 class Keys;
 
+// Holds the keys derived for a single tag
+// Keys are only ever read, so one Keys instance can be shared by any number of contexts on different threads.
+// A context itself is not thread safe, but can be reused for other tags by binding it again.
 class TagEncryption {
 public:
-    TagEncryption(std::shared_ptr<Tag> tag, std::shared_ptr<Keys> keys);
+    TagEncryption(const Keys& keys);
+    TagEncryption(Tag& tag, const Keys& keys);
     ~TagEncryption();
 
+    // Binds the context to a different tag, InitializeInternalKeys needs to be called again afterwards
+    // The tag needs to stay alive while it is bound
+    void Bind(Tag& tag);
+
+    // Derives the keys for the bound tag, does nothing if they were already derived since the last Bind
     bool InitializeInternalKeys();
 
+    const Keys& GetKeys() const;
+
     bool ValidateLockedSecretHMAC();
     bool ValidateUnfixedInfosHMAC();
 
     bool UpdateLockedSecretHMAC();
     bool UpdateUnfixedInfosHMAC();
+    // Updates the selected HMACs in the order they depend on each other, use this instead of updating both separately
+    bool UpdateHMACs(bool lockedSecret = true, bool unfixedInfos = true);
 
     bool EncryptTag();
     bool DecryptTag();
@@ -32,8 +44,9 @@ private:
     bool GenerateLockedSecretHMAC(const std::span<std::byte, 0x20>& hmac);
     bool GenerateUnfixedInfosHMAC(const std::span<std::byte, 0x20>& hmac);
 
-    std::shared_ptr<Tag> mTag;
-    std::shared_ptr<Keys> mKeys;
+    const Keys& mKeys;
+    Tag* mTag;
+    bool mHasInternalKeys;
 
     std::array<std::byte, 0x20> mKeyGenSalt;
 
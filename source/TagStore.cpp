@@ -0,0 +1,262 @@
+#include "TagStore.hpp"
+#include "Tag.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+
+#include <zlib.h>
+
+namespace {
+
+// Rows of a compressed column which are compressed together, materializing a tag decompresses one block per region
+constexpr std::size_t kBlockRows = 64;
+
+struct Range {
+    std::size_t offset;
+    std::size_t size;
+};
+
+// Ranges of the raw data every region of a tag version consists of, in order
+// Ranges past the end of a shorter dump are stored as zeros.
+struct Layout {
+    std::uint32_t version;
+    std::size_t size;
+    std::array<std::array<Range, 2>, TagStore::REGION_COUNT> regions;
+};
+
+constexpr std::array<Layout, 2> kLayouts = {{
+    {
+        0, 0x200, {{
+            { { { 0x000, 0x010 } } },
+            {},
+            {},
+            {},
+            { { { 0x010, 0x1f0 } } },
+            {},
+        }},
+    },
+    {
+        2, 0x21c, {{
+            { { { 0x000, 0x010 } } },
+            { { { 0x010, 0x024 } } },
+            { { { 0x034, 0x020 }, { 0x080, 0x020 } } },
+            { { { 0x054, 0x02c } } },
+            { { { 0x0a0, 0x168 } } },
+            { { { 0x208, 0x014 } } },
+        }},
+    },
+}};
+
+std::optional<std::size_t> GetLayoutIndex(std::uint32_t version)
+{
+    for (std::size_t i = 0; i < kLayouts.size(); i++) {
+        if (kLayouts[i].version == version) {
+            return i;
+        }
+    }
+
+    return std::nullopt;
+}
+
+} // namespace
+
+TagStore::TagStore(std::uint32_t compressedRegions)
+{
+    for (std::size_t layout = 0; layout < kLayouts.size(); layout++) {
+        for (std::size_t region = 0; region < REGION_COUNT; region++) {
+            Column& column = mColumns[layout][region];
+            for (const Range& range : kLayouts[layout].regions[region]) {
+                column.stride += range.size;
+            }
+
+            column.compressed = (compressedRegions & (1u << region)) != 0;
+        }
+    }
+}
+
+TagStore::~TagStore()
+{
+}
+
+Result<void> TagStore::Add(const Tag& tag)
+{
+    const std::optional<std::size_t> layoutIndex = GetLayoutIndex(tag.GetVersion());
+    if (!layoutIndex) {
+        return std::unexpected(Error::TAG_UNSUPPORTED_VERSION);
+    }
+
+    const Layout& layout = kLayouts[*layoutIndex];
+    const std::vector<std::byte> raw = tag.ToBytes();
+
+    for (std::size_t region = 0; region < REGION_COUNT; region++) {
+        Column& column = mColumns[*layoutIndex][region];
+        if (column.stride == 0) {
+            continue;
+        }
+
+        for (const Range& range : layout.regions[region]) {
+            const std::size_t available = std::min(range.size, raw.size() - std::min(range.offset, raw.size()));
+            column.open.insert(column.open.end(), raw.begin() + range.offset, raw.begin() + range.offset + available);
+            column.open.resize(column.open.size() + range.size - available);
+        }
+
+        column.rows++;
+        if (column.compressed && column.rows % kBlockRows == 0) {
+            // Blocks which don't get smaller, like those of the HMACs, are kept as they are and told apart by their size
+            uLongf size = compressBound(column.open.size());
+            std::vector<std::byte> block(size);
+            if (compress2(reinterpret_cast<Bytef*>(block.data()), &size, reinterpret_cast<const Bytef*>(column.open.data()), column.open.size(), Z_BEST_SPEED) == Z_OK && size < column.open.size()) {
+                block.resize(size);
+                block.shrink_to_fit();
+            } else {
+                block = column.open;
+            }
+
+            column.blocks.push_back(std::move(block));
+            column.open.clear();
+        }
+    }
+
+    const std::array<std::byte, 540>& data = tag.GetData();
+
+    mVersions.push_back(tag.GetVersion());
+    mEncrypted.push_back(tag.IsEncrypted());
+    mSizes.push_back(raw.size());
+    mRows.push_back(mColumns[*layoutIndex][REGION_HEADER].rows - 1);
+
+    std::array<std::byte, 8>& uid = mUids.emplace_back();
+    std::copy_n(data.begin() + tag.GetUidOffset(), uid.size(), uid.begin());
+
+    std::array<std::byte, 8>& ids = mIds.emplace_back();
+    std::copy_n(data.begin() + tag.GetLockedSecretOffset(), ids.size(), ids.begin());
+
+    const std::uint32_t seedOffset = tag.GetSeedOffset();
+    mWriteCounters.push_back((std::to_integer<std::uint16_t>(data[seedOffset]) << 8) | std::to_integer<std::uint16_t>(data[seedOffset + 1]));
+    mFlags.push_back(std::to_integer<std::uint8_t>(data[tag.GetUnfixedInfosOffset()]));
+
+    return {};
+}
+
+std::size_t TagStore::GetSize() const
+{
+    return mVersions.size();
+}
+
+const std::vector<std::uint8_t>& TagStore::GetVersions() const
+{
+    return mVersions;
+}
+
+const std::vector<std::array<std::byte, 8>>& TagStore::GetUids() const
+{
+    return mUids;
+}
+
+const std::vector<std::array<std::byte, 8>>& TagStore::GetIds() const
+{
+    return mIds;
+}
+
+const std::vector<std::uint16_t>& TagStore::GetWriteCounters() const
+{
+    return mWriteCounters;
+}
+
+const std::vector<std::uint8_t>& TagStore::GetFlags() const
+{
+    return mFlags;
+}
+
+bool TagStore::IsEncrypted(std::size_t index) const
+{
+    return mEncrypted[index] != 0;
+}
+
+Result<std::vector<std::byte>> TagStore::GetBytes(std::size_t index) const
+{
+    const std::size_t layoutIndex = *GetLayoutIndex(mVersions[index]);
+    const Layout& layout = kLayouts[layoutIndex];
+
+    std::vector<std::byte> raw(layout.size);
+    std::vector<std::byte> row;
+    for (std::size_t region = 0; region < REGION_COUNT; region++) {
+        const Column& column = mColumns[layoutIndex][region];
+        if (column.stride == 0) {
+            continue;
+        }
+
+        row.resize(column.stride);
+        Result<void> res = ReadRow(column, mRows[index], row);
+        if (!res) {
+            return std::unexpected(res.error());
+        }
+
+        std::size_t rowOffset = 0;
+        for (const Range& range : layout.regions[region]) {
+            std::copy_n(row.begin() + rowOffset, range.size, raw.begin() + range.offset);
+            rowOffset += range.size;
+        }
+    }
+
+    raw.resize(mSizes[index]);
+    return raw;
+}
+
+Result<std::shared_ptr<Tag>> TagStore::Materialize(std::size_t index) const
+{
+    Result<std::vector<std::byte>> raw = GetBytes(index);
+    if (!raw) {
+        return std::unexpected(raw.error());
+    }
+
+    Result<std::shared_ptr<Tag>> tag = Tag::FromBytes(mVersions[index], *raw);
+    if (tag) {
+        (*tag)->SetEncrypted(IsEncrypted(index));
+    }
+
+    return tag;
+}
+
+std::size_t TagStore::GetMemoryUsage() const
+{
+    std::size_t size = mVersions.size() * sizeof(mVersions[0]) + mEncrypted.size() * sizeof(mEncrypted[0])
+        + mSizes.size() * sizeof(mSizes[0]) + mRows.size() * sizeof(mRows[0]) + mUids.size() * sizeof(mUids[0])
+        + mIds.size() * sizeof(mIds[0]) + mWriteCounters.size() * sizeof(mWriteCounters[0]) + mFlags.size() * sizeof(mFlags[0]);
+
+    for (const std::array<Column, REGION_COUNT>& columns : mColumns) {
+        for (const Column& column : columns) {
+            size += column.open.size();
+            for (const std::vector<std::byte>& block : column.blocks) {
+                size += block.size() + sizeof(block);
+            }
+        }
+    }
+
+    return size;
+}
+
+Result<void> TagStore::ReadRow(const Column& column, std::size_t row, std::span<std::byte> out) const
+{
+    const std::size_t block = column.compressed ? row / kBlockRows : 0;
+    if (!column.compressed || block >= column.blocks.size()) {
+        const std::size_t openRow = column.compressed ? row % kBlockRows : row;
+        std::memcpy(out.data(), column.open.data() + openRow * column.stride, column.stride);
+        return {};
+    }
+
+    const std::vector<std::byte>& data = column.blocks[block];
+    if (data.size() == column.stride * kBlockRows) {
+        std::memcpy(out.data(), data.data() + (row % kBlockRows) * column.stride, column.stride);
+        return {};
+    }
+
+    std::vector<std::byte> rows(column.stride * kBlockRows);
+    uLongf size = rows.size();
+    if (uncompress(reinterpret_cast<Bytef*>(rows.data()), &size, reinterpret_cast<const Bytef*>(data.data()), data.size()) != Z_OK || size != rows.size()) {
+        return std::unexpected(Error::STORE_DECOMPRESS_FAILED);
+    }
+
+    std::memcpy(out.data(), rows.data() + (row % kBlockRows) * column.stride, column.stride);
+    return {};
+}
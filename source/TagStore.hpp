@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "Error.hpp"
+
+class Tag;
+
+// Columnar in-memory store of many tags for analytics, at a fraction of the memory of keeping the Tag objects around
+// The fields analytics look at are kept in one contiguous array each. The raw tag data is split into regions, every region
+// of a tag version is stored in an array of its own and can be compressed in blocks of rows. Tags are only parsed again
+// when they are materialized.
+class TagStore {
+public:
+    // Regions of the raw data of version 2 tags, version 0 tags only have a header and application region
+    enum Region {
+        // UID, lock bytes and capability container
+        REGION_HEADER,
+        // Write counter, flags, dates and nickname
+        REGION_SETTINGS,
+        // HMACs of the locked secret and the unfixed infos
+        REGION_HMACS,
+        // Model info and key generation salt
+        REGION_MODEL,
+        // Mii and application data, on version 0 tags all pages after the header
+        REGION_APPLICATION,
+        // Dynamic lock bytes, configuration pages and password, only present on 540 byte dumps
+        REGION_CONFIG,
+
+        REGION_COUNT,
+    };
+
+    // compressedRegions is a mask of 1 << Region
+    TagStore(std::uint32_t compressedRegions = 0);
+    virtual ~TagStore();
+
+    // Copies the fields and the raw data of the tag, not thread safe
+    Result<void> Add(const Tag& tag);
+
+    std::size_t GetSize() const;
+
+    // Columns of the fields, index i belongs to the i-th tag which was added
+    // The flags are encrypted on encrypted tags, everything else is readable either way.
+    const std::vector<std::uint8_t>& GetVersions() const;
+    // The 8 bytes at the UID offset of the tag
+    const std::vector<std::array<std::byte, 8>>& GetUids() const;
+    // The first 8 bytes of the locked secret, which hold the character and model IDs
+    const std::vector<std::array<std::byte, 8>>& GetIds() const;
+    const std::vector<std::uint16_t>& GetWriteCounters() const;
+    // The first byte of the unfixed infos
+    const std::vector<std::uint8_t>& GetFlags() const;
+
+    bool IsEncrypted(std::size_t index) const;
+
+    // Reassembles the raw data of a tag, decompressing the blocks of the compressed regions it is stored in
+    // May be called from multiple threads at once, as long as nothing is added.
+    Result<std::vector<std::byte>> GetBytes(std::size_t index) const;
+    // Parses the raw data of a tag again, the tag is encrypted if it was added encrypted
+    Result<std::shared_ptr<Tag>> Materialize(std::size_t index) const;
+
+    // Bytes held by all columns, without the space reserved for growing
+    std::size_t GetMemoryUsage() const;
+
+private:
+    // Rows of one region of one tag version, compressed columns are split into blocks of kBlockRows rows
+    struct Column {
+        std::size_t stride = 0;
+        std::size_t rows = 0;
+        bool compressed = false;
+        // Rows which aren't part of a compressed block yet, all rows if the column isn't compressed
+        std::vector<std::byte> open;
+        std::vector<std::vector<std::byte>> blocks;
+    };
+
+    Result<void> ReadRow(const Column& column, std::size_t row, std::span<std::byte> out) const;
+
+    std::vector<std::uint8_t> mVersions;
+    std::vector<std::uint8_t> mEncrypted;
+    std::vector<std::uint16_t> mSizes;
+    // Row of the tag in the columns of its version
+    std::vector<std::uint32_t> mRows;
+    std::vector<std::array<std::byte, 8>> mUids;
+    std::vector<std::array<std::byte, 8>> mIds;
+    std::vector<std::uint16_t> mWriteCounters;
+    std::vector<std::uint8_t> mFlags;
+
+    // Region columns of version 0 and version 2 tags
+    std::array<std::array<Column, REGION_COUNT>, 2> mColumns;
+};
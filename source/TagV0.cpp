@@ -1,8 +1,9 @@
 #include "TagV0.hpp"
 #include "TLV.hpp"
 #include "ndef.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 
-#include <iostream>
 #include <algorithm>
 
 namespace {
@@ -52,41 +53,43 @@ TagV0::~TagV0()
 {
 }
 
-std::shared_ptr<TagV0> TagV0::FromBytes(const std::span<const std::byte>& data)
+Result<std::shared_ptr<TagV0>> TagV0::FromBytes(const std::span<const std::byte>& data)
 {
+    NTAG_TRACE_SCOPE("TagV0::FromBytes");
+
     // Version 0 tags need at least 512 bytes
     if (data.size() != kTagSize) {
-        std::cerr << "Error: Version 0 tags should be " << kTagSize << " bytes in size" << std::endl;
-        return {};
+        return std::unexpected(Error(Error::TAG_V0_INVALID_SIZE, 0));
     }
 
     std::shared_ptr<TagV0> tag = std::make_shared<TagV0>();
 
     // Parse the locked area before continuing
     if (!tag->ParseLockedArea(data)) {
-        std::cerr << "Error: Failed to parse locked area" << std::endl;
-        return {};
+        return std::unexpected(Error(Error::TAG_V0_INVALID_LOCKED_AREA, kLockbyteBlock0 * sizeof(Block)));
     }
 
     // Now that the locked area is known, parse the data area
     std::vector<std::byte> dataArea;
     if (!tag->ParseDataArea(data, dataArea)) {
-        std::cerr << "Error: Failed to parse data area" << std::endl;
-        return {};
+        return std::unexpected(Error(Error::TAG_V0_INVALID_DATA_AREA, 0));
     }
 
     // The first few bytes in the dataArea make up the capability container
     std::copy_n(dataArea.begin(), tag->mCapabilityContainer.size(), std::as_writable_bytes(std::span(tag->mCapabilityContainer)).begin());
-    if (!tag->ValidateCapabilityContainer()) {
-        std::cerr << "Error: Failed to validate capability container" << std::endl;
-        return {};
+    if (Result<void> res = tag->ValidateCapabilityContainer(); !res) {
+        return std::unexpected(res.error().WithOffset(tag->DataAreaToTagOffset(res.error().GetOffset())));
     }
 
     // The rest of the dataArea contains the TLVs
-    tag->mTLVs = TLV::FromBytes(std::span(dataArea).subspan(tag->mCapabilityContainer.size()));
+    Result<std::vector<TLV>> tlvs = TLV::FromBytes(std::span(dataArea).subspan(tag->mCapabilityContainer.size()));
+    if (!tlvs) {
+        return std::unexpected(tlvs.error().WithOffset(tag->DataAreaToTagOffset(tag->mCapabilityContainer.size() + tlvs.error().GetOffset())));
+    }
+
+    tag->mTLVs = std::move(*tlvs);
     if (tag->mTLVs.empty()) {
-        std::cerr << "Error: Tag contains no TLVs" << std::endl;
-        return {};
+        return std::unexpected(Error(Error::TAG_V0_NO_TLVS, tag->DataAreaToTagOffset(tag->mCapabilityContainer.size())));
     }
 
     // Look for the NDEF tlv
@@ -99,19 +102,18 @@ std::shared_ptr<TagV0> TagV0::FromBytes(const std::span<const std::byte>& data)
     }
 
     if (ndefTlvIdx == static_cast<size_t>(-1)) {
-        std::cerr << "Error: Tag contains no NDEF TLV" << std::endl;
-        return {};
+        return std::unexpected(Error(Error::TAG_V0_NO_NDEF_TLV, tag->DataAreaToTagOffset(tag->mCapabilityContainer.size())));
     }
 
     const TLV& ndefTlv = tag->mTLVs[ndefTlvIdx];
+    const std::size_t ndefOffset = tag->mCapabilityContainer.size() + ndefTlv.GetValueOffset();
 
     // Parse the NDEF message
-    std::optional<ndef::Message> ndefMessage = ndef::Message::FromBytes(ndefTlv.GetValue());
+    Result<ndef::Message> ndefMessage = ndef::Message::FromBytes(ndefTlv.GetValue());
     if (!ndefMessage) {
-        std::cerr << "Error: Failed to parse NDEF message" << std::endl;
-        return {};
+        return std::unexpected(ndefMessage.error().WithOffset(tag->DataAreaToTagOffset(ndefOffset + ndefMessage.error().GetOffset())));
     }
-    tag->mNdefMessage = *ndefMessage;
+    tag->mNdefMessage = std::move(*ndefMessage);
 
     // Look for the unknown record which contains the data ntag cares about
     std::size_t payloadSize = 0;
@@ -125,8 +127,7 @@ std::shared_ptr<TagV0> TagV0::FromBytes(const std::span<const std::byte>& data)
     }
 
     if (payloadSize == 0) {
-        std::cerr << "Error: Tag doesn't contain NDEF payload" << std::endl;
-        return {};
+        return std::unexpected(Error(Error::TAG_V0_NO_NDEF_PAYLOAD, tag->DataAreaToTagOffset(ndefOffset)));
     }
 
     // Append locked data
@@ -140,15 +141,17 @@ std::shared_ptr<TagV0> TagV0::FromBytes(const std::span<const std::byte>& data)
     char noftMagic[4];
     std::copy_n(tag->GetData().begin() + 0x20, sizeof(noftMagic), std::as_writable_bytes(std::span(noftMagic)).begin());
     if (!std::equal(noftMagic, noftMagic + sizeof(noftMagic), "NOFT")) {
-        std::cerr << "Error: Tag doesn't contain NOFT magic" << std::endl;
-        return {};
+        return std::unexpected(Error(Error::TAG_V0_NO_NOFT_MAGIC, tag->DataAreaToTagOffset(ndefOffset)));
     }
 
+    metrics::Increment(metrics::TAGS_PARSED);
     return tag;
 }
 
 std::vector<std::byte> TagV0::ToBytes() const
 {
+    NTAG_TRACE_SCOPE("TagV0::ToBytes");
+
     // Create a copy of the ndef message
     std::size_t payloadSize = 0;
     ndef::Message ndefMessage = mNdefMessage;
@@ -194,8 +197,14 @@ std::vector<std::byte> TagV0::ToBytes() const
         dataArea.insert(dataArea.end(), tlvBytes.begin(), tlvBytes.end());
     }
 
-    // Make sure the dataArea is block size aligned
-    dataArea.resize((dataArea.size() + (sizeof(Block)-1)) & ~(sizeof(Block)-1));
+    // Pad the dataArea to cover all unlocked blocks (the padding is parsed as NULL TLVs)
+    std::size_t dataAreaBlockCount = 0;
+    for (std::uint8_t currentBlock = 0; currentBlock < kMaxBlockCount; currentBlock++) {
+        if (!IsBlockLocked(currentBlock)) {
+            dataAreaBlockCount++;
+        }
+    }
+    dataArea.resize(dataAreaBlockCount * sizeof(Block));
 
     // The rest will be the data area
     auto dataIterator = dataArea.begin();
@@ -207,6 +216,7 @@ std::vector<std::byte> TagV0::ToBytes() const
         }
     }
 
+    metrics::Increment(metrics::TAGS_WRITTEN);
     return bytes;
 }
 
@@ -343,26 +353,40 @@ bool TagV0::ParseDataArea(const std::span<const std::byte>& data, std::vector<st
     return true;
 }
 
-bool TagV0::ValidateCapabilityContainer()
+Result<void> TagV0::ValidateCapabilityContainer()
 {
     std::uint8_t nmn = mCapabilityContainer[0]; // NDEF Magic Number
     std::uint8_t vno = mCapabilityContainer[1]; // Version Number
     std::uint8_t tms = mCapabilityContainer[2]; // Tag memory size
 
     if (nmn != kNDEFMagicNumber) {
-        std::cerr << "Error: CC: Invalid NDEF Magic Number" << std::endl;
-        return false;
+        return std::unexpected(Error(Error::TAG_V0_CC_INVALID_MAGIC, 0));
     }
 
     if (vno >> 4 != 1) {
-        std::cerr << "Error: CC: Invalid Version Number" << std::endl;
-        return false;
+        return std::unexpected(Error(Error::TAG_V0_CC_INVALID_VERSION, 1));
     }
 
     if (8u * (tms + 1) < kTagSize) {
-        std::cerr << "Error: CC: Incomplete tag memory size" << std::endl;
-        return false;
+        return std::unexpected(Error(Error::TAG_V0_CC_INCOMPLETE_SIZE, 2));
     }
 
-    return true;
+    return {};
+}
+
+std::size_t TagV0::DataAreaToTagOffset(std::size_t offset) const
+{
+    // Find the unlocked block containing the offset
+    std::size_t dataAreaBlock = 0;
+    for (std::uint8_t currentBlock = 0; currentBlock < kMaxBlockCount; currentBlock++) {
+        if (!IsBlockLocked(currentBlock)) {
+            if (dataAreaBlock == offset / sizeof(Block)) {
+                return currentBlock * sizeof(Block) + offset % sizeof(Block);
+            }
+
+            dataAreaBlock++;
+        }
+    }
+
+    return kTagSize;
 }
@@ -4,6 +4,7 @@
 #include <span>
 #include <map>
 
+#include "Error.hpp"
 #include "Tag.hpp"
 #include "TLV.hpp"
 #include "ndef.hpp"
@@ -16,7 +17,7 @@ public:
     TagV0();
     virtual ~TagV0();
 
-    static std::shared_ptr<TagV0> FromBytes(const std::span<const std::byte>& data);
+    static Result<std::shared_ptr<TagV0>> FromBytes(const std::span<const std::byte>& data);
     virtual std::vector<std::byte> ToBytes() const override;
 
     virtual std::uint32_t GetVersion() const override;
@@ -35,7 +36,9 @@ private:
     bool ParseLockedArea(const std::span<const std::byte>& data);
     bool IsBlockLocked(std::uint8_t blockIdx) const;
     bool ParseDataArea(const std::span<const std::byte>& data, std::vector<std::byte>& dataArea);
-    bool ValidateCapabilityContainer();
+    Result<void> ValidateCapabilityContainer();
+    // Converts an offset into the data area to an offset into the raw tag data
+    std::size_t DataAreaToTagOffset(std::size_t offset) const;
 
     std::map<std::uint8_t, Block> mLockedOrReservedBlocks;
     std::map<std::uint8_t, Block> mLockedBlocks;
@@ -1,7 +1,9 @@
 #include "TagV2.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 
-#include <iostream>
 #include <algorithm>
+#include <array>
 
 namespace {
 
@@ -11,6 +13,44 @@ constexpr std::size_t kTagSize0 = 0x214u;
 constexpr std::size_t kTagSize1 = 0x21cu;
 // Amiibo Magic
 constexpr std::uint8_t kTagMagic = 0xa5;
+// Size of the tag data excluding the lock- and CFG- bytes
+constexpr std::size_t kDataSize = 0x208u;
+
+// Where the regions of the tag data are stored in the internal layout, everything from the data size on stays where it is
+struct Region {
+    std::size_t tagOffset;
+    std::size_t internalOffset;
+    std::size_t size;
+};
+
+constexpr std::array<Region, 7> kRegions = {{
+    // UID
+    { 0x000, 0x1d4, 0x008 },
+    // Lock and capability container bytes
+    { 0x008, 0x000, 0x008 },
+    // Magic, write counter and the start of the unfixed infos
+    { 0x010, 0x028, 0x024 },
+    // Locked secret HMAC
+    { 0x034, 0x1b4, 0x020 },
+    // Locked secret and key gen salt
+    { 0x054, 0x1dc, 0x02c },
+    // Unfixed infos HMAC
+    { 0x080, 0x008, 0x020 },
+    // Rest of the unfixed infos
+    { 0x0a0, 0x04c, 0x168 },
+}};
+
+// Copies data of the size of a raw tag from one layout to the other, out needs to be at least as large as the data
+void ConvertLayout(const std::span<const std::byte>& data, std::byte* out, bool toInternal)
+{
+    for (const Region& region : kRegions) {
+        const std::size_t from = toInternal ? region.tagOffset : region.internalOffset;
+        const std::size_t to = toInternal ? region.internalOffset : region.tagOffset;
+        std::copy_n(data.begin() + from, region.size, out + to);
+    }
+
+    std::copy(data.begin() + kDataSize, data.end(), out + kDataSize);
+}
 
 }
 
@@ -23,17 +63,17 @@ TagV2::~TagV2()
 {
 }
 
-std::shared_ptr<TagV2> TagV2::FromBytes(const std::span<const std::byte>& data)
+Result<std::shared_ptr<TagV2>> TagV2::FromBytes(const std::span<const std::byte>& data)
 {
+    NTAG_TRACE_SCOPE("TagV2::FromBytes");
+
     if (data.size() != kTagSize0 && data.size() != kTagSize1) {
-        std::cerr << "Error: Version 2 tags should be at either " << kTagSize0 << " or " << kTagSize1 << " bytes in size" << std::endl;
-        return {};
+        return std::unexpected(Error(Error::TAG_V2_INVALID_SIZE, 0));
     }
 
     // Check for the amiibo magic
     if (data[0x10] != std::byte(kTagMagic)) {
-        std::cerr << "Error: Version 2 tag doesn't contain tag magic. Not a valid tag?" << std::endl;
-        return {};
+        return std::unexpected(Error(Error::TAG_V2_NO_MAGIC, 0x10));
     }
 
     std::shared_ptr<TagV2> tag = std::make_shared<TagV2>();
@@ -42,46 +82,44 @@ std::shared_ptr<TagV2> TagV2::FromBytes(const std::span<const std::byte>& data)
     tag->mOriginalFileSize = data.size();
 
     // Convert data to internal layout
-    std::copy_n(data.begin(), 8, tag->mData.begin() + tag->GetUidOffset());
-    std::copy_n(data.begin() + 8, 8, tag->mData.begin());
-    std::copy_n(data.begin() + 0x10, 4, tag->mData.begin() + 0x28);
-    std::copy_n(data.begin() + 0x14, 0x20, tag->mData.begin() + tag->GetUnfixedInfosOffset());
-    std::copy_n(data.begin() + 0x34, 0x20, tag->mData.begin() + tag->GetLockedSecretHmacOffset());
-    std::copy_n(data.begin() + 0x54, 0xc, tag->mData.begin() + tag->GetLockedSecretOffset());
-    std::copy_n(data.begin() + 0x60, 0x20, tag->mData.begin() + tag->GetKeyGenSaltOffset());
-    std::copy_n(data.begin() + 0x80, 0x20, tag->mData.begin() + tag->GetUnfixedInfosHmacOffset());
-    std::copy_n(data.begin() + 0xa0, 0x168, tag->mData.begin() + tag->GetUnfixedInfosOffset() + 0x20);
-
-    if (data.size() ==  kTagSize1) {
-        std::copy_n(data.begin() + 0x208, 0x14, tag->mData.begin() + 0x208);
-    } else {
-        std::copy_n(data.begin() + 0x208, 0xc, tag->mData.begin() + 0x208);
-    }
+    ConvertLayout(data, tag->mData.data(), true);
 
+    metrics::Increment(metrics::TAGS_PARSED);
     return tag;
 }
 
 std::vector<std::byte> TagV2::ToBytes() const
 {
+    NTAG_TRACE_SCOPE("TagV2::ToBytes");
+
     std::vector<std::byte> bytes(mOriginalFileSize);
 
     // Convert internal layout back to tag data
-    std::copy_n(mData.begin(), 8, bytes.begin() + 8);
-    std::copy_n(mData.begin() + GetUnfixedInfosHmacOffset(), 0x20, bytes.begin() + 0x80);
-    std::copy_n(mData.begin() + 0x28, 4, bytes.begin() + 0x10);
-    std::copy_n(mData.begin() + GetUnfixedInfosOffset(), 0x20, bytes.begin() + 0x14);
-    std::copy_n(mData.begin() + GetUnfixedInfosOffset() + 0x20, 0x168, bytes.begin() + 0xa0);
-    std::copy_n(mData.begin() + GetLockedSecretHmacOffset(), 0x20, bytes.begin() + 0x34);
-    std::copy_n(mData.begin() + GetUidOffset(), 8, bytes.begin());
-    std::copy_n(mData.begin() + GetLockedSecretOffset(), 0xc, bytes.begin() + 0x54);
-    std::copy_n(mData.begin() + GetKeyGenSaltOffset(), 0x20, bytes.begin() + 0x60);
-
-    if (mOriginalFileSize == kTagSize1) {
-        std::copy_n(mData.begin() + 0x208, 0x14, bytes.begin() + 0x208);
-    } else {
-        std::copy_n(mData.begin() + 0x208, 0xc, bytes.begin() + 0x208);
+    ConvertLayout(std::span(mData).first(mOriginalFileSize), bytes.data(), false);
+
+    metrics::Increment(metrics::TAGS_WRITTEN);
+    return bytes;
+}
+
+Result<std::vector<std::byte>> TagV2::ToInternalLayout(const std::span<const std::byte>& data)
+{
+    if (data.size() != kTagSize0 && data.size() != kTagSize1) {
+        return std::unexpected(Error(Error::TAG_V2_INVALID_SIZE, 0));
+    }
+
+    std::vector<std::byte> bytes(data.size());
+    ConvertLayout(data, bytes.data(), true);
+    return bytes;
+}
+
+Result<std::vector<std::byte>> TagV2::FromInternalLayout(const std::span<const std::byte>& data)
+{
+    if (data.size() != kTagSize0 && data.size() != kTagSize1) {
+        return std::unexpected(Error(Error::TAG_V2_INVALID_SIZE, 0));
     }
 
+    std::vector<std::byte> bytes(data.size());
+    ConvertLayout(data, bytes.data(), false);
     return bytes;
 }
 
@@ -94,8 +132,7 @@ std::uint32_t TagV2::GetVersion() const
 
 std::uint32_t TagV2::GetDataSize() const
 {
-    // This is the size of the tag data excluding the lock- and CFG- bytes
-    return 0x208;
+    return kDataSize;
 }
 
 std::uint32_t TagV2::GetSeedOffset() const
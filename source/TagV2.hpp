@@ -3,6 +3,7 @@
 #include <memory>
 #include <span>
 
+#include "Error.hpp"
 #include "Tag.hpp"
 
 class TagV2 : public Tag {
@@ -10,9 +11,14 @@ public:
     TagV2();
     virtual ~TagV2();
 
-    static std::shared_ptr<TagV2> FromBytes(const std::span<const std::byte>& data);
+    static Result<std::shared_ptr<TagV2>> FromBytes(const std::span<const std::byte>& data);
     virtual std::vector<std::byte> ToBytes() const override;
 
+    // Converts raw tag data to the internal layout and back, without parsing or crypting anything
+    // amiitool and 3DS tools store decrypted tags in the internal layout. The bytes after the tag data are the same in both.
+    static Result<std::vector<std::byte>> ToInternalLayout(const std::span<const std::byte>& data);
+    static Result<std::vector<std::byte>> FromInternalLayout(const std::span<const std::byte>& data);
+
     virtual std::uint32_t GetVersion() const override;
     virtual std::uint32_t GetDataSize() const override;
     virtual std::uint32_t GetSeedOffset() const override;
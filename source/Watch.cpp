@@ -0,0 +1,257 @@
+#include "Watch.hpp"
+#include "signals.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+#if defined(__linux__) && __has_include(<sys/inotify.h>)
+#define NTAG_HAS_INOTIFY
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#ifdef NTAG_HAS_INOTIFY
+
+namespace {
+
+// Files are picked up once they were closed after writing or moved in, so partially written files are never read
+// New directories are watched as well.
+constexpr std::uint32_t kWatchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE;
+constexpr std::size_t kEventBufferSize = 0x10000;
+
+class Watcher {
+public:
+    Watcher(const std::filesystem::path& inDir)
+     : mInDir(inDir), mFd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+    {
+    }
+
+    ~Watcher()
+    {
+        if (mFd >= 0) {
+            close(mFd);
+        }
+    }
+
+    int GetFd() const
+    {
+        return mFd;
+    }
+
+    // Watches the directory and all of its subdirectories, their files are added to pending if addFiles is set
+    bool AddDirectory(const std::filesystem::path& relative, bool addFiles, std::set<std::filesystem::path>& pending)
+    {
+        const int wd = inotify_add_watch(mFd, (mInDir / relative).c_str(), kWatchMask);
+        if (wd < 0) {
+            return false;
+        }
+
+        mDirectories[wd] = relative;
+
+        // Files can be created before the watch was added, so new directories are scanned once
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(mInDir / relative, ec)) {
+            if (entry.is_directory()) {
+                AddDirectory(relative / entry.path().filename(), addFiles, pending);
+            } else if (addFiles && entry.is_regular_file()) {
+                pending.insert(relative / entry.path().filename());
+            }
+        }
+
+        return true;
+    }
+
+    // Reads all queued events, files which were written are added to pending
+    // The descriptor is non-blocking, so this returns once the queue is drained. A signal returns early as well, the
+    // remaining events are read on the next call after the stop pipe was checked.
+    void ReadEvents(std::set<std::filesystem::path>& pending)
+    {
+        alignas(inotify_event) char buffer[kEventBufferSize];
+        while (true) {
+            const ssize_t size = read(mFd, buffer, sizeof(buffer));
+            if (size <= 0) {
+                return;
+            }
+
+            for (ssize_t offset = 0; offset < size;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+                HandleEvent(*event, pending);
+            }
+        }
+    }
+
+private:
+    void HandleEvent(const inotify_event& event, std::set<std::filesystem::path>& pending)
+    {
+        if (event.mask & IN_Q_OVERFLOW) {
+            // Events were lost, so every file could have changed
+            std::cerr << "Too many events, processing all files again" << std::endl;
+            AddDirectory({}, true, pending);
+            return;
+        }
+
+        auto it = mDirectories.find(event.wd);
+        if (it == mDirectories.end()) {
+            return;
+        }
+
+        if (event.mask & IN_IGNORED) {
+            // The directory was removed
+            mDirectories.erase(it);
+            return;
+        }
+
+        if (event.len == 0) {
+            return;
+        }
+
+        const std::filesystem::path path = it->second / event.name;
+        if (event.mask & IN_ISDIR) {
+            if (event.mask & (IN_CREATE | IN_MOVED_TO)) {
+                AddDirectory(path, true, pending);
+            }
+        } else if (event.mask & IN_MOVED_FROM) {
+            // Usually a temporary file which is renamed once it is complete
+            pending.erase(path);
+        } else if (event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+            pending.insert(path);
+        }
+    }
+
+    std::filesystem::path mInDir;
+    int mFd;
+    // Paths relative to the input directory
+    std::unordered_map<int, std::filesystem::path> mDirectories;
+};
+
+bool IsInside(const std::filesystem::path& path, const std::filesystem::path& dir)
+{
+    const std::filesystem::path canonicalPath = std::filesystem::weakly_canonical(path);
+    const std::filesystem::path canonicalDir = std::filesystem::weakly_canonical(dir);
+    const auto [dirEnd, pathEnd] = std::mismatch(canonicalDir.begin(), canonicalDir.end(), canonicalPath.begin(), canonicalPath.end());
+    return dirEnd == canonicalDir.end();
+}
+
+void ProcessBatch(const watch::Options& options, std::vector<batch::Context>& contexts, const std::set<std::filesystem::path>& pending, const std::filesystem::path& inDir, const std::filesystem::path& outDir)
+{
+    NTAG_TRACE_SCOPE("ProcessBatch");
+
+    const auto startTime = std::chrono::steady_clock::now();
+
+    // Files which were removed again in the meantime don't need to be reported
+    std::vector<std::filesystem::path> files;
+    for (const std::filesystem::path& path : pending) {
+        std::error_code ec;
+        if (std::filesystem::is_regular_file(inDir / path, ec)) {
+            files.push_back(path);
+        }
+    }
+
+    if (files.empty()) {
+        return;
+    }
+
+    std::size_t failed = 0;
+    std::mutex outputMutex;
+    batch::ProcessFiles(options.batch, contexts, files, inDir, outDir, [&](std::size_t i, batch::Status status, const std::optional<Error>& error) {
+        if (status == batch::STATUS_OK) {
+            return;
+        }
+
+        batch::CountFailure(status);
+
+        std::lock_guard lock(outputMutex);
+        failed++;
+        std::cerr << files[i].string() << ": " << batch::GetStatusString(status);
+        if (error) {
+            std::cerr << " (" << error->GetDescription() << " at offset 0x" << std::hex << error->GetOffset() << std::dec << ")";
+        }
+        std::cerr << "\n";
+    });
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    std::cout << "Processed " << files.size() << " tags in " << elapsed.count() << "s, " << failed << " failed" << std::endl;
+}
+
+} // namespace
+
+bool watch::IsAvailable()
+{
+    return true;
+}
+
+Result<void> watch::Run(const Options& options, const std::filesystem::path& inDir, const std::filesystem::path& outDir)
+{
+    if (IsInside(outDir, inDir)) {
+        return std::unexpected(Error(Error::WATCH_OUTPUT_INSIDE_INPUT));
+    }
+
+    const signals::StopPipe stop;
+    Watcher watcher(inDir);
+    std::set<std::filesystem::path> pending;
+    if (stop.GetFd() < 0 || watcher.GetFd() < 0 || !watcher.AddDirectory({}, false, pending)) {
+        return std::unexpected(Error(Error::WATCH_FAILED));
+    }
+
+    // Created once, so the derived keys and keyset hints are reused by every batch
+    std::vector<batch::Context> contexts(std::max(1u, options.batch.jobs), batch::Context(options.batch));
+    batch::MetricsReporter reporter(options.batch);
+
+    std::chrono::steady_clock::time_point deadline;
+    bool stopping = false;
+    while (!stopping) {
+        // Wait for the window to close if there are files, otherwise for the next event
+        int timeout = -1;
+        if (!pending.empty()) {
+            timeout = std::max<int>(0, std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+        }
+
+        pollfd fds[2] = {
+            { watcher.GetFd(), POLLIN, 0 },
+            { stop.GetFd(), POLLIN, 0 },
+        };
+
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+            return std::unexpected(Error(Error::WATCH_FAILED));
+        }
+
+        // Files which were already picked up are still processed before stopping
+        stopping = fds[1].revents != 0;
+
+        if (fds[0].revents & POLLIN) {
+            const bool wasEmpty = pending.empty();
+            watcher.ReadEvents(pending);
+            if (wasEmpty && !pending.empty()) {
+                deadline = std::chrono::steady_clock::now() + options.window;
+            }
+        }
+
+        if (!pending.empty() && (stopping || std::chrono::steady_clock::now() >= deadline)) {
+            ProcessBatch(options, contexts, pending, inDir, outDir);
+            pending.clear();
+        }
+    }
+
+    return {};
+}
+
+#else
+
+bool watch::IsAvailable()
+{
+    return false;
+}
+
+Result<void> watch::Run(const Options&, const std::filesystem::path&, const std::filesystem::path&)
+{
+    return std::unexpected(Error(Error::WATCH_NOT_SUPPORTED));
+}
+
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+
+#include "Batch.hpp"
+#include "Error.hpp"
+
+// Processes files as soon as they are written to a directory, instead of scanning the whole directory again
+namespace watch {
+
+struct Options {
+    // Only the operation, keys and number of jobs are used, files are always processed by the parallel executor
+    batch::Options batch;
+    // Files written within this time after the first one are processed together
+    std::chrono::milliseconds window;
+};
+
+// Returns whether watching directories is supported on this platform
+bool IsAvailable();
+
+// Processes every file which is written to or moved into inDir or one of its subdirectories until SIGINT or SIGTERM
+// is received, the results are stored with the same relative paths in outDir. Files which were already in inDir are
+// left alone. The worker contexts are kept for the whole run, so the keys stay warm between batches.
+// outDir can't be inside of inDir, since every result would trigger processing it again.
+Result<void> Run(const Options& options, const std::filesystem::path& inDir, const std::filesystem::path& outDir);
+
+} // namespace watch
@@ -1,17 +1,145 @@
 #include "crypto.hpp"
+#include "metrics.hpp"
 
 #include <cstdint>
 #include <array>
 
 #include <mbedtls/aes.h>
 #include <mbedtls/md.h>
+#include <mbedtls/sha256.h>
 
-bool crypto::CryptAesCTR(const std::span<const std::byte>& key, const std::span<const std::byte, 0x10>& nonce, const std::span<const std::byte>& inData, const std::span<std::byte>& outData)
+namespace {
+
+constexpr std::size_t kSha256BlockSize = 0x40;
+
+// Shared by the keys which are only used once and the ones with a cached key schedule
+// mbedtls only reads the context while crypting, so it can be shared between threads.
+bool CryptCTR(const mbedtls_aes_context& ctx, const std::span<const std::byte, 0x10>& nonce, const std::span<const std::byte>& inData, const std::span<std::byte>& outData)
 {
     if (inData.size() != outData.size()) {
         return false;
     }
 
+    // Create a copy of the nonce since mbedtls will modify it
+    std::array<std::byte, 0x10> _nonce;
+    std::copy(nonce.begin(), nonce.end(), _nonce.begin());
+
+    metrics::Increment(metrics::AES_BLOCKS, (inData.size() + 0xf) / 0x10);
+
+    size_t ncOff = 0;
+    std::array<uint8_t, 0x10> streamBlock{};
+    return mbedtls_aes_crypt_ctr(const_cast<mbedtls_aes_context*>(&ctx), inData.size(), &ncOff, reinterpret_cast<uint8_t*>(_nonce.data()), streamBlock.data(), reinterpret_cast<const uint8_t*>(inData.data()), reinterpret_cast<uint8_t*>(outData.data())) == 0;
+}
+
+} // namespace
+
+// Inner and outer hash states after absorbing the padded key, every HMAC continues from copies of them
+struct crypto::HmacKey::Context {
+    Context()
+    {
+        mbedtls_md_init(&inner);
+        mbedtls_md_init(&outer);
+    }
+
+    ~Context()
+    {
+        mbedtls_md_free(&inner);
+        mbedtls_md_free(&outer);
+    }
+
+    mbedtls_md_context_t inner;
+    mbedtls_md_context_t outer;
+};
+
+struct crypto::AesKey::Context {
+    mbedtls_aes_context ctx;
+};
+
+crypto::AesKey::AesKey()
+{
+}
+
+crypto::AesKey::~AesKey()
+{
+    if (mContext) {
+        mbedtls_aes_free(&mContext->ctx);
+    }
+}
+
+bool crypto::AesKey::SetKey(const std::span<const std::byte>& key)
+{
+    std::unique_ptr<Context> context = std::make_unique<Context>();
+    mbedtls_aes_init(&context->ctx);
+
+    // For AES-CTR mbedtls_aes_setkey_enc is used for both decrypt and encrypt
+    if (mbedtls_aes_setkey_enc(&context->ctx, reinterpret_cast<const uint8_t*>(key.data()), key.size() * 8) != 0) {
+        mbedtls_aes_free(&context->ctx);
+        return false;
+    }
+
+    if (mContext) {
+        mbedtls_aes_free(&mContext->ctx);
+    }
+
+    mContext = std::move(context);
+    return true;
+}
+
+bool crypto::AesKey::IsSet() const
+{
+    return mContext != nullptr;
+}
+
+crypto::HmacKey::HmacKey()
+{
+}
+
+crypto::HmacKey::~HmacKey()
+{
+}
+
+bool crypto::HmacKey::SetKey(const std::span<const std::byte>& key)
+{
+    const mbedtls_md_info_t* info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+
+    // Keys longer than a block are hashed first, shorter ones are zero padded
+    std::array<uint8_t, kSha256BlockSize> block{};
+    if (key.size() > block.size()) {
+        if (mbedtls_md(info, reinterpret_cast<const uint8_t*>(key.data()), key.size(), block.data()) != 0) {
+            return false;
+        }
+    } else {
+        std::copy(key.begin(), key.end(), reinterpret_cast<std::byte*>(block.data()));
+    }
+
+    std::unique_ptr<Context> context = std::make_unique<Context>();
+    if (mbedtls_md_setup(&context->inner, info, 0) != 0 || mbedtls_md_setup(&context->outer, info, 0) != 0) {
+        return false;
+    }
+
+    std::array<uint8_t, kSha256BlockSize> innerPad;
+    std::array<uint8_t, kSha256BlockSize> outerPad;
+    for (std::size_t i = 0; i < block.size(); i++) {
+        innerPad[i] = block[i] ^ 0x36;
+        outerPad[i] = block[i] ^ 0x5c;
+    }
+
+    if (mbedtls_md_starts(&context->inner) != 0 || mbedtls_md_update(&context->inner, innerPad.data(), innerPad.size()) != 0 ||
+        mbedtls_md_starts(&context->outer) != 0 || mbedtls_md_update(&context->outer, outerPad.data(), outerPad.size()) != 0) {
+        return false;
+    }
+
+    mContext = std::move(context);
+    return true;
+}
+
+bool crypto::HmacKey::IsSet() const
+{
+    return mContext != nullptr;
+}
+
+bool crypto::CryptAesCTR(const std::span<const std::byte>& key, const std::span<const std::byte, 0x10>& nonce, const std::span<const std::byte>& inData, const std::span<std::byte>& outData)
+{
     mbedtls_aes_context ctx;
     mbedtls_aes_init(&ctx);
 
@@ -21,19 +149,18 @@ bool crypto::CryptAesCTR(const std::span<const std::byte>& key, const std::span<
         return false;
     }
 
-    // Create a copy of the nonce since mbedtls will modify it
-    std::array<std::byte, 0x10> _nonce;
-    std::copy(nonce.begin(), nonce.end(), _nonce.begin());
+    const bool res = CryptCTR(ctx, nonce, inData, outData);
+    mbedtls_aes_free(&ctx);
+    return res;
+}
 
-    size_t ncOff = 0;
-    std::array<uint8_t, 0x10> streamBlock{};
-    if (mbedtls_aes_crypt_ctr(&ctx, inData.size(), &ncOff, reinterpret_cast<uint8_t*>(_nonce.data()), streamBlock.data(), reinterpret_cast<const uint8_t*>(inData.data()), reinterpret_cast<uint8_t*>(outData.data())) != 0) {
-        mbedtls_aes_free(&ctx);
+bool crypto::CryptAesCTR(const AesKey& key, const std::span<const std::byte, 0x10>& nonce, const std::span<const std::byte>& inData, const std::span<std::byte>& outData)
+{
+    if (!key.IsSet()) {
         return false;
     }
 
-    mbedtls_aes_free(&ctx);
-    return true;
+    return CryptCTR(key.mContext->ctx, nonce, inData, outData);
 }
 
 bool crypto::EncryptAesCBC(const std::span<const std::byte>& key, const std::span<const std::byte, 0x10>& iv, const std::span<const std::byte>& inData, const std::span<std::byte>& outData)
@@ -54,6 +181,8 @@ bool crypto::EncryptAesCBC(const std::span<const std::byte>& key, const std::spa
     std::array<std::byte, 0x10> _iv;
     std::copy(iv.begin(), iv.end(), _iv.begin());
 
+    metrics::Increment(metrics::AES_BLOCKS, inData.size() / 0x10);
+
     if (mbedtls_aes_crypt_cbc(&ctx, MBEDTLS_AES_ENCRYPT, inData.size(), reinterpret_cast<uint8_t*>(_iv.data()), reinterpret_cast<const uint8_t*>(inData.data()), reinterpret_cast<uint8_t*>(outData.data())) != 0) {
         mbedtls_aes_free(&ctx);
         return false;
@@ -81,6 +210,8 @@ bool crypto::DecryptAesCBC(const std::span<const std::byte>& key, const std::spa
     std::array<std::byte, 0x10> _iv;
     std::copy(iv.begin(), iv.end(), _iv.begin());
 
+    metrics::Increment(metrics::AES_BLOCKS, inData.size() / 0x10);
+
     if (mbedtls_aes_crypt_cbc(&ctx, MBEDTLS_AES_DECRYPT, inData.size(), reinterpret_cast<uint8_t*>(_iv.data()), reinterpret_cast<const uint8_t*>(inData.data()), reinterpret_cast<uint8_t*>(outData.data())) != 0) {
         mbedtls_aes_free(&ctx);
         return false;
@@ -92,6 +223,38 @@ bool crypto::DecryptAesCBC(const std::span<const std::byte>& key, const std::spa
 
 bool crypto::GenerateHMAC(const std::span<const std::byte>& key, const std::span<const std::byte>& inData, const std::span<std::byte, 0x20>& outData)
 {
+    metrics::Increment(metrics::HMACS_COMPUTED);
+
     const mbedtls_md_info_t* info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
     return mbedtls_md_hmac(info, reinterpret_cast<const uint8_t*>(key.data()), key.size(), reinterpret_cast<const uint8_t*>(inData.data()), inData.size(), reinterpret_cast<uint8_t*>(outData.data())) == 0;
 }
+
+bool crypto::GenerateHMAC(const HmacKey& key, const std::span<const std::byte>& inData, const std::span<std::byte, 0x20>& outData)
+{
+    if (!key.IsSet()) {
+        return false;
+    }
+
+    metrics::Increment(metrics::HMACS_COMPUTED);
+
+    // The precomputed states are only cloned from, never updated
+    mbedtls_md_context_t ctx;
+    mbedtls_md_init(&ctx);
+
+    std::array<uint8_t, 0x20> innerHash;
+    const bool res = mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0) == 0 &&
+        mbedtls_md_clone(&ctx, &key.mContext->inner) == 0 &&
+        mbedtls_md_update(&ctx, reinterpret_cast<const uint8_t*>(inData.data()), inData.size()) == 0 &&
+        mbedtls_md_finish(&ctx, innerHash.data()) == 0 &&
+        mbedtls_md_clone(&ctx, &key.mContext->outer) == 0 &&
+        mbedtls_md_update(&ctx, innerHash.data(), innerHash.size()) == 0 &&
+        mbedtls_md_finish(&ctx, reinterpret_cast<uint8_t*>(outData.data())) == 0;
+
+    mbedtls_md_free(&ctx);
+    return res;
+}
+
+bool crypto::GenerateSHA256(const std::span<const std::byte>& inData, const std::span<std::byte, 0x20>& outData)
+{
+    return mbedtls_sha256(reinterpret_cast<const uint8_t*>(inData.data()), inData.size(), reinterpret_cast<uint8_t*>(outData.data()), 0) == 0;
+}
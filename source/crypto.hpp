@@ -1,16 +1,57 @@
 #pragma once
 
 #include <cstddef>
+#include <memory>
 #include <span>
 
 namespace crypto {
 
+// AES key with its key schedule expanded once, for keys which are used for every tag
+// Crypting only reads the schedule, so a single instance can be used from multiple threads at once.
+class AesKey {
+public:
+    AesKey();
+    ~AesKey();
+
+    bool SetKey(const std::span<const std::byte>& key);
+    bool IsSet() const;
+
+private:
+    friend bool CryptAesCTR(const AesKey& key, const std::span<const std::byte, 0x10>& nonce, const std::span<const std::byte>& inData, const std::span<std::byte>& outData);
+
+    struct Context;
+    std::unique_ptr<Context> mContext;
+};
+
+// HMAC-SHA256 key with the inner and outer hash states precomputed, which saves hashing both key pads for every HMAC
+// Like AesKey it is only read when generating HMACs, so a single instance can be used from multiple threads at once.
+class HmacKey {
+public:
+    HmacKey();
+    ~HmacKey();
+
+    bool SetKey(const std::span<const std::byte>& key);
+    bool IsSet() const;
+
+private:
+    friend bool GenerateHMAC(const HmacKey& key, const std::span<const std::byte>& inData, const std::span<std::byte, 0x20>& outData);
+
+    struct Context;
+    std::unique_ptr<Context> mContext;
+};
+
 bool CryptAesCTR(const std::span<const std::byte>& key, const std::span<const std::byte, 0x10>& nonce, const std::span<const std::byte>& inData, const std::span<std::byte>& outData);
 
+bool CryptAesCTR(const AesKey& key, const std::span<const std::byte, 0x10>& nonce, const std::span<const std::byte>& inData, const std::span<std::byte>& outData);
+
 bool EncryptAesCBC(const std::span<const std::byte>& key, const std::span<const std::byte, 0x10>& iv, const std::span<const std::byte>& inData, const std::span<std::byte>& outData);
 
 bool DecryptAesCBC(const std::span<const std::byte>& key, const std::span<const std::byte, 0x10>& iv, const std::span<const std::byte>& inData, const std::span<std::byte>& outData);
 
 bool GenerateHMAC(const std::span<const std::byte>& key, const std::span<const std::byte>& inData, const std::span<std::byte, 0x20>& outData);
 
+bool GenerateHMAC(const HmacKey& key, const std::span<const std::byte>& inData, const std::span<std::byte, 0x20>& outData);
+
+bool GenerateSHA256(const std::span<const std::byte>& inData, const std::span<std::byte, 0x20>& outData);
+
 } // namespace crypto
@@ -0,0 +1,50 @@
+#include "io.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+#include <cstdio>
+#include <memory>
+
+std::optional<std::vector<std::byte>> io::ReadBinaryFile(const std::string& path)
+{
+    NTAG_TRACE_SCOPE("ReadBinaryFile");
+
+    auto fp = std::unique_ptr<std::FILE, int(*)(std::FILE*)>(std::fopen(path.c_str(), "rb"), &std::fclose);
+    if (!fp) {
+        return {};
+    }
+
+    std::fseek(fp.get(), 0, SEEK_END);
+    long fz = std::ftell(fp.get());
+    if (fz == -1l) {
+        return {};
+    }
+
+    std::fseek(fp.get(), 0, SEEK_SET);
+
+    std::vector<std::byte> buffer(fz);
+    std::size_t bytesRead = std::fread(buffer.data(), 1, buffer.size(), fp.get());
+
+    // Truncate buffer if not fully read
+    buffer.resize(bytesRead);
+
+    metrics::Increment(metrics::BYTES_READ, bytesRead);
+    return buffer;
+}
+
+bool io::WriteBinaryFile(const std::string& path, const std::span<const std::byte>& data)
+{
+    NTAG_TRACE_SCOPE("WriteBinaryFile");
+
+    auto fp = std::unique_ptr<std::FILE, int(*)(std::FILE*)>(std::fopen(path.c_str(), "wb"), &std::fclose);
+    if (!fp) {
+        return false;
+    }
+
+    if (std::fwrite(data.data(), 1, data.size(), fp.get()) != data.size()) {
+        return false;
+    }
+
+    metrics::Increment(metrics::BYTES_WRITTEN, data.size());
+    return true;
+}
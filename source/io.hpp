@@ -0,0 +1,14 @@
+#pragma once
+
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace io {
+
+std::optional<std::vector<std::byte>> ReadBinaryFile(const std::string& path);
+
+bool WriteBinaryFile(const std::string& path, const std::span<const std::byte>& data);
+
+} // namespace io
@@ -1,52 +1,263 @@
+#include <algorithm>
 #include <iostream>
 #include <cstdio>
 #include <cstdint>
 #include <iterator>
 #include <optional>
+#include <filesystem>
+#include <sstream>
+#include <iomanip>
+#include <thread>
 
 #include <excmd.h>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
 #include "TagV0.hpp"
 #include "TagV2.hpp"
 #include "Keys.hpp"
+#include "Keyring.hpp"
+#include "Manifest.hpp"
 #include "TagEncryption.hpp"
+#include "Generator.hpp"
+#include "Archive.hpp"
+#include "Batch.hpp"
+#include "Cache.hpp"
+#include "Detect.hpp"
+#include "Diff.hpp"
+#include "Dump.hpp"
+#include "Edit.hpp"
+#include "Records.hpp"
+#include "Server.hpp"
+#include "Stats.hpp"
+#include "Stress.hpp"
+#include "TagStore.hpp"
+#include "Watch.hpp"
+#include "io.hpp"
+#include "trace.hpp"
 
 namespace {
 
 constexpr std::size_t kKeyfileSize = 160u;
+constexpr const char* kDefaultConfiguration = "ntagtool.conf";
+constexpr const char* kDefaultSocket = "ntagtool.sock";
+constexpr std::uint32_t kDefaultWatchWindow = 200;
+constexpr std::uint32_t kDefaultCacheSize = 1024;
 
-std::optional<std::vector<std::byte>> ReadBinaryFile(const std::string& path)
+// Loads the keys from the key file passed with the specified option, exits on failure
+std::shared_ptr<const Keys> LoadKeyFile(const excmd::option_state& options, const std::string& option)
 {
-    auto fp = std::unique_ptr<std::FILE, int(*)(std::FILE*)>(std::fopen(path.c_str(), "rb"), &std::fclose);
-    if (!fp) {
-        return {};
+    if (!options.has(option)) {
+        std::cerr << "Missing " << option << " argument" << std::endl;
+        std::exit(-1);
+    }
+
+    auto keyBuffer = io::ReadBinaryFile(options.get<std::string>(option));
+    if (!keyBuffer) {
+        std::cerr << "Failed to read " << option << std::endl;
+        std::exit(-1);
+    }
+
+    if (keyBuffer->size() != kKeyfileSize) {
+        std::cerr << option << " should be " << kKeyfileSize << " bytes in size" << std::endl;
+        std::exit(-1);
+    }
+
+    Result<std::shared_ptr<const Keys>> keys = Keys::FromKeyset(std::span(*keyBuffer).subspan<0, kKeyfileSize>());
+    if (!keys) {
+        std::cerr << "Failed to create keys from " << option << ": " << keys.error().GetDescription() << std::endl;
+        std::exit(1);
+    }
+
+    return *keys;
+}
+
+// Loads the keys used to process tags, either from key_file or all keysets from the configuration, exits on failure
+// The loaded keysets are listed on log.
+std::shared_ptr<Keyring> LoadKeyring(const excmd::option_state& options, std::ostream& log = std::cout)
+{
+    std::shared_ptr<Keyring> keyring;
+    if (options.has("key_file") || !(options.has("config") || std::filesystem::exists(kDefaultConfiguration))) {
+        std::shared_ptr<const Keys> keys = LoadKeyFile(options, "key_file");
+        keyring = std::make_shared<Keyring>();
+        keyring->Add(std::filesystem::path(options.get<std::string>("key_file")).filename().string(), keys);
+        return keyring;
+    }
+
+    const std::string path = options.has("config") ? options.get<std::string>("config") : kDefaultConfiguration;
+    Result<std::shared_ptr<Keyring>> res = Keyring::FromConfiguration(path);
+    if (!res) {
+        std::cerr << "Failed to load " << path << ": " << res.error().GetDescription()
+            << " (offset 0x" << std::hex << res.error().GetOffset() << std::dec << ")" << std::endl;
+        std::exit(-1);
+    }
+
+    keyring = *res;
+    for (std::size_t i = 0; i < keyring->GetSize(); i++) {
+        // The first 8 bytes are plenty to tell keysets apart
+        std::ostringstream fingerprint;
+        for (std::size_t j = 0; j < 8; j++) {
+            fingerprint << std::hex << std::setw(2) << std::setfill('0') << std::to_integer<int>(keyring->GetKeys(i)->GetFingerprint()[j]);
+        }
+
+        log << "Loaded keyset " << keyring->GetName(i) << " (" << fingerprint.str() << ")" << std::endl;
     }
 
-    std::fseek(fp.get(), 0, SEEK_END);
-    long fz = std::ftell(fp.get());
-    if (fz == -1l) {
+    return keyring;
+}
+
+// Opens the cache passed with --cache, null if there is none, exits on failure
+std::shared_ptr<Cache> OpenCache(const excmd::option_state& options)
+{
+    if (!options.has("cache")) {
+        return nullptr;
+    }
+
+    const std::uintmax_t size = std::uintmax_t(options.has("cache_size") ? options.get<std::uint32_t>("cache_size") : kDefaultCacheSize) << 20;
+    Result<std::shared_ptr<Cache>> cache = Cache::Open(options.get<std::string>("cache"), size);
+    if (!cache) {
+        std::cerr << "Failed to open cache: " << cache.error().GetDescription() << std::endl;
+        std::exit(-1);
+    }
+
+    return *cache;
+}
+
+// Returns the format passed with --input_format, empty to detect it for every tag
+std::optional<dump::Format> GetInputFormat(const excmd::option_state& options)
+{
+    if (!options.has("input_format")) {
         return {};
     }
 
-    std::fseek(fp.get(), 0, SEEK_SET);
+    return dump::GetFormat(options.get<std::string>("input_format"));
+}
+
+dump::Format GetOutputFormat(const excmd::option_state& options)
+{
+    return options.has("output_format") ? *dump::GetFormat(options.get<std::string>("output_format")) : dump::FORMAT_BINARY;
+}
+
+// Returns the layout passed with the specified option, the tag layout if there is none
+dump::Layout GetLayout(const excmd::option_state& options, const std::string& option)
+{
+    return options.has(option) ? *dump::GetLayout(options.get<std::string>(option)) : dump::LAYOUT_TAG;
+}
+
+batch::Options GetBatchOptions(const excmd::option_state& options)
+{
+    batch::Options batchOptions{};
+    if (options.has("tag_version")) {
+        batchOptions.tagVersion = options.get<std::uint32_t>("tag_version");
+    }
+    batchOptions.inputFormat = GetInputFormat(options);
+    batchOptions.outputFormat = GetOutputFormat(options);
+    batchOptions.inputLayout = GetLayout(options, "import_layout");
+    batchOptions.outputLayout = GetLayout(options, "export_layout");
+    batchOptions.executor = (options.has("executor") && options.get<std::string>("executor") == "pipeline") ? batch::EXECUTOR_PIPELINE : batch::EXECUTOR_PARALLEL;
+    batchOptions.jobs = options.has("jobs") ? options.get<std::uint32_t>("jobs") : std::thread::hardware_concurrency();
+    batchOptions.ioJobs = options.has("io_jobs") ? options.get<std::uint32_t>("io_jobs") : 2;
+    batchOptions.pin = options.has("pin");
+    batchOptions.metricsPath = options.has("metrics") ? options.get<std::string>("metrics") : "";
+    batchOptions.metricsInterval = std::chrono::seconds(options.has("metrics_interval") ? options.get<std::uint32_t>("metrics_interval") : 10);
+    batchOptions.cache = OpenCache(options);
+    return batchOptions;
+}
+
+// Reads in_file and converts it to raw tag data from the dump format and layout passed with the options, exits on failure
+std::vector<std::byte> ReadTagInput(const excmd::option_state& options)
+{
+    std::optional<std::vector<std::byte>> data = io::ReadBinaryFile(options.get<std::string>("in_file"));
+    if (!data) {
+        std::cerr << "Failed to read in_file" << std::endl;
+        std::exit(-1);
+    }
+
+    std::vector<std::byte> converted;
+    Result<std::span<const std::byte>> res = dump::Import(GetInputFormat(options), GetLayout(options, "import_layout"), *data, converted);
+    if (!res) {
+        std::cerr << "Failed to parse in_file: " << res.error().GetDescription()
+            << " (offset 0x" << std::hex << res.error().GetOffset() << std::dec << ")" << std::endl;
+        std::exit(-1);
+    }
+
+    return res->data() == data->data() ? std::move(*data) : std::move(converted);
+}
+
+// Writes the tag to out_file in the dump format and layout passed with the options, exits on failure
+void WriteTagOutput(const excmd::option_state& options, const std::span<const std::byte>& data)
+{
+    std::vector<std::byte> out(data.begin(), data.end());
+    dump::Export(GetOutputFormat(options), GetLayout(options, "export_layout"), out);
+    if (!io::WriteBinaryFile(options.get<std::string>("out_file"), out)) {
+        std::cerr << "Failed to write out_file" << std::endl;
+        std::exit(-1);
+    }
+}
+
+// Opens the manifest passed with --manifest for a directory run, once all other batch options are set, exits on failure
+void OpenManifest(const excmd::option_state& options, batch::Options& batchOptions)
+{
+    if (!options.has("manifest")) {
+        return;
+    }
+
+    Result<std::shared_ptr<Manifest>> manifest = Manifest::Open(options.get<std::string>("manifest"), Manifest::GetFingerprint(batchOptions));
+    if (!manifest) {
+        std::cerr << "Failed to open manifest: " << manifest.error().GetDescription() << std::endl;
+        std::exit(-1);
+    }
 
-    std::vector<std::byte> buffer(fz);
-    std::size_t bytesRead = std::fread(buffer.data(), 1, buffer.size(), fp.get());
+    batchOptions.manifest = *manifest;
+}
 
-    // Truncate buffer if not fully read
-    buffer.resize(bytesRead);
+// Returns whether in_file is processed as a batch, which is the case for directories and archives
+bool IsBatchInput(const std::filesystem::path& in)
+{
+    return std::filesystem::is_directory(in) || archive::IsArchive(in);
+}
 
-    return buffer;
+// Runs a directory batch, unless the input is an archive or the results are written to a tar archive
+// The manifest only applies to directories, archives are always processed completely.
+batch::Summary RunBatch(const batch::Options& batchOptions, const std::filesystem::path& in, const std::filesystem::path& out)
+{
+    if (std::filesystem::is_directory(in) && !archive::IsTar(out)) {
+        return batch::Run(batchOptions, in, out);
+    }
+
+    return batch::RunArchive(batchOptions, in, out);
 }
 
-bool WriteBinaryFile(const std::string& path, const std::span<const std::byte>& data)
+// Prints the summary of a batch run and returns the exit code
+int PrintSummary(const batch::Summary& summary, std::ostream& log = std::cout)
 {
-    auto fp = std::unique_ptr<std::FILE, int(*)(std::FILE*)>(std::fopen(path.c_str(), "wb"), &std::fclose);
-    if (!fp) {
-        return false;
+    log << "Processed " << summary.total << " tags in " << summary.elapsed.count() << "s, "
+        << summary.failed << " failed";
+    if (summary.skipped != 0) {
+        log << ", " << summary.skipped << " unchanged";
     }
+    log << std::endl;
+    return summary.failed != 0 ? 1 : 0;
+}
 
-    return std::fwrite(data.data(), 1, data.size(), fp.get()) == data.size();
+void PrintThroughput(const batch::Summary& summary)
+{
+    const double seconds = std::max(summary.elapsed.count(), 1e-9);
+    std::cout << "Throughput: " << summary.total / seconds << " tags/s, "
+        << summary.bytes / seconds / (1024.0 * 1024.0) << " MiB/s" << std::endl;
+}
+
+// Prints the status of a single tag and the error if there is one
+void PrintStatus(const char* prefix, batch::Status status, const std::optional<Error>& error)
+{
+    std::cerr << prefix << batch::GetStatusString(status);
+    if (error) {
+        std::cerr << " (" << error->GetDescription() << " at offset 0x" << std::hex << error->GetOffset() << std::dec << ")";
+    }
+    std::cerr << std::endl;
 }
 
 }
@@ -58,47 +269,275 @@ int main(int argc, char* argv[])
 
     parser.global_options()
         .add_option("v,version", excmd::description("Show version."))
-        .add_option("h,help", excmd::description("Show help."));
+        .add_option("h,help", excmd::description("Show help."))
+        .add_option("trace",
+                    excmd::description("Write a Chrome / Perfetto trace of all processing phases to the specified file."),
+                    excmd::value<std::string>());
 
     parser.add_command("help")
         .add_argument("help-command", excmd::optional(), excmd::value<std::string>());
 
-    excmd::option_group_adder tagOptionGroup =
-        parser.add_option_group("Tag options")
+    excmd::option_group_adder keyOptionGroup =
+        parser.add_option_group("Key options")
             .add_option("key_file",
                         excmd::description("Path to the key file."),
                         excmd::value<std::string>())
+            .add_option("config",
+                        excmd::description("Path to a configuration with the keysets to match tags against, used instead of key_file. Defaults to ntagtool.conf if it exists."),
+                        excmd::value<std::string>());
+
+    excmd::option_group_adder tagOptionGroup =
+        parser.add_option_group("Tag options")
             .add_option("tag_version",
-                        excmd::description("Tag version to use."),
+                        excmd::description("Tag version to use. If not specified, the version and whether the tag is encrypted are detected, generate makes a mix of all versions."),
                         excmd::value<std::uint32_t>(),
                         excmd::allowed<std::uint32_t>(
                             { 0, 2 }
                         ));
 
+    excmd::option_group_adder batchOptionGroup =
+        parser.add_option_group("Batch options")
+            .add_option("jobs",
+                        excmd::description("Number of worker threads used when processing a directory."),
+                        excmd::value<std::uint32_t>())
+            .add_option("pin",
+                        excmd::description("Pin every worker thread to its own CPU."))
+            .add_option("executor",
+                        excmd::description("How directories are processed. parallel processes whole files on every worker, pipeline runs every processing stage on its own workers."),
+                        excmd::value<std::string>(),
+                        excmd::allowed<std::string>(
+                            { "parallel", "pipeline" }
+                        ))
+            .add_option("io_jobs",
+                        excmd::description("Number of threads for each of the read and write stages of the pipeline executor."),
+                        excmd::value<std::uint32_t>())
+            .add_option("metrics",
+                        excmd::description("Periodically write Prometheus metrics to the specified file."),
+                        excmd::value<std::string>())
+            .add_option("metrics_interval",
+                        excmd::description("Interval in seconds between metrics writes."),
+                        excmd::value<std::uint32_t>())
+            .add_option("manifest",
+                        excmd::description("Record processed files in the specified manifest and skip files which didn't change since they were recorded. Interrupted runs resume from the manifest."),
+                        excmd::value<std::string>())
+            .add_option("cache",
+                        excmd::description("Directory of a cache for processed tags, tags which were already processed with the same keys are loaded from it. Can be shared by multiple processes."),
+                        excmd::value<std::string>())
+            .add_option("cache_size",
+                        excmd::description("Size of the cache in MiB, the least recently used tags are removed beyond it. Defaults to 1024."),
+                        excmd::value<std::uint32_t>());
+
+    excmd::option_group_adder inputFormatOptionGroup =
+        parser.add_option_group("Input format options")
+            .add_option("input_format",
+                        excmd::description("Format of the input tags. binary is a raw dump of the pages, flipper a Flipper Zero .nfc file, proxmark a Proxmark3 JSON dump and hex the pages as hex digits. Detected for every tag if not specified."),
+                        excmd::value<std::string>(),
+                        excmd::allowed<std::string>(
+                            { "binary", "flipper", "proxmark", "hex" }
+                        ))
+            .add_option("import_layout",
+                        excmd::description("Layout of version 2 input tags. tag is the layout of the tag memory, amiitool the layout amiitool and 3DS tools store decrypted tags in. Defaults to tag."),
+                        excmd::value<std::string>(),
+                        excmd::allowed<std::string>(
+                            { "tag", "amiitool" }
+                        ));
+
+    excmd::option_group_adder outputFormatOptionGroup =
+        parser.add_option_group("Output format options")
+            .add_option("output_format",
+                        excmd::description("Format to write the results in, one of the input formats. Defaults to binary."),
+                        excmd::value<std::string>(),
+                        excmd::allowed<std::string>(
+                            { "binary", "flipper", "proxmark", "hex" }
+                        ))
+            .add_option("export_layout",
+                        excmd::description("Layout to write version 2 results in, one of the import layouts. Defaults to tag."),
+                        excmd::value<std::string>(),
+                        excmd::allowed<std::string>(
+                            { "tag", "amiitool" }
+                        ));
+
     // TODO
     // parser.add_command("info")
+    //     .add_option_group(keyOptionGroup)
     //     .add_option_group(tagOptionGroup)
     //     .add_argument("tag_file", excmd::description("Path to the tag file."), excmd::value<std::string>());
 
     // parser.add_command("verify")
+    //     .add_option_group(keyOptionGroup)
     //     .add_option_group(tagOptionGroup)
     //     .add_argument("tag_file", excmd::description("Path to the tag file."), excmd::value<std::string>());
 
     parser.add_command("encrypt")
+        .add_option_group(keyOptionGroup)
         .add_option_group(tagOptionGroup)
-        .add_argument("in_file", excmd::description("Path to the decrypted tag file."), excmd::value<std::string>())
-        .add_argument("out_file", excmd::description("Path to store the encrypted tag file."), excmd::value<std::string>());
+        .add_option_group(inputFormatOptionGroup)
+        .add_option_group(outputFormatOptionGroup)
+        .add_option_group(batchOptionGroup)
+        .add_argument("in_file", excmd::description("Path to the decrypted tag file, a directory of tag files or a zip or tar archive."), excmd::value<std::string>())
+        .add_argument("out_file", excmd::description("Path to store the encrypted tag file, directory or tar archive (.tar, .tar.gz, .tgz)."), excmd::value<std::string>());
 
     parser.add_command("decrypt")
+        .add_option_group(keyOptionGroup)
+        .add_option_group(tagOptionGroup)
+        .add_option_group(inputFormatOptionGroup)
+        .add_option_group(outputFormatOptionGroup)
+        .add_option_group(batchOptionGroup)
+        .add_argument("in_file", excmd::description("Path to the encrypted tag file, a directory of tag files or a zip or tar archive."), excmd::value<std::string>())
+        .add_argument("out_file", excmd::description("Path to store the decrypted tag file, directory or tar archive (.tar, .tar.gz, .tgz)."), excmd::value<std::string>());
+
+    excmd::option_group_adder rekeyOptionGroup =
+        parser.add_option_group("Rekey options")
+            .add_option("target_key_file",
+                        excmd::description("Path to the key file to sign and encrypt the tags with."),
+                        excmd::value<std::string>());
+
+    parser.add_command("rekey")
+        .add_option_group(keyOptionGroup)
+        .add_option_group(tagOptionGroup)
+        .add_option_group(inputFormatOptionGroup)
+        .add_option_group(outputFormatOptionGroup)
+        .add_option_group(rekeyOptionGroup)
+        .add_option_group(batchOptionGroup)
+        .add_argument("in_file", excmd::description("Path to the encrypted tag file, a directory of tag files or a zip or tar archive."), excmd::value<std::string>())
+        .add_argument("out_file", excmd::description("Path to store the re-encrypted tag file, directory or tar archive (.tar, .tar.gz, .tgz)."), excmd::value<std::string>());
+
+    parser.add_command("audit")
+        .add_option_group(keyOptionGroup)
+        .add_option_group(tagOptionGroup)
+        .add_option_group(inputFormatOptionGroup)
+        .add_option_group(batchOptionGroup)
+        .add_argument("in_file", excmd::description("Path to the tag file, a directory of tag files or a zip or tar archive to round trip. Nothing is written."), excmd::value<std::string>());
+
+    parser.add_command("apply")
+        .add_option_group(keyOptionGroup)
+        .add_option_group(tagOptionGroup)
+        .add_option_group(inputFormatOptionGroup)
+        .add_option_group(outputFormatOptionGroup)
+        .add_option_group(batchOptionGroup)
+        .add_argument("script", excmd::description("Path to the edit script."), excmd::value<std::string>())
+        .add_argument("in_file", excmd::description("Path to the tag file, a directory of tag files or a zip or tar archive to edit."), excmd::value<std::string>())
+        .add_argument("out_file", excmd::description("Path to store the edited and encrypted tag file, directory or tar archive (.tar, .tar.gz, .tgz)."), excmd::value<std::string>());
+
+    excmd::option_group_adder streamOptionGroup =
+        parser.add_option_group("Stream options")
+            .add_option("framing",
+                        excmd::description("How records are separated. length prefixes every record with its size as a 32 bit little endian number, fixed expects records of record_size bytes."),
+                        excmd::value<std::string>(),
+                        excmd::allowed<std::string>(
+                            { "length", "fixed" }
+                        ))
+            .add_option("record_size",
+                        excmd::description("Size of every record with fixed framing, at most 4096 bytes."),
+                        excmd::value<std::uint32_t>());
+
+    parser.add_command("stream")
+        .add_option_group(keyOptionGroup)
+        .add_option_group(tagOptionGroup)
+        .add_option_group(inputFormatOptionGroup)
+        .add_option_group(outputFormatOptionGroup)
+        .add_option_group(rekeyOptionGroup)
+        .add_option_group(batchOptionGroup)
+        .add_option_group(streamOptionGroup)
+        .add_argument("operation",
+                      excmd::description("Operation to run on the records read from stdin, the results are written to stdout."),
+                      excmd::value<std::string>(),
+                      excmd::allowed<std::string>(
+                          { "decrypt", "encrypt", "verify", "rekey" }
+                      ));
+
+    parser.add_command("diff")
+        .add_option_group(keyOptionGroup)
         .add_option_group(tagOptionGroup)
-        .add_argument("in_file", excmd::description("Path to the encrypted tag file."), excmd::value<std::string>())
-        .add_argument("out_file", excmd::description("Path to store the decrypted tag file."), excmd::value<std::string>());
+        .add_option_group(inputFormatOptionGroup)
+        .add_option_group(batchOptionGroup)
+        .add_argument("left", excmd::description("Path to the first tag file or directory of tag files."), excmd::value<std::string>())
+        .add_argument("right", excmd::description("Path to the second tag file or directory of tag files, directories are paired by UID."), excmd::value<std::string>());
+
+    excmd::option_group_adder statsOptionGroup =
+        parser.add_option_group("Stats options")
+            .add_option("compress",
+                        excmd::description("Compress the tag data held in memory in blocks. Takes less memory, mostly for decrypted tags, but loading is slower."))
+            .add_option("verify",
+                        excmd::description("Materialize every tag from the store afterwards and check that it serializes to the stored data."));
+
+    parser.add_command("stats")
+        .add_option_group(keyOptionGroup)
+        .add_option_group(tagOptionGroup)
+        .add_option_group(inputFormatOptionGroup)
+        .add_option_group(batchOptionGroup)
+        .add_option_group(statsOptionGroup)
+        .add_argument("in_file", excmd::description("Path to a directory of tag files or a zip or tar archive to decrypt and summarize."), excmd::value<std::string>());
 
     // TODO
     // parser.add_command("set")
+    //     .add_option_group(keyOptionGroup)
     //     .add_option_group(tagOptionGroup)
     //     .add_argument("tag_file", excmd::description("Path to the tag file."), excmd::value<std::string>());
 
+    excmd::option_group_adder serveOptionGroup =
+        parser.add_option_group("Serve options")
+            .add_option("socket",
+                        excmd::description("Path of the Unix domain socket to listen on. Defaults to ntagtool.sock."),
+                        excmd::value<std::string>())
+            .add_option("max_in_flight",
+                        excmd::description("Number of requests of a single client which are processed at once."),
+                        excmd::value<std::uint32_t>());
+
+    parser.add_command("serve")
+        .add_option_group(keyOptionGroup)
+        .add_option_group(tagOptionGroup)
+        .add_option_group(batchOptionGroup)
+        .add_option_group(serveOptionGroup);
+
+    excmd::option_group_adder watchOptionGroup =
+        parser.add_option_group("Watch options")
+            .add_option("window_ms",
+                        excmd::description("Milliseconds to wait for more files after the first one, files written within this time are processed together. Defaults to 200."),
+                        excmd::value<std::uint32_t>());
+
+    parser.add_command("watch")
+        .add_option_group(keyOptionGroup)
+        .add_option_group(tagOptionGroup)
+        .add_option_group(inputFormatOptionGroup)
+        .add_option_group(outputFormatOptionGroup)
+        .add_option_group(rekeyOptionGroup)
+        .add_option_group(batchOptionGroup)
+        .add_option_group(watchOptionGroup)
+        .add_argument("operation",
+                      excmd::description("Operation to run on every file written to in_dir."),
+                      excmd::value<std::string>(),
+                      excmd::allowed<std::string>(
+                          { "decrypt", "encrypt", "verify", "rekey" }
+                      ))
+        .add_argument("in_dir", excmd::description("Directory to watch for new tag files."), excmd::value<std::string>())
+        .add_argument("out_dir", excmd::description("Directory to store the results in, can't be inside of in_dir."), excmd::value<std::string>());
+
+    excmd::option_group_adder generateOptionGroup =
+        parser.add_option_group("Generate options")
+            .add_option("count",
+                        excmd::description("Number of tags to generate."),
+                        excmd::value<std::uint32_t>())
+            .add_option("seed",
+                        excmd::description("Seed used for the keyset and tag contents."),
+                        excmd::value<std::uint64_t>());
+
+    parser.add_command("generate")
+        .add_option_group(tagOptionGroup)
+        .add_option_group(generateOptionGroup)
+        .add_argument("out_dir", excmd::description("Directory to store the synthetic keyset and encrypted tags."), excmd::value<std::string>());
+
+    excmd::option_group_adder stressOptionGroup =
+        parser.add_option_group("Stress options")
+            .add_option("iterations",
+                        excmd::description("Number of times every tag is decrypted and encrypted again."),
+                        excmd::value<std::uint32_t>());
+
+    parser.add_command("stress")
+        .add_option_group(generateOptionGroup)
+        .add_option_group(batchOptionGroup)
+        .add_option_group(stressOptionGroup);
+
     try {
         options = parser.parse(argc, argv);
     } catch (const excmd::exception& ex) {
@@ -122,110 +561,601 @@ int main(int argc, char* argv[])
         std::exit(0);
     }
 
-    if (options.has("decrypt") || options.has("encrypt")) {
-        const bool decrypt = options.has("decrypt");
-
-        if (!options.has("key_file")) {
-            std::cerr << "Missing key_file argument" << std::endl;
+    if (options.has("trace")) {
+        if (!trace::IsAvailable()) {
+            std::cerr << "Tracing support was not compiled in" << std::endl;
             std::exit(-1);
         }
 
+        trace::Start();
+        trace::SetThreadName("main");
+    }
+
+    int exitCode = 0;
+
+    if (options.has("decrypt") || options.has("encrypt")) {
+        const bool decrypt = options.has("decrypt");
+
         if (decrypt) {
             std::cout << "Decrypting " << options.get<std::string>("in_file") << " to " << options.get<std::string>("out_file") << std::endl;
         } else {
             std::cout << "Encrypting " << options.get<std::string>("in_file") << " to " << options.get<std::string>("out_file") << std::endl;
         }
 
-        auto tagBuffer = ReadBinaryFile(options.get<std::string>("in_file"));
-        if (!tagBuffer) {
-            std::cerr << "Failed to read in_file" << std::endl;
-            std::exit(-1);
-        }
+        std::shared_ptr<Keyring> keyring = LoadKeyring(options);
 
-        auto keyBuffer = ReadBinaryFile(options.get<std::string>("key_file"));
-        if (!keyBuffer) {
-            std::cerr << "Failed to read key_file" << std::endl;
-            std::exit(-1);
+        if (IsBatchInput(options.get<std::string>("in_file"))) {
+            batch::Options batchOptions = GetBatchOptions(options);
+            batchOptions.operation = decrypt ? batch::OPERATION_DECRYPT : batch::OPERATION_ENCRYPT;
+            batchOptions.keyring = keyring;
+            OpenManifest(options, batchOptions);
+
+            exitCode = PrintSummary(RunBatch(batchOptions, options.get<std::string>("in_file"), options.get<std::string>("out_file")));
+        } else if (const std::shared_ptr<Cache> cache = OpenCache(options)) {
+            const std::vector<std::byte> tagBuffer = ReadTagInput(options);
+
+            std::optional<std::uint32_t> tagVersion;
+            if (options.has("tag_version")) {
+                tagVersion = options.get<std::uint32_t>("tag_version");
+            }
+
+            // Tags from the cache are never parsed, so only the result is reported
+            const batch::Operation operation = decrypt ? batch::OPERATION_DECRYPT : batch::OPERATION_ENCRYPT;
+            batch::Context context(*keyring);
+            context.SetCache(cache.get());
+            std::vector<std::byte> out;
+            std::optional<Error> error;
+            const batch::Status status = batch::ProcessTag(operation, tagVersion, context, tagBuffer, out, &error);
+            if (!batch::ShouldWrite(operation, status)) {
+                PrintStatus(decrypt ? "Failed to decrypt tag: " : "Failed to encrypt tag: ", status, error);
+                std::exit(1);
+            }
+
+            if (status != batch::STATUS_OK) {
+                std::cout << batch::GetStatusString(status) << std::endl;
+            }
+
+            WriteTagOutput(options, out);
+        } else {
+            const std::vector<std::byte> tagBuffer = ReadTagInput(options);
+
+            const bool detectTag = !options.has("tag_version");
+            const std::optional<std::uint32_t> tagVersion = detectTag ? detect::DetectVersion(tagBuffer) : options.get<std::uint32_t>("tag_version");
+            if (!tagVersion) {
+                std::cerr << "Failed to detect the tag version, specify it with --tag_version" << std::endl;
+                std::exit(-1);
+            }
+
+            Result<std::shared_ptr<Tag>> tagResult = Tag::FromBytes(*tagVersion, tagBuffer);
+            if (!tagResult) {
+                std::cerr << "Failed to create tag: " << tagResult.error().GetDescription()
+                    << " (offset 0x" << std::hex << tagResult.error().GetOffset() << std::dec << ")" << std::endl;
+                std::exit(-1);
+            }
+
+            std::shared_ptr<Tag> tag = *tagResult;
+
+            tag->SetEncrypted(decrypt);
+
+            batch::Context context(*keyring);
+            detect::State state;
+            const std::optional<std::size_t> keysetIndex = batch::SelectKeys(context, *tag, decrypt ? detect::STATE_ENCRYPTED : detect::STATE_DECRYPTED, detectTag, state);
+            if (!keysetIndex) {
+                std::cerr << "Failed to init internal keys" << std::endl;
+                std::exit(1);
+            }
+
+            TagEncryption& te = context.encryptions[*keysetIndex];
+            if (keyring->GetSize() > 1) {
+                if (state != detect::STATE_UNKNOWN) {
+                    std::cout << "Using keyset " << keyring->GetName(*keysetIndex) << std::endl;
+                } else {
+                    std::cout << "No keyset matched, using " << keyring->GetName(*keysetIndex) << std::endl;
+                }
+            }
+
+            if (detectTag) {
+                switch (state) {
+                    case detect::STATE_ENCRYPTED:
+                        std::cout << "Detected encrypted version " << *tagVersion << " tag" << std::endl;
+                        break;
+                    case detect::STATE_DECRYPTED:
+                        std::cout << "Detected decrypted version " << *tagVersion << " tag" << std::endl;
+                        break;
+                    case detect::STATE_UNKNOWN:
+                        std::cout << "Detected version " << *tagVersion << " tag, but could not detect if it is encrypted" << std::endl;
+                        break;
+                }
+            }
+
+            if (decrypt) {
+                // Detecting an encrypted tag already decrypted it
+                if (state == detect::STATE_DECRYPTED) {
+                    std::cout << "Tag is already decrypted" << std::endl;
+                } else if (tag->IsEncrypted() && !te.DecryptTag()) {
+                    std::cerr << "Failed to decrypt tag" << std::endl;
+                    std::exit(1);
+                }
+
+                if (te.ValidateLockedSecretHMAC()) {
+                    std::cout << "Locked secret HMAC valid" << std::endl;
+                } else {
+                    std::cout << "Locked secret HMAC not valid" << std::endl;
+                }
+
+                if (te.ValidateUnfixedInfosHMAC()) {
+                    std::cout << "Unfixed infos HMAC valid" << std::endl;
+                } else {
+                    std::cout << "Unfixed infos HMAC not valid" << std::endl;
+                }
+            } else if (tag->IsEncrypted()) {
+                std::cout << "Tag is already encrypted" << std::endl;
+            } else {
+                if (te.ValidateLockedSecretHMAC()) {
+                    std::cout << "Locked secret HMAC valid" << std::endl;
+                } else {
+                    std::cout << "Locked secret HMAC not valid, updating..." << std::endl;
+                    te.UpdateLockedSecretHMAC();
+                }
+
+                if (te.ValidateUnfixedInfosHMAC()) {
+                    std::cout << "Unfixed infos HMAC valid" << std::endl;
+                } else {
+                    std::cout << "Unfixed infos HMAC not valid, updating..." << std::endl;
+                    te.UpdateUnfixedInfosHMAC();
+                }
+
+                if (!te.EncryptTag()) {
+                    std::cerr << "Failed to encrypt tag" << std::endl;
+                    std::exit(1);
+                }
+            }
+
+            WriteTagOutput(options, tag->ToBytes());
         }
 
-        if (keyBuffer->size() != kKeyfileSize) {
-            std::cerr << "key_file should be " << kKeyfileSize << "bytes in size" << std::endl;
-            std::exit(-1);
+        std::cout << "Done!" << std::endl;
+    }
+
+    if (options.has("rekey")) {
+        std::cout << "Rekeying " << options.get<std::string>("in_file") << " to " << options.get<std::string>("out_file") << std::endl;
+
+        std::shared_ptr<Keyring> keyring = LoadKeyring(options);
+        std::shared_ptr<const Keys> targetKeys = LoadKeyFile(options, "target_key_file");
+
+        if (IsBatchInput(options.get<std::string>("in_file"))) {
+            batch::Options batchOptions = GetBatchOptions(options);
+            batchOptions.operation = batch::OPERATION_REKEY;
+            batchOptions.keyring = keyring;
+            batchOptions.targetKeys = targetKeys;
+            OpenManifest(options, batchOptions);
+
+            exitCode = PrintSummary(RunBatch(batchOptions, options.get<std::string>("in_file"), options.get<std::string>("out_file")));
+        } else {
+            const std::vector<std::byte> tagBuffer = ReadTagInput(options);
+
+            std::optional<std::uint32_t> tagVersion;
+            if (options.has("tag_version")) {
+                tagVersion = options.get<std::uint32_t>("tag_version");
+            }
+
+            // Decrypting, signing and encrypting again all happens in memory
+            const std::shared_ptr<Cache> cache = OpenCache(options);
+            batch::Context context(*keyring, targetKeys.get());
+            if (cache) {
+                context.SetCache(cache.get());
+            }
+            std::vector<std::byte> out;
+            std::optional<Error> error;
+            const batch::Status status = batch::ProcessTag(batch::OPERATION_REKEY, tagVersion, context, tagBuffer, out, &error);
+            if (status != batch::STATUS_OK) {
+                PrintStatus("Failed to rekey tag: ", status, error);
+                std::exit(1);
+            }
+
+            WriteTagOutput(options, out);
         }
 
-        std::shared_ptr<Tag> tag{};
-        if (options.get<uint32_t>("tag_version") == 0) {
-            tag = TagV0::FromBytes(*tagBuffer);
-        } else if (options.get<uint32_t>("tag_version") == 2) {
-            tag = TagV2::FromBytes(*tagBuffer);
+        std::cout << "Done!" << std::endl;
+    }
+
+    if (options.has("audit")) {
+        std::cout << "Auditing " << options.get<std::string>("in_file") << std::endl;
+
+        std::shared_ptr<Keyring> keyring = LoadKeyring(options);
+
+        if (IsBatchInput(options.get<std::string>("in_file"))) {
+            batch::Options batchOptions = GetBatchOptions(options);
+            batchOptions.operation = batch::OPERATION_AUDIT;
+            batchOptions.keyring = keyring;
+            OpenManifest(options, batchOptions);
+
+            // Audits never write, so there is no output directory
+            const batch::Summary summary = RunBatch(batchOptions, options.get<std::string>("in_file"), {});
+            exitCode = PrintSummary(summary);
+            PrintThroughput(summary);
+        } else {
+            const std::vector<std::byte> tagBuffer = ReadTagInput(options);
+
+            std::optional<std::uint32_t> tagVersion;
+            if (options.has("tag_version")) {
+                tagVersion = options.get<std::uint32_t>("tag_version");
+            }
+
+            const std::shared_ptr<Cache> cache = OpenCache(options);
+            batch::Context context(*keyring);
+            if (cache) {
+                context.SetCache(cache.get());
+            }
+            std::vector<std::byte> out;
+            std::optional<Error> error;
+            const batch::Status status = batch::ProcessTag(batch::OPERATION_AUDIT, tagVersion, context, tagBuffer, out, &error);
+            if (status != batch::STATUS_OK) {
+                PrintStatus("Audit failed: ", status, error);
+                std::exit(1);
+            }
+
+            std::cout << "Round trip is identical" << std::endl;
         }
 
-        if (!tag) {
-            std::cerr << "Failed to create tag" << std::endl;
+        std::cout << "Done!" << std::endl;
+    }
+
+    if (options.has("apply")) {
+        std::cout << "Applying " << options.get<std::string>("script") << " to " << options.get<std::string>("in_file")
+            << ", writing to " << options.get<std::string>("out_file") << std::endl;
+
+        std::shared_ptr<Keyring> keyring = LoadKeyring(options);
+
+        Result<std::shared_ptr<const edit::Script>> script = edit::Script::FromFile(options.get<std::string>("script"));
+        if (!script) {
+            std::cerr << "Failed to load script: " << script.error().GetDescription()
+                << " (offset 0x" << std::hex << script.error().GetOffset() << std::dec << ")" << std::endl;
             std::exit(-1);
         }
 
-        // TODO we currently don't detect if the tag is encrypted or not
-        //      so always assume encrypted/decrypted
-        tag->SetEncrypted(decrypt);
+        for (std::uint32_t version : { 0u, 2u }) {
+            const edit::Plan* plan = (*script)->GetPlan(version);
+            if (!plan) {
+                std::cout << "Version " << version << ": script doesn't fit" << std::endl;
+                continue;
+            }
 
-        std::shared_ptr<Keys> keys = Keys::FromKeyset(std::span(*keyBuffer).subspan<0, 160>());
-        if (!tag) {
-            std::cerr << "Failed to create keys" << std::endl;
-            std::exit(1);
+            std::cout << "Version " << version << ": " << plan->patches.size() << (plan->patches.size() == 1 ? " patch" : " patches")
+                << (plan->deriveKeys ? ", derives keys" : "")
+                << (plan->updateLockedSecretHmac ? ", updates locked secret HMAC" : "")
+                << (plan->updateUnfixedInfosHmac ? ", updates unfixed infos HMAC" : "") << std::endl;
         }
 
-        TagEncryption te(tag, keys);
-        if (!te.InitializeInternalKeys()) {
-            std::cerr << "Failed to init internal keys" << std::endl;
-            std::exit(1);
-        }
+        if (IsBatchInput(options.get<std::string>("in_file"))) {
+            batch::Options batchOptions = GetBatchOptions(options);
+            batchOptions.operation = batch::OPERATION_APPLY;
+            batchOptions.keyring = keyring;
+            batchOptions.script = *script;
+            OpenManifest(options, batchOptions);
 
-        if (decrypt) {
-            if (!te.DecryptTag()) {
-                std::cerr << "Failed to decrypt tag" << std::endl;
+            exitCode = PrintSummary(RunBatch(batchOptions, options.get<std::string>("in_file"), options.get<std::string>("out_file")));
+        } else {
+            const std::vector<std::byte> tagBuffer = ReadTagInput(options);
+
+            std::optional<std::uint32_t> tagVersion;
+            if (options.has("tag_version")) {
+                tagVersion = options.get<std::uint32_t>("tag_version");
+            }
+
+            const std::shared_ptr<Cache> cache = OpenCache(options);
+            batch::Context context(*keyring);
+            context.script = script->get();
+            if (cache) {
+                context.SetCache(cache.get());
+            }
+            std::vector<std::byte> out;
+            std::optional<Error> error;
+            const batch::Status status = batch::ProcessTag(batch::OPERATION_APPLY, tagVersion, context, tagBuffer, out, &error);
+            if (status != batch::STATUS_OK) {
+                PrintStatus("Failed to apply script: ", status, error);
                 std::exit(1);
             }
 
-            if (te.ValidateLockedSecretHMAC()) {
-                std::cout << "Locked secret HMAC valid" << std::endl;
-            } else {
-                std::cout << "Locked secret HMAC not valid" << std::endl;
+            WriteTagOutput(options, out);
+        }
+
+        std::cout << "Done!" << std::endl;
+    }
+
+    if (options.has("stream")) {
+        // stdout carries the records, so everything else goes to stderr
+        const std::string operation = options.get<std::string>("operation");
+
+        batch::Options batchOptions = GetBatchOptions(options);
+        batchOptions.keyring = LoadKeyring(options, std::cerr);
+        if (operation == "decrypt") {
+            batchOptions.operation = batch::OPERATION_DECRYPT;
+        } else if (operation == "encrypt") {
+            batchOptions.operation = batch::OPERATION_ENCRYPT;
+        } else if (operation == "verify") {
+            batchOptions.operation = batch::OPERATION_VERIFY;
+        } else {
+            batchOptions.operation = batch::OPERATION_REKEY;
+            batchOptions.targetKeys = LoadKeyFile(options, "target_key_file");
+        }
+
+        batch::StreamOptions streamOptions{};
+        streamOptions.framing = (options.has("framing") && options.get<std::string>("framing") == "fixed") ? batch::FRAMING_FIXED : batch::FRAMING_LENGTH;
+        if (streamOptions.framing == batch::FRAMING_FIXED) {
+            if (!options.has("record_size") || options.get<std::uint32_t>("record_size") == 0) {
+                std::cerr << "Missing record_size argument" << std::endl;
+                std::exit(-1);
             }
 
-            if (te.ValidateUnfixedInfosHMAC()) {
-                std::cout << "Unfixed infos HMAC valid" << std::endl;
-            } else {
-                std::cout << "Unfixed infos HMAC not valid" << std::endl;
+            streamOptions.recordSize = options.get<std::uint32_t>("record_size");
+            if (streamOptions.recordSize > batch::kMaxRecordSize) {
+                std::cerr << "Invalid record_size: " << Error(Error::RECORD_TOO_LARGE).GetDescription() << std::endl;
+                std::exit(-1);
+            }
+
+            // Text dumps differ in length, so only raw tags keep every output record at record_size bytes
+            if ((batchOptions.inputFormat && *batchOptions.inputFormat != dump::FORMAT_BINARY) || batchOptions.outputFormat != dump::FORMAT_BINARY) {
+                std::cerr << "Fixed framing only supports the binary format, use length framing for other formats" << std::endl;
+                std::exit(-1);
+            }
+
+            batchOptions.inputFormat = dump::FORMAT_BINARY;
+        }
+
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+        exitCode = PrintSummary(batch::RunStream(batchOptions, streamOptions, stdin, stdout), std::cerr);
+    }
+
+    if (options.has("diff")) {
+        const std::filesystem::path left = options.get<std::string>("left");
+        const std::filesystem::path right = options.get<std::string>("right");
+
+        std::shared_ptr<Keyring> keyring = LoadKeyring(options);
+
+        if (std::filesystem::is_directory(left) && std::filesystem::is_directory(right)) {
+            const batch::Options batchOptions = GetBatchOptions(options);
+
+            diff::Options diffOptions{};
+            diffOptions.tagVersion = batchOptions.tagVersion;
+            diffOptions.inputFormat = batchOptions.inputFormat;
+            diffOptions.inputLayout = batchOptions.inputLayout;
+            diffOptions.keyring = keyring;
+            diffOptions.cache = batchOptions.cache;
+            diffOptions.jobs = batchOptions.jobs;
+            diffOptions.pin = batchOptions.pin;
+
+            const diff::Summary summary = diff::CompareDirectories(diffOptions, left, right, std::cout);
+            std::cout << "Compared " << summary.matched << " pairs in " << summary.elapsed.count() << "s, "
+                << summary.changed << " changed, " << summary.onlyLeft << " only in " << left.string() << ", "
+                << summary.onlyRight << " only in " << right.string() << ", " << summary.failed << " failed" << std::endl;
+
+            // Same convention as diff, 1 if there are differences
+            if (summary.failed != 0) {
+                exitCode = -1;
+            } else if (summary.changed != 0 || summary.onlyLeft != 0 || summary.onlyRight != 0) {
+                exitCode = 1;
             }
         } else {
-            if (te.ValidateLockedSecretHMAC()) {
-                std::cout << "Locked secret HMAC valid" << std::endl;
-            } else {
-                std::cout << "Locked secret HMAC not valid, updating..." << std::endl;
-                te.UpdateLockedSecretHMAC();
+            std::optional<std::uint32_t> tagVersion;
+            if (options.has("tag_version")) {
+                tagVersion = options.get<std::uint32_t>("tag_version");
             }
 
-            if (te.ValidateUnfixedInfosHMAC()) {
-                std::cout << "Unfixed infos HMAC valid" << std::endl;
-            } else {
-                std::cout << "Unfixed infos HMAC not valid, updating..." << std::endl;
-                te.UpdateUnfixedInfosHMAC();
+            const std::shared_ptr<Cache> cache = OpenCache(options);
+            batch::Context context(*keyring);
+            context.inputFormat = GetInputFormat(options);
+            context.inputLayout = GetLayout(options, "import_layout");
+            context.SetCache(cache.get());
+            std::array<diff::Snapshot, 2> snapshots;
+            for (std::size_t i = 0; i < snapshots.size(); i++) {
+                const std::filesystem::path& path = i == 0 ? left : right;
+                auto tagBuffer = io::ReadBinaryFile(path.string());
+                if (!tagBuffer) {
+                    std::cerr << "Failed to read " << path.string() << std::endl;
+                    std::exit(-1);
+                }
+
+                std::optional<Error> error;
+                const batch::Status status = diff::LoadSnapshot(context, tagVersion, *tagBuffer, snapshots[i], &error);
+                if (status != batch::STATUS_OK) {
+                    PrintStatus((path.string() + ": ").c_str(), status, error);
+                    std::exit(-1);
+                }
             }
 
-            if (!te.EncryptTag()) {
-                std::cerr << "Failed to encrypt tag" << std::endl;
+            if (snapshots[0].version != snapshots[1].version) {
+                std::cout << "Tag versions differ (" << snapshots[0].version << " and " << snapshots[1].version << ")" << std::endl;
                 std::exit(1);
             }
+
+            std::vector<diff::Change> changes;
+            diff::Compare(snapshots[0], snapshots[1], changes);
+            diff::PrintChanges(std::cout, snapshots[0], snapshots[1], changes);
+            if (!changes.empty()) {
+                exitCode = 1;
+            }
+        }
+    }
+
+    if (options.has("stats")) {
+        const std::filesystem::path in = options.get<std::string>("in_file");
+        const batch::Options batchOptions = GetBatchOptions(options);
+
+        stats::Options statsOptions{};
+        statsOptions.tagVersion = batchOptions.tagVersion;
+        statsOptions.inputFormat = batchOptions.inputFormat;
+        statsOptions.inputLayout = batchOptions.inputLayout;
+        statsOptions.keyring = LoadKeyring(options);
+        statsOptions.cache = batchOptions.cache;
+        statsOptions.jobs = batchOptions.jobs;
+        statsOptions.pin = batchOptions.pin;
+
+        TagStore store(options.has("compress") ? ~0u : 0u);
+        const stats::Summary summary = stats::Load(statsOptions, in, store);
+        std::cout << "Loaded " << store.GetSize() << " tags in " << summary.elapsed.count() << "s, "
+            << summary.failed << " failed" << std::endl;
+
+        stats::Print(store, std::cout);
+        exitCode = summary.failed != 0 ? 1 : 0;
+
+        if (options.has("verify")) {
+            const std::size_t failed = stats::Verify(store, statsOptions.jobs, statsOptions.pin);
+            std::cout << "Verified " << store.GetSize() << " tags, " << failed << " failed" << std::endl;
+            if (failed != 0) {
+                exitCode = 1;
+            }
+        }
+    }
+
+    if (options.has("serve")) {
+        if (!server::IsAvailable()) {
+            std::cerr << "Serving requests is not supported on this platform" << std::endl;
+            std::exit(-1);
+        }
+
+        std::shared_ptr<Keyring> keyring = LoadKeyring(options);
+
+        server::Options serverOptions{};
+        serverOptions.socketPath = options.has("socket") ? options.get<std::string>("socket") : kDefaultSocket;
+        serverOptions.keyring = keyring;
+        serverOptions.cache = OpenCache(options);
+        serverOptions.jobs = options.has("jobs") ? options.get<std::uint32_t>("jobs") : std::thread::hardware_concurrency();
+        serverOptions.maxInFlight = options.has("max_in_flight") ? options.get<std::uint32_t>("max_in_flight") : 64;
+
+        std::cout << "Listening on " << serverOptions.socketPath.string() << " with " << serverOptions.jobs << " workers" << std::endl;
+
+        Result<void> res = server::Run(serverOptions);
+        if (!res) {
+            std::cerr << "Failed to serve on " << serverOptions.socketPath.string() << ": " << res.error().GetDescription() << std::endl;
+            std::exit(-1);
+        }
+
+        std::cout << "Done!" << std::endl;
+    }
+
+    if (options.has("watch")) {
+        if (!watch::IsAvailable()) {
+            std::cerr << "Watching directories is not supported on this platform" << std::endl;
+            std::exit(-1);
+        }
+
+        const std::string operation = options.get<std::string>("operation");
+        const std::filesystem::path inDir = options.get<std::string>("in_dir");
+        const std::filesystem::path outDir = options.get<std::string>("out_dir");
+        if (!std::filesystem::is_directory(inDir)) {
+            std::cerr << "in_dir is not a directory" << std::endl;
+            std::exit(-1);
         }
 
-        if (!WriteBinaryFile(options.get<std::string>("out_file"), tag->ToBytes())) {
-            std::cerr << "Failed to write out_file" << std::endl;
+        watch::Options watchOptions{};
+        watchOptions.batch = GetBatchOptions(options);
+        watchOptions.batch.keyring = LoadKeyring(options);
+        if (operation == "decrypt") {
+            watchOptions.batch.operation = batch::OPERATION_DECRYPT;
+        } else if (operation == "encrypt") {
+            watchOptions.batch.operation = batch::OPERATION_ENCRYPT;
+        } else if (operation == "verify") {
+            watchOptions.batch.operation = batch::OPERATION_VERIFY;
+        } else {
+            watchOptions.batch.operation = batch::OPERATION_REKEY;
+            watchOptions.batch.targetKeys = LoadKeyFile(options, "target_key_file");
+        }
+        watchOptions.window = std::chrono::milliseconds(options.has("window_ms") ? options.get<std::uint32_t>("window_ms") : kDefaultWatchWindow);
+
+        std::cout << "Watching " << inDir.string() << " with " << watchOptions.batch.jobs << " workers" << std::endl;
+
+        Result<void> res = watch::Run(watchOptions, inDir, outDir);
+        if (!res) {
+            std::cerr << "Failed to watch " << inDir.string() << ": " << res.error().GetDescription() << std::endl;
+            std::exit(-1);
+        }
+
+        std::cout << "Done!" << std::endl;
+    }
+
+    if (options.has("generate")) {
+        const std::filesystem::path outDir = options.get<std::string>("out_dir");
+        const std::uint32_t count = options.has("count") ? options.get<std::uint32_t>("count") : 1;
+        const std::uint64_t seed = options.has("seed") ? options.get<std::uint64_t>("seed") : 0;
+
+        // Keep the tags separate from the keyset, so the tags directory can be used for batch processing
+        std::error_code ec;
+        std::filesystem::create_directories(outDir / "tags", ec);
+        if (ec) {
+            std::cerr << "Failed to create out_dir: " << ec.message() << std::endl;
             std::exit(-1);
         }
 
+        Generator generator(seed);
+
+        const std::array<std::byte, 160> keyset = generator.GenerateKeyset();
+        if (!io::WriteBinaryFile((outDir / "keyset.bin").string(), keyset)) {
+            std::cerr << "Failed to write keyset" << std::endl;
+            std::exit(-1);
+        }
+
+        Result<std::shared_ptr<const Keys>> keys = Keys::FromKeyset(keyset);
+        if (!keys) {
+            std::cerr << "Failed to create keys: " << keys.error().GetDescription() << std::endl;
+            std::exit(1);
+        }
+
+        std::cout << "Generating " << count << " tags in " << outDir.string() << std::endl;
+
+        for (std::uint32_t i = 0; i < count; i++) {
+            // Alternate between versions if none was specified
+            std::uint32_t version = (i & 1) ? 2 : 0;
+            if (options.has("tag_version")) {
+                version = options.get<std::uint32_t>("tag_version");
+            }
+
+            auto tagBuffer = generator.GenerateTag(version, **keys);
+            if (!tagBuffer) {
+                std::cerr << "Failed to generate tag " << i << std::endl;
+                std::exit(1);
+            }
+
+            std::ostringstream fileName;
+            fileName << "tag_v" << version << "_" << std::setw(6) << std::setfill('0') << i << ".bin";
+            if (!io::WriteBinaryFile((outDir / "tags" / fileName.str()).string(), *tagBuffer)) {
+                std::cerr << "Failed to write tag " << i << std::endl;
+                std::exit(-1);
+            }
+        }
+
         std::cout << "Done!" << std::endl;
     }
 
-    return 0;
+    if (options.has("stress")) {
+        stress::Options stressOptions{};
+        stressOptions.jobs = options.has("jobs") ? options.get<std::uint32_t>("jobs") : std::thread::hardware_concurrency();
+        stressOptions.pin = options.has("pin");
+        stressOptions.count = options.has("count") ? options.get<std::uint32_t>("count") : 64;
+        stressOptions.iterations = options.has("iterations") ? options.get<std::uint32_t>("iterations") : 100;
+        stressOptions.seed = options.has("seed") ? options.get<std::uint64_t>("seed") : 0;
+
+        std::cout << "Round tripping " << stressOptions.count << " tags " << stressOptions.iterations << " times on "
+            << stressOptions.jobs << " threads" << std::endl;
+
+        stress::Summary summary = stress::Run(stressOptions);
+        std::cout << "Processed " << summary.total << " round trips in " << summary.elapsed.count() << "s, "
+            << summary.failed << " failed" << std::endl;
+        if (summary.total == 0 || summary.failed != 0) {
+            exitCode = 1;
+        }
+    }
+
+    if (options.has("trace")) {
+        if (!trace::WriteJson(options.get<std::string>("trace"))) {
+            std::cerr << "Failed to write trace" << std::endl;
+            std::exit(-1);
+        }
+    }
+
+    return exitCode;
 }
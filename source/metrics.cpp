@@ -0,0 +1,208 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+// Bucket i counts observations of at most 2^i microseconds, the last bucket is +Inf
+constexpr std::size_t kBucketCount = 22;
+
+struct Histogram {
+    std::array<std::atomic<std::uint64_t>, kBucketCount> buckets{};
+    std::atomic<std::uint64_t> sum{}; // in nanoseconds
+    std::atomic<std::uint64_t> count{};
+};
+
+// Every thread owns one of these, values are only ever written by the owning thread
+struct ThreadMetrics {
+    std::array<std::atomic<std::uint64_t>, metrics::COUNTER_COUNT> counters{};
+    std::array<Histogram, metrics::STAGE_COUNT> histograms{};
+};
+
+struct CounterInfo {
+    const char* name;
+    const char* help;
+    const char* label;
+};
+
+constexpr CounterInfo kCounterInfo[metrics::COUNTER_COUNT] = {
+    { "ntag_tags_parsed_total", "Number of tags parsed successfully.", nullptr },
+    { "ntag_tags_written_total", "Number of tags serialized.", nullptr },
+    { "ntag_aes_blocks_total", "Number of AES blocks crypted.", nullptr },
+    { "ntag_hmacs_total", "Number of HMACs computed.", nullptr },
+    { "ntag_key_derivations_total", "Number of internal key derivations.", nullptr },
+    { "ntag_bytes_read_total", "Number of bytes read from files.", nullptr },
+    { "ntag_bytes_written_total", "Number of bytes written to files.", nullptr },
+    { "ntag_failures_total", "Number of failed tags by reason.", "read" },
+    { "ntag_failures_total", nullptr, "parse" },
+    { "ntag_failures_total", nullptr, "keys" },
+    { "ntag_failures_total", nullptr, "crypt" },
+    { "ntag_failures_total", nullptr, "hmac" },
+    { "ntag_failures_total", nullptr, "write" },
+    { "ntag_failures_total", nullptr, "mismatch" },
+    { "ntag_failures_total", nullptr, "edit" },
+    { "ntag_cache_hits_total", "Number of tags loaded from the cache.", nullptr },
+    { "ntag_cache_misses_total", "Number of tags not found in the cache.", nullptr },
+};
+
+constexpr const char* kStageNames[metrics::STAGE_COUNT] = {
+    "read",
+    "parse",
+    "crypt",
+    "serialize",
+    "write",
+};
+
+std::mutex gThreadMetricsMutex;
+std::vector<std::unique_ptr<ThreadMetrics>> gThreadMetrics;
+
+ThreadMetrics& GetThreadMetrics()
+{
+    // Owned by gThreadMetrics so the values outlive the thread
+    thread_local ThreadMetrics* threadMetrics = nullptr;
+    if (!threadMetrics) {
+        std::lock_guard lock(gThreadMetricsMutex);
+        gThreadMetrics.push_back(std::make_unique<ThreadMetrics>());
+        threadMetrics = gThreadMetrics.back().get();
+    }
+
+    return *threadMetrics;
+}
+
+// Single writer, so a relaxed load and store is enough and avoids a locked instruction
+void Add(std::atomic<std::uint64_t>& value, std::uint64_t amount)
+{
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+} // namespace
+
+void metrics::Increment(Counter counter, std::uint64_t value)
+{
+    Add(GetThreadMetrics().counters[counter], value);
+}
+
+void metrics::Observe(Stage stage, std::chrono::nanoseconds duration)
+{
+    const std::uint64_t ns = duration.count() > 0 ? duration.count() : 0;
+    // The smallest bucket whose bound of 2^i microseconds isn't below the duration, rounded up to whole microseconds
+    const std::uint64_t us = (ns + 999) / 1000;
+    const std::size_t bucket = std::min<std::size_t>(us == 0 ? 0 : std::bit_width(us - 1), kBucketCount - 1);
+
+    Histogram& histogram = GetThreadMetrics().histograms[stage];
+    Add(histogram.buckets[bucket], 1);
+    Add(histogram.sum, ns);
+    Add(histogram.count, 1);
+}
+
+std::uint64_t metrics::GetTotal(Counter counter)
+{
+    std::lock_guard lock(gThreadMetricsMutex);
+
+    std::uint64_t total = 0;
+    for (const auto& threadMetrics : gThreadMetrics) {
+        total += threadMetrics->counters[counter].load(std::memory_order_relaxed);
+    }
+
+    return total;
+}
+
+std::string metrics::FormatPrometheus()
+{
+    std::lock_guard lock(gThreadMetricsMutex);
+    std::ostringstream out;
+
+    // Merge the per thread counters
+    for (std::size_t i = 0; i < COUNTER_COUNT; i++) {
+        std::uint64_t total = 0;
+        for (const auto& threadMetrics : gThreadMetrics) {
+            total += threadMetrics->counters[i].load(std::memory_order_relaxed);
+        }
+
+        const CounterInfo& info = kCounterInfo[i];
+        if (info.help) {
+            out << "# HELP " << info.name << " " << info.help << "\n";
+            out << "# TYPE " << info.name << " counter\n";
+        }
+
+        out << info.name;
+        if (info.label) {
+            out << "{reason=\"" << info.label << "\"}";
+        }
+        out << " " << total << "\n";
+    }
+
+    // Merge the per thread histograms
+    out << "# HELP ntag_stage_duration_seconds Time spent per tag in each processing stage.\n";
+    out << "# TYPE ntag_stage_duration_seconds histogram\n";
+    for (std::size_t i = 0; i < STAGE_COUNT; i++) {
+        std::array<std::uint64_t, kBucketCount> buckets{};
+        std::uint64_t sum = 0;
+        std::uint64_t count = 0;
+        for (const auto& threadMetrics : gThreadMetrics) {
+            const Histogram& histogram = threadMetrics->histograms[i];
+            for (std::size_t j = 0; j < kBucketCount; j++) {
+                buckets[j] += histogram.buckets[j].load(std::memory_order_relaxed);
+            }
+            sum += histogram.sum.load(std::memory_order_relaxed);
+            count += histogram.count.load(std::memory_order_relaxed);
+        }
+
+        // Prometheus buckets are cumulative
+        std::uint64_t cumulative = 0;
+        for (std::size_t j = 0; j < kBucketCount; j++) {
+            cumulative += buckets[j];
+            out << "ntag_stage_duration_seconds_bucket{stage=\"" << kStageNames[i] << "\",le=\"";
+            if (j == kBucketCount - 1) {
+                out << "+Inf";
+            } else {
+                out << double(1ull << j) / 1e6;
+            }
+            out << "\"} " << cumulative << "\n";
+        }
+        out << "ntag_stage_duration_seconds_sum{stage=\"" << kStageNames[i] << "\"} " << double(sum) / 1e9 << "\n";
+        out << "ntag_stage_duration_seconds_count{stage=\"" << kStageNames[i] << "\"} " << count << "\n";
+    }
+
+    return out.str();
+}
+
+bool metrics::WritePrometheus(const std::string& path)
+{
+    // Write to a temporary file first, so scrapers never see a partially written file
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::trunc);
+        if (!file) {
+            return false;
+        }
+
+        file << FormatPrometheus();
+        if (!file.good()) {
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, path, ec);
+    return !ec;
+}
+
+metrics::Timer::Timer(Stage stage)
+ : mStage(stage), mStart(std::chrono::steady_clock::now())
+{
+}
+
+metrics::Timer::~Timer()
+{
+    Observe(mStage, std::chrono::steady_clock::now() - mStart);
+}
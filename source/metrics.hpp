@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <string>
+
+namespace metrics {
+
+enum Counter {
+    TAGS_PARSED,
+    TAGS_WRITTEN,
+    AES_BLOCKS,
+    HMACS_COMPUTED,
+    KEY_DERIVATIONS,
+    BYTES_READ,
+    BYTES_WRITTEN,
+    FAILED_READ,
+    FAILED_PARSE,
+    FAILED_KEYS,
+    FAILED_CRYPT,
+    FAILED_HMAC,
+    FAILED_WRITE,
+    FAILED_MISMATCH,
+    FAILED_EDIT,
+    CACHE_HITS,
+    CACHE_MISSES,
+
+    COUNTER_COUNT,
+};
+
+enum Stage {
+    STAGE_READ,
+    STAGE_PARSE,
+    STAGE_CRYPT,
+    STAGE_SERIALIZE,
+    STAGE_WRITE,
+
+    STAGE_COUNT,
+};
+
+// Counters are kept per thread and only merged when formatting, so updating them never contends
+void Increment(Counter counter, std::uint64_t value = 1);
+void Observe(Stage stage, std::chrono::nanoseconds duration);
+
+std::uint64_t GetTotal(Counter counter);
+
+// Format the merged counters and histograms in the Prometheus text exposition format
+std::string FormatPrometheus();
+bool WritePrometheus(const std::string& path);
+
+// Records the lifetime of the object into the histogram of the specified stage
+class Timer {
+public:
+    Timer(Stage stage);
+    ~Timer();
+
+private:
+    Stage mStage;
+    std::chrono::steady_clock::time_point mStart;
+};
+
+} // namespace metrics
@@ -1,11 +1,11 @@
 #include "ndef.hpp"
 
-#include <iostream>
 #include <cassert>
 
 namespace ndef {
 
 Record::Record()
+ : mFlags(0), mTNF(NDEF_TNF_EMPTY)
 {
 }
 
@@ -13,8 +13,9 @@ Record::~Record()
 {
 }
 
-std::optional<Record> Record::FromStream(Stream& stream)
+Result<Record> Record::FromStream(Stream& stream)
 {
+    const std::size_t recordOffset = stream.GetPosition();
     Record rec;
 
     // Read record header
@@ -39,7 +40,7 @@ std::optional<Record> Record::FromStream(Stream& stream)
 
     // Some sane limits for the payload size
     if (payloadLen > 2 * 1024 * 1024) {
-        return {};
+        return std::unexpected(Error(Error::NDEF_RECORD_PAYLOAD_TOO_LARGE, recordOffset));
     }
 
     // ID length
@@ -50,7 +51,7 @@ std::optional<Record> Record::FromStream(Stream& stream)
 
     // Make sure we didn't read past the end of the stream yet
     if (stream.GetError() != Stream::ERROR_OK) {
-        return {};
+        return std::unexpected(Error(Error::NDEF_RECORD_READ_PAST_END, recordOffset));
     }
 
     // Type
@@ -67,7 +68,7 @@ std::optional<Record> Record::FromStream(Stream& stream)
 
     // Make sure we didn't read past the end of the stream again
     if (stream.GetError() != Stream::ERROR_OK) {
-        return {};
+        return std::unexpected(Error(Error::NDEF_RECORD_READ_PAST_END, recordOffset));
     }
 
     return rec;
@@ -187,34 +188,32 @@ Message::~Message()
 {
 }
 
-std::optional<Message> Message::FromBytes(const std::span<const std::byte>& data)
+Result<Message> Message::FromBytes(const std::span<const std::byte>& data)
 {
     Message msg;
     SpanStream stream(data, std::endian::big);
 
     while (stream.GetRemaining() > 0) {
-        std::optional<Record> rec = Record::FromStream(stream);
+        Result<Record> rec = Record::FromStream(stream);
         if (!rec) {
-            std::cerr << "Warning: Failed to parse NDEF Record #" << msg.mRecords.size()
-                << ". Ignoring the remaining " << stream.GetRemaining() << " bytes in NDEF message" << std::endl;
-            break;
+            // A record which fails to parse can never be followed by a valid end record
+            return std::unexpected(rec.error());
         }
 
         msg.mRecords.emplace_back(*rec);
 
-        if ((*rec).IsLast() && stream.GetRemaining() > 0) {
-            std::cerr << "Warning: Ignoring " << stream.GetRemaining() << " bytes in NDEF message" << std::endl;
+        // Any bytes after the end record are ignored
+        if (rec->IsLast()) {
             break;
         }
     }
 
     if (msg.mRecords.empty()) {
-        return {};
+        return std::unexpected(Error(Error::NDEF_NO_RECORDS, 0));
     }
 
     if (!msg.mRecords.back().IsLast()) {
-        std::cerr << "Error: NDEF message missing end record" << std::endl;
-        return {}; 
+        return std::unexpected(Error(Error::NDEF_MISSING_END_RECORD, stream.GetPosition()));
     }
 
     return msg;
@@ -2,8 +2,8 @@
 
 #include <span>
 #include <vector>
-#include <optional>
 
+#include "Error.hpp"
 #include "stream.hpp"
 
 namespace ndef {
@@ -34,7 +34,7 @@ public:
     Record();
     virtual ~Record();
 
-    static std::optional<Record> FromStream(Stream& stream);
+    static Result<Record> FromStream(Stream& stream);
     std::vector<std::byte> ToBytes(uint8_t flags = 0) const;
 
     TypeNameFormat GetTNF() const;
@@ -63,7 +63,7 @@ public:
     Message();
     virtual ~Message();
 
-    static std::optional<Message> FromBytes(const std::span<const std::byte>& data);
+    static Result<Message> FromBytes(const std::span<const std::byte>& data);
     std::vector<std::byte> ToBytes() const;
 
     Record& operator[](int i) { return mRecords[i]; }
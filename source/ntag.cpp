@@ -0,0 +1,196 @@
+#include <ntag.h>
+
+#include "Batch.hpp"
+#include "Keys.hpp"
+#include "Scheduler.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <thread>
+
+struct ntag_keys {
+    std::shared_ptr<const Keys> keys;
+};
+
+namespace {
+
+constexpr std::size_t kKeysetSize = 160u;
+
+ntag_status ToStatus(batch::Status status)
+{
+    switch (status) {
+        case batch::STATUS_OK:           return NTAG_OK;
+        case batch::STATUS_PARSE_FAILED: return NTAG_ERROR_PARSE;
+        case batch::STATUS_KEYS_FAILED:  return NTAG_ERROR_KEYS;
+        case batch::STATUS_CRYPT_FAILED: return NTAG_ERROR_CRYPT;
+        case batch::STATUS_HMAC_INVALID: return NTAG_ERROR_HMAC_INVALID;
+        case batch::STATUS_MISMATCH:     return NTAG_ERROR_MISMATCH;
+        default: break;
+    }
+
+    return NTAG_ERROR_INTERNAL;
+}
+
+bool IsValidVersion(std::uint32_t tagVersion)
+{
+    return tagVersion == 0 || tagVersion == 2 || tagVersion == NTAG_TAG_VERSION_AUTO;
+}
+
+std::optional<std::uint32_t> ToOptionalVersion(std::uint32_t tagVersion)
+{
+    if (tagVersion == NTAG_TAG_VERSION_AUTO) {
+        return {};
+    }
+
+    return tagVersion;
+}
+
+ntag_status Process(batch::Context& context, batch::Operation operation, std::uint32_t tagVersion, const void* in, std::size_t inSize, void* out, std::size_t outSize)
+{
+    if (!in || !IsValidVersion(tagVersion)) {
+        return NTAG_ERROR_INVALID_ARGUMENT;
+    }
+
+    if (operation != batch::OPERATION_VERIFY && operation != batch::OPERATION_AUDIT) {
+        if (!out) {
+            return NTAG_ERROR_INVALID_ARGUMENT;
+        }
+
+        if (outSize < inSize) {
+            return NTAG_ERROR_BUFFER_TOO_SMALL;
+        }
+    }
+
+    // Exceptions must not cross the C boundary
+    try {
+        std::vector<std::byte> result;
+        batch::Status status = batch::ProcessTag(operation, ToOptionalVersion(tagVersion), context, std::span(static_cast<const std::byte*>(in), inSize), result);
+
+        if (batch::ShouldWrite(operation, status)) {
+            std::memcpy(out, result.data(), std::min(result.size(), outSize));
+        }
+
+        return ToStatus(status);
+    } catch (...) {
+        return NTAG_ERROR_INTERNAL;
+    }
+}
+
+ntag_status ProcessSingle(const ntag_keys* keys, batch::Operation operation, std::uint32_t tagVersion, const void* in, std::size_t inSize, void* out, std::size_t outSize, const ntag_keys* targetKeys = nullptr)
+{
+    if (!keys || (operation == batch::OPERATION_REKEY && !targetKeys)) {
+        return NTAG_ERROR_INVALID_ARGUMENT;
+    }
+
+    // Every call sets up its own context and buffers, which allocates; batches share one context per worker
+    batch::Context context(*keys->keys, targetKeys ? targetKeys->keys.get() : nullptr);
+    return Process(context, operation, tagVersion, in, inSize, out, outSize);
+}
+
+} // namespace
+
+const char* ntag_status_string(ntag_status status)
+{
+    switch (status) {
+        case NTAG_OK:                     return "OK";
+        case NTAG_ERROR_INVALID_ARGUMENT: return "Invalid argument";
+        case NTAG_ERROR_INVALID_KEYSET:   return "Invalid keyset";
+        case NTAG_ERROR_BUFFER_TOO_SMALL: return "Output buffer too small";
+        case NTAG_ERROR_PARSE:            return "Failed to parse tag";
+        case NTAG_ERROR_KEYS:             return "Failed to init internal keys";
+        case NTAG_ERROR_CRYPT:            return "Failed to crypt tag";
+        case NTAG_ERROR_HMAC_INVALID:     return "HMAC not valid";
+        case NTAG_ERROR_INTERNAL:         return "Internal error";
+        case NTAG_ERROR_MISMATCH:         return "Round trip mismatch";
+    }
+
+    return "Unknown";
+}
+
+ntag_status ntag_keys_open(const void* keyset, size_t keyset_size, ntag_keys** out_keys)
+{
+    if (!keyset || !out_keys) {
+        return NTAG_ERROR_INVALID_ARGUMENT;
+    }
+
+    if (keyset_size != kKeysetSize) {
+        return NTAG_ERROR_INVALID_KEYSET;
+    }
+
+    try {
+        Result<std::shared_ptr<const Keys>> keys = Keys::FromKeyset(std::span<const std::byte, kKeysetSize>(static_cast<const std::byte*>(keyset), kKeysetSize));
+        if (!keys) {
+            return NTAG_ERROR_INVALID_KEYSET;
+        }
+
+        *out_keys = new ntag_keys{ std::move(*keys) };
+        return NTAG_OK;
+    } catch (...) {
+        return NTAG_ERROR_INTERNAL;
+    }
+}
+
+void ntag_keys_close(ntag_keys* keys)
+{
+    delete keys;
+}
+
+ntag_status ntag_decrypt(const ntag_keys* keys, uint32_t tag_version, const void* in, size_t in_size, void* out, size_t out_size)
+{
+    return ProcessSingle(keys, batch::OPERATION_DECRYPT, tag_version, in, in_size, out, out_size);
+}
+
+ntag_status ntag_encrypt(const ntag_keys* keys, uint32_t tag_version, const void* in, size_t in_size, void* out, size_t out_size)
+{
+    return ProcessSingle(keys, batch::OPERATION_ENCRYPT, tag_version, in, in_size, out, out_size);
+}
+
+ntag_status ntag_verify(const ntag_keys* keys, uint32_t tag_version, const void* in, size_t in_size)
+{
+    return ProcessSingle(keys, batch::OPERATION_VERIFY, tag_version, in, in_size, nullptr, 0);
+}
+
+ntag_status ntag_audit(const ntag_keys* keys, uint32_t tag_version, const void* in, size_t in_size)
+{
+    return ProcessSingle(keys, batch::OPERATION_AUDIT, tag_version, in, in_size, nullptr, 0);
+}
+
+ntag_status ntag_rekey(const ntag_keys* keys, const ntag_keys* target_keys, uint32_t tag_version, const void* in, size_t in_size, void* out, size_t out_size)
+{
+    return ProcessSingle(keys, batch::OPERATION_REKEY, tag_version, in, in_size, out, out_size, target_keys);
+}
+
+ntag_status ntag_batch(const ntag_keys* keys, ntag_operation operation, uint32_t tag_version, ntag_item* items, size_t count, uint32_t jobs)
+{
+    if (!keys || (!items && count != 0) || !IsValidVersion(tag_version)) {
+        return NTAG_ERROR_INVALID_ARGUMENT;
+    }
+
+    batch::Operation batchOperation;
+    switch (operation) {
+        case NTAG_OPERATION_DECRYPT: batchOperation = batch::OPERATION_DECRYPT; break;
+        case NTAG_OPERATION_ENCRYPT: batchOperation = batch::OPERATION_ENCRYPT; break;
+        case NTAG_OPERATION_VERIFY:  batchOperation = batch::OPERATION_VERIFY;  break;
+        case NTAG_OPERATION_AUDIT:   batchOperation = batch::OPERATION_AUDIT;   break;
+        default: return NTAG_ERROR_INVALID_ARGUMENT;
+    }
+
+    if (jobs == 0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    try {
+        // One context per worker, they all share the same keys
+        std::vector<batch::Context> contexts(jobs, batch::Context(*keys->keys));
+
+        scheduler::ParallelFor(count, jobs, false, [&](std::size_t i, unsigned int worker) {
+            ntag_item& item = items[i];
+            item.status = Process(contexts[worker], batchOperation, tag_version, item.in, item.in_size, item.out, item.out_size);
+        });
+    } catch (...) {
+        return NTAG_ERROR_INTERNAL;
+    }
+
+    return NTAG_OK;
+}
@@ -0,0 +1,79 @@
+#include "signals.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define NTAG_HAS_POSIX_SIGNALS
+#include <csignal>
+#include <unistd.h>
+#endif
+
+#ifdef NTAG_HAS_POSIX_SIGNALS
+
+namespace {
+
+// Write end of the pipe of the current instance, the handler can't access anything else
+int gWriteFd = -1;
+
+struct sigaction gOldInterrupt;
+struct sigaction gOldTerminate;
+
+void HandleSignal(int)
+{
+    const char c = 0;
+    [[maybe_unused]] const ssize_t res = write(gWriteFd, &c, 1);
+}
+
+} // namespace
+
+signals::StopPipe::StopPipe()
+ : mFds{ -1, -1 }
+{
+    if (pipe(mFds) != 0) {
+        mFds[0] = mFds[1] = -1;
+        return;
+    }
+
+    gWriteFd = mFds[1];
+
+    struct sigaction action{};
+    action.sa_handler = HandleSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &gOldInterrupt);
+    sigaction(SIGTERM, &action, &gOldTerminate);
+}
+
+signals::StopPipe::~StopPipe()
+{
+    if (mFds[0] < 0) {
+        return;
+    }
+
+    sigaction(SIGINT, &gOldInterrupt, nullptr);
+    sigaction(SIGTERM, &gOldTerminate, nullptr);
+    gWriteFd = -1;
+
+    close(mFds[0]);
+    close(mFds[1]);
+}
+
+int signals::StopPipe::GetFd() const
+{
+    return mFds[0];
+}
+
+#else
+
+signals::StopPipe::StopPipe()
+ : mFds{ -1, -1 }
+{
+}
+
+signals::StopPipe::~StopPipe()
+{
+}
+
+int signals::StopPipe::GetFd() const
+{
+    return -1;
+}
+
+#endif
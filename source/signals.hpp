@@ -0,0 +1,23 @@
+#pragma once
+
+namespace signals {
+
+// Turns SIGINT and SIGTERM into a readable file descriptor while it is alive, so loops waiting in poll can stop cleanly
+// The previous handlers are restored when it is destroyed. Only a single instance may exist at a time.
+// Without POSIX signals and pipes GetFd always returns -1.
+class StopPipe {
+public:
+    StopPipe();
+    ~StopPipe();
+
+    StopPipe(const StopPipe&) = delete;
+    StopPipe& operator=(const StopPipe&) = delete;
+
+    // Becomes readable once a stop signal was received, -1 if the pipe could not be created
+    int GetFd() const;
+
+private:
+    int mFds[2];
+};
+
+} // namespace signals
@@ -0,0 +1,127 @@
+#include "trace.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct Event {
+    const char* name;
+    std::int64_t start;
+    std::int64_t duration;
+};
+
+// Each thread records into its own buffer, so recording never takes a lock
+struct ThreadBuffer {
+    std::uint32_t id;
+    std::string name;
+    std::vector<Event> events;
+};
+
+std::chrono::steady_clock::time_point gStartTime;
+
+std::mutex gBuffersMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> gBuffers;
+
+ThreadBuffer& GetThreadBuffer()
+{
+    // Buffers are owned by gBuffers so their events outlive the thread
+    thread_local ThreadBuffer* buffer = nullptr;
+    if (!buffer) {
+        std::lock_guard lock(gBuffersMutex);
+        gBuffers.push_back(std::make_unique<ThreadBuffer>());
+        buffer = gBuffers.back().get();
+        buffer->id = gBuffers.size();
+        buffer->name = "thread " + std::to_string(buffer->id);
+        buffer->events.reserve(0x1000);
+    }
+
+    return *buffer;
+}
+
+std::int64_t GetTimestamp()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - gStartTime).count();
+}
+
+} // namespace
+
+std::atomic<bool> trace::gEnabled = false;
+
+bool trace::IsAvailable()
+{
+#ifdef NTAG_ENABLE_TRACE
+    return true;
+#else
+    return false;
+#endif
+}
+
+void trace::Start()
+{
+    gStartTime = std::chrono::steady_clock::now();
+    gEnabled.store(true, std::memory_order_release);
+}
+
+void trace::SetThreadName(const std::string& name)
+{
+    if (!IsEnabled()) {
+        return;
+    }
+
+    ThreadBuffer& buffer = GetThreadBuffer();
+    std::lock_guard lock(gBuffersMutex);
+    buffer.name = name;
+}
+
+bool trace::WriteJson(const std::string& path)
+{
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    // Stop recording before walking the buffers
+    gEnabled.store(false, std::memory_order_release);
+
+    std::lock_guard lock(gBuffersMutex);
+
+    file << "{\"traceEvents\":[";
+    bool first = true;
+    for (const auto& buffer : gBuffers) {
+        // Thread name metadata
+        file << (first ? "\n" : ",\n");
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id
+             << ",\"args\":{\"name\":\"" << buffer->name << "\"}}";
+        first = false;
+
+        // Complete events, timestamps are in microseconds
+        for (const Event& event : buffer->events) {
+            file << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"ntag\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id
+                 << ",\"ts\":" << event.start / 1000 << "." << event.start % 1000 / 100
+                 << ",\"dur\":" << event.duration / 1000 << "." << event.duration % 1000 / 100 << "}";
+        }
+    }
+    file << "\n],\"displayTimeUnit\":\"ns\"}\n";
+
+    return file.good();
+}
+
+std::int64_t trace::Scope::Begin()
+{
+    return GetTimestamp();
+}
+
+void trace::Scope::End(const char* name, std::int64_t start)
+{
+    // Recording stopped while the scope was open
+    if (!IsEnabled()) {
+        return;
+    }
+
+    GetThreadBuffer().events.push_back({ name, start, GetTimestamp() - start });
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Trace points are compiled out completely unless NTAG_ENABLE_TRACE is defined (build with make TRACE=0 to remove them)
+#ifdef NTAG_ENABLE_TRACE
+#define NTAG_TRACE_CONCAT_(a, b) a##b
+#define NTAG_TRACE_CONCAT(a, b) NTAG_TRACE_CONCAT_(a, b)
+#define NTAG_TRACE_SCOPE(name) trace::Scope NTAG_TRACE_CONCAT(_traceScope, __LINE__)(name)
+#define NTAG_TRACE_THREAD_NAME(name) trace::SetThreadName(name)
+#else
+#define NTAG_TRACE_SCOPE(name) do {} while (0)
+#define NTAG_TRACE_THREAD_NAME(name) do {} while (0)
+#endif
+
+namespace trace {
+
+// Returns false if tracing support was compiled out
+bool IsAvailable();
+
+// Set while recording, only read through IsEnabled
+extern std::atomic<bool> gEnabled;
+
+// Start recording trace events on all threads
+void Start();
+
+// Inline so trace points cost a single branch while nothing is recorded
+inline bool IsEnabled()
+{
+    return gEnabled.load(std::memory_order_relaxed);
+}
+
+// Name the calling thread in the trace output
+void SetThreadName(const std::string& name);
+
+// Write all recorded events as Chrome / Perfetto trace event JSON
+bool WriteJson(const std::string& path);
+
+class Scope {
+public:
+    Scope(const char* name)
+     : mName(name), mStart(IsEnabled() ? Begin() : -1)
+    {
+    }
+
+    ~Scope()
+    {
+        if (mStart >= 0) {
+            End(mName, mStart);
+        }
+    }
+
+private:
+    // Only called while tracing, Begin returns the start timestamp and End records the event
+    static std::int64_t Begin();
+    static void End(const char* name, std::int64_t start);
+
+    const char* mName;
+    std::int64_t mStart;
+};
+
+} // namespace trace